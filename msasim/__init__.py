@@ -10,8 +10,11 @@ from .distributions import (
 from .tree import Tree
 from .protocol import SimProtocol
 from .simulator import Simulator
+from .batch import BatchSimulator
 from .msa import Msa
-from .constants import SIMULATION_TYPE, MODEL_CODES
+from .packed_msa import PackedMsa
+from .arrays import SequenceArrays
+from .constants import SIMULATION_TYPE, MODEL_CODES, SUBSTITUTION_ENGINE, MEMORY_STRATEGY, TABLE_EVICTION
 
 __all__ = [
     'Distribution',
@@ -22,7 +25,13 @@ __all__ = [
     'Tree',
     'SimProtocol',
     'Simulator',
+    'BatchSimulator',
     'Msa',
+    'PackedMsa',
+    'SequenceArrays',
     'SIMULATION_TYPE',
     'MODEL_CODES',
+    'SUBSTITUTION_ENGINE',
+    'MEMORY_STRATEGY',
+    'TABLE_EVICTION',
 ]
\ No newline at end of file
@@ -0,0 +1,39 @@
+"""Zero-copy NumPy access to simulation outputs"""
+
+from typing import List
+
+
+def as_numpy(view):
+    """
+    Wrap a buffer exported by _Sailfish (an ArrayView) as a read-only NumPy array without
+    copying; the array keeps the C++ memory alive.
+    """
+    import numpy as np
+    return np.asarray(view)
+
+
+class SequenceArrays:
+    """
+    Sequences saved by one substitution simulation, stored in C++ as one contiguous block
+    of alphabet codes and exposed as NumPy arrays sharing that memory.
+
+    codes is a (rows, columns) uint8 array; alphabet[code] is the character of a code.
+    ids holds the tree node id of every row.
+    """
+
+    def __init__(self, arena):
+        self._arena = arena
+        self.codes = as_numpy(arena.codes())
+        self.ids = as_numpy(arena.ids())
+        self.names: List[str] = arena.names()
+        self.alphabet: str = arena.alphabet()
+
+    def __len__(self) -> int:
+        return self._arena.num_rows()
+
+    def row_of_id(self, node_id: int) -> int:
+        """Row of a tree node, -1 if its sequence was not saved."""
+        return self._arena.row_of_id(node_id)
+
+    def get_sequence(self, row: int) -> str:
+        return self._arena.row_string(row)
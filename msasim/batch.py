@@ -0,0 +1,160 @@
+"""Simulation of many trees under one model"""
+
+import _Sailfish
+import pathlib
+from typing import List, Optional, Union
+from .distributions import Distribution
+from .tree import Tree
+from .msa import Msa
+from .simulator import Simulator
+from .constants import MODEL_CODES, SIMULATION_TYPE
+
+
+class BatchSimulator:
+    """
+    Simulate one MSA per tree for many trees (e.g. gene trees) under a single substitution
+    model and indel process. The model is built once and shared by all trees, and trees are
+    simulated in parallel; the MSA of each tree depends only on the seed and the tree's
+    position in the batch, not on the number of threads.
+    """
+
+    def __init__(
+        self,
+        trees: Union[List[Union[str, Tree]], str, pathlib.Path],
+        simulation_type: SIMULATION_TYPE = SIMULATION_TYPE.NOSUBS
+    ):
+        """
+        Args:
+            trees: a list of Newick strings or Trees, or the path of a file of Newick trees,
+                each terminated by ';'.
+            simulation_type: DNA, PROTEIN or NOSUBS (indels only).
+        """
+        if simulation_type == SIMULATION_TYPE.PROTEIN:
+            self._batch = _Sailfish.AminoBatchSimulator()
+            self._alphabet = _Sailfish.alphabetCode.AMINOACID
+        elif simulation_type == SIMULATION_TYPE.DNA:
+            self._batch = _Sailfish.NucleotideBatchSimulator()
+            self._alphabet = _Sailfish.alphabetCode.NUCLEOTIDE
+        elif simulation_type == SIMULATION_TYPE.NOSUBS:
+            self._batch = _Sailfish.NucleotideBatchSimulator()
+            self._alphabet = _Sailfish.alphabetCode.NULLCODE
+        else:
+            raise ValueError(f"unknown simulation type, please provde one of the following: {[e.name for e in SIMULATION_TYPE]}")
+        self._simulation_type = simulation_type
+
+        if isinstance(trees, (str, pathlib.Path)):
+            if self._batch.add_trees_from_file(str(trees)) == 0:
+                raise ValueError(f"no trees found in {trees}")
+        else:
+            for tree in trees:
+                self._batch.add_tree(repr(tree) if isinstance(tree, Tree) else tree)
+
+        self._insertion_dist = None
+        self._deletion_dist = None
+        self._is_sub_model_init = False
+
+    def get_num_trees(self) -> int:
+        return self._batch.num_trees()
+
+    def set_sequence_size(self, sequence_size: int) -> None:
+        if sequence_size <= 0:
+            raise ValueError(f"sequence_size must be positive, received: {sequence_size}")
+        self._batch.set_sequence_size(sequence_size)
+
+    def set_min_sequence_size(self, min_sequence_size: int) -> None:
+        self._batch.set_min_sequence_size(min_sequence_size)
+
+    def set_indel_rates(self, insertion_rate: float, deletion_rate: float) -> None:
+        """Insertion and deletion rates of every branch of every tree."""
+        if insertion_rate < 0 or deletion_rate < 0:
+            raise ValueError(f"indel rates must be non-negative, received: {insertion_rate}, {deletion_rate}")
+        self._batch.set_insertion_rate(insertion_rate)
+        self._batch.set_deletion_rate(deletion_rate)
+
+    def set_indel_length_distributions(self, insertion_dist: Distribution, deletion_dist: Distribution) -> None:
+        self._insertion_dist = insertion_dist
+        self._deletion_dist = deletion_dist
+        self._batch.set_insertion_length_distribution(insertion_dist._get_Sailfish_dist())
+        self._batch.set_deletion_length_distribution(deletion_dist._get_Sailfish_dist())
+
+    def set_seed(self, seed: int) -> None:
+        self._batch.set_seed(seed)
+
+    def set_num_threads(self, num_threads: int = 0) -> None:
+        """
+        Number of trees simulated at once, 0 uses one per hardware thread (default: 1).
+        """
+        if num_threads < 0:
+            raise ValueError(f"num_threads must be non-negative, received: {num_threads}")
+        self._batch.set_num_threads(num_threads)
+
+    def save_all_nodes_sequences(self) -> None:
+        self._batch.save_all_nodes_sequences(True)
+
+    def set_replacement_model(
+            self,
+            model: _Sailfish.modelCode,
+            amino_model_file: pathlib.Path = None,
+            model_parameters: List = None,
+            gamma_parameters_alpha: float = 1.0,
+            gamma_parameters_categories: int = 1,
+            invariant_sites_proportion: float = 0.0,
+            site_rate_correlation: float = 0.0,
+        ) -> None:
+        """Same arguments as Simulator.set_replacement_model."""
+        if self._simulation_type == SIMULATION_TYPE.NOSUBS:
+            raise ValueError("no replacement model is used in an indel only simulation")
+        if int(gamma_parameters_categories) != gamma_parameters_categories:
+            raise ValueError(f"gamma_parameters_catergories has to be a positive int value: received value of {gamma_parameters_categories}")
+        model_factory = _Sailfish.modelFactory(None)
+        model_factory.set_alphabet(self._alphabet)
+        model_factory.set_replacement_model(model)
+        if self._simulation_type == SIMULATION_TYPE.PROTEIN:
+            if model_parameters:
+                raise ValueError(f"no model parameters are used in protein, recevied value of: {model_parameters}")
+            if model == MODEL_CODES.CUSTOM and amino_model_file:
+                model_factory.set_amino_replacement_model_file(str(amino_model_file))
+        elif model == MODEL_CODES.NUCJC:
+            if model_parameters:
+                raise ValueError(f"no model parameters in JC model, recevied value of: {model_parameters}")
+        elif not model_parameters:
+            raise ValueError("please provide a model parameters")
+        else:
+            model_factory.set_model_parameters(model_parameters)
+
+        rates, probs, transition_matrix = Simulator._create_site_rate_model(
+            gamma_alpha=gamma_parameters_alpha,
+            gamma_categories=gamma_parameters_categories,
+            invariant_proportion=invariant_sites_proportion,
+            site_rate_correlation=site_rate_correlation
+        )
+        model_factory.setSiteRateModel(rates, probs, transition_matrix)
+        self._batch.set_model(model_factory)
+        self._is_sub_model_init = True
+
+    def _verify(self) -> None:
+        if self._insertion_dist is None or self._deletion_dist is None:
+            raise ValueError("please provide indel length distributions -> set_indel_length_distributions(Distribution, Distribution)")
+        if self._simulation_type != SIMULATION_TYPE.NOSUBS and not self._is_sub_model_init:
+            raise ValueError("please provide a replacement model -> set_replacement_model(...)")
+
+    def simulate(self) -> List[Msa]:
+        """MSA of every tree, in the order the trees were given."""
+        self._verify()
+        return [Msa._wrap(msa) for msa in self._batch.simulate()]
+
+    def simulate_tree(self, index: int) -> Msa:
+        """MSA of the index-th tree, the same as simulate()[index]."""
+        self._verify()
+        return Msa._wrap(self._batch.simulate_tree(index))
+
+    def simulate_to_files(self, path_prefix: Union[str, pathlib.Path], compress: bool = False) -> List[pathlib.Path]:
+        """
+        Write the MSA of every tree to path_prefix + index + '.fasta' ('.fasta.gz' with
+        compress) without keeping the MSAs in memory.
+
+        Returns:
+            The paths written, in tree order.
+        """
+        self._verify()
+        return [pathlib.Path(path) for path in self._batch.simulate_to_files(str(path_prefix), compress)]
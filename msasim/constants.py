@@ -4,6 +4,9 @@ import _Sailfish
 from enum import Enum
 
 MODEL_CODES = _Sailfish.modelCode
+SUBSTITUTION_ENGINE = _Sailfish.substitutionEngine
+MEMORY_STRATEGY = _Sailfish.memoryStrategy
+TABLE_EVICTION = _Sailfish.tableEviction
 
 class SIMULATION_TYPE(Enum):
     NOSUBS = 0
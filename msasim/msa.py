@@ -1,7 +1,8 @@
 """Multiple sequence alignment output"""
 
 import _Sailfish
-from typing import Dict, List
+from typing import Dict, Iterator, List, Tuple
+from .arrays import as_numpy
 
 class Msa:
     """MSA result from simulation"""
@@ -9,6 +10,13 @@ class Msa:
     def __init__(self, species_dict: Dict, root_node, save_list: List[bool]):
         self._msa = _Sailfish.Msa(species_dict, root_node, save_list)
 
+    @classmethod
+    def _wrap(cls, msa: _Sailfish.Msa) -> "Msa":
+        """Internal: wrap an MSA simulated in C++"""
+        wrapped = cls.__new__(cls)
+        wrapped._msa = msa
+        return wrapped
+
     def generate_msas(self, node):
         self._msa.generate_msas(node)
     
@@ -17,6 +25,13 @@ class Msa:
     
     def get_root_positions_in_msa(self) -> List[int]:
         return self._msa.get_root_positions_in_msa()
+
+    def get_root_positions_array(self):
+        """
+        MSA column of every root site as a uint64 NumPy array sharing the MSA's memory
+        (2**64 - 1 for root sites deleted from the alignment). Requires numpy.
+        """
+        return as_numpy(self._msa.get_root_positions_view())
     
     def get_num_sequences(self) -> int:
         return self._msa.num_sequences()
@@ -33,5 +48,41 @@ class Msa:
     def get_msa(self) -> str:
         return self._msa.get_msa_string()
     
-    def write_msa(self, file_path) -> None:
-        self._msa.write_msa(file_path)
+    def write_msa(self, file_path, compress: bool = False) -> None:
+        """
+        Write the MSA in FASTA format. With compress=True the file is BGZF (block gzip),
+        readable with gzip/zcat and bgzip-aware tools, and is compressed on all cores.
+        """
+        self._msa.write_msa(str(file_path), compress)
+
+    def write_packed_msa(self, file_path) -> None:
+        """
+        Write the MSA in Sailfish's packed binary format: 2-bit nucleotides or 5-bit amino
+        acids next to the gap runs of every row. Read it back with msasim.PackedMsa.
+        """
+        self._msa.write_packed_msa(str(file_path))
+
+    def iter_rows(self) -> Iterator[Tuple[str, bytes]]:
+        """
+        Yield (name, row) for every row of the alignment, the row as ASCII bytes with gaps.
+        Rows are rendered one at a time, so memory stays bounded by a single row.
+        Alignments without substitutions are named by node id.
+        """
+        rows = self._msa.rows()
+        for row in range(rows.num_rows()):
+            yield rows.name(row), rows.row(row)
+
+    def iter_chunks(self, chunk_bytes: int = 1 << 24) -> Iterator[memoryview]:
+        """
+        Yield the FASTA text of the alignment (as returned by get_msa) in chunks of whole
+        rows of at most chunk_bytes each (a longer row makes a chunk of its own). Each chunk
+        is rendered in parallel on all cores.
+        """
+        if chunk_bytes <= 0:
+            raise ValueError(f"chunk_bytes must be positive, got {chunk_bytes}")
+        rows = self._msa.rows()
+        first_row = 0
+        while first_row < rows.num_rows():
+            last_row = rows.chunk_end(first_row, chunk_bytes)
+            yield memoryview(rows.chunk(first_row, last_row))
+            first_row = last_row
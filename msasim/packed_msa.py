@@ -0,0 +1,72 @@
+"""Memory-mapped reader of the packed binary MSA format"""
+
+import _Sailfish
+from typing import Iterator, List, Tuple
+
+
+class PackedMsa:
+    """
+    Alignment written by Msa.write_packed_msa, memory mapped and read in place.
+
+    Opening only checks the header and row indices, so it takes milliseconds regardless of
+    the alignment size. Rows are decoded on request; gap runs and packed residues are exposed
+    without copying as read-only buffers (usable with memoryview or numpy.asarray).
+    """
+
+    def __init__(self, file_path):
+        self._msa = _Sailfish.PackedMsa(str(file_path))
+
+    def get_num_sequences(self) -> int:
+        return self._msa.num_sequences()
+
+    def get_length(self) -> int:
+        return self._msa.length()
+
+    def get_alphabet(self) -> str:
+        """Characters of the alphabet codes; empty for alignments simulated without substitutions."""
+        return self._msa.alphabet()
+
+    def get_names(self) -> List[str]:
+        return self._msa.names()
+
+    def get_name(self, row: int) -> str:
+        return self._msa.name(row)
+
+    def get_row(self, row: int) -> str:
+        """The aligned row as text, gaps included."""
+        return self._msa.row(row).decode("ascii")
+
+    def get_gap_runs(self, row: int) -> memoryview:
+        """
+        Runs of the row as int32: negative entries are gap runs, positive entries are runs
+        of residues. The buffer points into the mapped file.
+        """
+        return memoryview(self._msa.gap_runs(row))
+
+    def get_packed_residues(self) -> memoryview:
+        """
+        Residue codes of all rows packed LSB first into uint64 words. Row r starts at bit
+        residue_offset(r) * bits_per_residue.
+        """
+        return memoryview(self._msa.packed_residues())
+
+    def get_bits_per_residue(self) -> int:
+        return self._msa.bits_per_residue()
+
+    def get_residue_offset(self, row: int) -> int:
+        return self._msa.residue_offset(row)
+
+    def verify(self) -> None:
+        """Check the runs of every row against the alignment length; raises RuntimeError if corrupt."""
+        self._msa.verify()
+
+    def get_msa(self) -> str:
+        """The whole alignment as FASTA text."""
+        return self._msa.to_fasta()
+
+    def __len__(self) -> int:
+        return self._msa.num_sequences()
+
+    def __iter__(self) -> Iterator[Tuple[str, str]]:
+        for row in range(self._msa.num_sequences()):
+            yield self._msa.name(row), self.get_row(row)
@@ -3,11 +3,12 @@
 import _Sailfish
 import warnings
 import pathlib
-from typing import Dict, Optional, List
+from typing import Dict, Optional, List, Union
 from .protocol import SimProtocol
 from .distributions import PoissonDistribution
 from .msa import Msa
-from .constants import MODEL_CODES, SIMULATION_TYPE
+from .arrays import SequenceArrays, as_numpy
+from .constants import MODEL_CODES, MEMORY_STRATEGY, SIMULATION_TYPE, SUBSTITUTION_ENGINE, TABLE_EVICTION
 
 
 # TODO delete one of this (I think the above if not used)
@@ -15,20 +16,19 @@ class BlockTreePython:
     '''
     Used to contain the events on a multiple branches (entire tree).
     '''
-    def __init__(self, branch_block_dict: Dict[str, _Sailfish.Block]):
+    def __init__(self, branch_block_dict: _Sailfish.BlockMap):
+        # the blocks stay in C++ (and in the memory report) until an Msa consumes them
         self._branch_block_dict = branch_block_dict
-        # dictionary of {str: List of blocks}
-        self._branch_block_dict_python = {i: x for i, x in branch_block_dict.items()}
     
-    def _get_Sailfish_blocks(self) -> Dict[str, _Sailfish.Block]:
+    def _get_Sailfish_blocks(self) -> _Sailfish.BlockMap:
         return self._branch_block_dict
     
     def get_branches_str(self) -> str:
         return {i: self._branch_block_dict[i].print_tree() for i in list(self._branch_block_dict.keys())}
     
     def get_specific_branch(self, branch: str) -> str:
-        if not branch in self._branch_block_dict_python:
-            raise ValueError(f"branch not in the _branch_block, aviable branches are: {list(self._branch_block_dict_python.keys())}")
+        if not branch in self._branch_block_dict:
+            raise ValueError(f"branch not in the _branch_block, aviable branches are: {list(self._branch_block_dict.keys())}")
         return self._branch_block_dict[branch].print_tree()
     
     def print_branches(self) -> str:
@@ -37,9 +37,9 @@ class BlockTreePython:
             print(self._branch_block_dict[i].print_tree())
     
     def block_list(self)  -> List:
-        if not branch in self._branch_block_dict_python:
-            raise ValueError(f"branch not in the _branch_block, aviable branches are: {list(self._branch_block_dict_python.keys())}")
-        return self._branch_block_dict_python[branch]
+        if not branch in self._branch_block_dict:
+            raise ValueError(f"branch not in the _branch_block, aviable branches are: {list(self._branch_block_dict.keys())}")
+        return self._branch_block_dict[branch]
 
 class Simulator:
     """Simulate MSAs based on SimProtocol"""
@@ -62,6 +62,7 @@ class Simulator:
             simProtocol.set_min_sequence_size(1)
 
         self._root_seq = ""
+        self._memory_reports = []
         # verify sim_protocol
         if self._verify_sim_protocol(simProtocol):
             self._simProtocol = simProtocol
@@ -107,8 +108,8 @@ class Simulator:
         # TODO, complete
         pass
 
+    @staticmethod
     def _create_site_rate_model(
-        self,
         gamma_alpha: float = 1.0,
         gamma_categories: int = 1,
         invariant_proportion: float = 0.0,
@@ -169,21 +170,11 @@ class Simulator:
                     "Using invariant sites only, ignoring correlation."
                 )
             else:
-                try:
-                    from msasim.correlation import build_auto_gamma_transition_matrix
-                    
-                    transition_matrix = build_auto_gamma_transition_matrix(
-                        alpha=gamma_alpha,
-                        categories=gamma_categories,
-                        rho=site_rate_correlation
-                    )
-                    
-                except ImportError:
-                    warnings.warn(
-                        "site_rate_correlation > 0 requires scipy. "
-                        "Install with: pip install scipy or pip install 'msasim[correlation]'. "
-                        "Ignoring correlation parameter."
-                    )
+                transition_matrix = _Sailfish.auto_gamma_transition_matrix(
+                    alpha=gamma_alpha,
+                    categories=gamma_categories,
+                    rho=site_rate_correlation
+                )
         return rates, probs, transition_matrix
     
     def _init_sub_model(self) -> None:
@@ -252,6 +243,136 @@ class Simulator:
 
         self._is_sub_model_init = True
         
+    def set_substitution_engine(
+            self,
+            engine: SUBSTITUTION_ENGINE = SUBSTITUTION_ENGINE.AUTO,
+            gillespie_threshold: Optional[float] = None
+        ) -> None:
+        """
+        Select how substitutions are simulated along each branch.
+
+        Args:
+            engine: AUTO picks per branch, MATRIX draws every site from P(t),
+                GILLESPIE simulates the individual substitution events.
+            gillespie_threshold: expected substitutions per site below which AUTO
+                uses the event-driven engine (default: 0.1).
+        """
+        if gillespie_threshold is not None:
+            if gillespie_threshold < 0:
+                raise ValueError(f"gillespie_threshold must be non-negative, received: {gillespie_threshold}")
+            self._simulator.set_gillespie_threshold(gillespie_threshold)
+        self._simulator.set_substitution_engine(engine)
+
+    def set_num_threads(self, num_threads: int = 0) -> None:
+        """
+        Set the number of worker threads used by the parallel parts of the simulation.
+
+        Args:
+            num_threads: number of threads, 0 uses one per hardware thread (default: 1
+                until this is called). Results for a given seed are the same for any
+                number of threads above one.
+        """
+        if num_threads < 0:
+            raise ValueError(f"num_threads must be non-negative, received: {num_threads}")
+        self._simulator.set_num_threads(num_threads)
+
+    def get_num_threads(self) -> int:
+        return self._simulator.get_num_threads()
+
+    def set_transition_table_cache(
+            self,
+            max_tables: int = 0,
+            eviction: TABLE_EVICTION = TABLE_EVICTION.LRU
+        ) -> None:
+        """
+        Bound the transition probability tables kept in memory. A table holds the
+        transition distributions of one branch length and rate category, and is built
+        the first time a branch needs it.
+
+        Args:
+            max_tables: most tables kept at once, 0 for no limit (default). At least one
+                table per rate category is always kept.
+            eviction: which table a full cache drops, LRU (least recently used, default)
+                or FIFO (oldest). Dropped tables are rebuilt when needed again, so the
+                output does not depend on these settings.
+        """
+        if max_tables < 0:
+            raise ValueError(f"max_tables must be non-negative, received: {max_tables}")
+        self._simulator.set_transition_table_cache(max_tables, eviction)
+
+    def set_branch_length_quantization(self, max_total_variation: float = 0.0) -> None:
+        """
+        Share transition tables between branches of nearby lengths, for trees with many
+        distinct (continuous) branch lengths. Lengths are snapped to a log-spaced grid
+        chosen so that, for every rate category, no row of a branch's transition matrix
+        moves by more than max_total_variation in total-variation distance.
+
+        Args:
+            max_total_variation: largest error allowed, 0 for exact lengths (default).
+                The realized bound is reported as "error_bound" by
+                get_transition_table_stats.
+        """
+        if max_total_variation < 0 or max_total_variation >= 1:
+            raise ValueError(f"max_total_variation must be in [0, 1), received: {max_total_variation}")
+        self._simulator.set_branch_length_quantization(max_total_variation)
+
+    def get_transition_table_stats(self) -> Dict[str, Union[int, float]]:
+        """
+        Counters of the transition table cache since the substitution model was set:
+        "hits" (tables found in memory), "misses" (tables made resident), "shared"
+        (misses served by tables another simulator of the same model built), "evictions",
+        "resident_tables", "capacity" (0 for no limit), "unique_lengths" (branch
+        lengths with their own tables) and "error_bound" (total-variation error of the
+        branch length quantization, 0 when exact).
+        """
+        stats = self._simulator.get_transition_table_stats()
+        return {
+            "hits": stats.hits,
+            "misses": stats.misses,
+            "shared": stats.shared,
+            "evictions": stats.evictions,
+            "resident_tables": stats.resident_tables,
+            "capacity": stats.capacity,
+            "unique_lengths": stats.unique_lengths,
+            "error_bound": stats.error_bound,
+        }
+
+    @staticmethod
+    def set_model_cache_size(max_models: int = 8) -> None:
+        """
+        Set how many substitution models the process-wide model cache keeps (default: 8).
+        Simulators set up with a model already in the cache - same alphabet, replacement
+        model, parameters and site-rate model - reuse its stochastic process and transition
+        tables instead of building them. 0 disables the cache.
+        """
+        if max_models < 0:
+            raise ValueError(f"max_models must be non-negative, received: {max_models}")
+        _Sailfish.set_model_cache_capacity(max_models)
+
+    @staticmethod
+    def clear_model_cache() -> None:
+        """
+        Drop every cached substitution model, including the parsed empirical and custom
+        replacement models, and reset the cache counters. Simulators keep the models they use.
+        """
+        _Sailfish.clear_model_cache()
+
+    @staticmethod
+    def get_model_cache_stats() -> Dict[str, int]:
+        """
+        Counters of the process-wide model cache: "hits" (models reused), "misses" (models
+        built), "models" (models held) and "capacity".
+        """
+        stats = _Sailfish.model_cache_stats()
+        return {"hits": stats.hits, "misses": stats.misses, "models": stats.models, "capacity": stats.capacity}
+
+    def set_async_output(self, enabled: bool = True) -> None:
+        """
+        Write low-memory output (simulate_low_memory) from a separate writer thread, so
+        simulation and disk I/O overlap. Enabled by default.
+        """
+        self._simulator.set_async_output(enabled)
+
     def gen_indels(self) -> BlockTreePython:
         return BlockTreePython(self._simulator.gen_indels())
     
@@ -264,11 +385,18 @@ class Simulator:
     def save_all_nodes_sequences(self):
         self._simulator.save_all_nodes_sequences()
 
-    def gen_substitutions(self, length: int, root_string: str = "", root_positions_in_msa: List[int] = []) -> List[List[str]]:
+    def gen_substitutions(self, length: int, root_string: str = "", root_positions_in_msa: List[int] = []) -> _Sailfish.SequenceArena:
         if not self._is_sub_model_init:
             self._init_sub_model()
         return self._simulator.gen_substitutions(length, root_string, root_positions_in_msa)
     
+    def gen_substitution_arrays(self, length: int, root_string: str = "", root_positions_in_msa: List[int] = []) -> SequenceArrays:
+        """
+        Same as gen_substitutions, returning the saved sequences as NumPy arrays (a rows x
+        columns uint8 array of alphabet codes, node ids and names). Requires numpy.
+        """
+        return SequenceArrays(self.gen_substitutions(length, root_string, root_positions_in_msa))
+
     def set_root_sequence(self, sequence: str):
         if self._simProtocol.get_sequence_size() != len(sequence):
             raise ValueError(f"the provided root sequence length of {len(sequence)} does not match the sequence size in the simProtocol of {self._simProtocol.get_sequence_size()}")
@@ -277,7 +405,9 @@ class Simulator:
     # @profile
     def simulate(self, times: int = 1) -> List[Msa]:
         Msas = []
+        self._memory_reports = []
         for _ in range(times):
+            _Sailfish.reset_memory_peaks()
             if self._simProtocol._is_insertion_rate_zero and self._simProtocol._is_deletion_rate_zero:
                 msa = Msa(sum(self.get_sequences_to_save()),
                           self._simProtocol.get_sequence_size(),
@@ -299,9 +429,30 @@ class Simulator:
                 msa.fill_substitutions(substitutions)
 
             Msas.append(msa)
+            self._memory_reports.append(_Sailfish.memory_report())
         return Msas
     
-    def simulate_low_memory(self, output_file_path: pathlib.Path) -> Msa:
+    def simulate_low_memory(self, output_file_path: pathlib.Path, compress: bool = False,
+                            substitution_memory_budget_bytes: Optional[int] = None) -> Optional[_Sailfish.MemoryPlan]:
+        """
+        Simulate and write the MSA straight to output_file_path without keeping it in memory.
+        With compress=True the file is written as BGZF (block gzip), compressed with the
+        threads set by set_num_threads.
+
+        With substitution_memory_budget_bytes, the substitution and output phase runs with the
+        fastest strategy whose estimated peak fits the budget (see MEMORY_STRATEGY), and the
+        plan is returned with the peak resident memory measured while writing. Raises
+        MemoryError if no strategy fits.
+
+        The budget covers the substitution and output phase only, and as an estimate from the
+        sizes of its structures over the memory resident when planning, not a guarantee. The
+        indel simulation and the alignment it builds run in memory first, unbounded, and
+        MemoryError is only raised once they are done.
+        """
+        self._simulator.set_compressed_output(compress)
+        _Sailfish.reset_memory_peaks()
+        self._memory_reports = []
+        msa = None
         if self._simProtocol._is_insertion_rate_zero and self._simProtocol._is_deletion_rate_zero:
             msa_length = self._simProtocol.get_sequence_size()
         else:
@@ -309,17 +460,70 @@ class Simulator:
             msa = Msa(blocktree._get_Sailfish_blocks(),
                         self._simProtocol._get_root(),
                         self.get_sequences_to_save())
+            del blocktree # the blocks are copied into the MSA
             msa_length = msa.get_length()
-            self._simulator.set_aligned_sequence_map(msa._msa)
 
-        # sim.init_substitution_sim(mFac)
-        if self._simulation_type != SIMULATION_TYPE.NOSUBS:
-            self._simulator.gen_substitutions_to_file(msa_length, 
-                                                      str(output_file_path),
-                                                      self._root_seq)
+        if self._simulation_type == SIMULATION_TYPE.NOSUBS:
+            msa.write_msa(str(output_file_path), compress)
+            self._memory_reports.append(_Sailfish.memory_report())
+            return None
+        if substitution_memory_budget_bytes is None:
+            if msa is not None:
+                self._simulator.set_aligned_sequence_map(msa._msa)
+            try:
+                self._simulator.gen_substitutions_to_file(msa_length,
+                                                          str(output_file_path),
+                                                          self._root_seq)
+            finally:
+                self._simulator.clear_gap_runs()
+            self._memory_reports.append(_Sailfish.memory_report())
+            return None
+
+        if not self._is_sub_model_init:
+            self._init_sub_model()
+        plan = self._simulator.plan_substitution_memory(substitution_memory_budget_bytes, msa_length,
+                                                        msa._msa if msa is not None else None)
+        if not plan.feasible:
+            raise MemoryError(f"the substitution phase needs an estimated {plan.estimated_peak_bytes} bytes "
+                              f"({plan.baseline_bytes} already resident), more than the budget of {substitution_memory_budget_bytes}")
+        _Sailfish.reset_peak_resident_bytes()
+
+        if plan.strategy == MEMORY_STRATEGY.IN_MEMORY:
+            if msa is None:
+                msa = Msa(sum(self.get_sequences_to_save()), msa_length, self.get_sequences_to_save())
+            msa.fill_substitutions(self.gen_substitutions(msa_length, self._root_seq, msa.get_root_positions_in_msa()))
+            msa.write_msa(str(output_file_path), compress)
         else:
-            msa.write_msa(str(output_file_path))
+            if msa is not None and plan.strategy == MEMORY_STRATEGY.SPILLED_GAP_RUNS:
+                self._simulator.spill_gap_runs(msa._msa, str(output_file_path) + ".gapruns")
+                del msa
+                _Sailfish.release_freed_memory()
+            elif msa is not None:
+                self._simulator.set_aligned_sequence_map(msa._msa)
+            try:
+                self._simulator.gen_substitutions_to_file(msa_length, str(output_file_path), self._root_seq)
+            finally:
+                self._simulator.clear_gap_runs()
+
+        plan.peak_resident_bytes = _Sailfish.peak_resident_bytes()
+        self._memory_reports.append(_Sailfish.memory_report())
+        return plan
     
+    def get_memory_report(self) -> Dict[str, Dict[str, int]]:
+        """
+        Memory tracked during the last replicate of simulate (or the last simulate_low_memory
+        call): for every subsystem and the "total", the bytes held at the end ("current"),
+        the peak over the replicate ("peak") and the peak within each phase ("peak_indels",
+        "peak_msa", "peak_substitutions", "peak_output"). Empty before the first simulation.
+        """
+        return self._memory_reports[-1] if self._memory_reports else {}
+
+    def get_memory_reports(self) -> List[Dict[str, Dict[str, int]]]:
+        """
+        One memory report (see get_memory_report) per replicate of the last simulate call.
+        """
+        return list(self._memory_reports)
+
     def __call__(self) -> Msa:
         return self.simulate(1)[0]
     
@@ -327,4 +531,18 @@ class Simulator:
         self._simulator.save_site_rates(is_save)
     
     def get_rates(self) -> List[float]:
-        return self._simulator.get_site_rates()
\ No newline at end of file
+        return self._simulator.get_site_rates()
+
+    def get_rates_array(self):
+        """
+        Site rates of the last simulation (saved with save_rates(True)) as a float64 NumPy
+        array sharing the simulator's buffer; later simulations do not modify it.
+        """
+        return as_numpy(self._simulator.get_site_rates_view())
+
+    def get_rate_categories_array(self):
+        """
+        Rate category of every site in the last simulation as a uint8 NumPy array sharing
+        the simulator's buffer; later simulations do not modify it.
+        """
+        return as_numpy(self._simulator.get_rate_categories_view())
\ No newline at end of file
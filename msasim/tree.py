@@ -3,6 +3,8 @@
 import _Sailfish
 import os
 from re import split
+from typing import List
+from .arrays import as_numpy
 
 def is_newick(tree: str) -> bool:
     """Validate newick format"""
@@ -23,27 +25,91 @@ class Tree:
     def __init__(self, input_str: str):
         is_from_file = os.path.isfile(input_str)
         
-        if is_from_file:
-            tree_str = open(input_str, 'r').read()
-        else:
-            tree_str = input_str
-            
-        if not is_newick(tree_str):
+        # parsed and validated in one pass, into flat arrays that build the simulation tree
+        try:
+            if is_from_file:
+                self._flat = _Sailfish.FlatTree.from_file(input_str)
+            else:
+                self._flat = _Sailfish.FlatTree.from_newick(input_str)
+        except ValueError as error:
             source = "file" if is_from_file else "string"
-            raise ValueError(f"Invalid newick from {source}: {tree_str}")
+            raise ValueError(f"Invalid newick from {source}: {error}") from error
             
-        self._tree = _Sailfish.Tree(input_str, is_from_file)
-        self._tree_str = tree_str
+        self._tree = self._flat.to_tree()
+        self._tree_str = None if is_from_file else input_str
     
+    @classmethod
+    def _from_flat(cls, flat) -> "Tree":
+        tree = cls.__new__(cls)
+        tree._flat = flat
+        tree._tree = flat.to_tree()
+        tree._tree_str = None
+        return tree
+
+    @classmethod
+    def from_parents(cls, parents: List[int], branch_lengths: List[float], names: List[str]) -> "Tree":
+        """
+        Tree given by the parent index of every node (-1 for the root), without going
+        through Newick. Nodes are renumbered in preorder.
+        """
+        parents = [2**32 - 1 if parent < 0 else parent for parent in parents]
+        return cls._from_flat(_Sailfish.FlatTree.from_parents(parents, branch_lengths, names))
+
+    @classmethod
+    def balanced(cls, num_leaves: int, branch_length: float = 0.1) -> "Tree":
+        """Balanced binary tree with all branches of branch_length."""
+        return cls._from_flat(_Sailfish.balanced_tree(num_leaves, branch_length))
+
+    @classmethod
+    def caterpillar(cls, num_leaves: int, branch_length: float = 0.1) -> "Tree":
+        """Caterpillar (ladder) tree with all branches of branch_length."""
+        return cls._from_flat(_Sailfish.caterpillar_tree(num_leaves, branch_length))
+
+    @classmethod
+    def coalescent(cls, num_leaves: int, population_size: float = 1.0, seed: int = 0) -> "Tree":
+        """
+        Kingman coalescent tree; two leaves coalesce population_size branch length units
+        back on average.
+        """
+        return cls._from_flat(_Sailfish.coalescent_tree(num_leaves, population_size, seed))
+
+    @classmethod
+    def birth_death(cls, num_leaves: int, birth_rate: float = 1.0, death_rate: float = 0.0, seed: int = 0) -> "Tree":
+        """
+        Reconstructed birth-death tree with num_leaves extant leaves (Yule with
+        death_rate=0); death_rate must not exceed birth_rate.
+        """
+        return cls._from_flat(_Sailfish.birth_death_tree(num_leaves, birth_rate, death_rate, seed))
+
     def get_num_nodes(self) -> int:
-        return self._tree.num_nodes
+        return self._flat.num_nodes
     
     def get_num_leaves(self) -> int:
-        return self._tree.root.num_leaves
+        return self._flat.num_leaves
+
+    def get_parents_array(self):
+        """
+        Parent id of every node as a uint32 NumPy array (2**32 - 1 for the root). Node ids
+        are in preorder with the root 0; node i is on branch i - 1 of the SimProtocol.
+        Requires numpy.
+        """
+        return as_numpy(self._flat.parents())
+
+    def get_branch_lengths_array(self):
+        """Length of the branch above every node as a float64 NumPy array. Requires numpy."""
+        return as_numpy(self._flat.branch_lengths())
+
+    def get_node_names(self) -> List[str]:
+        return self._flat.names()
+
+    def to_newick(self) -> str:
+        return self._flat.to_newick()
     
     def _get_Sailfish_tree(self) -> _Sailfish.Tree:
         """Internal: Get C++ tree object"""
         return self._tree
     
     def __repr__(self) -> str:
-        return self._tree_str
\ No newline at end of file
+        if self._tree_str is None:
+            self._tree_str = self._flat.to_newick()
+        return self._tree_str
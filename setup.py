@@ -1,4 +1,5 @@
 # Available at setup time due to pyproject.toml
+import sys
 from glob import glob
 from pathlib import Path
 from pybind11.setup_helpers import Pybind11Extension, build_ext
@@ -19,6 +20,13 @@ __version__ = "26.4.2"
 
 # SRC_DIR = Path("src").resolve()
 
+# the simulator spawns std::threads for its parallel sections
+thread_flags = [] if sys.platform == "win32" else ["-pthread"]
+
+# zlib provides the BGZF (block gzip) output mode; it ships with every non-Windows platform
+zlib_macros = [] if sys.platform == "win32" else [('SAILFISH_HAVE_ZLIB', '1')]
+zlib_libraries = [] if sys.platform == "win32" else ["z"]
+
 def print_sources(sources):
     print(sources)
     return sources
@@ -29,8 +37,11 @@ ext_modules = [
         cxx_std = "17",
         extra_objects=[str(x) for x in Path(".").resolve().glob("libs/*") if x.is_file()],
         # extra_compile_args=["-g"],
+        extra_compile_args=thread_flags,
+        extra_link_args=thread_flags,
         # Example: passing in the version to the compiled code
-        define_macros = [('VERSION_INFO', __version__)],
+        define_macros = [('VERSION_INFO', __version__)] + zlib_macros,
+        libraries=zlib_libraries,
         ),
 ]
 
@@ -0,0 +1,197 @@
+#ifndef ___ALIAS_TABLE
+#define ___ALIAS_TABLE
+
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+#include <random>
+#include <type_traits>
+#include "../libs/Phylolib/includes/definitions.h"
+#include "../libs/Phylolib/includes/errorMsg.h"
+
+/**
+ * Walker/Vose alias table: O(n) construction, O(1) draws from a fixed discrete distribution.
+ *
+ * A draw needs a single generator output. With a full-range 64-bit generator the high 32 bits
+ * select the column (multiply-shift, no division) and the low 32 bits are compared against the
+ * column's fixed-point threshold, so the draw is branch-free integer arithmetic. Other generators
+ * fall back to one uniform u in [0,1): x = u * n selects the column floor(x), and the fractional
+ * part of x decides between the column and its alias.
+ * Draws return 0-based indices (DiscreteDistribution::drawSample is 1-based).
+ */
+class AliasTable {
+public:
+    AliasTable() = default;
+
+    /**
+     * @param weights - non-negative weights, normalized internally (must not all be zero)
+     */
+    explicit AliasTable(const std::vector<MDOUBLE>& weights) {
+        const size_t n = weights.size();
+        if (n == 0) errorMsg::reportError("AliasTable: weights cannot be empty");
+
+        MDOUBLE total = 0.0;
+        for (MDOUBLE w: weights) {
+            if (w < 0.0) errorMsg::reportError("AliasTable: weights must be non-negative");
+            total += w;
+        }
+        if (total <= 0.0) errorMsg::reportError("AliasTable: weights must not all be zero");
+
+        _threshold.resize(n);
+        _fixedThreshold.resize(n);
+        _alias.resize(n);
+
+        std::vector<double> scaled(n);
+        std::vector<uint32_t> small, large;
+        small.reserve(n);
+        large.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            scaled[i] = weights[i] * n / total;
+            if (scaled[i] < 1.0) small.push_back(static_cast<uint32_t>(i));
+            else large.push_back(static_cast<uint32_t>(i));
+        }
+
+        while (!small.empty() && !large.empty()) {
+            uint32_t less = small.back(); small.pop_back();
+            uint32_t more = large.back(); large.pop_back();
+            _threshold[less] = scaled[less];
+            _alias[less] = more;
+            scaled[more] = (scaled[more] + scaled[less]) - 1.0;
+            if (scaled[more] < 1.0) small.push_back(more);
+            else large.push_back(more);
+        }
+        // whatever is left is 1 up to rounding
+        for (uint32_t i: large) { _threshold[i] = 1.0; _alias[i] = i; }
+        for (uint32_t i: small) { _threshold[i] = 1.0; _alias[i] = i; }
+
+        for (size_t i = 0; i < n; ++i) {
+            _fixedThreshold[i] = static_cast<uint64_t>(std::ldexp(_threshold[i], 32));
+        }
+    }
+
+    template<typename RngType>
+    uint32_t drawSample(RngType &rng) const {
+        if constexpr (isFullRange64<RngType>()) {
+            return drawFromBits(rng(), _fixedThreshold.size(), _fixedThreshold.data(), _alias.data());
+        }
+        const double x = std::uniform_real_distribution<double>(0.0, 1.0)(rng) * static_cast<double>(_threshold.size());
+        uint32_t column = static_cast<uint32_t>(x);
+        if (column >= _threshold.size()) column = static_cast<uint32_t>(_threshold.size() - 1);
+        return (x - column < _threshold[column]) ? column : _alias[column];
+    }
+
+    /**
+     * Fill out[0..n) with independent draws.
+     * Table pointers are hoisted into locals: stores through uint8_t may alias anything,
+     * so reading them through the members would force a reload on every iteration.
+     */
+    template<typename RngType>
+    void drawSamples(uint8_t *out, size_t n, RngType &rng) const {
+        if constexpr (isFullRange64<RngType>()) {
+            const uint64_t *threshold = _fixedThreshold.data();
+            const uint32_t *alias = _alias.data();
+            const uint64_t columns = _fixedThreshold.size();
+            for (size_t i = 0; i < n; ++i) {
+                out[i] = static_cast<uint8_t>(drawFromBits(rng(), columns, threshold, alias));
+            }
+        } else {
+            for (size_t i = 0; i < n; ++i) out[i] = static_cast<uint8_t>(drawSample(rng));
+        }
+    }
+
+    /**
+     * Map one 64-bit generator output to a column or its alias.
+     * The select is done with a mask rather than a branch, which would mispredict on
+     * roughly every other draw.
+     */
+    static uint32_t drawFromBits(uint64_t bits, uint64_t columns,
+                                 const uint64_t *threshold, const uint32_t *alias) {
+        const uint32_t column = static_cast<uint32_t>(((bits >> 32) * columns) >> 32);
+        const uint32_t useAlias = 0u - static_cast<uint32_t>((bits & 0xFFFFFFFFull) >= threshold[column]);
+        return column ^ ((column ^ alias[column]) & useAlias);
+    }
+
+    template<typename RngType>
+    static constexpr bool isFullRange64() {
+        return std::is_same<typename RngType::result_type, uint64_t>::value
+            && RngType::min() == 0 && RngType::max() == std::numeric_limits<uint64_t>::max();
+    }
+
+    const uint64_t *fixedThresholds() const {
+        return _fixedThreshold.data();
+    }
+
+    const uint32_t *aliases() const {
+        return _alias.data();
+    }
+
+    size_t size() const {
+        return _threshold.size();
+    }
+
+private:
+    std::vector<double> _threshold;
+    std::vector<uint64_t> _fixedThreshold; // _threshold scaled by 2^32
+    std::vector<uint32_t> _alias;
+};
+
+/**
+ * Alias table over a compile-time number of outcomes (an alphabet), for bulk draws into
+ * uint8 buffers. With N known the column multiply folds into constants, and drawSamples
+ * takes generator outputs in batches so the table lookups form a loop the compiler can
+ * unroll and vectorize independently of the generator's serial dependency.
+ */
+template<size_t N>
+class FixedAliasTable {
+    static_assert(N > 0 && N <= 256, "FixedAliasTable indices must fit in uint8_t");
+public:
+    FixedAliasTable() {
+        _threshold.fill(uint64_t(1) << 32);
+        for (size_t i = 0; i < N; ++i) _alias[i] = static_cast<uint8_t>(i);
+    }
+
+    explicit FixedAliasTable(const std::vector<MDOUBLE>& weights) {
+        if (weights.size() != N) errorMsg::reportError("FixedAliasTable: number of weights does not match the table size");
+        AliasTable table(weights);
+        for (size_t i = 0; i < N; ++i) {
+            _threshold[i] = table.fixedThresholds()[i];
+            _alias[i] = static_cast<uint8_t>(table.aliases()[i]);
+        }
+    }
+
+    template<typename RngType>
+    uint8_t drawSample(RngType &rng) const {
+        static_assert(AliasTable::isFullRange64<RngType>(), "FixedAliasTable requires a full-range 64-bit generator");
+        return fromBits(rng());
+    }
+
+    template<typename RngType>
+    void drawSamples(uint8_t *out, size_t n, RngType &rng) const {
+        static_assert(AliasTable::isFullRange64<RngType>(), "FixedAliasTable requires a full-range 64-bit generator");
+        constexpr size_t BATCH = 256;
+        uint64_t bits[BATCH];
+        size_t done = 0;
+        while (done < n) {
+            const size_t batch = std::min(BATCH, n - done);
+            for (size_t i = 0; i < batch; ++i) bits[i] = rng();
+            uint8_t *batchOut = out + done;
+            for (size_t i = 0; i < batch; ++i) batchOut[i] = fromBits(bits[i]);
+            done += batch;
+        }
+    }
+
+private:
+    uint8_t fromBits(uint64_t bits) const {
+        const uint32_t column = static_cast<uint32_t>(((bits >> 32) * N) >> 32);
+        const uint8_t useAlias = static_cast<uint8_t>(0u - static_cast<uint32_t>((bits & 0xFFFFFFFFull) >= _threshold[column]));
+        return static_cast<uint8_t>(column ^ ((column ^ _alias[column]) & useAlias));
+    }
+
+    std::array<uint64_t, N> _threshold;
+    std::array<uint8_t, N> _alias;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef ___ARRAY_VIEW
+#define ___ARRAY_VIEW
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+
+/**
+ * Struct module format code of an item type ("B" for uint8, "d" for double, ...), as used by
+ * the Python buffer protocol.
+ */
+template<typename T>
+const char* bufferFormat() {
+    static_assert(std::is_arithmetic<T>::value, "buffers hold arithmetic items");
+    if (std::is_same<T, double>::value) return "d";
+    if (std::is_same<T, float>::value) return "f";
+    static const char *INTEGER_CODES[] = {"b", "B", "h", "H", "i", "I", "q", "Q"};
+    const size_t sizeLog2 = sizeof(T) == 1 ? 0 : sizeof(T) == 2 ? 1 : sizeof(T) == 4 ? 2 : 3;
+    return INTEGER_CODES[sizeLog2 * 2 + (std::is_unsigned<T>::value ? 1 : 0)];
+}
+
+
+/**
+ * Read-only view of a C-contiguous array owned by some C++ object.
+ *
+ * The view shares ownership of that object (owner may be empty when the caller ties the
+ * lifetimes otherwise, e.g. through pybind's keep_alive), so it stays valid after the
+ * producer moved on. It carries the shape and item format needed to export the memory
+ * through the Python buffer protocol, where NumPy wraps it without copying.
+ */
+struct ArrayView {
+    std::shared_ptr<const void> owner;
+    const void *data;
+    std::vector<size_t> shape;
+    size_t itemSize;
+    const char *format;
+
+    template<typename T>
+    static ArrayView of(std::shared_ptr<const void> owner, const T *data, std::vector<size_t> shape) {
+        return {std::move(owner), data, std::move(shape), sizeof(T), bufferFormat<T>()};
+    }
+
+    template<typename T>
+    static ArrayView of(const std::shared_ptr<std::vector<T>> &vector) {
+        return of<T>(vector, vector->data(), {vector->size()});
+    }
+
+    size_t size() const {
+        size_t count = 1;
+        for (size_t extent : shape) count *= extent;
+        return count;
+    }
+
+    // byte strides of the C-contiguous layout
+    std::vector<size_t> strides() const {
+        std::vector<size_t> result(shape.size());
+        size_t stride = itemSize;
+        for (size_t axis = shape.size(); axis-- > 0;) {
+            result[axis] = stride;
+            stride *= shape[axis];
+        }
+        return result;
+    }
+};
+
+
+/**
+ * The buffer (a vector, a SequenceArena, ...) behind buffer, reusable for the next round of
+ * output: a fresh one if views of the current one are still held elsewhere (their data must
+ * not change under them), the current one otherwise, so steady-state simulation does not
+ * allocate.
+ */
+template<typename Buffer>
+Buffer& exclusiveBuffer(std::shared_ptr<Buffer> &buffer) {
+    if (!buffer || buffer.use_count() > 1) buffer = std::make_shared<Buffer>();
+    return *buffer;
+}
+
+#endif
@@ -0,0 +1,269 @@
+#ifndef ___AUTO_GAMMA_CORRELATION
+#define ___AUTO_GAMMA_CORRELATION
+
+#include <cmath>
+#include <deque>
+#include <mutex>
+#include <limits>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <stdexcept>
+#include <algorithm>
+#include <unordered_map>
+
+#include "../libs/Phylolib/includes/definitions.h"
+#include "ParallelFor.h"
+
+/**
+ * Transition matrix of the auto-discrete-gamma model (Yang 1995): the rates of adjacent
+ * sites are gamma variates coupled by a bivariate normal copula of correlation rho, and
+ * M[i][j] is the probability that a site of category j follows one of category i.
+ *
+ * The categories have equal probability, so a category is an interval between normal
+ * quantiles of 1/K steps and every cell is a rectangle probability of the bivariate
+ * normal. Its CDF is evaluated with Genz's method (Drezner-Wesolowsky with Gauss-Legendre
+ * quadrature, about 1e-15 absolute error), once per pair of interior quantiles.
+ */
+
+// standard normal CDF
+inline double normalCdf(double x) {
+    return 0.5 * std::erfc(-x * M_SQRT1_2);
+}
+
+// standard normal quantile: Acklam's rational approximation, refined by one Halley step
+inline double normalQuantile(double p) {
+    if (p <= 0.0) return -std::numeric_limits<double>::infinity();
+    if (p >= 1.0) return std::numeric_limits<double>::infinity();
+    static const double a[] = {-3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+                               1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00};
+    static const double b[] = {-5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+                               6.680131188771972e+01, -1.328068155288572e+01};
+    static const double c[] = {-7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                               -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00};
+    static const double d[] = {7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+                               3.754408661907416e+00};
+    const double LOW = 0.02425;
+    double x;
+    if (p < LOW) {
+        const double q = std::sqrt(-2.0 * std::log(p));
+        x = (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5])
+            / ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1.0);
+    } else if (p <= 1.0 - LOW) {
+        const double q = p - 0.5;
+        const double r = q * q;
+        x = (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q
+            / (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1.0);
+    } else {
+        const double q = std::sqrt(-2.0 * std::log(1.0 - p));
+        x = -(((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5])
+            / ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1.0);
+    }
+    const double error = normalCdf(x) - p;
+    const double u = error * std::sqrt(2.0 * M_PI) * std::exp(0.5 * x * x);
+    return x - u / (1.0 + 0.5 * x * u);
+}
+
+/**
+ * P(X < x, Y < y) for standard normals of correlation rho, |rho| < 1.
+ */
+inline double bivariateNormalCdf(double x, double y, double rho) {
+    if (x == -std::numeric_limits<double>::infinity() || y == -std::numeric_limits<double>::infinity()) return 0.0;
+    if (x == std::numeric_limits<double>::infinity()) return normalCdf(y);
+    if (y == std::numeric_limits<double>::infinity()) return normalCdf(x);
+    if (rho == 0.0) return normalCdf(x) * normalCdf(y);
+
+    // Gauss-Legendre points (negative half) and weights of 6, 12 and 20 points
+    static const double W[3][10] = {
+        {0.1713244923791705, 0.3607615730481384, 0.4679139345726904},
+        {0.04717533638651177, 0.1069393259953183, 0.1600783285433464, 0.2031674267230659, 0.2334925365383547,
+         0.2491470458134029},
+        {0.01761400713915212, 0.04060142980038694, 0.06267204833410906, 0.08327674157670475, 0.1019301198172404,
+         0.1181945319615184, 0.1316886384491766, 0.1420961093183821, 0.1491729864726037, 0.1527533871307259}};
+    static const double X[3][10] = {
+        {-0.9324695142031522, -0.6612093864662647, -0.2386191860831970},
+        {-0.9815606342467191, -0.9041172563704750, -0.7699026741943050, -0.5873179542866171, -0.3678314989981802,
+         -0.1252334085114692},
+        {-0.9931285991850949, -0.9639719272779138, -0.9122344282513259, -0.8391169718222188, -0.7463319064601508,
+         -0.6360536807265150, -0.5108670019508271, -0.3737060887154196, -0.2277858511416451, -0.07652652113349733}};
+    const double TWO_PI = 2.0 * M_PI;
+    const double absRho = std::abs(rho);
+    const int set = absRho < 0.3 ? 0 : (absRho < 0.75 ? 1 : 2);
+    const int points = set == 0 ? 3 : (set == 1 ? 6 : 10);
+
+    // Genz computes the upper orthant P(X > h, Y > k) = P(X < x, Y < y) with h = -x, k = -y
+    double h = -x, k = -y;
+    double hk = h * k;
+    double result = 0.0;
+    if (absRho < 0.925) {
+        const double hs = 0.5 * (h * h + k * k);
+        const double asr = std::asin(rho);
+        for (int i = 0; i < points; ++i) {
+            for (int side = -1; side <= 1; side += 2) {
+                const double sn = std::sin(0.5 * asr * (1.0 + side * X[set][i]));
+                result += W[set][i] * std::exp((sn * hk - hs) / (1.0 - sn * sn));
+            }
+        }
+        return result * asr / (2.0 * TWO_PI) + normalCdf(-h) * normalCdf(-k);
+    }
+
+    if (rho < 0.0) {
+        k = -k;
+        hk = -hk;
+    }
+    const double as = (1.0 - rho) * (1.0 + rho);
+    double a = std::sqrt(as);
+    const double bs = (h - k) * (h - k);
+    const double c = (4.0 - hk) / 8.0;
+    const double dd = (12.0 - hk) / 16.0;
+    result = a * std::exp(-0.5 * (bs / as + hk)) * (1.0 - c * (bs - as) * (1.0 - dd * bs / 5.0) / 3.0 + c * dd * as * as / 5.0);
+    if (hk > -160.0) {
+        const double b = std::sqrt(bs);
+        result -= std::exp(-0.5 * hk) * std::sqrt(TWO_PI) * normalCdf(-b / a) * b * (1.0 - c * bs * (1.0 - dd * bs / 5.0) / 3.0);
+    }
+    a *= 0.5;
+    for (int i = 0; i < points; ++i) {
+        for (int side = -1; side <= 1; side += 2) {
+            const double xs = a * a * (1.0 + side * X[set][i]) * (1.0 + side * X[set][i]);
+            const double rs = std::sqrt(1.0 - xs);
+            result += a * W[set][i] * (std::exp(-bs / (2.0 * xs) - hk / (1.0 + rs)) / rs
+                                       - std::exp(-0.5 * (bs / xs + hk)) * (1.0 + c * xs * (1.0 + dd * xs)));
+        }
+    }
+    result = -result / TWO_PI;
+
+    if (rho > 0.0) return result + normalCdf(-std::max(h, k));
+    result = -result;
+    if (k > h) result += (h < 0.0) ? normalCdf(k) - normalCdf(h) : normalCdf(-h) - normalCdf(-k);
+    return result;
+}
+
+/**
+ * The K x K auto-discrete-gamma transition matrix, computed anew; the (K - 1)^2 / 2 CDF
+ * evaluations of distinct interior quantile pairs are spread over numThreads threads
+ * (0 = one per hardware thread).
+ *
+ * alpha only shapes the gamma rates of the categories, not the copula, so it is validated
+ * but does not enter the matrix. |rho| = 1 gives the identity (rho = 1) or the reversed
+ * identity (rho = -1).
+ */
+inline std::vector<std::vector<MDOUBLE>> buildAutoGammaTransitionMatrix(MDOUBLE alpha, size_t categories, MDOUBLE rho,
+                                                                        size_t numThreads = 1) {
+    if (categories < 2) throw std::invalid_argument("Need at least 2 categories, got " + std::to_string(categories));
+    if (!(rho >= -1.0 && rho <= 1.0)) throw std::invalid_argument("Correlation rho must be in [-1, 1], got " + std::to_string(rho));
+    if (!(alpha > 0.0)) throw std::invalid_argument("Alpha must be positive, got " + std::to_string(alpha));
+
+    const size_t K = categories;
+    std::vector<std::vector<MDOUBLE>> matrix(K, std::vector<MDOUBLE>(K, 0.0));
+    if (std::abs(std::abs(rho) - 1.0) < 1e-6) {
+        for (size_t i = 0; i < K; ++i) matrix[i][rho > 0.0 ? i : K - 1 - i] = 1.0;
+        return matrix;
+    }
+
+    std::vector<double> quantiles(K + 1);
+    for (size_t q = 0; q <= K; ++q) quantiles[q] = normalQuantile(static_cast<double>(q) / K);
+
+    // cdf[a][b] = P(X < quantile a, Y < quantile b), symmetric; the margins are a / K
+    std::vector<std::vector<double>> cdf(K + 1, std::vector<double>(K + 1, 0.0));
+    for (size_t q = 0; q <= K; ++q) {
+        cdf[K][q] = static_cast<double>(q) / K;
+        cdf[q][K] = static_cast<double>(q) / K;
+    }
+    parallelFor(1, K, numThreads, [&](size_t a) {
+        for (size_t b = a; b < K; ++b) cdf[a][b] = bivariateNormalCdf(quantiles[a], quantiles[b], rho);
+    });
+    for (size_t a = 1; a < K; ++a) {
+        for (size_t b = 1; b < a; ++b) cdf[a][b] = cdf[b][a];
+    }
+
+    for (size_t i = 0; i < K; ++i) {
+        double rowSum = 0.0;
+        for (size_t j = 0; j < K; ++j) {
+            const double cell = cdf[i + 1][j + 1] - cdf[i][j + 1] - cdf[i + 1][j] + cdf[i][j];
+            matrix[i][j] = std::min(1.0, std::max(0.0, cell));
+            rowSum += matrix[i][j];
+        }
+        rowSum = std::max(rowSum, 1e-10);
+        for (size_t j = 0; j < K; ++j) matrix[i][j] /= rowSum;
+    }
+    return matrix;
+}
+
+/**
+ * Process-wide memo of auto-gamma transition matrices by (categories, rho), so sweeps that
+ * revisit a correlation - or only vary alpha - build each matrix once. Holds the
+ * MAX_MATRICES most recently built matrices.
+ */
+class AutoGammaMatrixCache {
+public:
+    static constexpr size_t MAX_MATRICES = 1024;
+
+    std::vector<std::vector<MDOUBLE>> get(MDOUBLE alpha, size_t categories, MDOUBLE rho, size_t numThreads = 1) {
+        const Key key(categories, rhoBits(rho));
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto it = _matrices.find(key);
+            if (it != _matrices.end()) {
+                if (!(alpha > 0.0)) throw std::invalid_argument("Alpha must be positive, got " + std::to_string(alpha));
+                return it->second;
+            }
+        }
+        std::vector<std::vector<MDOUBLE>> matrix = buildAutoGammaTransitionMatrix(alpha, categories, rho, numThreads);
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_matrices.emplace(key, matrix).second) {
+            _order.push_back(key);
+            if (_order.size() > MAX_MATRICES) {
+                _matrices.erase(_order.front());
+                _order.pop_front();
+            }
+        }
+        return matrix;
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _matrices.size();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _matrices.clear();
+        _order.clear();
+    }
+
+private:
+    using Key = std::pair<size_t, uint64_t>;
+
+    struct KeyHash {
+        size_t operator()(const Key &key) const {
+            return std::hash<uint64_t>()(key.second * 31 + key.first);
+        }
+    };
+
+    static uint64_t rhoBits(MDOUBLE rho) {
+        double value = rho + 0.0; // -0.0 and 0.0 are the same matrix
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    mutable std::mutex _mutex;
+    std::unordered_map<Key, std::vector<std::vector<MDOUBLE>>, KeyHash> _matrices;
+    std::deque<Key> _order; // oldest first
+};
+
+inline AutoGammaMatrixCache& autoGammaMatrixCache() {
+    static AutoGammaMatrixCache cache;
+    return cache;
+}
+
+/**
+ * The auto-gamma transition matrix of (alpha, categories, rho), from the process-wide memo.
+ */
+inline std::vector<std::vector<MDOUBLE>> autoGammaTransitionMatrix(MDOUBLE alpha, size_t categories, MDOUBLE rho,
+                                                                   size_t numThreads = 1) {
+    return autoGammaMatrixCache().get(alpha, categories, rho, numThreads);
+}
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef ___BATCH_SIMULATOR
+#define ___BATCH_SIMULATOR
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "Simulator.h"
+#include "ParallelFor.h"
+
+/**
+ * One alignment per tree for many trees (e.g. gene trees) under a single substitution
+ * model and indel process.
+ *
+ * Trees are simulated independently, numThreads at a time, each by its own Simulator with
+ * the seed streamSeed(seed, index), so every tree's alignment depends only on the seed and
+ * its position in the batch, not on the thread count. All trees share the model through
+ * the process-wide model cache: its process and eigensystem are built once and transition
+ * tables are shared between trees with equal branch lengths. Trees running at once would
+ * move the ledger's process-wide memory phase concurrently, so their phase scopes are
+ * ignored and their memory is attributed to the caller's phase.
+ */
+template<typename RngType = std::mt19937_64, size_t AlphabetSize = 4>
+class BatchSimulator
+{
+public:
+    BatchSimulator() : _sequenceSize(100), _minSequenceSize(0), _insertionRate(0.0), _deletionRate(0.0),
+        _insertionLengths(nullptr), _deletionLengths(nullptr), _seed(0), _numThreads(1), _saveAllNodes(false) {}
+
+    /**
+     * Substitution model of every tree (the tree of model is not used); without one, only
+     * indels are simulated.
+     */
+    void setModel(const modelFactory &model) {
+        if (!model.isModelValid()) {
+            throw std::invalid_argument("The substitution model is incomplete");
+        }
+        _model = std::make_unique<modelFactory>(model, nullptr);
+    }
+
+    void addTree(const std::string &newick) {
+        _newicks.push_back(newick);
+    }
+
+    /**
+     * Add every tree of a file of Newick trees, each terminated by ';'.
+     * @return the number of trees added
+     */
+    size_t addTreesFromFile(const std::string &filePath) {
+        std::ifstream in(filePath);
+        if (!in.is_open()) throw std::runtime_error("Could not open tree file " + filePath);
+        size_t added = 0;
+        std::string newick;
+        while (std::getline(in, newick, ';')) {
+            if (newick.find('(') == std::string::npos) continue; // whitespace after the last tree
+            _newicks.push_back(newick.substr(newick.find_first_not_of(" \t\r\n")) + ";");
+            ++added;
+        }
+        return added;
+    }
+
+    size_t numTrees() const { return _newicks.size(); }
+
+    void clearTrees() { _newicks.clear(); }
+
+    void setSequenceSize(size_t sequenceSize) { _sequenceSize = sequenceSize; }
+    void setMinSequenceSize(size_t minSequenceSize) { _minSequenceSize = minSequenceSize; }
+    void setInsertionRate(double rate) { _insertionRate = rate; }
+    void setDeletionRate(double rate) { _deletionRate = rate; }
+
+    // the distributions are shared by all trees and only read
+    void setInsertionLengthDistribution(DiscreteDistribution* lengths) { _insertionLengths = lengths; }
+    void setDeletionLengthDistribution(DiscreteDistribution* lengths) { _deletionLengths = lengths; }
+
+    void setSeed(size_t seed) { _seed = seed; }
+
+    /**
+     * Number of trees simulated at once (0 = one per hardware thread); each tree is
+     * simulated on a single thread.
+     */
+    void setNumThreads(size_t numThreads) { _numThreads = numThreads; }
+
+    // keep the sequences of internal nodes and the root as well as the leaves
+    void setSaveAllNodes(bool saveAllNodes) { _saveAllNodes = saveAllNodes; }
+
+    /**
+     * Alignment of the index-th tree; the same for a given seed however it is scheduled.
+     */
+    std::unique_ptr<MSA> simulateTree(size_t index) const {
+        if (index >= _newicks.size()) throw std::out_of_range("Tree index out of range: " + std::to_string(index));
+        const bool withIndels = _insertionRate > 0.0 || _deletionRate > 0.0;
+        if (withIndels && (_insertionLengths == nullptr || _deletionLengths == nullptr)) {
+            throw std::invalid_argument("Indel length distributions are required with non-zero indel rates");
+        }
+
+        tree phylotree(_newicks[index], false);
+        const size_t numBranches = phylotree.getNodesNum() - 1;
+        SimulationProtocol protocol(&phylotree);
+        protocol.setSequenceSize(_sequenceSize);
+        protocol.setMinSequenceSize(_minSequenceSize);
+        protocol.setInsertionRates(std::vector<double>(numBranches, _insertionRate));
+        protocol.setDeletionRates(std::vector<double>(numBranches, _deletionRate));
+        protocol.setInsertionLengthDistributions(std::vector<DiscreteDistribution*>(numBranches, _insertionLengths));
+        protocol.setDeletionLengthDistributions(std::vector<DiscreteDistribution*>(numBranches, _deletionLengths));
+        protocol.setSeed(streamSeed(_seed, index));
+
+        Simulator<RngType, AlphabetSize> simulator(&protocol);
+        if (_saveAllNodes) simulator.setSaveAllNodes();
+        const std::vector<bool> nodesToSave = simulator.getNodesSaveList();
+
+        std::unique_ptr<MSA> msa;
+        if (withIndels) {
+            BlockMap blocks = simulator.generateSimulation();
+            msa = std::make_unique<MSA>(blocks, phylotree.getRoot(), nodesToSave);
+        } else {
+            size_t numSequences = 0;
+            for (bool saved : nodesToSave) numSequences += saved;
+            msa = std::make_unique<MSA>(numSequences, _sequenceSize, nodesToSave);
+        }
+
+        if (_model) {
+            modelFactory model(*_model, &phylotree);
+            simulator.initSubstitionSim(model);
+            msa->fillSubstitutions(simulator.simulateSubstitutions(msa->getMSAlength(), "", msa->getRootPositionsInMsa()));
+        }
+        return msa;
+    }
+
+    /**
+     * Alignments of all trees, in the order the trees were added.
+     */
+    std::vector<std::unique_ptr<MSA>> simulate() const {
+        std::vector<std::unique_ptr<MSA>> msas(_newicks.size());
+        parallelFor(0, _newicks.size(), _numThreads, [&](size_t index) {
+            MemoryPhasesIgnored ignorePhases;
+            msas[index] = simulateTree(index);
+        });
+        return msas;
+    }
+
+    /**
+     * Write the alignment of every tree to pathPrefix + index + ".fasta" (".fasta.gz" with
+     * compress), each released once written, so memory holds at most numThreads alignments.
+     * @return the paths written, in tree order
+     */
+    std::vector<std::string> simulateToFiles(const std::string &pathPrefix, bool compress = false) const {
+        std::vector<std::string> paths(_newicks.size());
+        parallelFor(0, _newicks.size(), _numThreads, [&](size_t index) {
+            MemoryPhasesIgnored ignorePhases;
+            paths[index] = pathPrefix + std::to_string(index) + (compress ? ".fasta.gz" : ".fasta");
+            std::unique_ptr<MSA> msa = simulateTree(index);
+            if (!msa->makeRenderer().writeFile(paths[index], compress, 1)) {
+                throw std::runtime_error("Unable to open file " + paths[index]);
+            }
+        });
+        return paths;
+    }
+
+private:
+    std::vector<std::string> _newicks;
+    std::unique_ptr<modelFactory> _model;
+    size_t _sequenceSize;
+    size_t _minSequenceSize;
+    double _insertionRate;
+    double _deletionRate;
+    DiscreteDistribution* _insertionLengths;
+    DiscreteDistribution* _deletionLengths;
+    size_t _seed;
+    size_t _numThreads;
+    bool _saveAllNodes;
+};
+
+#endif
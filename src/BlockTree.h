@@ -4,10 +4,86 @@
 #include <memory>
 #include <unordered_map>
 #include <tuple>
+#include <utility>
 #include "AvlTree.h"
+#include "MemoryAccounting.h"
 
 
-typedef std::unordered_map<size_t, std::tuple<BlockList, size_t>> BlockMap;
+/**
+ * Block lists and sequence length of every branch, by node id. The map charges its own
+ * bytes to the memory ledger, so they are counted for as long as it holds the lists,
+ * wherever it is kept; branches stored with setBranch are charged as they are added.
+ */
+class BlockMap : public std::unordered_map<size_t, std::tuple<BlockList, size_t>> {
+public:
+  using Branches = std::unordered_map<size_t, std::tuple<BlockList, size_t>>;
+
+  BlockMap() : _charge(BLOCK_MAP_MEMORY), _listBytes(0) {}
+
+  BlockMap(const BlockMap &other) : Branches(other), _charge(BLOCK_MAP_MEMORY), _listBytes(0) {
+    recount();
+  }
+
+  BlockMap(BlockMap &&other) noexcept
+      : Branches(std::move(other)), _charge(BLOCK_MAP_MEMORY), _listBytes(other._listBytes) {
+    other.clear();
+    updateCharge();
+  }
+
+  BlockMap& operator=(const BlockMap &other) {
+    Branches::operator=(other);
+    recount();
+    return *this;
+  }
+
+  BlockMap& operator=(BlockMap &&other) noexcept {
+    Branches::operator=(std::move(other));
+    _listBytes = other._listBytes;
+    other.clear();
+    updateCharge();
+    return *this;
+  }
+
+  void setBranch(size_t nodeId, std::tuple<BlockList, size_t> branch) {
+    std::tuple<BlockList, size_t> &slot = (*this)[nodeId];
+    _listBytes -= listBytes(slot);
+    slot = std::move(branch);
+    _listBytes += listBytes(slot);
+    updateCharge();
+  }
+
+  // frees the lists and the buckets, releasing the charge
+  void clear() {
+    Branches().swap(*this);
+    _listBytes = 0;
+    updateCharge();
+  }
+
+  // block lists plus a hash node (value, link, cached hash) and bucket per branch; an
+  // empty map allocates nothing
+  size_t memoryUsage() const {
+    if (empty()) return 0;
+    return bucket_count() * sizeof(void*) + size() * (sizeof(value_type) + 2 * sizeof(void*)) + _listBytes;
+  }
+
+private:
+  static size_t listBytes(const std::tuple<BlockList, size_t> &branch) {
+    return std::get<0>(branch).capacity() * sizeof(BlockList::value_type);
+  }
+
+  void recount() {
+    _listBytes = 0;
+    for (const auto &branch : *this) _listBytes += listBytes(branch.second);
+    updateCharge();
+  }
+
+  void updateCharge() {
+    _charge.update(memoryUsage());
+  }
+
+  MemoryCharge _charge;
+  size_t _listBytes;
+};
 
 
 enum class BLOCK {
@@ -1,27 +1,84 @@
 #ifndef CACHED_TRANSITION_PROBABILITIES_H
 #define CACHED_TRANSITION_PROBABILITIES_H
 
+#include <list>
+#include <cmath>
+#include <memory>
 #include <vector>
+#include <limits>
+#include <cstdint>
+#include <stdexcept>
 #include <unordered_map>
 #include "../libs/Phylolib/includes/tree.h"
-#include "../libs/Phylolib/includes/DiscreteNDistribution.h"
 #include "../libs/Phylolib/includes/stochasticProcess.h"
+#include "MemoryAccounting.h"
+#include "ModelCache.h"
+#include "CdfTable.h"
+#include "ParallelFor.h"
 
+// Which resident table a full bounded cache drops to make room for a new one:
+// LRU_EVICTION  - the table least recently acquired
+// FIFO_EVICTION - the table built first
+enum tableEviction {
+    LRU_EVICTION,
+    FIFO_EVICTION
+};
+
+struct TransitionTableStats {
+    size_t hits = 0;          // acquisitions served by a resident table
+    size_t misses = 0;        // tables made resident, built or shared
+    size_t shared = 0;        // misses served by a table another simulator built (ModelCache)
+    size_t evictions = 0;     // tables dropped to stay within the capacity
+    size_t residentTables = 0;
+    size_t capacity = 0;      // 0 for unbounded
+    size_t uniqueLengths = 0; // branch lengths with their own tables
+    double errorBound = 0.0;  // total variation of the length quantization, 0 when exact
+};
+
+/**
+ * Transition distributions of every (branch, rate category, parent character), shared by the
+ * branches with the same length (to 1e-6), or with length quantization by the branches in
+ * the same cell of a log-spaced grid.
+ *
+ * Tables are built on first use, one CdfTable per (unique branch length, rate category)
+ * holding the rows of every parent character, so branches simulated by the Gillespie
+ * engine and categories no site draws never get one. With a capacity the resident tables
+ * are bounded and the eviction policy picks which one a new table replaces; an evicted table
+ * is rebuilt identically if needed again. Tables acquired by the branch being simulated are
+ * pinned until released, so the capacity is at least the number of categories.
+ *
+ * Tables are built by the SharedSubstitutionModel of the process: for time-reversible models
+ * from one eigendecomposition of the rate matrix, otherwise one Pij_t call per entry. An
+ * unbounded cache shares the tables it builds with every other simulator of the model, and
+ * any cache takes shared tables instead of building them; a bounded cache keeps the tables
+ * it builds to itself so that its capacity bounds their memory.
+ */
 template<size_t AlphabetSize>
 class CachedTransitionProbabilities {
 public:
-    CachedTransitionProbabilities(const tree& _tree, const stochasticProcess& _sp)
+    using Table = CdfTable<AlphabetSize>;
+    using Model = SharedSubstitutionModel<AlphabetSize>;
+
+    /**
+     * Tables of a process used by this cache alone.
+     */
+    CachedTransitionProbabilities(const tree& _tree, const stochasticProcess& _sp, size_t capacity = 0,
+                                  tableEviction eviction = LRU_EVICTION)
+        : CachedTransitionProbabilities(_tree, std::make_shared<Model>(std::make_shared<const stochasticProcess>(_sp)),
+                                        capacity, eviction) {}
+
+    /**
+     * Tables of a model shared through the ModelCache.
+     */
+    CachedTransitionProbabilities(const tree& _tree, std::shared_ptr<Model> model, size_t capacity = 0,
+                                  tableEviction eviction = LRU_EVICTION)
+        : _model(std::move(model)), _numCategories(_model->process().categories()), _capacity(0), _eviction(eviction)
     {
         const size_t numNodes = _tree.getNodesNum();
-        const size_t numCategories = _sp.categories();
-        
-        // Reserve mapping vector
         _nodeToUniqueIndex.resize(numNodes);
-        
-        // Map for deduplicating branch lengths
-        std::unordered_map<long, size_t> branchLengthToIndex;
-        
-        // Iterative tree traversal
+        _nodeLengths.resize(numNodes, 0.0);
+
+        // Iterative tree traversal; unique lengths are numbered in this order
         std::vector<tree::nodeP> nodesToProcess;
         nodesToProcess.push_back(_tree.getRoot());
         
@@ -31,46 +88,8 @@ public:
             
             // Process non-root nodes
             if (pos > 0) {
-                const MDOUBLE branchLength = currentNode->dis2father();
-                const int nodeID = currentNode->id();
-                const long key = static_cast<long>(branchLength * 1e6);
-                
-                // Check if this branch length already exists
-                auto it = branchLengthToIndex.find(key);
-                if (it == branchLengthToIndex.end()) {
-                    // New unique branch length - create distributions
-                    size_t newIndex = _distributions.size();
-                    branchLengthToIndex[key] = newIndex;
-                    
-                    std::vector<DiscreteNDistribution<AlphabetSize>> nodeDistributions;
-                    nodeDistributions.reserve(numCategories * AlphabetSize);
-                    
-                    for (size_t cat = 0; cat < numCategories; ++cat) {
-                        const MDOUBLE rate = _sp.rates(cat);
-                        
-                        for (size_t i = 0; i < AlphabetSize; ++i) {
-                            std::vector<double> probabilities;
-                            probabilities.reserve(AlphabetSize);
-                            MDOUBLE normalizingFactor = 0.0;
-                            
-                            for (size_t j = 0; j < AlphabetSize; ++j) {
-                                MDOUBLE prob = _sp.Pij_t(i, j, branchLength * rate);
-                                // std::cout << "(" << i << j << ")=" <<prob << "\n";
-
-                                normalizingFactor += prob;
-                                probabilities.push_back(prob);
-                            }
-                            
-                            nodeDistributions.emplace_back((probabilities));
-                        }
-                    }
-                    
-                    _distributions.push_back(std::move(nodeDistributions));
-                    _nodeToUniqueIndex[nodeID] = newIndex;
-                } else {
-                    // Reuse existing distributions
-                    _nodeToUniqueIndex[nodeID] = it->second;
-                }
+                _branchOrder.push_back(currentNode->id());
+                _nodeLengths[currentNode->id()] = currentNode->dis2father();
             }
             
             // Add children to queue
@@ -79,24 +98,402 @@ public:
             }
             ++pos;
         }
+
+        for (size_t cat = 0; cat < _numCategories; ++cat) _categoryRates.push_back(_model->process().rates(cat));
+        mapExactLengths();
+        setCapacity(capacity);
     }
-    
-    DiscreteNDistribution<AlphabetSize>& getDistribution(int nodeID, int category, int character)  {
-        size_t uniqueIndex = _nodeToUniqueIndex[nodeID];
-        size_t distributionIndex = category * AlphabetSize + character;
 
-        return _distributions[uniqueIndex][distributionIndex];
+    /**
+     * Share tables between branches of nearby lengths: lengths are snapped to a log-spaced
+     * grid whose ratio keeps the total-variation distance between every row of a branch's
+     * transition matrices and the snapped ones within maxTotalVariation, for every rate
+     * category. 0 restores exact lengths (to 1e-6). Drops every table, so it must be called
+     * between simulations, with no table acquired.
+     */
+    void setLengthQuantization(double maxTotalVariation) {
+        if (maxTotalVariation < 0.0) throw std::invalid_argument("maxTotalVariation must be non-negative");
+        _maxTotalVariation = maxTotalVariation;
+        if (maxTotalVariation == 0.0) {
+            mapExactLengths();
+        } else {
+            mapQuantizedLengths();
+        }
+        account();
     }
 
+    double lengthQuantization() const { return _maxTotalVariation; }
+
+    /**
+     * Largest total-variation distance, over the rows and rate categories, between the
+     * transition matrices of a branch and the ones of the length it shares (0 when exact),
+     * measured at the shortest and longest branch of every grid cell.
+     */
+    double quantizationErrorBound() const { return _errorBound; }
 
+    /**
+     * Bound the resident tables (0 = unbounded), evicting tables that no longer fit.
+     */
+    void setCapacity(size_t capacity) {
+        _capacity = capacity == 0 ? 0 : std::max(capacity, _numCategories);
+        while (_capacity > 0 && residentTables() > _capacity && evictOne()) {}
+        account();
+    }
+
+    void setEvictionPolicy(tableEviction eviction) { _eviction = eviction; }
+    tableEviction evictionPolicy() const { return _eviction; }
 
-    size_t getNumUniqueBranches() {return _distributions.size();}
+    /**
+     * The table of node's branch under category, built if not resident and pinned until
+     * release(nodeID, category).
+     */
+    const Table* acquire(int nodeID, int category) {
+        const size_t key = keyOf(nodeID, category);
+        int64_t slot = _slotOfKey[key];
+        if (slot != NO_SLOT) {
+            ++_stats.hits;
+            if (_eviction == LRU_EVICTION) _order.splice(_order.end(), _order, _slots[slot].order);
+        } else {
+            ++_stats.misses;
+            slot = buildTable(key);
+        }
+        ++_slots[slot].pins;
+        return _slots[slot].table.get();
+    }
+
+    void release(int nodeID, int category) {
+        --_slots[_slotOfKey[keyOf(nodeID, category)]].pins;
+    }
+
+    /**
+     * Cumulative row of one parent character, valid until the next table is built.
+     */
+    const float* getCdf(int nodeID, int category, int character) {
+        const Table *table = acquire(nodeID, category);
+        release(nodeID, category);
+        return table->row(character);
+    }
+
+    /**
+     * Build the tables of every category of the given nodes' branches ahead of the simulation,
+     * in parallel over unique branch lengths. Only for unbounded caches; the tables are the
+     * same as the ones built on demand.
+     */
+    void prebuild(const std::vector<size_t> &nodeIDs, size_t numThreads) {
+        if (_capacity != 0) return;
+        std::vector<size_t> uniqueIndices;
+        std::vector<bool> listed(_uniqueBranchLengths.size(), false);
+        for (size_t nodeID : nodeIDs) {
+            const size_t uniqueIndex = _nodeToUniqueIndex[nodeID];
+            if (listed[uniqueIndex]) continue;
+            listed[uniqueIndex] = true;
+            for (size_t cat = 0; cat < _numCategories; ++cat) {
+                if (_slotOfKey[uniqueIndex * _numCategories + cat] == NO_SLOT) {
+                    uniqueIndices.push_back(uniqueIndex);
+                    break;
+                }
+            }
+        }
+        std::vector<std::shared_ptr<const Table>> found(uniqueIndices.size() * _numCategories);
+        std::vector<std::unique_ptr<Table>> built(uniqueIndices.size() * _numCategories);
+        parallelFor(0, uniqueIndices.size(), numThreads, [&](size_t index) {
+            for (size_t cat = 0; cat < _numCategories; ++cat) {
+                const size_t key = uniqueIndices[index] * _numCategories + cat;
+                if (_slotOfKey[key] != NO_SLOT) continue;
+                found[index * _numCategories + cat] = _model->findTable(timeOf(key));
+                if (!found[index * _numCategories + cat]) built[index * _numCategories + cat] = _model->makeTable(timeOf(key));
+            }
+        });
+        for (size_t index = 0; index < uniqueIndices.size(); ++index) {
+            for (size_t cat = 0; cat < _numCategories; ++cat) {
+                const size_t key = uniqueIndices[index] * _numCategories + cat;
+                if (_slotOfKey[key] != NO_SLOT) continue;
+                ++_stats.misses;
+                if (found[index * _numCategories + cat]) {
+                    ++_stats.shared;
+                    placeTable(key, std::move(found[index * _numCategories + cat]), true);
+                } else {
+                    placeTable(key, _model->shareTable(timeOf(key), std::move(built[index * _numCategories + cat])), true);
+                }
+            }
+        }
+        account();
+    }
+
+    size_t getNumUniqueBranches() const {return _uniqueBranchLengths.size();}
+
+    size_t numCategories() const { return _numCategories; }
+
+    size_t residentTables() const { return _slots.size() - _freeSlots.size(); }
+
+    TransitionTableStats stats() const {
+        TransitionTableStats result = _stats;
+        result.residentTables = residentTables();
+        result.capacity = _capacity;
+        result.uniqueLengths = _uniqueBranchLengths.size();
+        result.errorBound = _errorBound;
+        return result;
+    }
+
+    void resetStats() { _stats = TransitionTableStats(); }
+
+    // true if the tables are computed from the eigendecomposition of the rate matrix
+    bool usesEigenDecomposition() const { return _model->usesEigenDecomposition(); }
+
+    const std::shared_ptr<Model>& model() const { return _model; }
+
+    size_t memoryUsage() const {
+        size_t bytes = _nodeToUniqueIndex.capacity() * sizeof(size_t) + _branchOrder.capacity() * sizeof(int)
+                       + _nodeLengths.capacity() * sizeof(MDOUBLE)
+                       + _uniqueBranchLengths.capacity() * sizeof(MDOUBLE)
+                       + _slotOfKey.capacity() * sizeof(int64_t)
+                       + _slots.capacity() * sizeof(TableSlot) + _order.size() * 3 * sizeof(void*);
+        return bytes + _tableBytes;
+    }
+
+    /**
+     * memoryUsage once the tables of the given nodes' branches are built, within the capacity.
+     */
+    size_t projectedMemoryUsage(const std::vector<size_t> &nodeIDs) const {
+        std::vector<bool> listed(_uniqueBranchLengths.size(), false);
+        size_t numTables = 0;
+        for (size_t nodeID : nodeIDs) {
+            if (listed[_nodeToUniqueIndex[nodeID]]) continue;
+            listed[_nodeToUniqueIndex[nodeID]] = true;
+            numTables += _numCategories;
+        }
+        if (_capacity > 0) numTables = std::min(numTables, _capacity);
+        const size_t tableBytes = sizeof(Table) + sizeof(TableSlot) + 3 * sizeof(void*);
+        return memoryUsage() - _tableBytes + numTables * tableBytes;
+    }
 
 private:
-    // std::vector<std::vector<DiscreteNDistribution<20>>> _distributionsAmino;
-    std::vector<std::vector<DiscreteNDistribution<AlphabetSize>>> _distributions;
+    static constexpr int64_t NO_SLOT = -1;
+    static constexpr long NON_POSITIVE_KEY = std::numeric_limits<long>::min() / 2;
+
+    struct TableSlot {
+        std::shared_ptr<const Table> table;
+        bool shared = false; // shared through the model, which charges its memory
+        size_t key;
+        uint32_t pins = 0;
+        std::list<size_t>::iterator order;
+    };
+
+    size_t keyOf(int nodeID, int category) const {
+        return _nodeToUniqueIndex[nodeID] * _numCategories + static_cast<size_t>(category);
+    }
+
+    MDOUBLE timeOf(size_t key) const {
+        return _uniqueBranchLengths[key / _numCategories] * _categoryRates[key % _numCategories];
+    }
+
+    int64_t buildTable(size_t key) {
+        while (_capacity > 0 && residentTables() >= _capacity && evictOne()) {}
+        int64_t slot;
+        if (auto found = _model->findTable(timeOf(key))) {
+            ++_stats.shared;
+            slot = placeTable(key, std::move(found), true);
+        } else if (_capacity == 0) {
+            slot = placeTable(key, _model->shareTable(timeOf(key), _model->makeTable(timeOf(key))), true);
+        } else {
+            slot = placeTable(key, _model->makeTable(timeOf(key)), false);
+        }
+        account();
+        return slot;
+    }
+
+    int64_t placeTable(size_t key, std::shared_ptr<const Table> built, bool shared) {
+        int64_t slot;
+        if (_freeSlots.empty()) {
+            slot = static_cast<int64_t>(_slots.size());
+            _slots.emplace_back();
+        } else {
+            slot = _freeSlots.back();
+            _freeSlots.pop_back();
+        }
+        TableSlot &table = _slots[slot];
+        table.table = std::move(built);
+        table.shared = shared;
+        if (!shared) _tableBytes += sizeof(Table);
+        table.key = key;
+        table.pins = 0;
+        table.order = _order.insert(_order.end(), static_cast<size_t>(slot));
+        _slotOfKey[key] = slot;
+        return slot;
+    }
+
+    // drop the first unpinned table in eviction order; false if every table is pinned
+    bool evictOne() {
+        for (auto it = _order.begin(); it != _order.end(); ++it) {
+            TableSlot &table = _slots[*it];
+            if (table.pins > 0) continue;
+            _slotOfKey[table.key] = NO_SLOT;
+            if (!table.shared) _tableBytes -= sizeof(Table);
+            table.table.reset();
+            _freeSlots.push_back(*it);
+            _order.erase(it);
+            ++_stats.evictions;
+            return true;
+        }
+        return false;
+    }
+
+
+    void account() { _charge.update(memoryUsage()); }
+
+    // drop every table and give each branch the unique length of its key
+    template<typename KeyOf, typename LengthOf>
+    void mapLengths(KeyOf keyOf, LengthOf lengthOf) {
+        std::unordered_map<long, size_t> keyToIndex;
+        _uniqueBranchLengths.clear();
+        for (int nodeID : _branchOrder) {
+            const long key = keyOf(_nodeLengths[nodeID]);
+            auto it = keyToIndex.find(key);
+            if (it == keyToIndex.end()) {
+                // New unique branch length, its tables are built on first use
+                keyToIndex[key] = _uniqueBranchLengths.size();
+                _nodeToUniqueIndex[nodeID] = _uniqueBranchLengths.size();
+                _uniqueBranchLengths.push_back(lengthOf(key, _nodeLengths[nodeID]));
+            } else {
+                // Reuse existing distributions
+                _nodeToUniqueIndex[nodeID] = it->second;
+            }
+        }
+        _slots.clear();
+        _freeSlots.clear();
+        _order.clear();
+        _tableBytes = 0;
+        _slotOfKey.assign(_uniqueBranchLengths.size() * _numCategories, NO_SLOT);
+    }
+
+    void mapExactLengths() {
+        mapLengths([](MDOUBLE length) { return static_cast<long>(length * 1e6); },
+                   [](long, MDOUBLE length) { return length; });
+        _errorBound = 0.0;
+    }
 
+    void mapQuantizedLengths() {
+        MDOUBLE shortest = 0.0, longest = 0.0;
+        for (int nodeID : _branchOrder) {
+            const MDOUBLE length = _nodeLengths[nodeID];
+            if (length <= 0.0) continue;
+            shortest = shortest == 0.0 ? length : std::min(shortest, length);
+            longest = std::max(longest, length);
+        }
+        double fastest = 0.0, slowest = 0.0;
+        for (MDOUBLE rate : _categoryRates) {
+            if (rate <= 0.0) continue;
+            slowest = slowest == 0.0 ? rate : std::min(slowest, rate);
+            fastest = std::max(fastest, rate);
+        }
+        if (shortest == 0.0 || fastest == 0.0) {
+            mapExactLengths();
+            return;
+        }
+
+        // widest log step whose half keeps the probed times within the bound, then narrowed
+        // until the realized error is also within it
+        const double minTime = shortest * slowest, maxTime = longest * fastest;
+        double low = 0.0, high = std::log(maxTime / minTime) + 1.0;
+        if (probedError(high, minTime, maxTime) > _maxTotalVariation) {
+            for (int iteration = 0; iteration < 40; ++iteration) {
+                const double middle = 0.5 * (low + high);
+                if (probedError(middle, minTime, maxTime) <= _maxTotalVariation) low = middle;
+                else high = middle;
+            }
+            high = low;
+        }
+        double step = high;
+        const double origin = std::log(shortest);
+        for (int attempt = 0; attempt < 20; ++attempt) {
+            if (!(step > 0.0) || std::log(longest / shortest) / step > 1e12) break;
+            // non-positive lengths keep their exact keys, below every grid cell
+            mapLengths([&](MDOUBLE length) {
+                           return length <= 0.0 ? NON_POSITIVE_KEY - static_cast<long>(-length * 1e6)
+                                                : std::lround((std::log(length) - origin) / step);
+                       },
+                       [&](long key, MDOUBLE length) {
+                           return length <= 0.0 ? length : std::exp(origin + key * step);
+                       });
+            _errorBound = realizedError();
+            if (_errorBound <= _maxTotalVariation) return;
+            step *= 0.5;
+        }
+        // a bound too tight for any grid
+        mapExactLengths();
+    }
+
+    // largest total-variation distance between corresponding rows of P(first) and P(second)
+    double totalVariation(MDOUBLE first, MDOUBLE second) const {
+        std::vector<double> a(AlphabetSize * AlphabetSize), b(AlphabetSize * AlphabetSize);
+        _model->transitionMatrix(first, a.data());
+        _model->transitionMatrix(second, b.data());
+        double worst = 0.0;
+        for (size_t i = 0; i < AlphabetSize; ++i) {
+            double distance = 0.0;
+            for (size_t j = 0; j < AlphabetSize; ++j) distance += std::abs(a[i * AlphabetSize + j] - b[i * AlphabetSize + j]);
+            worst = std::max(worst, 0.5 * distance);
+        }
+        return worst;
+    }
+
+    // error of snapping by half a log step, at times spread log-uniformly over the tree
+    double probedError(double step, double minTime, double maxTime) const {
+        const size_t PROBES = 48;
+        double worst = 0.0;
+        for (size_t k = 0; k < PROBES; ++k) {
+            const double time = minTime * std::pow(maxTime / minTime, k / double(PROBES - 1));
+            worst = std::max(worst, totalVariation(time, time * std::exp(0.5 * step)));
+            worst = std::max(worst, totalVariation(time, time * std::exp(-0.5 * step)));
+        }
+        return worst;
+    }
+
+    // error at the shortest and longest branch sharing each unique length
+    double realizedError() const {
+        const size_t numUnique = _uniqueBranchLengths.size();
+        std::vector<MDOUBLE> shortest(numUnique, 0.0), longest(numUnique, 0.0);
+        std::vector<bool> seen(numUnique, false);
+        for (int nodeID : _branchOrder) {
+            const size_t index = _nodeToUniqueIndex[nodeID];
+            const MDOUBLE length = _nodeLengths[nodeID];
+            shortest[index] = seen[index] ? std::min(shortest[index], length) : length;
+            longest[index] = seen[index] ? std::max(longest[index], length) : length;
+            seen[index] = true;
+        }
+        double worst = 0.0;
+        for (size_t index = 0; index < numUnique; ++index) {
+            const MDOUBLE shared = _uniqueBranchLengths[index];
+            if (shortest[index] == shared && longest[index] == shared) continue;
+            for (MDOUBLE rate : _categoryRates) {
+                if (rate <= 0.0) continue;
+                worst = std::max(worst, totalVariation(shortest[index] * rate, shared * rate));
+                worst = std::max(worst, totalVariation(longest[index] * rate, shared * rate));
+            }
+        }
+        return worst;
+    }
+
+    std::shared_ptr<Model> _model;
+    size_t _numCategories;
+    std::vector<MDOUBLE> _categoryRates;
+    std::vector<MDOUBLE> _uniqueBranchLengths;
     std::vector<size_t> _nodeToUniqueIndex;
+    std::vector<int> _branchOrder;       // non-root node ids, breadth first
+    std::vector<MDOUBLE> _nodeLengths;   // branch length of every node
+    double _maxTotalVariation = 0.0;
+    double _errorBound = 0.0;
+
+    std::vector<int64_t> _slotOfKey; // (unique branch, category) -> slot
+    std::vector<TableSlot> _slots;
+    std::vector<int64_t> _freeSlots;
+    std::list<size_t> _order;        // eviction order, next victim first
+    size_t _tableBytes = 0;
+    size_t _capacity;
+    tableEviction _eviction;
+    TransitionTableStats _stats;
+
+    MemoryCharge _charge{TRANSITION_TABLES_MEMORY};
 };
 
 #endif // CACHED_TRANSITION_PROBABILITIES_H
\ No newline at end of file
@@ -2,9 +2,13 @@
 #define ___CATEGORY_SAMPLER
 
 #include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
 #include "../libs/Phylolib/includes/definitions.h"
 #include "../libs/Phylolib/includes/errorMsg.h"
-#include "../libs/Phylolib/includes/DiscreteDistribution.h"
+#include "AliasTable.h"
+#include "ParallelFor.h"
 
 /**
  * CategorySampler handles sampling rate categories with Markov chain autocorrelation.
@@ -13,6 +17,10 @@
  * The stationary distribution is used only for sampling the initial category.
  * 
  * Compatible with Yang (1995) auto-discrete-gamma model and extensions like G+I with autocorrelation.
+ *
+ * All distributions are alias tables built once in the constructor. When every row of the
+ * transition matrix equals the stationary distribution the categories are independent and
+ * draws skip the chain entirely.
  */
 class CategorySampler {
 public:
@@ -23,7 +31,7 @@ public:
      */
     CategorySampler(const std::vector<std::vector<MDOUBLE>>& transitionMatrix,
                    const std::vector<MDOUBLE>& stationaryProbs)
-        : _stationaryProbs(stationaryProbs), _previousCategory(-1) {
+        : _stationaryProbs(stationaryProbs), _previousCategory(-1), _independent(true), _bridgePowersUnavailable(false) {
         
         // Validate inputs
         if (stationaryProbs.empty()) {
@@ -71,7 +79,12 @@ public:
             errorMsg::reportError("CategorySampler: stationary probabilities must sum to 1");
         }
         
+        if (numCategories > 256) {
+            errorMsg::reportError("CategorySampler: at most 256 rate categories are supported");
+        }
+
         // Build transition samplers from provided matrix
+        _initialSampler = AliasTable(_stationaryProbs);
         buildTransitionSamplers(transitionMatrix);
     }
     
@@ -81,16 +94,130 @@ public:
      */
     template<typename RngType = std::mt19937_64>
     int drawSample(RngType &rng) {
-        if (_previousCategory < 0) {
-            DiscreteDistribution initialSampler(_stationaryProbs);
-            _previousCategory = initialSampler.drawSample(rng) - 1;
+        if (_previousCategory < 0 || _independent) {
+            _previousCategory = static_cast<int>(_initialSampler.drawSample(rng));
             return _previousCategory;
         }
         
-        int nextCategory = _transitionSamplers[_previousCategory].drawSample(rng) - 1;
+        int nextCategory = static_cast<int>(_transitionSamplers[_previousCategory].drawSample(rng));
         _previousCategory = nextCategory;
         return nextCategory;
     }
+
+    /**
+     * Sample the next n categories of the chain in one call.
+     * Equivalent in distribution to n calls of drawSample.
+     * @param n - number of categories to draw
+     * @param out - resized to n and filled with category indices
+     */
+    template<typename RngType = std::mt19937_64>
+    void drawSamples(size_t n, std::vector<uint8_t> &out, RngType &rng) {
+        out.resize(n);
+        if (n == 0) return;
+
+        if (_independent) {
+            _initialSampler.drawSamples(out.data(), n, rng);
+            _previousCategory = out[n - 1];
+            return;
+        }
+
+        uint8_t state = (_previousCategory < 0)
+            ? static_cast<uint8_t>(_initialSampler.drawSample(rng))
+            : static_cast<uint8_t>(_transitionSamplers[_previousCategory].drawSample(rng));
+        out[0] = state;
+        _previousCategory = fillChain(out.data() + 1, n - 1, state, rng);
+    }
+
+    /**
+     * Parallel drawSamples: exact for correlated categories, not an approximation.
+     *
+     * Sites are cut into chunks of BRIDGE_CHUNK_LENGTH. The states at the chunk starts are drawn
+     * sequentially (they form a chain with transition matrix P^m, m = chunk length), then every
+     * chunk is filled in parallel conditioned on the states at both of its ends (bridge sampling):
+     *     P(x_s = y | x_{s-1} = x, x_end = b)  proportional to  P[x][y] * P^d[y][b],
+     * where d is the distance from s to the chunk end. Once P^d has converged to its limit the end
+     * state carries no information and the plain transition rows are used.
+     * Every chunk draws from its own generator seeded from a single draw of rng, so the output for
+     * a given seed does not depend on the number of threads: one thread fills the same chunks in
+     * order. Falls back to the serial drawSamples when the sequence is shorter than two chunks or
+     * P converges too slowly for its powers to be tabulated.
+     * @param numThreads - worker threads, 0 for one per hardware thread
+     */
+    template<typename RngType = std::mt19937_64>
+    void drawSamples(size_t n, std::vector<uint8_t> &out, RngType &rng, size_t numThreads) {
+        const size_t numChunks = (n + BRIDGE_CHUNK_LENGTH - 1) / BRIDGE_CHUNK_LENGTH;
+        if (numChunks < 2 || (!_independent && !ensureBridgePowers())) {
+            drawSamples(n, out, rng);
+            return;
+        }
+
+        out.resize(n);
+        const uint64_t baseSeed = static_cast<uint64_t>(rng());
+
+        if (_independent) {
+            parallelFor(0, numChunks, numThreads, [&](size_t chunk) {
+                RngType chunkRng(streamSeed(baseSeed, chunk));
+                const size_t chunkBegin = chunk * BRIDGE_CHUNK_LENGTH;
+                const size_t chunkEnd = std::min(n, chunkBegin + BRIDGE_CHUNK_LENGTH);
+                _initialSampler.drawSamples(out.data() + chunkBegin, chunkEnd - chunkBegin, chunkRng);
+            });
+            _previousCategory = out[n - 1];
+            return;
+        }
+
+        const size_t numCategories = _transitionSamplers.size();
+        std::uniform_real_distribution<MDOUBLE> uniform(0.0, 1.0);
+
+        // chunk start states: a chain with transition matrix P^m
+        const MDOUBLE *chunkPower = bridgePower(BRIDGE_CHUNK_LENGTH);
+        std::vector<uint8_t> chunkStart(numChunks);
+        chunkStart[0] = (_previousCategory < 0)
+            ? static_cast<uint8_t>(_initialSampler.drawSample(rng))
+            : static_cast<uint8_t>(_transitionSamplers[_previousCategory].drawSample(rng));
+        for (size_t chunk = 1; chunk < numChunks; ++chunk) {
+            const MDOUBLE *row = chunkPower + chunkStart[chunk - 1] * numCategories;
+            chunkStart[chunk] = static_cast<uint8_t>(drawFromWeights(row, numCategories, uniform(rng)));
+        }
+
+        parallelFor(0, numChunks, numThreads, [&](size_t chunk) {
+            RngType chunkRng(streamSeed(baseSeed, chunk));
+            std::uniform_real_distribution<MDOUBLE> chunkUniform(0.0, 1.0);
+            const size_t chunkBegin = chunk * BRIDGE_CHUNK_LENGTH;
+            uint8_t *output = out.data() + chunkBegin;
+            uint8_t state = chunkStart[chunk];
+            output[0] = state;
+
+            if (chunk + 1 == numChunks) {
+                fillChain(output + 1, n - chunkBegin - 1, state, chunkRng);
+                return;
+            }
+
+            // far from the end the bridge weights are flat, so the chain runs unconditioned
+            const size_t converged = _bridgePowers.size() - 1;
+            const size_t freeSteps = (BRIDGE_CHUNK_LENGTH - 1 > converged) ? BRIDGE_CHUNK_LENGTH - converged : 1;
+            state = fillChain(output + 1, freeSteps - 1, state, chunkRng);
+
+            const uint8_t endState = chunkStart[chunk + 1];
+            std::vector<MDOUBLE> weights(numCategories);
+            for (size_t site = freeSteps; site < BRIDGE_CHUNK_LENGTH; ++site) {
+                const MDOUBLE *transitionRow = _transitionMatrix.data() + state * numCategories;
+                const MDOUBLE *power = bridgePower(BRIDGE_CHUNK_LENGTH - site);
+                MDOUBLE total = 0.0;
+                for (size_t next = 0; next < numCategories; ++next) {
+                    weights[next] = transitionRow[next] * power[next * numCategories + endState];
+                    total += weights[next];
+                }
+                state = static_cast<uint8_t>(drawFromWeights(weights.data(), numCategories,
+                                                             chunkUniform(chunkRng) * total));
+                output[site] = state;
+            }
+        });
+        _previousCategory = out[n - 1];
+    }
+
+    bool isIndependent() const {
+        return _independent;
+    }
     
     /**
      * Reset to sample from stationary distribution (for new sequences)
@@ -102,6 +229,105 @@ public:
     }
 
 private:
+    static constexpr size_t BRIDGE_CHUNK_LENGTH = size_t(1) << 15;
+    static constexpr size_t BRIDGE_MAX_POWER_ENTRIES = size_t(1) << 22;
+
+    /**
+     * Fill output[0..count) with successors of state along the chain, return the last state.
+     */
+    template<typename RngType>
+    uint8_t fillChain(uint8_t *output, size_t count, uint8_t state, RngType &rng) const {
+        // row table pointers are held in locals: stores through uint8_t may alias the members
+        const size_t numCategories = _transitionSamplers.size();
+        std::vector<const uint64_t*> thresholds(numCategories);
+        std::vector<const uint32_t*> aliases(numCategories);
+        for (size_t i = 0; i < numCategories; ++i) {
+            thresholds[i] = _transitionSamplers[i].fixedThresholds();
+            aliases[i] = _transitionSamplers[i].aliases();
+        }
+        const uint64_t columns = numCategories;
+        const uint64_t *const *rowThresholds = thresholds.data();
+        const uint32_t *const *rowAliases = aliases.data();
+
+        for (size_t i = 0; i < count; ++i) {
+            if constexpr (AliasTable::isFullRange64<RngType>()) {
+                state = static_cast<uint8_t>(AliasTable::drawFromBits(rng(), columns,
+                                                                      rowThresholds[state], rowAliases[state]));
+            } else {
+                state = static_cast<uint8_t>(_transitionSamplers[state].drawSample(rng));
+            }
+            output[i] = state;
+        }
+        return state;
+    }
+
+    /**
+     * Tabulate P^0, P^1, ... until the rows of P^d agree (then P^d is the limit for every larger d)
+     * or until BRIDGE_CHUNK_LENGTH, the largest distance a bridge needs.
+     * @return false if the table would exceed BRIDGE_MAX_POWER_ENTRIES
+     */
+    bool ensureBridgePowers() {
+        if (!_bridgePowers.empty()) return true;
+        if (_bridgePowersUnavailable) return false;
+
+        const size_t numCategories = _transitionSamplers.size();
+        const size_t matrixSize = numCategories * numCategories;
+        std::vector<std::vector<MDOUBLE>> powers;
+        std::vector<MDOUBLE> identity(matrixSize, 0.0);
+        for (size_t i = 0; i < numCategories; ++i) identity[i * numCategories + i] = 1.0;
+        powers.push_back(std::move(identity));
+
+        while (powers.size() <= BRIDGE_CHUNK_LENGTH) {
+            if ((powers.size() + 1) * matrixSize > BRIDGE_MAX_POWER_ENTRIES) {
+                _bridgePowersUnavailable = true;
+                return false;
+            }
+            const std::vector<MDOUBLE> &previous = powers.back();
+            std::vector<MDOUBLE> next(matrixSize, 0.0);
+            for (size_t i = 0; i < numCategories; ++i) {
+                for (size_t k = 0; k < numCategories; ++k) {
+                    const MDOUBLE pik = previous[i * numCategories + k];
+                    if (pik == 0.0) continue;
+                    for (size_t j = 0; j < numCategories; ++j) {
+                        next[i * numCategories + j] += pik * _transitionMatrix[k * numCategories + j];
+                    }
+                }
+            }
+            powers.push_back(std::move(next));
+
+            MDOUBLE spread = 0.0;
+            const std::vector<MDOUBLE> &latest = powers.back();
+            for (size_t j = 0; j < numCategories; ++j) {
+                MDOUBLE lowest = latest[j], highest = latest[j];
+                for (size_t i = 1; i < numCategories; ++i) {
+                    lowest = std::min(lowest, latest[i * numCategories + j]);
+                    highest = std::max(highest, latest[i * numCategories + j]);
+                }
+                spread = std::max(spread, highest - lowest);
+            }
+            if (spread < 1e-13) break;
+        }
+        _bridgePowers = std::move(powers);
+        return true;
+    }
+
+    // inverse-CDF draw; rounding past the end lands on the last index with positive weight
+    static size_t drawFromWeights(const MDOUBLE *weights, size_t count, MDOUBLE threshold) {
+        size_t lastPositive = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (weights[i] <= 0.0) continue;
+            if (threshold < weights[i]) return i;
+            threshold -= weights[i];
+            lastPositive = i;
+        }
+        return lastPositive;
+    }
+
+    // P^distance, clamped to the last tabulated power
+    const MDOUBLE *bridgePower(size_t distance) const {
+        return _bridgePowers[std::min(distance, _bridgePowers.size() - 1)].data();
+    }
+
     void buildTransitionSamplers(const std::vector<std::vector<MDOUBLE>>& transitionMatrix) {
         size_t numCategories = transitionMatrix.size();
         _transitionSamplers.clear();
@@ -109,12 +335,21 @@ private:
         
         for (size_t i = 0; i < numCategories; ++i) {
             _transitionSamplers.emplace_back(transitionMatrix[i]);
+            _transitionMatrix.insert(_transitionMatrix.end(), transitionMatrix[i].begin(), transitionMatrix[i].end());
+            for (size_t j = 0; j < numCategories; ++j) {
+                if (std::abs(transitionMatrix[i][j] - _stationaryProbs[j]) > 1e-12) _independent = false;
+            }
         }
     }
     
     std::vector<MDOUBLE> _stationaryProbs;
     int _previousCategory;
-    std::vector<DiscreteDistribution> _transitionSamplers;
+    bool _independent;
+    AliasTable _initialSampler;
+    std::vector<AliasTable> _transitionSamplers;
+    std::vector<MDOUBLE> _transitionMatrix; // row-major P
+    std::vector<std::vector<MDOUBLE>> _bridgePowers; // P^0 .. P^K, K = convergence or chunk length
+    bool _bridgePowersUnavailable;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,54 @@
+#ifndef ___CDF_TABLE
+#define ___CDF_TABLE
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include "AliasTable.h"
+
+/**
+ * Transition distributions of every parent character for one branch length and rate
+ * category, as one flat, cache-line aligned block of float32 cumulative thresholds laid out
+ * [parent][child]: the row of a parent is AlphabetSize consecutive floats, so a site reads
+ * a single row from a base pointer it already holds.
+ *
+ * A draw takes the top 24 bits of one 64-bit generator output as u in [0,1) and counts the
+ * thresholds at or below u, which is branch-free and vectorizes over the row. Thresholds are
+ * rounded to float32, so each probability is exact to about 2^-24; a zero probability stays
+ * exactly zero. Draws return 0-based characters.
+ */
+template<size_t AlphabetSize>
+struct alignas(64) CdfTable {
+    static_assert(AlphabetSize > 0 && AlphabetSize <= 256, "CdfTable characters must fit in uint8_t");
+    static constexpr size_t N = AlphabetSize;
+
+    std::array<float, N * N> cdf;
+
+    const float* row(size_t parent) const { return cdf.data() + parent * N; }
+
+    /**
+     * Set the row of parent from non-negative probabilities, normalized here.
+     */
+    void setRow(size_t parent, const double *probabilities) {
+        double total = 0.0;
+        for (size_t j = 0; j < N; ++j) total += probabilities[j];
+        float *out = cdf.data() + parent * N;
+        double cumulative = 0.0;
+        for (size_t j = 0; j + 1 < N; ++j) {
+            cumulative += probabilities[j];
+            out[j] = static_cast<float>(cumulative / total);
+        }
+        out[N - 1] = 1.0f;
+    }
+
+    template<typename RngType>
+    static uint8_t drawFromRow(const float *row, RngType &rng) {
+        static_assert(AliasTable::isFullRange64<RngType>(), "CdfTable requires a full-range 64-bit generator");
+        const float u = static_cast<float>(rng() >> 40) * (1.0f / 16777216.0f);
+        uint32_t character = 0;
+        for (size_t j = 0; j + 1 < N; ++j) character += (u >= row[j]);
+        return static_cast<uint8_t>(character);
+    }
+};
+
+#endif
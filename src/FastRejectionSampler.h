@@ -1,15 +1,30 @@
-#include <vector>
-#include <unordered_map>
+#ifndef ___FAST_REJECTION_SAMPLER
+#define ___FAST_REJECTION_SAMPLER
 
+#include <vector>
+#include <cstdint>
+#include <cstring>
 #include <cmath>
 #include <random>
 #include <algorithm>
-
-#include <iostream>
-
+#include <stdexcept>
+
+/**
+ * Dynamic discrete sampler: draws index i with probability w_i / sum(w), with O(1) weight updates.
+ *
+ * Weights are grouped into levels by their binary exponent, so that every weight in level e lies in
+ * [2^e, 2^(e+1)). A draw picks a level proportionally to its total weight (linear scan over the few
+ * levels spanned by [minWeight, maxWeight]) and then an item of that level uniformly, accepting it with
+ * probability w_i / 2^(e+1) >= 1/2. Levels are flat index arrays; every item remembers its level and its
+ * slot in that level, so moving an item between levels is a swap-with-last plus a push_back. The arrays
+ * keep their capacity, so steady-state updates do not allocate.
+ *
+ * Zero weights are allowed and are simply never drawn.
+ */
 class FastRejectionSampler
 {
 private:
+    static constexpr int32_t NO_LEVEL = -1;
 
     std::vector<double> _weights;
     double _minWeight;
@@ -17,125 +32,159 @@ private:
     std::uniform_real_distribution<double> _biasedCoin;
     double _totalWeightsSum;
 
-    std::vector<std::vector<size_t>> _levelToWeights;
-    std::unordered_map<size_t, size_t> _weightIndexToBin;
+    std::vector<std::vector<uint32_t>> _levelToWeights;
+    std::vector<int32_t> _weightIndexToLevel;
+    std::vector<uint32_t> _weightIndexToBin;
 
     int _minWeightLevel;
     int _maxWeightLevel;
 
     std::vector<double> _levelsWeights;
+    std::vector<double> _levelRejectionScale; // 2^-(e+1) for level e
+
+    // floor(log2(weight)) for positive normal doubles, read straight from the exponent bits
+    static int exponentOf(double weight) {
+        uint64_t bits;
+        std::memcpy(&bits, &weight, sizeof(bits));
+        return static_cast<int>((bits >> 52) & 0x7FF) - 1023;
+    }
+
+    int32_t levelOf(double weight) const {
+        if (weight == 0.0) return NO_LEVEL;
+        return exponentOf(weight) - _minWeightLevel;
+    }
+
+    void checkBounds(double weight) const {
+        if (weight == 0.0) return;
+        if (!(weight >= _minWeight && weight <= _maxWeight)) {
+            throw std::out_of_range("FastRejectionSampler: weight is out of the [minWeight, maxWeight] bounds");
+        }
+    }
+
+    void insertIntoLevel(uint32_t weightIndex, int32_t level, double weight) {
+        _weightIndexToLevel[weightIndex] = level;
+        if (level == NO_LEVEL) return;
+        auto &bins = _levelToWeights[level];
+        _weightIndexToBin[weightIndex] = static_cast<uint32_t>(bins.size());
+        bins.push_back(weightIndex);
+        _levelsWeights[level] += weight;
+    }
+
+    void removeFromLevel(uint32_t weightIndex, int32_t level, double weight) {
+        if (level == NO_LEVEL) return;
+        auto &bins = _levelToWeights[level];
+        const uint32_t bin = _weightIndexToBin[weightIndex];
+        const uint32_t lastWeightIndex = bins.back();
+        bins[bin] = lastWeightIndex;
+        _weightIndexToBin[lastWeightIndex] = bin;
+        bins.pop_back();
+        // an empty level is reset exactly so rounding errors cannot accumulate in it
+        _levelsWeights[level] = bins.empty() ? 0.0 : _levelsWeights[level] - weight;
+    }
 
 public:
-    FastRejectionSampler(const std::vector<double> &weights, double minWeight, double maxWeight): 
+    FastRejectionSampler(const std::vector<double> &weights, double minWeight, double maxWeight):
         _weights(weights), _minWeight(minWeight), _maxWeight(maxWeight) , _biasedCoin(0.0,1.0), _totalWeightsSum(0.0) {
 
-        _minWeightLevel = static_cast<int>(std::log2(minWeight));
-        if (_minWeightLevel >= 0) _minWeightLevel += 1;
-        _maxWeightLevel = static_cast<int>(std::log2(maxWeight)) + 1;
+        if (!(minWeight > 0.0) || !std::isnormal(minWeight) || !(maxWeight >= minWeight) || !std::isfinite(maxWeight)) {
+            throw std::invalid_argument("FastRejectionSampler: weight bounds must satisfy 0 < minWeight <= maxWeight");
+        }
+        if (_weights.size() > UINT32_MAX) {
+            throw std::invalid_argument("FastRejectionSampler: too many weights");
+        }
+
+        _minWeightLevel = exponentOf(minWeight);
+        _maxWeightLevel = exponentOf(maxWeight);
         size_t numLevels = _maxWeightLevel - _minWeightLevel + 1;
 
         _levelToWeights.resize(numLevels);
         _levelsWeights.resize(numLevels, 0.0);
-
-
-        for(size_t i=0; i < _weights.size(); ++i) {
-            MDOUBLE currentWeight = _weights[i];
-            if (currentWeight == 0.0) continue;
-            _totalWeightsSum += currentWeight;
-            int level = static_cast<int>(std::log2(currentWeight));
-            if (level >= 0) level += 1;
-            level -= _minWeightLevel;
-            _levelsWeights[level] += currentWeight;
-            size_t innerIndex = _levelToWeights.at(level).size();
-            _levelToWeights.at(level).push_back(i);
-            _weightIndexToBin[i] = innerIndex;
-
+        _levelRejectionScale.resize(numLevels);
+        for (size_t level = 0; level < numLevels; ++level) {
+            _levelRejectionScale[level] = std::ldexp(1.0, -(static_cast<int>(level) + _minWeightLevel + 1));
         }
 
+        _weightIndexToLevel.resize(_weights.size());
+        _weightIndexToBin.resize(_weights.size());
 
+        // size every level once instead of growing them item by item
+        std::vector<size_t> levelCounts(numLevels, 0);
+        for (double weight: _weights) {
+            checkBounds(weight);
+            int32_t level = levelOf(weight);
+            if (level != NO_LEVEL) levelCounts[level]++;
+        }
+        for (size_t level = 0; level < numLevels; ++level) {
+            _levelToWeights[level].reserve(levelCounts[level]);
+        }
 
+        for (size_t i = 0; i < _weights.size(); ++i) {
+            insertIntoLevel(static_cast<uint32_t>(i), levelOf(_weights[i]), _weights[i]);
+            _totalWeightsSum += _weights[i];
+        }
     }
-    
+
     template <typename Generator>
     size_t sample(Generator&& gen) {
-        double levelSampler = std::uniform_real_distribution<double>(0.0, _totalWeightsSum)(gen);
-        int selectedLevel = 0;
+        double levelSampler = _biasedCoin(gen) * _totalWeightsSum;
+        size_t selectedLevel = _levelsWeights.size();
 
         double cumulativeWeight = 0.0;
-
         for (size_t i = 0; i < _levelsWeights.size(); i++) {
+            if (_levelToWeights[i].empty()) continue;
             cumulativeWeight += _levelsWeights[i];
             selectedLevel = i;
             if (levelSampler < cumulativeWeight) break;
         }
+        if (selectedLevel == _levelsWeights.size()) {
+            throw std::logic_error("FastRejectionSampler: cannot sample when all weights are zero");
+        }
 
-        int correctedLevel =  selectedLevel + _minWeightLevel;
-        double levelConversion = 1.0 / std::pow(2, correctedLevel);
-        auto binsInSelectedLevel = _levelToWeights.at(selectedLevel);
-
-        
-        auto binSampler = std::uniform_int_distribution<int>(0, binsInSelectedLevel.size() - 1);
+        const std::vector<uint32_t> &binsInSelectedLevel = _levelToWeights[selectedLevel];
+        const double levelConversion = _levelRejectionScale[selectedLevel];
+        std::uniform_int_distribution<size_t> binSampler(0, binsInSelectedLevel.size() - 1);
 
-        // rejection sampling:
+        // rejection sampling, acceptance probability is at least 1/2:
         while (true) {
-            int selectedBin = binSampler(gen);
-            size_t selectedIndex = binsInSelectedLevel[selectedBin];
-            double rejection = _weights[selectedIndex] * levelConversion;
-            double coinToss = _biasedCoin(gen);
-            if (coinToss < rejection) return selectedIndex;
+            const uint32_t selectedIndex = binsInSelectedLevel[binSampler(gen)];
+            const double rejection = _weights[selectedIndex] * levelConversion;
+            if (_biasedCoin(gen) < rejection) return selectedIndex;
         }
-    
-        // return UINT64_MAX;
     }
 
 
-    void updateWeight(int weightIndex, double newWeight) {
-        if ((newWeight > _maxWeight) || (newWeight < _minWeight)) {
-            std::cout << "new weight is out of bounds\n";
-            abort();
-        }
-        double oldWeight = _weights[weightIndex];
-        int oldLevel = static_cast<int>(std::log2(_weights[weightIndex]));
-        size_t oldBinIndex = _weightIndexToBin.at(weightIndex);
-        if (oldLevel >= 0) oldLevel += 1;
-        int oldLevelIndex = oldLevel - _minWeightLevel;
-
-        int newLevel = static_cast<int>(std::log2(newWeight));
-        if (newLevel >= 0) newLevel += 1;
-        int newLevelIndex = newLevel - _minWeightLevel;
+    void updateWeight(size_t weightIndex, double newWeight) {
+        checkBounds(newWeight);
+        const double oldWeight = _weights[weightIndex];
+        if (oldWeight == newWeight) return;
 
-        _totalWeightsSum -= oldWeight;
-        _totalWeightsSum += newWeight;
+        const int32_t oldLevel = _weightIndexToLevel[weightIndex];
+        const int32_t newLevel = levelOf(newWeight);
 
+        _totalWeightsSum += newWeight - oldWeight;
+        _weights[weightIndex] = newWeight;
 
         if (oldLevel == newLevel) {
-            _levelsWeights[newLevelIndex] -= oldWeight;
-            _levelsWeights[newLevelIndex] += newWeight;
-
-            _weights[weightIndex] = newWeight;
+            _levelsWeights[newLevel] += newWeight - oldWeight;
             return;
         }
 
-        // remove weight from old level
-        _levelsWeights[oldLevelIndex] -= oldWeight;
-        size_t numberOfBins = _levelToWeights.at(oldLevelIndex).size();
-        if (numberOfBins > 1) {
-            size_t weightIndexOfLastBin = _levelToWeights.at(oldLevelIndex)[numberOfBins - 1];
-            _levelToWeights.at(oldLevelIndex)[oldBinIndex] = weightIndexOfLastBin;
-            _weightIndexToBin[weightIndexOfLastBin] = oldBinIndex;
-        } else {
-            _levelsWeights[oldLevelIndex] = 0.0;
-        }
-        _levelToWeights.at(oldLevelIndex).pop_back();
-
-        // add to new level
-        _levelsWeights[newLevelIndex] += newWeight;
-        _weightIndexToBin[weightIndex] = _levelToWeights.at(newLevelIndex).size();
-        _levelToWeights.at(newLevelIndex).push_back(weightIndex);
-
-        // update weight in the original weights vector
-        _weights[weightIndex] = newWeight;
+        removeFromLevel(static_cast<uint32_t>(weightIndex), oldLevel, oldWeight);
+        insertIntoLevel(static_cast<uint32_t>(weightIndex), newLevel, newWeight);
+    }
 
+    /**
+     * Recompute the level and total sums from the weights, dropping accumulated rounding errors.
+     */
+    void recomputeSums() {
+        std::fill(_levelsWeights.begin(), _levelsWeights.end(), 0.0);
+        _totalWeightsSum = 0.0;
+        for (size_t i = 0; i < _weights.size(); ++i) {
+            int32_t level = _weightIndexToLevel[i];
+            if (level == NO_LEVEL) continue;
+            _levelsWeights[level] += _weights[i];
+            _totalWeightsSum += _weights[i];
+        }
     }
 
     const std::vector<double> & getLevelsWeights() {
@@ -151,6 +200,14 @@ public:
         return _totalWeightsSum;
     }
 
+    double getWeight(size_t weightIndex) const {
+        return _weights[weightIndex];
+    }
+
+    size_t size() const {
+        return _weights.size();
+    }
+
     int getLevelBin(int level) {
         return level + _minWeightLevel;
     }
@@ -161,13 +218,17 @@ public:
         for(size_t i=0; i < _weights.size(); ++i) {
             sum += _weights[i];
         }
-        if (abs(sum - _totalWeightsSum) > epsilon) return false;
+        if (std::abs(sum - _totalWeightsSum) > epsilon * std::max(1.0, sum)) return false;
 
         sum = 0.0;
         for (size_t i = 0; i < _levelsWeights.size(); i++) {
             sum += _levelsWeights[i];
+            for (uint32_t weightIndex: _levelToWeights[i]) {
+                if (_weightIndexToLevel[weightIndex] != static_cast<int32_t>(i)) return false;
+                if (_levelToWeights[i][_weightIndexToBin[weightIndex]] != weightIndex) return false;
+            }
         }
-        if (abs(sum - _totalWeightsSum) > epsilon) return false;
+        if (std::abs(sum - _totalWeightsSum) > epsilon * std::max(1.0, sum)) return false;
 
         return true;
     }
@@ -175,3 +236,4 @@ public:
     ~FastRejectionSampler(){};
 };
 
+#endif
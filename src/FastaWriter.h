@@ -0,0 +1,238 @@
+#ifndef ___FASTA_WRITER
+#define ___FASTA_WRITER
+
+#include <array>
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include "OutputSink.h"
+
+/**
+ * Buffered FASTA writer shared by the low-memory simulation path and the MSA writers.
+ *
+ * Rows are encoded straight into a large byte buffer: residue codes go through a char lookup
+ * table, text rows are copied, and gap runs are filled with memset. Full buffers are handed to
+ * an OutputSink, by default one running on its own writer thread, so encoding the next rows
+ * overlaps writing the previous ones. Rows longer than the buffer are encoded piecewise, so
+ * memory stays bounded by the buffer and the sink's ring.
+ */
+class FastaWriter {
+public:
+    static constexpr size_t DEFAULT_BUFFER_SIZE = size_t(1) << 22;
+
+    explicit FastaWriter(size_t bufferSize = DEFAULT_BUFFER_SIZE)
+        : _bufferSize(std::max<size_t>(bufferSize, 64)), _used(0), _bufferCharge(OUTPUT_BUFFERS_MEMORY) {
+        _buffer.resize(_bufferSize);
+        _bufferCharge.update(_buffer.capacity());
+        _lookup.fill('?');
+    }
+
+    FastaWriter(const FastaWriter&) = delete;
+    FastaWriter& operator=(const FastaWriter&) = delete;
+
+    // failures are reported by an explicit close(); here they are only logged, since
+    // reporting them could exit or throw out of the destructor
+    ~FastaWriter() {
+        abandon();
+    }
+
+    /**
+     * Open (truncate) filePath. A file still open, e.g. left by a failed write, is closed
+     * with its failures only logged; close() it first to have them reported.
+     * @param async - write on a separate thread
+     * @param compress - write BGZF-compressed output
+     * @param numThreads - threads compressing blocks in parallel (0 for one per hardware thread)
+     * @return false if the file could not be opened
+     */
+    bool open(const std::string &filePath, bool async = true, bool compress = false, size_t numThreads = 1) {
+        abandon();
+        _sink = openOutputSink(filePath, async, compress, numThreads);
+        return _sink != nullptr;
+    }
+
+    /**
+     * Write into an already constructed sink, e.g. a compressing one.
+     */
+    void open(std::unique_ptr<OutputSink> sink) {
+        abandon();
+        _sink = std::move(sink);
+    }
+
+    bool isOpen() const {
+        return _sink != nullptr;
+    }
+
+    size_t bufferSize() const {
+        return _bufferSize;
+    }
+
+    /**
+     * @param lookup - output character of every alphabet code, codes are 0..size-1
+     */
+    template<size_t AlphabetSize>
+    void setCharLookup(const std::array<char, AlphabetSize> &lookup) {
+        static_assert(AlphabetSize <= 256, "alphabet codes must fit the lookup table");
+        std::copy(lookup.begin(), lookup.end(), _lookup.begin());
+    }
+
+    /**
+     * Write ">name\n" followed by the first length residues of row.
+     * @param row - any indexable container of alphabet codes
+     */
+    template<typename Row>
+    void writeRow(const std::string &name, const Row &row, size_t length) {
+        writeHeader(name);
+        appendResidues(row, 0, length);
+        appendBytes("\n", 1);
+    }
+
+    /**
+     * Write a row laid out by its gap structure: negative entries are gap runs, positive
+     * entries are runs of residues. row spans the whole MSA; a gap run skips over the
+     * residues it covers, as in MsaRenderer.
+     */
+    template<typename Row>
+    void writeAlignedRow(const std::string &name, const Row &row, const std::vector<int> &gapStructure) {
+        writeHeader(name);
+        size_t site = 0;
+        for (int blockSize : gapStructure) {
+            if (blockSize < 0) {
+                appendGaps(static_cast<size_t>(-blockSize));
+                site += -blockSize;
+            } else {
+                appendResidues(row, site, static_cast<size_t>(blockSize));
+                site += blockSize;
+            }
+        }
+        appendBytes("\n", 1);
+    }
+
+    /**
+     * Write ">name\n" followed by a row that is already text.
+     */
+    void writeText(const std::string &name, const std::string &text) {
+        writeHeader(name);
+        appendBytes(text.data(), text.size());
+        appendBytes("\n", 1);
+    }
+
+    /**
+     * Same as writeAlignedRow for a row that is already text; a gap run skips over the
+     * characters of text it covers, as in the MSA string writers.
+     */
+    void writeAlignedText(const std::string &name, const std::string &text, const std::vector<int> &gapStructure) {
+        writeHeader(name);
+        size_t passed = 0;
+        for (int blockSize : gapStructure) {
+            if (blockSize < 0) {
+                appendGaps(static_cast<size_t>(-blockSize));
+                passed += -blockSize;
+            } else {
+                appendBytes(text.data() + passed, static_cast<size_t>(blockSize));
+                passed += blockSize;
+            }
+        }
+        appendBytes("\n", 1);
+    }
+
+    void writeBytes(const char *bytes, size_t count) {
+        appendBytes(bytes, count);
+    }
+
+    void writeBytes(const std::string &text) {
+        appendBytes(text.data(), text.size());
+    }
+
+    void flush() {
+        if (!_sink) return;
+        drain();
+        _sink->flush();
+    }
+
+    void close() {
+        if (!_sink) return;
+        drain();
+        // released before closing, so a failure is reported once and not again by the destructor
+        std::unique_ptr<OutputSink> sink = std::move(_sink);
+        try {
+            sink->close();
+        } catch (...) {
+            sink->suppressErrors();
+            throw;
+        }
+    }
+
+private:
+    // close, logging failures instead of reporting them
+    void abandon() {
+        if (_sink) _sink->suppressErrors();
+        close();
+    }
+
+    void writeHeader(const std::string &name) {
+        appendBytes(">", 1);
+        appendBytes(name.data(), name.size());
+        appendBytes("\n", 1);
+    }
+
+    // hand the filled part of the buffer to the sink and get an empty one back
+    void drain() {
+        if (_used == 0) return;
+        _buffer.resize(_used);
+        _sink->submit(_buffer);
+        _buffer.resize(_bufferSize);
+        _bufferCharge.update(_buffer.capacity());
+        _used = 0;
+    }
+
+    void appendBytes(const char *bytes, size_t count) {
+        while (count > 0) {
+            if (_used == _bufferSize) drain();
+            const size_t chunk = std::min(count, _bufferSize - _used);
+            std::memcpy(_buffer.data() + _used, bytes, chunk);
+            _used += chunk;
+            bytes += chunk;
+            count -= chunk;
+        }
+    }
+
+    void appendGaps(size_t count) {
+        while (count > 0) {
+            if (_used == _bufferSize) drain();
+            const size_t chunk = std::min(count, _bufferSize - _used);
+            std::memset(_buffer.data() + _used, '-', chunk);
+            _used += chunk;
+            count -= chunk;
+        }
+    }
+
+    template<typename Row>
+    void appendResidues(const Row &row, size_t first, size_t count) {
+        // the lookup lives in a local copy so stores into the char buffer cannot alias it
+        const std::array<char, 256> lookup = _lookup;
+        while (count > 0) {
+            if (_used == _bufferSize) drain();
+            const size_t chunk = std::min(count, _bufferSize - _used);
+            char *out = _buffer.data() + _used;
+            for (size_t i = 0; i < chunk; ++i) {
+                out[i] = lookup[static_cast<uint8_t>(row[first + i])];
+            }
+            _used += chunk;
+            first += chunk;
+            count -= chunk;
+        }
+    }
+
+    size_t _bufferSize;
+    std::vector<char> _buffer;
+    size_t _used;
+    std::array<char, 256> _lookup;
+    std::unique_ptr<OutputSink> _sink;
+    MemoryCharge _bufferCharge;
+};
+
+#endif
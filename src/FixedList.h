@@ -121,6 +121,11 @@ public:
         return _msaSeqLength;
     }
 
+    size_t memoryUsage() const {
+        return (_nextIndices.capacity() + _traversalPositions.capacity()) * sizeof(size_t)
+               + _isColumns.capacity() / 8;
+    }
+
 
     size_t getAbsolutePosition(size_t index) const {
         return _traversalPositions[index];
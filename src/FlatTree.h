@@ -0,0 +1,424 @@
+#ifndef ___FLAT_TREE
+#define ___FLAT_TREE
+
+#include <limits>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <clocale>
+#include <stdexcept>
+#include <string_view>
+
+#include "../libs/Phylolib/includes/tree.h"
+
+/**
+ * Rooted tree held as flat arrays indexed by node id: parent, children, branch length and
+ * name of every node.
+ *
+ * Ids are assigned in preorder (root 0, every node before its descendants, children in
+ * Newick order), as Phylolib numbers the nodes of a tree it reads, so a node keeps its id in
+ * the tree made by toTree() and node id - 1 is its branch index in a SimulationProtocol.
+ * Children are stored contiguously: the children of node i are
+ * children()[childOffsets()[i] .. childOffsets()[i + 1]).
+ */
+class FlatTree
+{
+public:
+    static constexpr uint32_t NO_PARENT = std::numeric_limits<uint32_t>::max();
+
+    /**
+     * Parse one Newick tree (terminated by ';') in a single pass over the text. Quoted
+     * labels ('...', with '' for a quote) and [comments] are accepted; internal node labels
+     * are kept as names.
+     * @throws std::invalid_argument with the offending position for malformed input
+     */
+    static FlatTree fromNewick(std::string_view newick) {
+        FlatTree flat;
+        flat.parse(newick);
+        return flat;
+    }
+
+    static FlatTree fromFile(const std::string &filePath) {
+        std::unique_ptr<FILE, int(*)(FILE*)> file(std::fopen(filePath.c_str(), "rb"), &std::fclose);
+        if (!file) throw std::runtime_error("Could not open tree file " + filePath);
+        std::string text;
+        char buffer[1 << 16];
+        size_t bytesRead;
+        while ((bytesRead = std::fread(buffer, 1, sizeof(buffer), file.get())) > 0) text.append(buffer, bytesRead);
+        return fromNewick(text);
+    }
+
+    /**
+     * Tree given by the parent of every node (NO_PARENT for the root) in any numbering, e.g.
+     * built by a tree generator; nodes are renumbered in preorder, children keep their input
+     * order.
+     * @throws std::invalid_argument for mismatched sizes, negative lengths, no or several
+     *         roots, or nodes not connected to the root
+     */
+    static FlatTree fromParents(const std::vector<uint32_t> &parents, const std::vector<double> &branchLengths,
+                                const std::vector<std::string> &names) {
+        const size_t count = parents.size();
+        if (count == 0 || count >= NO_PARENT || branchLengths.size() != count || names.size() != count) {
+            throw std::invalid_argument("Parents, branch lengths and names must have the same, non-zero size");
+        }
+        uint32_t inputRoot = NO_PARENT;
+        std::vector<uint32_t> offsets(count + 1, 0);
+        for (uint32_t node = 0; node < count; ++node) {
+            if (branchLengths[node] < 0.0) throw std::invalid_argument("Negative branch length of node " + std::to_string(node));
+            if (parents[node] == NO_PARENT) {
+                if (inputRoot != NO_PARENT) throw std::invalid_argument("Tree has more than one root");
+                inputRoot = node;
+            } else if (parents[node] >= count) {
+                throw std::invalid_argument("Parent of node " + std::to_string(node) + " out of range");
+            } else {
+                ++offsets[parents[node] + 1];
+            }
+        }
+        if (inputRoot == NO_PARENT) throw std::invalid_argument("Tree has no root");
+        for (size_t node = 0; node < count; ++node) offsets[node + 1] += offsets[node];
+        std::vector<uint32_t> inputChildren(count - 1);
+        std::vector<uint32_t> filled(offsets.begin(), offsets.end() - 1);
+        for (uint32_t node = 0; node < count; ++node) {
+            if (node != inputRoot) inputChildren[filled[parents[node]]++] = node;
+        }
+
+        FlatTree flat;
+        flat._parents.reserve(count);
+        flat._branchLengths.reserve(count);
+        flat._nameStarts.reserve(count);
+        flat._nameLengths.reserve(count);
+        // (input node, its new parent id); children pushed in reverse so the first is numbered first
+        std::vector<std::pair<uint32_t, uint32_t>> stack{{inputRoot, NO_PARENT}};
+        while (!stack.empty()) {
+            const auto [node, newParent] = stack.back();
+            stack.pop_back();
+            const uint32_t id = flat.addNode(newParent);
+            flat._branchLengths[id] = branchLengths[node];
+            flat._nameStarts[id] = flat._nameData.size();
+            flat._nameLengths[id] = static_cast<uint32_t>(names[node].size());
+            flat._nameData += names[node];
+            for (uint32_t index = offsets[node + 1]; index-- > offsets[node];) stack.emplace_back(inputChildren[index], id);
+        }
+        if (flat.numNodes() != count) throw std::invalid_argument("Tree has nodes not connected to the root");
+        flat.finish();
+        return flat;
+    }
+
+    size_t numNodes() const { return _parents.size(); }
+    size_t numLeaves() const { return _numLeaves; }
+    uint32_t root() const { return 0; }
+
+    uint32_t parent(uint32_t node) const { return _parents[node]; }
+    double branchLength(uint32_t node) const { return _branchLengths[node]; }
+    bool isLeaf(uint32_t node) const { return _childOffsets[node] == _childOffsets[node + 1]; }
+    size_t numChildren(uint32_t node) const { return _childOffsets[node + 1] - _childOffsets[node]; }
+    uint32_t child(uint32_t node, size_t index) const { return _children[_childOffsets[node] + index]; }
+
+    std::string_view name(uint32_t node) const {
+        return std::string_view(_nameData).substr(_nameStarts[node], _nameLengths[node]);
+    }
+
+    const std::vector<uint32_t>& parents() const { return _parents; }
+    const std::vector<double>& branchLengths() const { return _branchLengths; }
+    const std::vector<uint32_t>& childOffsets() const { return _childOffsets; }
+    const std::vector<uint32_t>& children() const { return _children; }
+
+    std::vector<std::string> names() const {
+        std::vector<std::string> result;
+        result.reserve(numNodes());
+        for (uint32_t node = 0; node < numNodes(); ++node) result.emplace_back(name(node));
+        return result;
+    }
+
+    /**
+     * Phylolib tree of the same shape, ids, names and branch lengths, for SimulationProtocol;
+     * unnamed internal nodes are named N<id> as Phylolib's own reader names them.
+     */
+    std::unique_ptr<tree> toTree() const {
+        auto phylotree = std::make_unique<tree>();
+        phylotree->createRootNode();
+        std::vector<tree::nodeP> nodes(numNodes());
+        nodes[0] = phylotree->getRoot();
+        for (uint32_t node = 1; node < numNodes(); ++node) {
+            // preorder: the parent was created before the node
+            nodes[node] = phylotree->createNode(nodes[_parents[node]], node);
+            nodes[node]->setDisToFather(_branchLengths[node]);
+        }
+        for (uint32_t node = 0; node < numNodes(); ++node) {
+            if (_nameLengths[node] > 0 || isLeaf(node)) nodes[node]->setName(std::string(name(node)));
+            else nodes[node]->setName("N" + std::to_string(node));
+        }
+        phylotree->updateNumberofNodesANDleaves();
+        return phylotree;
+    }
+
+    /**
+     * Newick text of the tree; branch lengths are written with 15 significant digits, or 17
+     * when 15 do not read back to the same double.
+     */
+    std::string toNewick() const {
+        std::string out;
+        out.reserve(numNodes() * 16);
+        // (node, next child to visit), iterative so that deep (caterpillar) trees cannot overflow the stack
+        std::vector<std::pair<uint32_t, uint32_t>> stack{{root(), 0}};
+        while (!stack.empty()) {
+            auto &[node, next] = stack.back();
+            if (next == 0 && !isLeaf(node)) out += '(';
+            if (next < numChildren(node)) {
+                if (next > 0) out += ',';
+                const uint32_t childNode = child(node, next++);
+                stack.emplace_back(childNode, 0);
+                continue;
+            }
+            if (!isLeaf(node)) out += ')';
+            appendName(out, name(node));
+            if (node != root()) {
+                out += ':';
+                appendBranchLength(out, _branchLengths[node]);
+            }
+            stack.pop_back();
+        }
+        out += ';';
+        return out;
+    }
+
+private:
+    FlatTree() : _numLeaves(0) {}
+
+    uint32_t addNode(uint32_t parentNode) {
+        if (_parents.size() >= NO_PARENT) throw std::invalid_argument("Tree has too many nodes");
+        _parents.push_back(parentNode);
+        _branchLengths.push_back(0.0);
+        _nameStarts.push_back(0);
+        _nameLengths.push_back(0);
+        return static_cast<uint32_t>(_parents.size() - 1);
+    }
+
+    void parse(std::string_view text) {
+        _text = text;
+        _position = 0;
+        _decimalPoint = localeDecimalPoint();
+        // every node but the root starts at a '(' or ','; a count is cheaper than regrowing the arrays
+        const size_t expectedNodes = 1 + std::count(text.begin(), text.end(), '(') + std::count(text.begin(), text.end(), ',');
+        _parents.reserve(expectedNodes);
+        _branchLengths.reserve(expectedNodes);
+        _nameStarts.reserve(expectedNodes);
+        _nameLengths.reserve(expectedNodes);
+        std::vector<uint32_t> open; // internal nodes whose ')' has not been read yet
+        uint32_t current = addNode(NO_PARENT);
+        while (true) {
+            skipBlanks();
+            while (peek() == '(') {
+                ++_position;
+                open.push_back(current);
+                current = addNode(current);
+                skipBlanks();
+            }
+            readLabel(current);
+            bool nextSibling = false;
+            while (!nextSibling) {
+                switch (peek()) {
+                case ',':
+                    if (open.empty()) fail("',' outside of parentheses");
+                    ++_position;
+                    current = addNode(open.back());
+                    nextSibling = true;
+                    break;
+                case ')':
+                    if (open.empty()) fail("unmatched ')'");
+                    ++_position;
+                    current = open.back();
+                    open.pop_back();
+                    readLabel(current);
+                    break;
+                case ';':
+                    if (!open.empty()) fail("unmatched '('");
+                    ++_position;
+                    skipBlanks();
+                    if (_position < _text.size()) fail("text after the end of the tree");
+                    finish();
+                    return;
+                default:
+                    fail(_position < _text.size() ? "unexpected character" : "missing ';'");
+                }
+            }
+        }
+    }
+
+    // name and branch length of node, then the blanks before the next token
+    void readLabel(uint32_t node) {
+        skipBlanks();
+        const size_t start = _nameData.size();
+        if (peek() == '\'') {
+            ++_position;
+            while (true) {
+                const size_t quote = _text.find('\'', _position);
+                if (quote == std::string_view::npos) fail("unterminated quoted label");
+                _nameData.append(_text.substr(_position, quote - _position));
+                _position = quote + 1;
+                if (peek() != '\'') break;
+                _nameData += '\''; // '' inside quotes
+                ++_position;
+            }
+        } else {
+            const size_t end = _position;
+            while (_position < _text.size() && !isDelimiter(_text[_position])) ++_position;
+            _nameData.append(_text.substr(end, _position - end));
+        }
+        _nameStarts[node] = start;
+        _nameLengths[node] = static_cast<uint32_t>(_nameData.size() - start);
+
+        skipBlanks();
+        if (peek() == ':') {
+            ++_position;
+            skipBlanks();
+            const size_t end = _position;
+            while (_position < _text.size() && isNumberChar(_text[_position])) ++_position;
+            const double length = parseBranchLength(_text.substr(end, _position - end));
+            if (length < 0.0) fail("negative branch length");
+            _branchLengths[node] = length;
+            skipBlanks();
+        }
+    }
+
+    // whitespace and [comments]
+    void skipBlanks() {
+        while (_position < _text.size()) {
+            const char c = _text[_position];
+            if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+                ++_position;
+            } else if (c == '[') {
+                const size_t close = _text.find(']', _position);
+                if (close == std::string_view::npos) fail("unterminated comment");
+                _position = close + 1;
+            } else {
+                return;
+            }
+        }
+    }
+
+    char peek() const { return _position < _text.size() ? _text[_position] : '\0'; }
+
+    static bool isDelimiter(char c) {
+        switch (c) {
+        case '(': case ')': case ',': case ':': case ';': case '[': case ']': case '\'':
+        case ' ': case '\t': case '\n': case '\r':
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    [[noreturn]] void fail(const std::string &reason) const {
+        throw std::invalid_argument("Invalid Newick at position " + std::to_string(_position) + ": " + reason);
+    }
+
+    // children from the parent links; ids increase along each child list
+    void finish() {
+        const size_t count = numNodes();
+        _childOffsets.assign(count + 1, 0);
+        for (size_t node = 1; node < count; ++node) ++_childOffsets[_parents[node] + 1];
+        for (size_t node = 0; node < count; ++node) _childOffsets[node + 1] += _childOffsets[node];
+        _children.resize(count - 1);
+        std::vector<uint32_t> filled(_childOffsets.begin(), _childOffsets.end() - 1);
+        for (size_t node = 1; node < count; ++node) _children[filled[_parents[node]]++] = static_cast<uint32_t>(node);
+        _numLeaves = 0;
+        for (uint32_t node = 0; node < count; ++node) _numLeaves += isLeaf(node);
+        _text = std::string_view();
+    }
+
+    static bool isNumberChar(char c) {
+        return (c >= '0' && c <= '9') || c == '.' || c == '-' || c == '+' || c == 'e' || c == 'E';
+    }
+
+    // strtod and printf use the C locale's decimal point, Newick always '.'
+    static char localeDecimalPoint() {
+        return std::localeconv()->decimal_point[0];
+    }
+
+    double parseBranchLength(std::string_view token) const {
+        // plain decimals of up to 15 digits: both the digits and the power of ten are exact
+        // doubles, so their quotient is the correctly rounded length
+        static const double powersOfTen[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                             1e12, 1e13, 1e14, 1e15};
+        uint64_t digits = 0;
+        size_t numDigits = 0, fractionDigits = 0;
+        bool point = false, plain = !token.empty();
+        for (char c : token) {
+            if (c == '.' && !point) {
+                point = true;
+            } else if (c >= '0' && c <= '9' && numDigits < 15) {
+                digits = digits * 10 + static_cast<uint64_t>(c - '0');
+                ++numDigits;
+                fractionDigits += point;
+            } else {
+                plain = false;
+                break;
+            }
+        }
+        if (plain && numDigits > 0) return static_cast<double>(digits) / powersOfTen[fractionDigits];
+
+        // strtod needs a terminated copy; lengths this long are padded with zeros and rare
+        char buffer[64];
+        std::string longNumber;
+        char *number = buffer;
+        if (token.size() >= sizeof(buffer)) {
+            longNumber.assign(token);
+            number = longNumber.data();
+        } else {
+            std::copy(token.begin(), token.end(), buffer);
+            buffer[token.size()] = '\0';
+        }
+        if (_decimalPoint != '.') std::replace(number, number + token.size(), '.', _decimalPoint);
+        char *last = nullptr;
+        const double length = token.empty() ? 0.0 : std::strtod(number, &last);
+        if (token.empty() || last != number + token.size()) fail("invalid branch length");
+        if (std::isinf(length)) fail("branch length out of range");
+        return length;
+    }
+
+    static void appendBranchLength(std::string &out, double length) {
+        char number[32];
+        const char point = localeDecimalPoint();
+        int size = std::snprintf(number, sizeof(number), "%.15g", length);
+        if (std::strtod(number, nullptr) != length) size = std::snprintf(number, sizeof(number), "%.17g", length);
+        if (point != '.') std::replace(number, number + size, point, '.');
+        out.append(number, size);
+    }
+
+    static void appendName(std::string &out, std::string_view name) {
+        bool plain = true;
+        for (char c : name) plain &= !isDelimiter(c);
+        if (plain) {
+            out.append(name);
+            return;
+        }
+        out += '\'';
+        for (char c : name) {
+            if (c == '\'') out += '\'';
+            out += c;
+        }
+        out += '\'';
+    }
+
+    std::vector<uint32_t> _parents;
+    std::vector<double> _branchLengths;
+    std::vector<size_t> _nameStarts;
+    std::vector<uint32_t> _nameLengths;
+    std::string _nameData;
+    std::vector<uint32_t> _childOffsets;
+    std::vector<uint32_t> _children;
+    size_t _numLeaves;
+
+    // parser state
+    std::string_view _text;
+    size_t _position = 0;
+    char _decimalPoint = '.';
+};
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef ___GAP_RUN_SPILL
+#define ___GAP_RUN_SPILL
+
+#include <cstdio>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <stdexcept>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#endif
+
+/**
+ * Gap runs of an alignment spilled to a scratch file, so the low-memory path can stream
+ * substituted rows without keeping the runs of every row in memory.
+ *
+ * Only an offset and a count per node id stay in memory; runsOf reads the runs of one row
+ * back into a reusable buffer. Rows are read in tree order rather than file order, one seek
+ * per row. The scratch file is removed when the spill is destroyed.
+ */
+class GapRunSpill {
+public:
+    /**
+     * Write the runs of every row of alignedSequence (node id -> runs) to filePath.
+     */
+    GapRunSpill(const std::string &filePath, const std::unordered_map<size_t, std::vector<int>> &alignedSequence)
+        : _filePath(filePath), _file(std::fopen(filePath.c_str(), "w+b")) {
+        if (_file == nullptr) throw std::runtime_error("GapRunSpill: could not create " + filePath);
+        uint64_t offset = 0;
+        for (const auto &row : alignedSequence) {
+            const size_t id = row.first;
+            if (id >= _offsets.size()) {
+                _offsets.resize(id + 1, 0);
+                _counts.resize(id + 1, 0);
+            }
+            _offsets[id] = offset;
+            _counts[id] = static_cast<uint32_t>(row.second.size());
+            if (!row.second.empty() && std::fwrite(row.second.data(), sizeof(int), row.second.size(), _file) != row.second.size()) {
+                close();
+                throw std::runtime_error("GapRunSpill: could not write " + filePath);
+            }
+            offset += row.second.size() * sizeof(int);
+        }
+        std::fflush(_file);
+        _fileBytes = offset;
+    }
+
+    GapRunSpill(const GapRunSpill&) = delete;
+    GapRunSpill& operator=(const GapRunSpill&) = delete;
+
+    ~GapRunSpill() {
+        close();
+    }
+
+    /**
+     * Runs of node id, valid until the next call.
+     */
+    const std::vector<int>& runsOf(size_t id) {
+        if (id >= _counts.size()) throw std::out_of_range("GapRunSpill: node " + std::to_string(id) + " has no gap runs");
+        _row.resize(_counts[id]);
+        if (_row.empty()) return _row;
+        if (!seek(_offsets[id])
+            || std::fread(_row.data(), sizeof(int), _row.size(), _file) != _row.size()) {
+            throw std::runtime_error("GapRunSpill: could not read " + _filePath);
+        }
+        return _row;
+    }
+
+    uint64_t fileBytes() const { return _fileBytes; }
+
+    /**
+     * Bytes held in memory: the per-node index and the row buffer.
+     */
+    size_t memoryUsage() const {
+        return _offsets.capacity() * sizeof(uint64_t) + _counts.capacity() * sizeof(uint32_t)
+               + _row.capacity() * sizeof(int);
+    }
+
+private:
+    // 64-bit offsets: long is 32 bits on Windows, so fseek could not reach past 2 GB
+    bool seek(uint64_t offset) {
+#ifdef _WIN32
+        return _fseeki64(_file, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+        return fseeko(_file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+    }
+
+    void close() {
+        if (_file == nullptr) return;
+        std::fclose(_file);
+        _file = nullptr;
+        std::remove(_filePath.c_str());
+    }
+
+    std::string _filePath;
+    std::FILE *_file;
+    std::vector<uint64_t> _offsets;
+    std::vector<uint32_t> _counts;
+    std::vector<int> _row;
+    uint64_t _fileBytes;
+};
+
+#endif
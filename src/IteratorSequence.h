@@ -85,6 +85,10 @@ public:
         return _sequence.size();
     }
 
+    size_t memoryUsage() const {
+        return sizeof(IteratorSequence) + _sequence.capacity() * sizeof(iteratorType);
+    }
+
     iteratorType getPos(size_t pos) {
         return _sequence[pos];
     }
@@ -13,6 +13,11 @@
 #include "../libs/Phylolib/includes/tree.h"
 #include "../libs/Phylolib/includes/sequenceContainer.h"
 
+#include "MsaRenderer.h"
+#include "PackedMsa.h"
+#include "SequenceArena.h"
+#include "MemoryAccounting.h"
+
 #include "Sequence.h"
 
 
@@ -36,6 +41,7 @@ public:
 
     MSA (BlockMap &blockmap,const tree::nodeP rootNode, const std::vector<bool>& nodesToSave) {
         size_t sequenceSize = std::get<static_cast<int>(BLOCKLIST::LENGTH)>(blockmap.at(rootNode->id()))-1;
+        MemoryPhaseScope phase(MSA_PHASE);
 
         size_t numberOfSeqs = 0;
         _sequencesToSave.clear();
@@ -55,8 +61,12 @@ public:
         // std::vector<Sequence> finalSequences;
 
         buildMsaRecursively(finalSequences, blockmap, *rootNode, superSequence, rootSequence, nodesToSave);
-        blockmap.clear();
-        
+        blockmap.clear(); // releases the lists and their charge
+
+        MemoryCharge superSequenceCharge(SUPER_SEQUENCE_MEMORY, superSequence.memoryUsage());
+        size_t compressedBytes = 0;
+        for (const auto &sequence : finalSequences) compressedBytes += sequence.memoryUsage();
+        MemoryCharge compressedCharge(MSA_SEQUENCES_MEMORY, compressedBytes);
         fillMSA(finalSequences, superSequence);
     }
 
@@ -73,6 +83,7 @@ public:
 
             auto blocks = std::get<static_cast<int>(BLOCKLIST::BLOCKS)>(blockmap.at(childNode->id()));//simulateAlongBranch(sequences.top().size(), currentNode->dis2father(), nodePosition);
             currentSequence.generateSequence(blocks, &parentSequence);
+            MemoryCharge sequenceCharge(MSA_SEQUENCES_MEMORY, currentSequence.memoryUsage());
             buildMsaRecursively(finalSequences, blockmap, *childNode, superSequence, currentSequence, nodesToSave);
         }
         
@@ -136,6 +147,7 @@ public:
             totalSize = 0;
 			// rowInMSA++;
         }
+        _gapRunsCharge.update(gapRunsMemoryUsage(_alignedSequence));
     };
 
     static MSA msaFromSequences(vector<Sequence> &sequences, SuperSequence &superSeq) {
@@ -204,12 +216,13 @@ public:
             totalSize = 0;
 			// rowInMSA++;
         }
+        msa._gapRunsCharge.update(gapRunsMemoryUsage(msa._alignedSequence));
         return msa;
     };
 
 
-    void fillSubstitutions(std::shared_ptr<sequenceContainer> _seqContainer) {
-        _substitutions = _seqContainer;
+    void fillSubstitutions(std::shared_ptr<SequenceArena> sequences) {
+        _substitutions = sequences;
     }
 
     void setSubstitutionsFolder(const std::string& substitutionsDir) {
@@ -236,6 +249,7 @@ public:
 		_numberOfSequences = msa._numberOfSequences;
 		_msaLength = msa._msaLength;
 		_alignedSequence = msa._alignedSequence;
+		_gapRunsCharge.update(gapRunsMemoryUsage(_alignedSequence));
 	};
 
 	int getMSAlength() const {return _msaLength;}
@@ -258,63 +272,47 @@ public:
 		}
 	}
 
-    std::string generateMsaStringWithoutSubs() {
-        // std::stringstream msaString;
-        std::string msaString;
-        msaString.reserve((_msaLength+1)*_numberOfSequences);
-
-        for (auto id: _sequencesToSave) {
-            const auto& alignedSeqRow = _alignedSequence[id];  // Single hash lookup
-
-            for (size_t col = 0; col < alignedSeqRow.size(); col++) {
-                int strSize = alignedSeqRow[col];
-                if (strSize < 0) {
-                    strSize = -strSize;
-                    msaString.append(strSize, '-');
-                } else {
-                    msaString.append(strSize, 'A');
-                }
-            }
-            msaString.append("\n");
+    /**
+     * Renderer of the alignment text, rows laid out up front and rendered in parallel: the
+     * FASTA rows of generateMsaString, or the bare indel rows of generateMsaStringWithoutSubs
+     * when withSubstitutions is false or there are no substitutions (named by node id when
+     * streamed). The callbacks only read the alignment, so rows can be rendered concurrently.
+     */
+    auto makeRenderer(bool withSubstitutions = true) const {
+        static const std::vector<int> noRuns;
+        const bool hasResidues = withSubstitutions && _substitutions != nullptr;
+        std::array<char, 256> lookup;
+        lookup.fill('?');
+        std::vector<int> ungappedRow;
+        if (hasResidues) {
+            lookup = alphabetLookup(_substitutions->alphabet());
+            ungappedRow.push_back(static_cast<int>(_substitutions->numColumns()));
         }
-        return msaString;
-    }
 
+        auto idOf = [this, hasResidues](size_t row) -> size_t {
+            return hasResidues ? _substitutions->id(row) : _sequencesToSave[row];
+        };
+        return makeMsaRenderer(hasResidues ? _numberOfSequences : _sequencesToSave.size(), hasResidues, lookup,
+            [this, idOf, hasResidues](size_t row) {
+                return hasResidues ? _substitutions->name(row) : std::to_string(idOf(row));
+            },
+            [this, idOf, hasResidues, ungappedRow](size_t row) -> const std::vector<int>& {
+                if (hasResidues && _alignedSequence.empty()) return ungappedRow;
+                auto found = _alignedSequence.find(idOf(row));
+                return found == _alignedSequence.end() ? noRuns : found->second;
+            },
+            [this](size_t row) {
+                const SequenceArena &sequences = *_substitutions;
+                return sequences.row(row);
+            });
+    }
 
-    std::string generateMsaString() {
-        if (_substitutions == nullptr) return generateMsaStringWithoutSubs();
-        std::string msaString;
-        msaString.reserve((_msaLength+1)*_numberOfSequences);
-        for (size_t row = 0; row < _numberOfSequences; row++) {
-            int passedSeq = 0;
-            int id = _substitutions->placeToId(row);
-            msaString.append(">");
-            msaString.append(_substitutions->name(id));
-            msaString.append("\n");
-            std::string currentSeq = (*_substitutions)[id].toString();
-            if (_alignedSequence.empty()) {
-                msaString.append(currentSeq);
-                msaString.append("\n");
-
-                continue;
-            }
-            const auto& alignedSeqRow = _alignedSequence[id];  // Single hash lookup
-            for (size_t col = 0; col < alignedSeqRow.size(); col++) {
-                int strSize = alignedSeqRow[col];
-                if (strSize < 0) {
-                    strSize = -strSize;
-                    msaString.append(strSize, '-');
-
-                } else {
-                    msaString.append(currentSeq.substr(passedSeq, strSize));
+    std::string generateMsaStringWithoutSubs() const {
+        return makeRenderer(false).toString(0);
+    }
 
-                }
-                passedSeq += strSize;
-            }
-            msaString.append("\n");
-            
-        }
-        return msaString;
+    std::string generateMsaString() const {
+        return makeRenderer().toString(0);
     }
 
     void printFullMsa() {
@@ -375,13 +373,41 @@ public:
     }
 
 
-    void writeFullMsa(const char * filePath) {
-        ofstream msafile (filePath);
-        if (msafile.is_open()) {
-            msafile << generateMsaString();
-            msafile.close();
+    /**
+     * Rows are rendered in parallel straight into the memory mapped output file, or with
+     * compress, chunk by chunk into the BGZF writer.
+     * @param compress - write BGZF (block gzip) output, blocks compressed on all cores
+     */
+    void writeFullMsa(const char * filePath, bool compress = false) const {
+        if (!makeRenderer().writeFile(filePath, compress, 0)) cout << "Unable to open file";
+    }
+
+    /**
+     * Write the MSA in the packed binary format of PackedMsa.h: residue codes bit-packed
+     * (2 bits for nucleotides, 5 for amino acids) next to the gap runs of every row.
+     * Alignments without substitutions store only the runs, named by node id.
+     */
+    void writePackedMsa(const char * filePath) {
+        const std::vector<int> ungappedRow(1, static_cast<int>(_msaLength));
+        auto gapRunsOf = [&](size_t row) -> const std::vector<int>& {
+            if (_alignedSequence.empty()) return ungappedRow;
+            size_t id = _substitutions == nullptr ? _sequencesToSave[row] : _substitutions->id(row);
+            return _alignedSequence[id];
+        };
+
+        bool opened;
+        if (_substitutions == nullptr) {
+            opened = ::writePackedMsa(filePath, _sequencesToSave.size(), _msaLength, "",
+                [&](size_t row) { return std::to_string(_sequencesToSave[row]); },
+                gapRunsOf,
+                [&](size_t) -> const std::vector<int>& { return ungappedRow; });
+        } else {
+            opened = ::writePackedMsa(filePath, _numberOfSequences, _msaLength, _substitutions->alphabet(),
+                [&](size_t row) { return _substitutions->name(row); },
+                gapRunsOf,
+                [&](size_t row) { return _substitutions->row(row); });
         }
-        else cout << "Unable to open file";
+        if (!opened) cout << "Unable to open file";
     }
 
     std::unordered_map<size_t, std::vector<int>> getMSAVec() {return _alignedSequence;}
@@ -398,11 +424,12 @@ public:
 private:
 	size_t _numberOfSequences; // NUMBER OF SEQUENCES IN THE MSA
     size_t _msaLength; // Length of the MSA
-    std::shared_ptr<sequenceContainer> _substitutions;
+    std::shared_ptr<SequenceArena> _substitutions;
     std::string _substitutionsDir;
     std::vector<std::filesystem::directory_entry> _substitutionPaths;
 
 	std::unordered_map<size_t, std::vector<int>> _alignedSequence;
+    MemoryCharge _gapRunsCharge{GAP_RUNS_MEMORY};
     std::vector<size_t> _sequencesToSave;
     std::vector<size_t> _rootPositionsInMsa;
 
@@ -0,0 +1,228 @@
+#ifndef ___MEMORY_ACCOUNTING
+#define ___MEMORY_ACCOUNTING
+
+#include <map>
+#include <array>
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <unordered_map>
+
+// Structures whose bytes the ledger tracks, each charged by the code that owns it.
+enum memorySubsystem {
+    BLOCK_TREE_MEMORY,              // AVL tree of the branch being simulated
+    BLOCK_MAP_MEMORY,               // block lists of every branch, for as long as a BlockMap holds them
+    SUPER_SEQUENCE_MEMORY,          // SuperSequence / FixedList columns of the MSA being built
+    MSA_SEQUENCES_MEMORY,           // Sequence vectors along the tree and compressed rows of the MSA being built
+    GAP_RUNS_MEMORY,                // gap runs of built MSAs
+    TRANSITION_TABLES_MEMORY,       // CachedTransitionProbabilities
+    SUBSTITUTION_SEQUENCES_MEMORY,  // SequenceArena rows kept for the caller
+    SUBSTITUTION_WORKSPACE_MEMORY,  // sequences along the tree, site rates and categories
+    OUTPUT_BUFFERS_MEMORY,          // writer, sink ring and compression buffers
+    NUM_MEMORY_SUBSYSTEMS
+};
+
+// Phases of a replicate; peaks are also kept per phase.
+enum memoryPhase {
+    INDEL_PHASE,
+    MSA_PHASE,
+    SUBSTITUTION_PHASE,
+    OUTPUT_PHASE,
+    NUM_MEMORY_PHASES,
+    NO_PHASE = NUM_MEMORY_PHASES
+};
+
+inline const char* memorySubsystemName(memorySubsystem subsystem) {
+    switch (subsystem) {
+        case BLOCK_TREE_MEMORY: return "block_tree";
+        case BLOCK_MAP_MEMORY: return "block_map";
+        case SUPER_SEQUENCE_MEMORY: return "super_sequence";
+        case MSA_SEQUENCES_MEMORY: return "msa_sequences";
+        case GAP_RUNS_MEMORY: return "gap_runs";
+        case TRANSITION_TABLES_MEMORY: return "transition_tables";
+        case SUBSTITUTION_SEQUENCES_MEMORY: return "substitution_sequences";
+        case SUBSTITUTION_WORKSPACE_MEMORY: return "substitution_workspace";
+        case OUTPUT_BUFFERS_MEMORY: return "output_buffers";
+        default: return "unknown";
+    }
+}
+
+inline const char* memoryPhaseName(memoryPhase phase) {
+    switch (phase) {
+        case INDEL_PHASE: return "indels";
+        case MSA_PHASE: return "msa";
+        case SUBSTITUTION_PHASE: return "substitutions";
+        case OUTPUT_PHASE: return "output";
+        default: return "none";
+    }
+}
+
+/**
+ * Process-wide current and peak bytes per subsystem, overall and per phase.
+ *
+ * Counts are the sizes of the tracked structures (capacities times element sizes plus
+ * known per-node overheads), not allocator statistics, so they are cheap enough to
+ * update once per tree node and stay comparable across platforms. Updates are lock-free;
+ * the peaks of concurrent updates are exact, phase changes are expected from one thread.
+ */
+class MemoryLedger {
+public:
+    static constexpr size_t TOTAL = NUM_MEMORY_SUBSYSTEMS;
+
+    void add(memorySubsystem subsystem, int64_t delta) {
+        if (delta == 0) return;
+        const int64_t now = _current[subsystem].fetch_add(delta, std::memory_order_relaxed) + delta;
+        const int64_t total = _current[TOTAL].fetch_add(delta, std::memory_order_relaxed) + delta;
+        raise(_peak[subsystem], now);
+        raise(_peak[TOTAL], total);
+        const int phase = _phase.load(std::memory_order_relaxed);
+        if (phase != NO_PHASE) {
+            raise(_phasePeak[phase][subsystem], now);
+            raise(_phasePeak[phase][TOTAL], total);
+        }
+    }
+
+    /**
+     * Start attributing peaks to phase, which begins at what is held now.
+     * @return the phase that was active
+     */
+    memoryPhase enterPhase(memoryPhase phase) {
+        const memoryPhase previous = static_cast<memoryPhase>(_phase.exchange(phase));
+        if (phase != NO_PHASE) {
+            for (size_t i = 0; i <= TOTAL; ++i) raise(_phasePeak[phase][i], current(i));
+        }
+        return previous;
+    }
+
+    memoryPhase phase() const { return static_cast<memoryPhase>(_phase.load()); }
+
+    int64_t current(size_t subsystem) const { return _current[subsystem].load(std::memory_order_relaxed); }
+    int64_t peak(size_t subsystem) const { return _peak[subsystem].load(std::memory_order_relaxed); }
+    int64_t phasePeak(memoryPhase phase, size_t subsystem) const {
+        return _phasePeak[phase][subsystem].load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Restart every peak from the bytes held now, e.g. at the start of a replicate.
+     */
+    void resetPeaks() {
+        for (size_t i = 0; i <= TOTAL; ++i) {
+            _peak[i].store(current(i));
+            for (auto &phasePeaks : _phasePeak) phasePeaks[i].store(0);
+        }
+        const int phase = _phase.load();
+        if (phase != NO_PHASE) enterPhase(static_cast<memoryPhase>(phase));
+    }
+
+    /**
+     * name -> {"current", "peak", "peak_<phase>"...} for every subsystem and "total".
+     */
+    std::map<std::string, std::map<std::string, int64_t>> report() const {
+        std::map<std::string, std::map<std::string, int64_t>> result;
+        for (size_t i = 0; i <= TOTAL; ++i) {
+            auto &entry = result[i == TOTAL ? "total" : memorySubsystemName(static_cast<memorySubsystem>(i))];
+            entry["current"] = current(i);
+            entry["peak"] = peak(i);
+            for (size_t phase = 0; phase < NUM_MEMORY_PHASES; ++phase) {
+                entry[std::string("peak_") + memoryPhaseName(static_cast<memoryPhase>(phase))]
+                    = phasePeak(static_cast<memoryPhase>(phase), i);
+            }
+        }
+        return result;
+    }
+
+private:
+    static void raise(std::atomic<int64_t> &peak, int64_t value) {
+        int64_t seen = peak.load(std::memory_order_relaxed);
+        while (value > seen && !peak.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+    }
+
+    std::array<std::atomic<int64_t>, TOTAL + 1> _current{};
+    std::array<std::atomic<int64_t>, TOTAL + 1> _peak{};
+    std::array<std::array<std::atomic<int64_t>, TOTAL + 1>, NUM_MEMORY_PHASES> _phasePeak{};
+    std::atomic<int> _phase{NO_PHASE};
+};
+
+inline MemoryLedger& memoryLedger() {
+    static MemoryLedger ledger;
+    return ledger;
+}
+
+/**
+ * Bytes held by one structure, charged to a subsystem of the ledger and released when the
+ * charge goes out of scope. Copies start empty; the copy's owner charges what it holds.
+ */
+class MemoryCharge {
+public:
+    explicit MemoryCharge(memorySubsystem subsystem, size_t bytes = 0) : _subsystem(subsystem) {
+        update(bytes);
+    }
+    MemoryCharge(const MemoryCharge &other) : _subsystem(other._subsystem) {}
+    MemoryCharge& operator=(const MemoryCharge&) { return *this; }
+    ~MemoryCharge() { update(0); }
+
+    void update(size_t bytes) {
+        memoryLedger().add(_subsystem, static_cast<int64_t>(bytes) - static_cast<int64_t>(_bytes));
+        _bytes = bytes;
+    }
+
+    size_t bytes() const { return _bytes; }
+
+private:
+    memorySubsystem _subsystem;
+    size_t _bytes = 0;
+};
+
+// true on a thread inside a MemoryPhasesIgnored scope
+inline bool& memoryPhasesIgnored() {
+    static thread_local bool ignored = false;
+    return ignored;
+}
+
+/**
+ * Attributes peaks to a phase for the lifetime of the scope, restoring the enclosing phase.
+ * Does nothing on a thread that ignores phases.
+ */
+class MemoryPhaseScope {
+public:
+    explicit MemoryPhaseScope(memoryPhase phase)
+        : _active(!memoryPhasesIgnored()), _previous(_active ? memoryLedger().enterPhase(phase) : NO_PHASE) {}
+    MemoryPhaseScope(const MemoryPhaseScope&) = delete;
+    MemoryPhaseScope& operator=(const MemoryPhaseScope&) = delete;
+    ~MemoryPhaseScope() {
+        if (_active) memoryLedger().enterPhase(_previous);
+    }
+
+private:
+    bool _active;
+    memoryPhase _previous;
+};
+
+/**
+ * Ignores the phase scopes opened on the calling thread for the lifetime of the scope. The
+ * phase is process-wide and changed from one thread, so work that runs on several threads
+ * at once (e.g. the trees of a batch) leaves it to the caller.
+ */
+class MemoryPhasesIgnored {
+public:
+    MemoryPhasesIgnored() : _previous(memoryPhasesIgnored()) { memoryPhasesIgnored() = true; }
+    MemoryPhasesIgnored(const MemoryPhasesIgnored&) = delete;
+    MemoryPhasesIgnored& operator=(const MemoryPhasesIgnored&) = delete;
+    ~MemoryPhasesIgnored() { memoryPhasesIgnored() = _previous; }
+
+private:
+    bool _previous;
+};
+
+// gap runs of an alignment (node id -> runs): runs plus a hash node and bucket per row
+inline size_t gapRunsMemoryUsage(const std::unordered_map<size_t, std::vector<int>> &alignedSequence) {
+    size_t bytes = alignedSequence.bucket_count() * sizeof(void*);
+    for (const auto &row : alignedSequence) {
+        bytes += sizeof(row) + 2 * sizeof(void*) + row.second.capacity() * sizeof(int);
+    }
+    return bytes;
+}
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef ___MEMORY_BUDGET
+#define ___MEMORY_BUDGET
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <algorithm>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#if !defined(_WIN32) && !defined(__linux__)
+#include <sys/resource.h>
+#endif
+
+// How the low-memory path lays out the substitution and output phase:
+// IN_MEMORY_STRATEGY        - keep the sequences and the alignment, render rows in parallel at the end
+// STREAMED_ROWS_STRATEGY    - keep the gap runs of every row, stream substituted rows to the file
+// SPILLED_GAP_RUNS_STRATEGY - spill the gap runs to a scratch file as well, stream rows
+enum memoryStrategy {
+    IN_MEMORY_STRATEGY,
+    STREAMED_ROWS_STRATEGY,
+    SPILLED_GAP_RUNS_STRATEGY
+};
+
+inline const char* memoryStrategyName(memoryStrategy strategy) {
+    switch (strategy) {
+        case IN_MEMORY_STRATEGY: return "in_memory";
+        case STREAMED_ROWS_STRATEGY: return "streamed_rows";
+        case SPILLED_GAP_RUNS_STRATEGY: return "spilled_gap_runs";
+    }
+    return "unknown";
+}
+
+/**
+ * What the substitution and output phase has to hold, known once the indel MSA is built.
+ */
+struct SubstitutionFootprint {
+    size_t msaLength = 0;
+    size_t numRows = 0;           // saved sequences
+    size_t numNodes = 0;
+    size_t totalGapRuns = 0;      // over all rows, 0 without indels
+    size_t nameBytes = 0;         // total length of the row names
+    size_t workingSetBytes = 0;   // simulating the substitutions themselves (rateMatrixSim::estimateWorkingSetBytes)
+    size_t outputBufferBytes = 0; // writer buffer, sink ring and compression buffers
+    bool compress = false;
+};
+
+struct MemoryPlan {
+    memoryStrategy strategy = SPILLED_GAP_RUNS_STRATEGY;
+    bool feasible = false;
+    size_t budgetBytes = 0;
+    size_t baselineBytes = 0;      // resident before the phase, gap runs excluded
+    size_t estimatedPeakBytes = 0; // baseline plus the estimate of the chosen strategy
+    size_t peakResidentBytes = 0;  // measured once the phase ran
+};
+
+/**
+ * Picks the fastest strategy for the substitution and output phase whose estimated peak fits
+ * a budget. Only that phase is planned: the indel simulation and the alignment it builds
+ * have already run, unbounded, by the time the footprint is known.
+ *
+ * Estimates are built from the sizes of the structures each strategy keeps (sequences, gap
+ * runs, rendered text, output buffers) on top of the memory resident when planning. They are
+ * estimates, not bounds: allocator overhead and anything else the caller allocates meanwhile
+ * are not counted.
+ */
+class SubstitutionMemoryPlanner {
+public:
+    // unordered_map node, bucket and vector header kept per row of gap runs
+    static constexpr size_t GAP_ROW_OVERHEAD = 64;
+    // SequenceArena id, row index and interned name string per row
+    static constexpr size_t ARENA_ROW_OVERHEAD = 48;
+    // chunk rendered at a time by compressed in-memory output (MsaRenderer::CHUNK_BYTES)
+    static constexpr size_t RENDER_CHUNK_BYTES = size_t(1) << 24;
+
+    explicit SubstitutionMemoryPlanner(size_t budgetBytes) : _budgetBytes(budgetBytes) {}
+
+    size_t budgetBytes() const { return _budgetBytes; }
+
+    static size_t gapRunBytes(const SubstitutionFootprint &footprint) {
+        if (footprint.totalGapRuns == 0) return 0;
+        return footprint.numRows * GAP_ROW_OVERHEAD + footprint.totalGapRuns * sizeof(int);
+    }
+
+    /**
+     * Estimated bytes the strategy adds to what is resident before the phase.
+     */
+    static size_t estimate(memoryStrategy strategy, const SubstitutionFootprint &footprint) {
+        size_t bytes = footprint.workingSetBytes;
+        switch (strategy) {
+            case IN_MEMORY_STRATEGY: {
+                const size_t textBytes = footprint.numRows * (footprint.msaLength + 3) + footprint.nameBytes;
+                bytes += gapRunBytes(footprint);
+                bytes += footprint.numRows * (footprint.msaLength + ARENA_ROW_OVERHEAD) + footprint.nameBytes;
+                bytes += footprint.numRows * sizeof(size_t); // renderer row offsets
+                // uncompressed output is rendered into the mapped file, whose pages count as resident
+                bytes += footprint.compress ? RENDER_CHUNK_BYTES + footprint.outputBufferBytes : textBytes;
+                break;
+            }
+            case STREAMED_ROWS_STRATEGY:
+                bytes += gapRunBytes(footprint) + footprint.outputBufferBytes;
+                break;
+            case SPILLED_GAP_RUNS_STRATEGY:
+                bytes += footprint.numNodes * (sizeof(uint64_t) + sizeof(uint32_t)) + footprint.outputBufferBytes;
+                break;
+        }
+        return bytes;
+    }
+
+    /**
+     * @param residentBytes - memory resident now, the gap runs of the footprint included
+     */
+    MemoryPlan plan(const SubstitutionFootprint &footprint, size_t residentBytes) const {
+        MemoryPlan result;
+        result.budgetBytes = _budgetBytes;
+        result.baselineBytes = residentBytes - std::min(residentBytes, gapRunBytes(footprint));
+        for (memoryStrategy strategy : {IN_MEMORY_STRATEGY, STREAMED_ROWS_STRATEGY, SPILLED_GAP_RUNS_STRATEGY}) {
+            result.strategy = strategy;
+            result.estimatedPeakBytes = result.baselineBytes + estimate(strategy, footprint);
+            result.feasible = result.estimatedPeakBytes <= _budgetBytes;
+            if (result.feasible) break;
+        }
+        return result;
+    }
+
+private:
+    size_t _budgetBytes;
+};
+
+
+#ifdef __linux__
+// value of a "Field:  1234 kB" line of /proc/self/status, in bytes
+inline size_t procStatusBytes(const std::string &field) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, field.size(), field) == 0 && line.size() > field.size() && line[field.size()] == ':') {
+            return static_cast<size_t>(std::stoull(line.substr(field.size() + 1))) * 1024;
+        }
+    }
+    return 0;
+}
+#endif
+
+/**
+ * Resident memory of the process now, 0 where it cannot be read.
+ */
+inline size_t currentResidentBytes() {
+#ifdef __linux__
+    return procStatusBytes("VmRSS");
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Peak resident memory of the process, since the last resetPeakResidentBytes where supported.
+ */
+inline size_t peakResidentBytes() {
+#if defined(__linux__)
+    return procStatusBytes("VmHWM");
+#elif defined(_WIN32)
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+/**
+ * Restart the peak measured by peakResidentBytes from the current resident memory (Linux only).
+ * @return false where the peak cannot be reset
+ */
+inline bool resetPeakResidentBytes() {
+#ifdef __linux__
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    clearRefs << "5";
+    clearRefs.flush();
+    return static_cast<bool>(clearRefs);
+#else
+    return false;
+#endif
+}
+
+/**
+ * Hand memory freed by large structures (e.g. the gap runs of a dropped MSA) back to the
+ * operating system, where the allocator supports it.
+ */
+inline void releaseFreedMemory() {
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+}
+
+#endif
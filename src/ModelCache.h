@@ -0,0 +1,255 @@
+#ifndef ___MODEL_CACHE
+#define ___MODEL_CACHE
+
+#include <list>
+#include <iterator>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+#include "../libs/Phylolib/includes/stochasticProcess.h"
+#include "MemoryAccounting.h"
+#include "RateMatrixEigen.h"
+#include "CdfTable.h"
+#include "modelFactory.h"
+
+/**
+ * The immutable parts of one substitution model (replacement model, parameters and site-rate
+ * model): its stochastic process, the eigendecomposition of its rate matrix, and the
+ * transition tables in use, keyed by the exact time (branch length x category rate) they
+ * were built for. Shared by every simulator using the model; tables are added under a lock
+ * and never modified, so a table found here is the one any simulator would build.
+ *
+ * The model only holds weak references: a shared table is freed once no cache uses it, so
+ * the pool is bounded by the tables of the simulators alive, however many trees were
+ * simulated. Every shared table is charged to the ledger once, from creation to release.
+ */
+template<size_t AlphabetSize>
+class SharedSubstitutionModel {
+public:
+    using Table = CdfTable<AlphabetSize>;
+
+    explicit SharedSubstitutionModel(std::shared_ptr<const stochasticProcess> process)
+        : _process(std::move(process)), _charge(TRANSITION_TABLES_MEMORY) {
+        auto eigen = std::make_shared<RateMatrixEigen<AlphabetSize>>();
+        if (eigen->decompose(*_process) && eigen->matches(*_process)) _eigen = std::move(eigen);
+    }
+
+    /**
+     * A process whose rate matrix was decomposed already (see ModelRegistry); eigen is
+     * nullptr if the tables are computed from Pij_t.
+     */
+    SharedSubstitutionModel(std::shared_ptr<const stochasticProcess> process,
+                            std::shared_ptr<const RateMatrixEigen<AlphabetSize>> eigen)
+        : _process(std::move(process)), _eigen(std::move(eigen)), _charge(TRANSITION_TABLES_MEMORY) {}
+
+    const stochasticProcess& process() const { return *_process; }
+    std::shared_ptr<const stochasticProcess> sharedProcess() const { return _process; }
+
+    // true if the tables are computed from the eigendecomposition of the rate matrix
+    bool usesEigenDecomposition() const { return _eigen != nullptr; }
+
+    void transitionMatrix(MDOUBLE time, double *out) const {
+        if (_eigen) {
+            _eigen->transitionMatrices(&time, 1, out);
+            return;
+        }
+        for (size_t i = 0; i < AlphabetSize; ++i) {
+            for (size_t j = 0; j < AlphabetSize; ++j) out[i * AlphabetSize + j] = _process->Pij_t(i, j, time);
+        }
+    }
+
+    // rows of every parent character at one time
+    std::unique_ptr<Table> makeTable(MDOUBLE time) const {
+        std::vector<double> matrix(AlphabetSize * AlphabetSize);
+        transitionMatrix(time, matrix.data());
+        auto table = std::make_unique<Table>();
+        for (size_t i = 0; i < AlphabetSize; ++i) table->setRow(i, matrix.data() + i * AlphabetSize);
+        return table;
+    }
+
+    /**
+     * The shared table of time, nullptr if none is in use.
+     */
+    std::shared_ptr<const Table> findTable(MDOUBLE time) const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _tables.find(timeKey(time));
+        return it == _tables.end() ? nullptr : it->second.lock();
+    }
+
+    /**
+     * Share a table built for time; if another simulator shared one first and still uses
+     * it, that one is returned (they are identical).
+     */
+    std::shared_ptr<const Table> shareTable(MDOUBLE time, std::unique_ptr<Table> table) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::weak_ptr<const Table> &entry = _tables[timeKey(time)];
+        if (auto existing = entry.lock()) return existing;
+
+        memoryLedger().add(TRANSITION_TABLES_MEMORY, static_cast<int64_t>(sizeof(Table)));
+        std::shared_ptr<const Table> shared(table.release(), [](const Table *released) {
+            memoryLedger().add(TRANSITION_TABLES_MEMORY, -static_cast<int64_t>(sizeof(Table)));
+            delete released;
+        });
+        entry = shared;
+        // drop the entries of released tables once they could make up half of the index
+        if (_tables.size() >= _pruneAt) {
+            for (auto it = _tables.begin(); it != _tables.end();) {
+                it = it->second.expired() ? _tables.erase(it) : std::next(it);
+            }
+            _pruneAt = std::max(MIN_PRUNE_SIZE, 2 * _tables.size());
+        }
+        _charge.update(memoryUsageLocked());
+        return shared;
+    }
+
+    /**
+     * Number of shared tables in use by some cache.
+     */
+    size_t sharedTables() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        size_t live = 0;
+        for (const auto &entry : _tables) live += !entry.second.expired();
+        return live;
+    }
+
+    size_t memoryUsage() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return memoryUsageLocked();
+    }
+
+private:
+    static constexpr size_t MIN_PRUNE_SIZE = 64;
+
+    static uint64_t timeKey(MDOUBLE time) {
+        uint64_t bits;
+        std::memcpy(&bits, &time, sizeof(bits));
+        return bits;
+    }
+
+    // the index; the tables themselves are charged while they are alive
+    size_t memoryUsageLocked() const {
+        return _tables.bucket_count() * sizeof(void*)
+               + _tables.size() * (sizeof(std::pair<uint64_t, std::weak_ptr<const Table>>) + 2 * sizeof(void*));
+    }
+
+    std::shared_ptr<const stochasticProcess> _process;
+    std::shared_ptr<const RateMatrixEigen<AlphabetSize>> _eigen;
+
+    mutable std::mutex _mutex;
+    std::unordered_map<uint64_t, std::weak_ptr<const Table>> _tables;
+    size_t _pruneAt = MIN_PRUNE_SIZE;
+    MemoryCharge _charge;
+};
+
+struct ModelCacheStats {
+    size_t hits = 0;     // models served from the cache
+    size_t misses = 0;   // models built
+    size_t models = 0;   // models held
+    size_t capacity = 0;
+};
+
+/**
+ * Process-wide cache of substitution models, keyed by the content of the model factory
+ * (modelFactory::cacheKey), so simulators set up with the same model - in the same
+ * simulator or another - share the process, the decomposition and the transition tables
+ * instead of building them again. Holds the most recently used models up to its capacity;
+ * simulators keep the models they use alive after they leave the cache.
+ */
+class ModelCache {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 8;
+
+    template<size_t AlphabetSize>
+    std::shared_ptr<SharedSubstitutionModel<AlphabetSize>> model(modelFactory &factory) {
+        const std::string key = std::to_string(AlphabetSize) + " " + factory.cacheKey();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto it = _entries.find(key);
+            if (it != _entries.end()) {
+                ++_stats.hits;
+                _order.splice(_order.begin(), _order, it->second);
+                return std::static_pointer_cast<SharedSubstitutionModel<AlphabetSize>>(it->second->second);
+            }
+        }
+
+        // built outside the lock; a concurrent build of the same model keeps the first one
+        auto registered = factory.getRegisteredModel();
+        auto built = std::make_shared<SharedSubstitutionModel<AlphabetSize>>(
+            factory.getStochasticProcess(*registered), registered->template eigensystem<AlphabetSize>());
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _entries.find(key);
+        if (it != _entries.end()) {
+            ++_stats.hits;
+            return std::static_pointer_cast<SharedSubstitutionModel<AlphabetSize>>(it->second->second);
+        }
+        ++_stats.misses;
+        if (_capacity == 0) return built;
+        _order.emplace_front(key, built);
+        _entries[key] = _order.begin();
+        trim();
+        return built;
+    }
+
+    /**
+     * Number of models held (0 = none, every simulator builds its own).
+     */
+    void setCapacity(size_t capacity) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _capacity = capacity;
+        trim();
+    }
+
+    size_t capacity() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _capacity;
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _entries.clear();
+        _order.clear();
+    }
+
+    ModelCacheStats stats() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        ModelCacheStats result = _stats;
+        result.models = _entries.size();
+        result.capacity = _capacity;
+        return result;
+    }
+
+    void resetStats() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stats = ModelCacheStats();
+    }
+
+private:
+    using Entry = std::pair<std::string, std::shared_ptr<void>>;
+
+    void trim() {
+        while (_entries.size() > _capacity) {
+            _entries.erase(_order.back().first);
+            _order.pop_back();
+        }
+    }
+
+    mutable std::mutex _mutex;
+    std::list<Entry> _order; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> _entries;
+    size_t _capacity = DEFAULT_CAPACITY;
+    ModelCacheStats _stats;
+};
+
+inline ModelCache& modelCache() {
+    memoryLedger(); // outlives the cache, whose tables are charged to it
+    static ModelCache cache;
+    return cache;
+}
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef ___MODEL_REGISTRY
+#define ___MODEL_REGISTRY
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <functional>
+#include <unordered_map>
+
+#include "../libs/Phylolib/includes/pijAccelerator.h"
+#include "../libs/Phylolib/includes/stochasticProcess.h"
+#include "../libs/Phylolib/includes/customDistribution.h"
+#include "RateMatrixEigen.h"
+
+/**
+ * A replacement model built once: its Pij accelerator (for amino acids a Chebyshev fit of
+ * the parsed matrix, the costly part of making a model) and, on first request, the
+ * eigendecomposition of its rate matrix. Immutable once built; stochastic processes are
+ * made from clones of the accelerator.
+ */
+class RegisteredModel {
+public:
+    explicit RegisteredModel(std::unique_ptr<pijAccelerator> accelerator)
+        : _accelerator(std::move(accelerator)) {}
+
+    const pijAccelerator& accelerator() const { return *_accelerator; }
+
+    /**
+     * The decomposition of the rate matrix, nullptr if the model is not reversible, does
+     * not match its Pij_t or is not of AlphabetSize states.
+     */
+    template<size_t AlphabetSize>
+    std::shared_ptr<const RateMatrixEigen<AlphabetSize>> eigensystem() const {
+        if (static_cast<size_t>(_accelerator->alphabetSize()) != AlphabetSize) return nullptr;
+        std::call_once(_eigenOnce, [this]() {
+            // rates of the site-rate model scale time only, a single unit rate will do
+            customDistribution unitRate({1.0}, {1.0});
+            stochasticProcess process(&unitRate, _accelerator.get());
+            auto eigen = std::make_shared<RateMatrixEigen<AlphabetSize>>();
+            if (eigen->decompose(process) && eigen->matches(process)) _eigen = std::move(eigen);
+        });
+        return std::static_pointer_cast<const RateMatrixEigen<AlphabetSize>>(_eigen);
+    }
+
+private:
+    std::unique_ptr<pijAccelerator> _accelerator;
+    mutable std::once_flag _eigenOnce;
+    mutable std::shared_ptr<const void> _eigen;
+};
+
+/**
+ * Process-wide registry of the models without free parameters (the empirical amino-acid
+ * matrices, JC and custom model files), keyed by their content, so each is parsed and fitted
+ * once per process; later factories of the same model only clone its accelerator.
+ */
+class ModelRegistry {
+public:
+    using Builder = std::function<std::unique_ptr<pijAccelerator>()>;
+
+    /**
+     * The model registered under key, built with build (outside the lock) on first use.
+     */
+    std::shared_ptr<const RegisteredModel> get(const std::string &key, const Builder &build) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto it = _models.find(key);
+            if (it != _models.end()) return it->second;
+        }
+        auto built = std::make_shared<const RegisteredModel>(build());
+        std::lock_guard<std::mutex> lock(_mutex);
+        // a concurrent build of the same model keeps the first one
+        return _models.emplace(key, std::move(built)).first->second;
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _models.size();
+    }
+
+    // factories and processes keep the models they use
+    void clear() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _models.clear();
+    }
+
+private:
+    mutable std::mutex _mutex;
+    std::unordered_map<std::string, std::shared_ptr<const RegisteredModel>> _models;
+};
+
+inline ModelRegistry& modelRegistry() {
+    static ModelRegistry registry;
+    return registry;
+}
+
+#endif
@@ -13,6 +13,11 @@
 #include "../libs/Phylolib/includes/tree.h"
 #include "../libs/Phylolib/includes/sequenceContainer.h"
 
+#include "MsaRenderer.h"
+#include "PackedMsa.h"
+#include "SequenceArena.h"
+#include "MemoryAccounting.h"
+
 #include "IteratorSequence.h"
 #include "FixedList.h"
 
@@ -27,6 +32,7 @@ public:
     MsaFixed(const BlockMap &blockmap, const tree::nodeP rootNode, 
          const std::vector<bool>& nodesToSave) {
         size_t sequenceSize = std::get<static_cast<int>(BLOCKLIST::LENGTH)>(blockmap.at(rootNode->id()))-1;
+        MemoryPhaseScope phase(MSA_PHASE);
 
         size_t numberOfSeqs = 0;
         _sequencesToSave.clear();
@@ -49,6 +55,7 @@ public:
 
         FixedList fixedList(exactSize);
         fixedList.initialize(sequenceSize);
+        MemoryCharge fixedListCharge(SUPER_SEQUENCE_MEMORY, fixedList.memoryUsage());
 
         IteratorSequence rootSequence(fixedList, nodesToSave[rootNode->id()], rootNode->id());
         rootSequence.initSequence();
@@ -56,6 +63,9 @@ public:
         std::vector<IteratorSequence> finalSequences;
         buildMsaRecursivelyFixed(finalSequences, blockmap, *rootNode, fixedList, 
                                 rootSequence, nodesToSave);
+        size_t finalBytes = 0;
+        for (const auto &sequence : finalSequences) finalBytes += sequence.memoryUsage();
+        MemoryCharge finalCharge(MSA_SEQUENCES_MEMORY, finalBytes);
         fillMSAFixed(finalSequences, fixedList);
     }
 
@@ -73,6 +83,7 @@ public:
             IteratorSequence currentSequence(fixedList, nodesToSave[childNode->id()], childNode->id());
             auto blocks = std::get<static_cast<int>(BLOCKLIST::BLOCKS)>(blockmap.at(childNode->id()));
             currentSequence.generateSequence(blocks, parentSequence);
+            MemoryCharge sequenceCharge(MSA_SEQUENCES_MEMORY, currentSequence.memoryUsage());
             buildMsaRecursivelyFixed(finalSequences, blockmap, *childNode, fixedList, 
                                       currentSequence, nodesToSave);
         }
@@ -132,10 +143,11 @@ public:
             lastPosition = 0;
             totalSize = 0;
         }
+        _gapRunsCharge.update(gapRunsMemoryUsage(_alignedSequence));
     }
 
-    void fillSubstitutions(std::shared_ptr<sequenceContainer> _seqContainer) {
-        _substitutions = _seqContainer;
+    void fillSubstitutions(std::shared_ptr<SequenceArena> sequences) {
+        _substitutions = sequences;
     }
 
     MsaFixed(size_t numSequences, size_t msaLength, const std::vector<bool>& nodesToSave): 
@@ -150,6 +162,7 @@ public:
         _numberOfSequences = msa._numberOfSequences;
         _msaLength = msa._msaLength;
         _alignedSequence = msa._alignedSequence;
+        _gapRunsCharge.update(gapRunsMemoryUsage(_alignedSequence));
     }
 
     int getMSAlength() const { return _msaLength; }
@@ -169,65 +182,94 @@ public:
         }
     }
 
-    std::string generateMsaStringWithoutSubs() {
-        std::stringstream msaString;
-        for (auto id: _sequencesToSave) {
-            for (size_t col = 0; col < _alignedSequence[id].size(); col++) {
-                int strSize = _alignedSequence[id][col];
-                if (strSize < 0) {
-                    strSize = -strSize;
-                    msaString << std::string(strSize, '-');
-                } else {
-                    msaString << std::string(strSize, 'A');
-                }
-            }
-            msaString << "\n";
+    /**
+     * Renderer of the alignment text, rows laid out up front and rendered in parallel: the
+     * FASTA rows of generateMsaString, or the bare indel rows of generateMsaStringWithoutSubs
+     * when withSubstitutions is false or there are no substitutions (named by node id when
+     * streamed). The callbacks only read the alignment, so rows can be rendered concurrently.
+     */
+    auto makeRenderer(bool withSubstitutions = true) const {
+        static const std::vector<int> noRuns;
+        const bool hasResidues = withSubstitutions && _substitutions != nullptr;
+        std::array<char, 256> lookup;
+        lookup.fill('?');
+        std::vector<int> ungappedRow;
+        if (hasResidues) {
+            lookup = alphabetLookup(_substitutions->alphabet());
+            ungappedRow.push_back(static_cast<int>(_substitutions->numColumns()));
         }
-        return msaString.str();
+
+        auto idOf = [this, hasResidues](size_t row) -> size_t {
+            return hasResidues ? _substitutions->id(row) : _sequencesToSave[row];
+        };
+        return makeMsaRenderer(hasResidues ? _numberOfSequences : _sequencesToSave.size(), hasResidues, lookup,
+            [this, idOf, hasResidues](size_t row) {
+                return hasResidues ? _substitutions->name(row) : std::to_string(idOf(row));
+            },
+            [this, idOf, hasResidues, ungappedRow](size_t row) -> const std::vector<int>& {
+                if (hasResidues && _alignedSequence.empty()) return ungappedRow;
+                auto found = _alignedSequence.find(idOf(row));
+                return found == _alignedSequence.end() ? noRuns : found->second;
+            },
+            [this](size_t row) {
+                const SequenceArena &sequences = *_substitutions;
+                return sequences.row(row);
+            });
     }
 
-    std::string generateMsaString() {
-        if (_substitutions == nullptr) return generateMsaStringWithoutSubs();
-        std::string msaString;
-        msaString.reserve((_msaLength+256)*_numberOfSequences);
-        for (size_t row = 0; row < _numberOfSequences; row++) {
-            int passedSeq = 0;
-            int id = _substitutions->placeToId(row);
-            msaString.append(">");
-            msaString.append(_substitutions->name(id));
-            msaString.append("\n");
-            std::string currentSeq = (*_substitutions)[id].toString();
-            if (_alignedSequence.empty()) {
-                msaString.append(currentSeq);
-                msaString.append("\n");
-                continue;
-            }
-            for (size_t col = 0; col < _alignedSequence[id].size(); col++) {
-                int strSize = _alignedSequence[id][col];
-                if (strSize < 0) {
-                    strSize = -strSize;
-                    msaString.append(std::string(strSize, '-'));
-                } else {
-                    msaString.append(currentSeq.substr(passedSeq, strSize));
-                }
-                passedSeq += strSize;
-            }
-            msaString.append("\n");
-        }
-        return msaString;
+    std::string generateMsaStringWithoutSubs() const {
+        return makeRenderer(false).toString(0);
+    }
+
+    std::string generateMsaString() const {
+        return makeRenderer().toString(0);
     }
 
     void printFullMsa() {
         std::cout << generateMsaString();
     }
 
-    void writeFullMsa(const char * filePath) {
-        ofstream msafile (filePath);
-        if (msafile.is_open()) {
-            msafile << generateMsaString();
-            msafile.close();
+    /**
+     * Rows are rendered in parallel straight into the memory mapped output file, or with
+     * compress, chunk by chunk into the BGZF writer.
+     * @param compress - write BGZF (block gzip) output, blocks compressed on all cores
+     */
+    void writeFullMsa(const char * filePath, bool compress = false) const {
+        if (!makeRenderer().writeFile(filePath, compress, 0)) cout << "Unable to open file";
+    }
+
+    /**
+     * Write the MSA in the packed binary format of PackedMsa.h: residue codes bit-packed
+     * (2 bits for nucleotides, 5 for amino acids) next to the gap runs of every row.
+     * Alignments without substitutions store only the runs, named by node id.
+     */
+    void writePackedMsa(const char * filePath) {
+        // _msaLength counts the FixedList sentinel, the rows span the sum of their runs
+        size_t msaLength = _msaLength;
+        if (!_alignedSequence.empty()) {
+            msaLength = 0;
+            for (int blockSize : _alignedSequence.begin()->second) msaLength += std::abs(blockSize);
+        }
+        const std::vector<int> ungappedRow(1, static_cast<int>(msaLength));
+        auto gapRunsOf = [&](size_t row) -> const std::vector<int>& {
+            if (_alignedSequence.empty()) return ungappedRow;
+            size_t id = _substitutions == nullptr ? _sequencesToSave[row] : _substitutions->id(row);
+            return _alignedSequence[id];
+        };
+
+        bool opened;
+        if (_substitutions == nullptr) {
+            opened = ::writePackedMsa(filePath, _sequencesToSave.size(), msaLength, "",
+                [&](size_t row) { return std::to_string(_sequencesToSave[row]); },
+                gapRunsOf,
+                [&](size_t) -> const std::vector<int>& { return ungappedRow; });
+        } else {
+            opened = ::writePackedMsa(filePath, _numberOfSequences, msaLength, _substitutions->alphabet(),
+                [&](size_t row) { return _substitutions->name(row); },
+                gapRunsOf,
+                [&](size_t row) { return _substitutions->row(row); });
         }
-        else cout << "Unable to open file";
+        if (!opened) cout << "Unable to open file";
     }
 
     std::unordered_map<size_t, std::vector<int>> getMSAVec() { return _alignedSequence; }
@@ -237,8 +279,9 @@ public:
 private:
     size_t _numberOfSequences;
     size_t _msaLength;
-    std::shared_ptr<sequenceContainer> _substitutions;
+    std::shared_ptr<SequenceArena> _substitutions;
     std::unordered_map<size_t, std::vector<int>> _alignedSequence;
+    MemoryCharge _gapRunsCharge{GAP_RUNS_MEMORY};
     std::vector<size_t> _sequencesToSave;
 };
 
@@ -0,0 +1,286 @@
+#ifndef ___MSA_RENDERER
+#define ___MSA_RENDERER
+
+#include <array>
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "OutputSink.h"
+#include "MemoryAccounting.h"
+#include "ParallelFor.h"
+
+/**
+ * Output file of known size written in place through a shared memory mapping, so any number
+ * of threads can fill disjoint parts of it. Only available on POSIX systems; open() returns
+ * false elsewhere and callers stream the output instead.
+ */
+class MappedOutputFile {
+public:
+    MappedOutputFile() : _descriptor(-1), _data(nullptr), _size(0) {}
+
+    MappedOutputFile(const MappedOutputFile&) = delete;
+    MappedOutputFile& operator=(const MappedOutputFile&) = delete;
+
+    ~MappedOutputFile() {
+        close();
+    }
+
+    /**
+     * Create (truncate) filePath with the given size and map it for writing.
+     * @return false if the file could not be created or mapped
+     */
+    bool open(const std::string &filePath, size_t size) {
+#ifdef _WIN32
+        (void)filePath;
+        (void)size;
+        return false;
+#else
+        close();
+        _descriptor = ::open(filePath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (_descriptor < 0) return false;
+        _size = size;
+        if (_size == 0) return true;
+        if (::ftruncate(_descriptor, static_cast<off_t>(_size)) != 0) {
+            close();
+            return false;
+        }
+        void *mapping = ::mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, _descriptor, 0);
+        if (mapping == MAP_FAILED) {
+            close();
+            return false;
+        }
+        _data = static_cast<char*>(mapping);
+        return true;
+#endif
+    }
+
+    char* data() { return _data; }
+    size_t size() const { return _size; }
+
+    void close() {
+#ifndef _WIN32
+        if (_data != nullptr) ::munmap(_data, _size);
+        if (_descriptor >= 0) ::close(_descriptor);
+#endif
+        _data = nullptr;
+        _descriptor = -1;
+        _size = 0;
+    }
+
+private:
+    int _descriptor;
+    char *_data;
+    size_t _size;
+};
+
+
+/**
+ * Renders an alignment as FASTA text with rows in parallel.
+ *
+ * The byte length of every row is known from its name and gap runs, so the offsets of all
+ * rows are computed up front and each row is rendered straight to its place in one
+ * preallocated buffer or memory mapped file: gap runs are filled with memset and residue
+ * codes go through a char lookup table, without building the row as a string first.
+ *
+ * Rows are described through callbacks, as for writePackedMsa: nameOf(row) returns the
+ * name, gapRunsOf(row) the runs (negative entries are gaps, positive entries residues) and
+ * residuesOf(row) an indexable sequence of codes in which gap runs skip the entries they
+ * cover. Without residues (an indel-only alignment) rows have no headers and residues are
+ * rendered as 'A', like MSA::generateMsaStringWithoutSubs.
+ *
+ * Rows and chunks of rows can also be rendered one at a time (rowName/renderSequence,
+ * chunkEnd/render), so callers can stream an alignment with memory bounded by a chunk.
+ */
+template<typename NameOf, typename GapRunsOf, typename ResiduesOf>
+class MsaRenderer {
+public:
+    // rows are streamed to compressed (or unmappable) outputs in chunks of about this size
+    static constexpr size_t CHUNK_BYTES = size_t(1) << 24;
+    // smaller outputs are rendered on the calling thread, spawning threads would cost more
+    static constexpr size_t MIN_PARALLEL_BYTES = size_t(1) << 20;
+
+    MsaRenderer(size_t numRows, bool hasResidues, const std::array<char, 256> &lookup,
+                NameOf nameOf, GapRunsOf gapRunsOf, ResiduesOf residuesOf)
+        : _hasResidues(hasResidues), _lookup(lookup), _nameOf(std::move(nameOf)),
+          _gapRunsOf(std::move(gapRunsOf)), _residuesOf(std::move(residuesOf)) {
+        _offsets.resize(numRows + 1);
+        _offsets[0] = 0;
+        for (size_t row = 0; row < numRows; ++row) {
+            size_t length = 1; // newline
+            for (int blockSize : _gapRunsOf(row)) length += std::abs(blockSize);
+            if (_hasResidues) length += _nameOf(row).size() + 2; // ">name\n"
+            _offsets[row + 1] = _offsets[row] + length;
+        }
+    }
+
+    size_t numRows() const { return _offsets.size() - 1; }
+    size_t size() const { return _offsets.back(); }
+
+    /**
+     * Bytes of text of rows [firstRow, lastRow), headers and newlines included.
+     */
+    size_t textSize(size_t firstRow, size_t lastRow) const {
+        return _offsets[lastRow] - _offsets[firstRow];
+    }
+
+    /**
+     * End of the chunk of rows starting at firstRow whose text fits maxBytes; a chunk holds
+     * at least one row, however long.
+     */
+    size_t chunkEnd(size_t firstRow, size_t maxBytes) const {
+        size_t lastRow = std::min(firstRow + 1, numRows());
+        while (lastRow < numRows() && _offsets[lastRow + 1] - _offsets[firstRow] <= maxBytes) ++lastRow;
+        return lastRow;
+    }
+
+    std::string rowName(size_t row) const {
+        return _nameOf(row);
+    }
+
+    /**
+     * Number of columns of the row, the length of its aligned sequence.
+     */
+    size_t rowLength(size_t row) const {
+        size_t length = textSize(row, row + 1) - 1;
+        if (_hasResidues) length -= _nameOf(row).size() + 2;
+        return length;
+    }
+
+    /**
+     * Render only the aligned sequence of the row (no header, no newline) into out, which
+     * must hold rowLength(row) characters.
+     */
+    void renderSequence(size_t row, char *out) const {
+        if (!_hasResidues) {
+            for (int blockSize : _gapRunsOf(row)) {
+                const size_t length = static_cast<size_t>(std::abs(blockSize));
+                std::memset(out, blockSize < 0 ? '-' : 'A', length);
+                out += length;
+            }
+            return;
+        }
+
+        // the lookup lives in a local copy so stores into the char buffer cannot alias it
+        const std::array<char, 256> lookup = _lookup;
+        const auto &residues = _residuesOf(row);
+        size_t site = 0;
+        for (int blockSize : _gapRunsOf(row)) {
+            if (blockSize < 0) {
+                std::memset(out, '-', static_cast<size_t>(-blockSize));
+                out += -blockSize;
+                site += -blockSize;
+            } else {
+                for (size_t end = site + blockSize; site < end; ++site) {
+                    *out++ = lookup[static_cast<uint8_t>(residues[site])];
+                }
+            }
+        }
+    }
+
+    /**
+     * Render rows [firstRow, lastRow) to out, which holds the text of exactly those rows.
+     */
+    void render(char *out, size_t firstRow, size_t lastRow, size_t numThreads) const {
+        const size_t base = _offsets[firstRow];
+        if (_offsets[lastRow] - base < MIN_PARALLEL_BYTES) numThreads = 1;
+        parallelFor(firstRow, lastRow, numThreads, [&](size_t row) {
+            renderRow(row, out + (_offsets[row] - base));
+        });
+    }
+
+    std::string toString(size_t numThreads) const {
+        MemoryPhaseScope phase(OUTPUT_PHASE);
+        std::string text(size(), '\0');
+        MemoryCharge textCharge(OUTPUT_BUFFERS_MEMORY, text.capacity());
+        if (!text.empty()) render(&text[0], 0, numRows(), numThreads);
+        return text;
+    }
+
+    /**
+     * Write the text to filePath: uncompressed output is rendered in place into the mapped
+     * file, compressed output is rendered chunk by chunk and streamed through a BGZF sink.
+     * @return false if the file could not be opened
+     */
+    bool writeFile(const std::string &filePath, bool compress, size_t numThreads) const {
+        MemoryPhaseScope phase(OUTPUT_PHASE);
+        if (!compress) {
+            MappedOutputFile file;
+            if (file.open(filePath, size())) {
+                MemoryCharge mappedCharge(OUTPUT_BUFFERS_MEMORY, size()); // written pages are resident
+                if (size() > 0) render(file.data(), 0, numRows(), numThreads);
+                file.close();
+                return true;
+            }
+        }
+
+        auto sink = openOutputSink(filePath, true, compress, numThreads);
+        if (!sink) return false;
+        std::vector<char> chunk;
+        MemoryCharge chunkCharge(OUTPUT_BUFFERS_MEMORY);
+        size_t firstRow = 0;
+        while (firstRow < numRows()) {
+            const size_t lastRow = chunkEnd(firstRow, CHUNK_BYTES);
+            chunk.resize(_offsets[lastRow] - _offsets[firstRow]);
+            render(chunk.data(), firstRow, lastRow, numThreads);
+            chunkCharge.update(chunk.capacity());
+            sink->submit(chunk);
+            chunkCharge.update(chunk.capacity()); // handed to the sink, a recycled buffer back
+            firstRow = lastRow;
+        }
+        sink->close();
+        return true;
+    }
+
+private:
+    void renderRow(size_t row, char *out) const {
+        char *newline = out + textSize(row, row + 1) - 1;
+        if (_hasResidues) {
+            const std::string &name = _nameOf(row);
+            *out++ = '>';
+            std::memcpy(out, name.data(), name.size());
+            out += name.size();
+            *out++ = '\n';
+        }
+        renderSequence(row, out);
+        *newline = '\n';
+    }
+
+    bool _hasResidues;
+    std::array<char, 256> _lookup;
+    NameOf _nameOf;
+    GapRunsOf _gapRunsOf;
+    ResiduesOf _residuesOf;
+    std::vector<size_t> _offsets;
+};
+
+/**
+ * Character lookup of an alphabet given as the output character of every code ("ACGT").
+ */
+inline std::array<char, 256> alphabetLookup(const std::string &characters) {
+    std::array<char, 256> lookup;
+    lookup.fill('?');
+    for (size_t code = 0; code < characters.size() && code < 256; code++) lookup[code] = characters[code];
+    return lookup;
+}
+
+template<typename NameOf, typename GapRunsOf, typename ResiduesOf>
+MsaRenderer<NameOf, GapRunsOf, ResiduesOf> makeMsaRenderer(size_t numRows, bool hasResidues,
+                                                           const std::array<char, 256> &lookup,
+                                                           NameOf nameOf, GapRunsOf gapRunsOf,
+                                                           ResiduesOf residuesOf) {
+    return MsaRenderer<NameOf, GapRunsOf, ResiduesOf>(numRows, hasResidues, lookup, std::move(nameOf),
+                                                      std::move(gapRunsOf), std::move(residuesOf));
+}
+
+#endif
@@ -0,0 +1,397 @@
+#ifndef ___OUTPUT_SINK
+#define ___OUTPUT_SINK
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <memory>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef SAILFISH_HAVE_ZLIB
+#include <zlib.h>
+#include <cstdint>
+#include <cstring>
+#include "ParallelFor.h"
+#endif
+
+#include "../libs/Phylolib/includes/errorMsg.h"
+#include "MemoryAccounting.h"
+
+/**
+ * Destination for the byte buffers produced by the output writers.
+ *
+ * submit() consumes the whole content of buffer; on return buffer is empty, possibly
+ * holding a recycled allocation, and can be refilled by the caller right away.
+ *
+ * Write failures, including those found when flushing or closing, are reported through
+ * errorMsg, which exits or throws. Writers closing a sink from their destructor call
+ * suppressErrors() first, as do the sinks' own destructors, so failures there are only logged.
+ */
+class OutputSink {
+public:
+    OutputSink() : _suppressErrors(false) {}
+    virtual ~OutputSink() {}
+    virtual void submit(std::vector<char> &buffer) = 0;
+    virtual void flush() = 0;
+    virtual void close() = 0;
+
+    /**
+     * Log failures to std::cerr from now on instead of reporting them.
+     */
+    virtual void suppressErrors() {
+        _suppressErrors = true;
+    }
+
+protected:
+    void fail(const std::string &message) const {
+        if (_suppressErrors) {
+            std::cerr << message << std::endl;
+            return;
+        }
+        errorMsg::reportError(message);
+    }
+
+private:
+    std::atomic<bool> _suppressErrors; // set by the producer, read by a writer thread
+};
+
+
+/**
+ * Writes every submitted buffer to a file on the calling thread.
+ */
+class FileOutputSink : public OutputSink {
+public:
+    /**
+     * @param binary - open in binary mode (compressed output), text mode otherwise
+     */
+    explicit FileOutputSink(const std::string &filePath, bool binary = false) : _filePath(filePath) {
+        _file.open(filePath, binary ? std::ios::out | std::ios::binary : std::ios::out);
+    }
+
+    ~FileOutputSink() override {
+        suppressErrors();
+        close();
+    }
+
+    bool isOpen() const {
+        return _file.is_open();
+    }
+
+    void submit(std::vector<char> &buffer) override {
+        _file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        buffer.clear();
+        if (!_file) fail("Could not write to file " + _filePath);
+    }
+
+    void flush() override {
+        if (!_file.is_open()) return;
+        _file.flush();
+        if (!_file) fail("Could not write to file " + _filePath);
+    }
+
+    void close() override {
+        if (!_file.is_open()) return;
+        _file.close();
+        if (!_file) fail("Could not write to file " + _filePath);
+    }
+
+private:
+    std::string _filePath;
+    std::ofstream _file;
+};
+
+
+/**
+ * Hands submitted buffers to a writer thread that forwards them to another sink, so the
+ * simulation keeps producing rows while earlier ones are written.
+ *
+ * At most ringSize buffers are in flight; submit() blocks while the ring is full, which
+ * bounds memory and throttles the producer to the speed of the disk. Written buffers are
+ * returned to the producer through submit(), so steady-state output does not allocate.
+ * A failure on the writer thread is reported on the next call from the producer.
+ */
+class AsyncOutputSink : public OutputSink {
+public:
+    static constexpr size_t DEFAULT_RING_SIZE = 4;
+
+    explicit AsyncOutputSink(std::unique_ptr<OutputSink> inner, size_t ringSize = DEFAULT_RING_SIZE)
+        : _inner(std::move(inner)), _ringSize(ringSize > 0 ? ringSize : 1),
+          _heldBytes(0), _ringCharge(OUTPUT_BUFFERS_MEMORY), _busy(false), _stopping(false), _failed(false) {
+        _writer = std::thread(&AsyncOutputSink::writerLoop, this);
+    }
+
+    ~AsyncOutputSink() override {
+        suppressErrors();
+        stopWriter();
+        if (_inner) _inner->close();
+    }
+
+    void submit(std::vector<char> &buffer) override {
+        if (buffer.empty()) return;
+        std::unique_lock<std::mutex> lock(_mutex);
+        _spaceAvailable.wait(lock, [this] { return _pending.size() < _ringSize || _failed; });
+        reportFailure();
+
+        std::vector<char> recycled;
+        if (!_free.empty()) {
+            recycled.swap(_free.back());
+            _free.pop_back();
+        }
+        _heldBytes += buffer.capacity();
+        _heldBytes -= recycled.capacity();
+        _ringCharge.update(_heldBytes);
+        _pending.push_back(std::move(buffer));
+        buffer.swap(recycled);
+        buffer.clear();
+        _workAvailable.notify_one();
+    }
+
+    void flush() override {
+        waitUntilIdle();
+        _inner->flush();
+    }
+
+    void close() override {
+        stopWriter();
+        _inner->close();
+        std::lock_guard<std::mutex> lock(_mutex);
+        reportFailure();
+    }
+
+    void suppressErrors() override {
+        OutputSink::suppressErrors();
+        _inner->suppressErrors();
+    }
+
+private:
+    void writerLoop() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+            _workAvailable.wait(lock, [this] { return !_pending.empty() || _stopping; });
+            if (_pending.empty()) return; // stopping with nothing left to write
+
+            std::vector<char> buffer = std::move(_pending.front());
+            _pending.pop_front();
+            _busy = true;
+            lock.unlock();
+
+            bool ok = true;
+            try {
+                if (!_failed) _inner->submit(buffer);
+            } catch (...) {
+                ok = false;
+            }
+
+            lock.lock();
+            _busy = false;
+            if (!ok) _failed = true;
+            buffer.clear();
+            _free.push_back(std::move(buffer));
+            _spaceAvailable.notify_all();
+        }
+    }
+
+    void waitUntilIdle() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _spaceAvailable.wait(lock, [this] { return (_pending.empty() && !_busy) || _failed; });
+        reportFailure();
+    }
+
+    void stopWriter() {
+        if (!_writer.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _workAvailable.notify_all();
+        _writer.join();
+    }
+
+    // called with _mutex held
+    void reportFailure() {
+        if (_failed) fail("AsyncOutputSink: writing the output failed");
+    }
+
+    std::unique_ptr<OutputSink> _inner;
+    size_t _ringSize;
+    std::deque<std::vector<char>> _pending;
+    std::vector<std::vector<char>> _free;
+    size_t _heldBytes; // pending, in-flight and free buffers
+    MemoryCharge _ringCharge;
+
+    std::mutex _mutex;
+    std::condition_variable _workAvailable;
+    std::condition_variable _spaceAvailable;
+    std::thread _writer;
+    bool _busy;
+    bool _stopping;
+    bool _failed;
+};
+
+
+#ifdef SAILFISH_HAVE_ZLIB
+/**
+ * Compresses the byte stream into BGZF (blocked gzip, as used by samtools/htslib) and forwards
+ * the compressed bytes to another sink.
+ *
+ * The input is cut into blocks of at most MAX_BLOCK_INPUT bytes; every block is an independent
+ * gzip member, so the blocks of each submitted buffer are deflated in parallel and then written
+ * in order. close() compresses the tail and appends the standard empty EOF block. The output is
+ * a valid multi-member gzip file readable by gzip/zcat, and by bgzip-aware tools as BGZF.
+ */
+class BgzfOutputSink : public OutputSink {
+public:
+    static constexpr size_t MAX_BLOCK_INPUT = 0xff00;
+    static constexpr size_t MAX_BLOCK_SIZE = 0x10000;
+
+    BgzfOutputSink(std::unique_ptr<OutputSink> inner, size_t numThreads = 1, int level = Z_DEFAULT_COMPRESSION)
+        : _inner(std::move(inner)), _numThreads(numThreads), _level(level), _closed(false),
+          _charge(OUTPUT_BUFFERS_MEMORY) {}
+
+    ~BgzfOutputSink() override {
+        suppressErrors();
+        close();
+    }
+
+    void submit(std::vector<char> &buffer) override {
+        _pending.insert(_pending.end(), buffer.begin(), buffer.end());
+        buffer.clear();
+        compressPending(false);
+    }
+
+    void flush() override {
+        compressPending(true);
+        _inner->flush();
+    }
+
+    void close() override {
+        if (_closed) return;
+        _closed = true;
+        compressPending(true);
+        static const unsigned char EOF_BLOCK[28] = {
+            0x1f, 0x8b, 0x08, 0x04, 0, 0, 0, 0, 0, 0xff, 0x06, 0, 0x42, 0x43, 0x02, 0,
+            0x1b, 0, 0x03, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+        _output.assign(reinterpret_cast<const char*>(EOF_BLOCK), reinterpret_cast<const char*>(EOF_BLOCK) + 28);
+        _inner->submit(_output);
+        _inner->close();
+    }
+
+    void suppressErrors() override {
+        OutputSink::suppressErrors();
+        _inner->suppressErrors();
+    }
+
+private:
+    // compress all complete blocks of _pending (and the partial tail if final) and forward them
+    void compressPending(bool final) {
+        const size_t numBlocks = final ? (_pending.size() + MAX_BLOCK_INPUT - 1) / MAX_BLOCK_INPUT
+                                       : _pending.size() / MAX_BLOCK_INPUT;
+        if (numBlocks == 0) return;
+
+        _blocks.resize(std::max(_blocks.size(), numBlocks));
+        const size_t consumed = std::min(_pending.size(), numBlocks * MAX_BLOCK_INPUT);
+        parallelFor(0, numBlocks, _numThreads, [&](size_t block) {
+            const size_t begin = block * MAX_BLOCK_INPUT;
+            const size_t length = std::min(MAX_BLOCK_INPUT, consumed - begin);
+            compressBlock(_pending.data() + begin, length, _blocks[block]);
+        });
+
+        _output.clear();
+        for (size_t block = 0; block < numBlocks; ++block) {
+            _output.insert(_output.end(), _blocks[block].begin(), _blocks[block].end());
+        }
+        _pending.erase(_pending.begin(), _pending.begin() + consumed);
+        _inner->submit(_output);
+
+        size_t bytes = _pending.capacity() + _output.capacity() + _blocks.capacity() * sizeof(std::vector<char>);
+        for (const auto &block : _blocks) bytes += block.capacity();
+        _charge.update(bytes);
+    }
+
+    void compressBlock(const char *data, size_t length, std::vector<char> &block) const {
+        static const unsigned char HEADER[18] = {
+            0x1f, 0x8b, 0x08, 0x04, 0, 0, 0, 0, 0, 0xff, 0x06, 0, 0x42, 0x43, 0x02, 0, 0, 0};
+        block.resize(MAX_BLOCK_SIZE);
+        std::memcpy(block.data(), HEADER, sizeof(HEADER));
+
+        size_t deflated = deflateInto(data, length, block.data() + 18, MAX_BLOCK_SIZE - 18 - 8, _level);
+        if (deflated == 0) {
+            // incompressible input: stored blocks always fit since the input is capped at 0xff00
+            deflated = deflateInto(data, length, block.data() + 18, MAX_BLOCK_SIZE - 18 - 8, Z_NO_COMPRESSION);
+            if (deflated == 0) errorMsg::reportError("BgzfOutputSink: could not compress block");
+        }
+
+        const size_t blockSize = 18 + deflated + 8;
+        const uint16_t bsize = static_cast<uint16_t>(blockSize - 1);
+        block[16] = static_cast<char>(bsize & 0xff);
+        block[17] = static_cast<char>(bsize >> 8);
+
+        const uint32_t crc = static_cast<uint32_t>(crc32(crc32(0L, Z_NULL, 0),
+                                                         reinterpret_cast<const Bytef*>(data),
+                                                         static_cast<uInt>(length)));
+        const uint32_t isize = static_cast<uint32_t>(length);
+        char *trailer = block.data() + 18 + deflated;
+        for (int i = 0; i < 4; ++i) {
+            trailer[i] = static_cast<char>((crc >> (8 * i)) & 0xff);
+            trailer[4 + i] = static_cast<char>((isize >> (8 * i)) & 0xff);
+        }
+        block.resize(blockSize);
+    }
+
+    // raw deflate of data into out; returns the compressed size, 0 if it did not fit
+    static size_t deflateInto(const char *data, size_t length, char *out, size_t capacity, int level) {
+        z_stream stream;
+        std::memset(&stream, 0, sizeof(stream));
+        if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            errorMsg::reportError("BgzfOutputSink: deflateInit2 failed");
+        }
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        stream.avail_in = static_cast<uInt>(length);
+        stream.next_out = reinterpret_cast<Bytef*>(out);
+        stream.avail_out = static_cast<uInt>(capacity);
+        const int status = deflate(&stream, Z_FINISH);
+        const size_t produced = capacity - stream.avail_out;
+        deflateEnd(&stream);
+        return status == Z_STREAM_END ? produced : 0;
+    }
+
+    std::unique_ptr<OutputSink> _inner;
+    size_t _numThreads;
+    int _level;
+    bool _closed;
+    std::vector<char> _pending;
+    std::vector<std::vector<char>> _blocks;
+    std::vector<char> _output;
+    MemoryCharge _charge;
+};
+#endif
+
+
+/**
+ * Open filePath for output, optionally compressed to BGZF and/or behind a writer thread.
+ * Compression runs on the writer thread when async, using numThreads threads for the blocks.
+ * @return nullptr if the file could not be opened
+ */
+inline std::unique_ptr<OutputSink> openOutputSink(const std::string &filePath, bool async,
+                                                  bool compress = false, size_t numThreads = 1) {
+    auto fileSink = std::make_unique<FileOutputSink>(filePath, compress);
+    if (!fileSink->isOpen()) return nullptr;
+
+    std::unique_ptr<OutputSink> sink = std::move(fileSink);
+    if (compress) {
+#ifdef SAILFISH_HAVE_ZLIB
+        sink = std::make_unique<BgzfOutputSink>(std::move(sink), numThreads);
+#else
+        errorMsg::reportError("BGZF output is not available: Sailfish was built without zlib");
+#endif
+    }
+    if (!async) return sink;
+    return std::make_unique<AsyncOutputSink>(std::move(sink));
+}
+
+#endif
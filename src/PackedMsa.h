@@ -0,0 +1,524 @@
+#ifndef ___PACKED_MSA
+#define ___PACKED_MSA
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "OutputSink.h"
+
+/**
+ * Packed binary MSA format (.sfmsa).
+ *
+ * A fixed 128 byte header is followed by six sections, each starting on an 8 byte boundary:
+ *   name index      uint64[numSequences + 1]  byte offsets into the name data
+ *   name data       the concatenated sequence names
+ *   gap index       uint64[numSequences + 1]  offsets into the gap runs (CSR row pointers)
+ *   gap runs        int32 runs as in MSA::_alignedSequence: negative entries are gap runs,
+ *                   positive entries are runs of residues
+ *   residue index   uint64[numSequences + 1]  residue offsets; row r starts at bit
+ *                   residueIndex[r] * bitsPerResidue of the residue data
+ *   residue data    alphabet codes packed LSB first into uint64 words (2 bits for
+ *                   nucleotides, 5 for amino acids), followed by one zero padding word
+ * Only residues are stored, gaps are described by the runs alone. An alignment simulated
+ * without substitutions has alphabetSize 0 and no residue data.
+ *
+ * All values are in the byte order of the machine that wrote the file; byteOrderMark lets a
+ * reader detect a mismatch. The layout is fixed so the file can be mapped and used in place.
+ */
+struct PackedMsaHeader {
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+    static constexpr size_t MAX_ALPHABET_SIZE = 32;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrderMark;
+    uint64_t numSequences;
+    uint64_t msaLength;
+    uint32_t alphabetSize;
+    uint32_t bitsPerResidue;
+    char alphabet[MAX_ALPHABET_SIZE]; // output character of every code
+    uint64_t nameIndexOffset;
+    uint64_t nameDataOffset;
+    uint64_t gapIndexOffset;
+    uint64_t gapRunsOffset;
+    uint64_t residueIndexOffset;
+    uint64_t residueDataOffset;
+    uint64_t fileSize;
+};
+static_assert(sizeof(PackedMsaHeader) == 128, "the packed MSA header layout is part of the format");
+
+static const char PACKED_MSA_MAGIC[8] = {'S', 'F', 'P', 'K', 'M', 'S', 'A', '\0'};
+
+/**
+ * Bits needed for the codes 0..alphabetSize-1 (0 when there are no residues).
+ */
+inline uint32_t packedBitsPerResidue(size_t alphabetSize) {
+    uint32_t bits = 0;
+    while ((size_t(1) << bits) < alphabetSize) ++bits;
+    return bits;
+}
+
+inline uint64_t alignTo8(uint64_t offset) {
+    return (offset + 7) & ~uint64_t(7);
+}
+
+
+/**
+ * Write an alignment in the packed format.
+ *
+ * Rows are described through callbacks so both MSA implementations can write without copying
+ * their rows: nameOf(row) returns the name, gapRunsOf(row) the runs of the row and
+ * residuesOf(row) an indexable sequence of alphabet codes spanning the whole MSA length,
+ * where gap runs skip over the entries they cover (as in MsaRenderer and
+ * FastaWriter::writeAlignedRow). residuesOf is not called when alphabet is empty.
+ *
+ * @param alphabet - output character of every code, empty for alignments without residues
+ * @return false if the file could not be opened
+ */
+template<typename NameOf, typename GapRunsOf, typename ResiduesOf>
+bool writePackedMsa(const std::string &filePath, size_t numSequences, size_t msaLength,
+                    const std::string &alphabet, NameOf &&nameOf, GapRunsOf &&gapRunsOf,
+                    ResiduesOf &&residuesOf) {
+    if (alphabet.size() > PackedMsaHeader::MAX_ALPHABET_SIZE) {
+        errorMsg::reportError("writePackedMsa: alphabets of more than 32 characters are not supported");
+    }
+
+    // first pass: section sizes
+    uint64_t nameBytes = 0;
+    uint64_t totalRuns = 0;
+    uint64_t totalResidues = 0;
+    for (size_t row = 0; row < numSequences; ++row) {
+        nameBytes += nameOf(row).size();
+        const std::vector<int> &runs = gapRunsOf(row);
+        totalRuns += runs.size();
+        for (int run : runs) {
+            if (run > 0) totalResidues += run;
+        }
+    }
+
+    PackedMsaHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, PACKED_MSA_MAGIC, sizeof(header.magic));
+    header.version = PackedMsaHeader::VERSION;
+    header.byteOrderMark = PackedMsaHeader::BYTE_ORDER_MARK;
+    header.numSequences = numSequences;
+    header.msaLength = msaLength;
+    header.alphabetSize = static_cast<uint32_t>(alphabet.size());
+    header.bitsPerResidue = packedBitsPerResidue(alphabet.size());
+    std::memcpy(header.alphabet, alphabet.data(), alphabet.size());
+
+    const uint64_t indexBytes = (numSequences + 1) * sizeof(uint64_t);
+    const uint64_t residueWords = header.bitsPerResidue == 0 ? 0
+                                : (totalResidues * header.bitsPerResidue + 63) / 64 + 1;
+    header.nameIndexOffset = sizeof(PackedMsaHeader);
+    header.nameDataOffset = header.nameIndexOffset + indexBytes;
+    header.gapIndexOffset = alignTo8(header.nameDataOffset + nameBytes);
+    header.gapRunsOffset = header.gapIndexOffset + indexBytes;
+    header.residueIndexOffset = alignTo8(header.gapRunsOffset + totalRuns * sizeof(int32_t));
+    header.residueDataOffset = header.residueIndexOffset + indexBytes;
+    header.fileSize = header.residueDataOffset + residueWords * sizeof(uint64_t);
+
+    // second pass: the sections in file order, written behind a writer thread
+    auto fileSink = std::make_unique<FileOutputSink>(filePath, true);
+    if (!fileSink->isOpen()) return false;
+    AsyncOutputSink sink(std::move(fileSink));
+
+    std::vector<char> buffer;
+    buffer.reserve(size_t(1) << 22);
+    uint64_t written = 0;
+    auto append = [&](const void *bytes, size_t count) {
+        const char *begin = static_cast<const char*>(bytes);
+        buffer.insert(buffer.end(), begin, begin + count);
+        written += count;
+        if (buffer.size() >= (size_t(1) << 22)) sink.submit(buffer);
+    };
+    auto padTo = [&](uint64_t offset) {
+        static const char zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        append(zeros, static_cast<size_t>(offset - written));
+    };
+    auto appendIndex = [&](auto &&countOf) {
+        uint64_t position = 0;
+        append(&position, sizeof(position));
+        for (size_t row = 0; row < numSequences; ++row) {
+            position += countOf(row);
+            append(&position, sizeof(position));
+        }
+    };
+    auto residueCount = [&](size_t row) {
+        uint64_t count = 0;
+        for (int run : gapRunsOf(row)) {
+            if (run > 0) count += run;
+        }
+        return count;
+    };
+
+    append(&header, sizeof(header));
+
+    appendIndex([&](size_t row) { return nameOf(row).size(); });
+    for (size_t row = 0; row < numSequences; ++row) {
+        const std::string &name = nameOf(row);
+        append(name.data(), name.size());
+    }
+
+    padTo(header.gapIndexOffset);
+    appendIndex([&](size_t row) { return gapRunsOf(row).size(); });
+    for (size_t row = 0; row < numSequences; ++row) {
+        for (int run : gapRunsOf(row)) {
+            const int32_t value = run;
+            append(&value, sizeof(value));
+        }
+    }
+
+    padTo(header.residueIndexOffset);
+    appendIndex(residueCount);
+
+    if (header.bitsPerResidue > 0) {
+        const uint32_t bits = header.bitsPerResidue;
+        const uint64_t mask = (uint64_t(1) << bits) - 1;
+        uint64_t word = 0;
+        uint32_t filled = 0;
+        for (size_t row = 0; row < numSequences; ++row) {
+            const auto &residues = residuesOf(row);
+            size_t site = 0;
+            for (int run : gapRunsOf(row)) {
+                if (run < 0) {
+                    site += -run;
+                    continue;
+                }
+                for (size_t end = site + run; site < end; ++site) {
+                    const uint64_t code = static_cast<uint64_t>(residues[site]) & mask;
+                    word |= code << filled;
+                    filled += bits;
+                    if (filled >= 64) {
+                        append(&word, sizeof(word));
+                        filled -= 64;
+                        // the bits of code that did not fit start the next word
+                        word = filled > 0 ? code >> (bits - filled) : 0;
+                    }
+                }
+            }
+        }
+        if (filled > 0) append(&word, sizeof(word));
+        padTo(header.fileSize);
+    }
+
+    sink.submit(buffer);
+    sink.close();
+    return written == header.fileSize;
+}
+
+
+/**
+ * Read-only view of a packed MSA file.
+ *
+ * The file is memory mapped and every accessor reads the mapping in place, so opening an
+ * alignment costs a header check regardless of its size and only the pages actually touched
+ * are read from disk. Opening checks the header and the row indices; the runs of a row are
+ * checked when it is decoded, verify() checks all of them up front. On Windows the file is read
+ * into memory instead of being mapped. Malformed files raise std::runtime_error.
+ */
+class PackedMsaReader {
+public:
+    explicit PackedMsaReader(const std::string &filePath) : _data(nullptr), _size(0) {
+        mapFile(filePath);
+        try {
+            validate();
+        } catch (...) {
+            unmapFile();
+            throw;
+        }
+    }
+
+    PackedMsaReader(const PackedMsaReader&) = delete;
+    PackedMsaReader& operator=(const PackedMsaReader&) = delete;
+
+    ~PackedMsaReader() {
+        unmapFile();
+    }
+
+    size_t getNumberOfSequences() const { return _header.numSequences; }
+    size_t getMSAlength() const { return _header.msaLength; }
+    size_t getAlphabetSize() const { return _header.alphabetSize; }
+    size_t getBitsPerResidue() const { return _header.bitsPerResidue; }
+    std::string getAlphabet() const { return std::string(_header.alphabet, _header.alphabetSize); }
+
+    std::string getName(size_t row) const {
+        checkRow(row);
+        const uint64_t *index = section<uint64_t>(_header.nameIndexOffset);
+        return std::string(section<char>(_header.nameDataOffset) + index[row], index[row + 1] - index[row]);
+    }
+
+    std::vector<std::string> getNames() const {
+        std::vector<std::string> names;
+        names.reserve(_header.numSequences);
+        for (size_t row = 0; row < _header.numSequences; ++row) names.push_back(getName(row));
+        return names;
+    }
+
+    /**
+     * Runs of the row, in place in the mapping; negative runs are gaps.
+     */
+    const int32_t* getGapRuns(size_t row) const {
+        checkRow(row);
+        return section<int32_t>(_header.gapRunsOffset) + section<uint64_t>(_header.gapIndexOffset)[row];
+    }
+
+    size_t getNumberOfGapRuns(size_t row) const {
+        checkRow(row);
+        const uint64_t *index = section<uint64_t>(_header.gapIndexOffset);
+        return index[row + 1] - index[row];
+    }
+
+    size_t getNumberOfResidues(size_t row) const {
+        checkRow(row);
+        const uint64_t *index = section<uint64_t>(_header.residueIndexOffset);
+        return index[row + 1] - index[row];
+    }
+
+    /**
+     * Index of the first residue of the row among all residues; it starts at bit
+     * getResidueOffset(row) * getBitsPerResidue() of the packed residues.
+     */
+    size_t getResidueOffset(size_t row) const {
+        checkRow(row);
+        return section<uint64_t>(_header.residueIndexOffset)[row];
+    }
+
+    /**
+     * Alphabet code of the i-th residue (not column) of the row.
+     */
+    uint32_t getResidue(size_t row, size_t i) const {
+        if (i >= getNumberOfResidues(row)) throw std::out_of_range("PackedMsaReader: residue out of range");
+        return codeAt((section<uint64_t>(_header.residueIndexOffset)[row] + i) * _header.bitsPerResidue);
+    }
+
+    /**
+     * Render row into out, which must hold getMSAlength() characters. Alignments without
+     * residues render residues as 'A', like the MSA string writers.
+     */
+    void decodeRow(size_t row, char *out) const {
+        const int32_t *runs = getGapRuns(row);
+        const size_t numRuns = getNumberOfGapRuns(row);
+        const uint32_t bits = _header.bitsPerResidue;
+        uint64_t bit = section<uint64_t>(_header.residueIndexOffset)[row] * bits;
+        uint64_t residuesLeft = getNumberOfResidues(row);
+        uint64_t columnsLeft = _header.msaLength;
+        char lookup[PackedMsaHeader::MAX_ALPHABET_SIZE];
+        std::memcpy(lookup, _header.alphabet, sizeof(lookup));
+
+        for (size_t r = 0; r < numRuns; ++r) {
+            const int32_t run = runs[r];
+            const uint64_t length = run < 0 ? -static_cast<int64_t>(run) : run;
+            if (length > columnsLeft || (run > 0 && length > residuesLeft)) fail(rowMismatch(row));
+            columnsLeft -= length;
+            if (run < 0) {
+                std::memset(out, '-', length);
+                out += length;
+                continue;
+            }
+            residuesLeft -= length;
+            if (bits == 0) {
+                std::memset(out, 'A', length);
+                out += length;
+            } else {
+                for (uint64_t i = 0; i < length; ++i, bit += bits) *out++ = lookup[codeAt(bit)];
+            }
+        }
+        if (columnsLeft != 0 || residuesLeft != 0) fail(rowMismatch(row));
+    }
+
+    std::string getRow(size_t row) const {
+        std::string text(_header.msaLength, '\0');
+        decodeRow(row, &text[0]);
+        return text;
+    }
+
+    /**
+     * The whole alignment as FASTA text, as written by MSA::writeFullMsa.
+     */
+    std::string toFasta() const {
+        std::string fasta;
+        for (size_t row = 0; row < _header.numSequences; ++row) {
+            fasta += ">" + getName(row) + "\n";
+            fasta += getRow(row);
+            fasta += "\n";
+        }
+        return fasta;
+    }
+
+    /**
+     * Check that the runs of every row add up to the alignment length and to the residues
+     * stored for the row.
+     */
+    void verify() const {
+        const int32_t *runs = gapRunsData();
+        const uint64_t *gapIndex = section<uint64_t>(_header.gapIndexOffset);
+        for (size_t row = 0; row < _header.numSequences; ++row) {
+            uint64_t columns = 0;
+            uint64_t residues = 0;
+            for (uint64_t r = gapIndex[row]; r < gapIndex[row + 1]; ++r) {
+                columns += runs[r] < 0 ? -static_cast<int64_t>(runs[r]) : runs[r];
+                if (runs[r] > 0) residues += runs[r];
+            }
+            if (columns != _header.msaLength || residues != getNumberOfResidues(row)) fail(rowMismatch(row));
+        }
+    }
+
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
+
+    const int32_t* gapRunsData() const { return section<int32_t>(_header.gapRunsOffset); }
+    size_t totalGapRuns() const { return section<uint64_t>(_header.gapIndexOffset)[_header.numSequences]; }
+    const uint64_t* residueData() const { return section<uint64_t>(_header.residueDataOffset); }
+    size_t residueDataWords() const {
+        return (_header.fileSize - _header.residueDataOffset) / sizeof(uint64_t);
+    }
+
+private:
+    template<typename T>
+    const T* section(uint64_t offset) const {
+        return reinterpret_cast<const T*>(_data + offset);
+    }
+
+    // code starting at the given bit of the residue data; the padding word makes word + 1 valid
+    uint32_t codeAt(uint64_t bit) const {
+        const uint64_t *words = section<uint64_t>(_header.residueDataOffset);
+        const uint64_t word = bit >> 6;
+        const uint32_t shift = static_cast<uint32_t>(bit & 63);
+        uint64_t value = words[word] >> shift;
+        if (shift + _header.bitsPerResidue > 64) value |= words[word + 1] << (64 - shift);
+        return static_cast<uint32_t>(value & ((uint64_t(1) << _header.bitsPerResidue) - 1));
+    }
+
+    void checkRow(size_t row) const {
+        if (row >= _header.numSequences) throw std::out_of_range("PackedMsaReader: row out of range");
+    }
+
+    void fail(const std::string &what) const {
+        throw std::runtime_error("PackedMsaReader: " + what);
+    }
+
+    void validate() {
+        if (_size < sizeof(PackedMsaHeader)) fail("file is too short to be a packed MSA");
+        std::memcpy(&_header, _data, sizeof(_header));
+        if (std::memcmp(_header.magic, PACKED_MSA_MAGIC, sizeof(_header.magic)) != 0) fail("not a packed MSA file");
+        if (_header.byteOrderMark != PackedMsaHeader::BYTE_ORDER_MARK) fail("file was written with a different byte order");
+        if (_header.version != PackedMsaHeader::VERSION) fail("unsupported format version " + std::to_string(_header.version));
+        if (_header.fileSize != _size) fail("file is truncated");
+        if (_header.alphabetSize > PackedMsaHeader::MAX_ALPHABET_SIZE ||
+            _header.bitsPerResidue != packedBitsPerResidue(_header.alphabetSize)) {
+            fail("invalid alphabet");
+        }
+
+        // sections in file order, each bounded by the next; sizes are compared by subtraction so
+        // that crafted counts and offsets cannot wrap around
+        const uint64_t sections[] = {sizeof(PackedMsaHeader), _header.nameIndexOffset, _header.nameDataOffset,
+                                     _header.gapIndexOffset, _header.gapRunsOffset, _header.residueIndexOffset,
+                                     _header.residueDataOffset, _size};
+        for (size_t i = 1; i < sizeof(sections) / sizeof(sections[0]); ++i) {
+            if (sections[i] < sections[i - 1]) fail("sections out of order or out of range");
+        }
+        const uint64_t alignedOffsets[] = {_header.nameIndexOffset, _header.gapIndexOffset, _header.gapRunsOffset,
+                                           _header.residueIndexOffset, _header.residueDataOffset};
+        for (uint64_t offset : alignedOffsets) {
+            if (offset % 8 != 0) fail("misaligned section");
+        }
+        const uint64_t numSequences = _header.numSequences;
+        if (numSequences >= (_size - sizeof(PackedMsaHeader)) / sizeof(uint64_t)) fail("too many sequences for the file size");
+        const uint64_t indexBytes = (numSequences + 1) * sizeof(uint64_t);
+        if (indexBytes > _header.nameDataOffset - _header.nameIndexOffset ||
+            indexBytes > _header.gapRunsOffset - _header.gapIndexOffset ||
+            indexBytes > _header.residueDataOffset - _header.residueIndexOffset) {
+            fail("index out of range");
+        }
+
+        // every row must stay inside its sections and span exactly msaLength columns
+        const uint64_t *nameIndex = section<uint64_t>(_header.nameIndexOffset);
+        const uint64_t *gapIndex = section<uint64_t>(_header.gapIndexOffset);
+        const uint64_t *residueIndex = section<uint64_t>(_header.residueIndexOffset);
+        if (nameIndex[numSequences] > _header.gapIndexOffset - _header.nameDataOffset ||
+            gapIndex[numSequences] > (_header.residueIndexOffset - _header.gapRunsOffset) / sizeof(int32_t)) {
+            fail("section sizes do not match the header");
+        }
+        const uint64_t residueWords = residueDataWords();
+        if (_header.bitsPerResidue > 0 &&
+            (residueWords == 0 || residueIndex[numSequences] > (residueWords - 1) * 64 / _header.bitsPerResidue)) {
+            fail("residue data is truncated");
+        }
+        for (uint64_t row = 0; row < numSequences; ++row) {
+            if (nameIndex[row] > nameIndex[row + 1] || gapIndex[row] > gapIndex[row + 1] ||
+                residueIndex[row] > residueIndex[row + 1]) {
+                fail("row indices are not increasing");
+            }
+        }
+    }
+
+    std::string rowMismatch(size_t row) const {
+        return "runs of row " + std::to_string(row) + " do not match the alignment length";
+    }
+
+#ifdef _WIN32
+    void mapFile(const std::string &filePath) {
+        std::ifstream file(filePath, std::ios::in | std::ios::binary | std::ios::ate);
+        if (!file.is_open()) fail("could not open " + filePath);
+        _size = static_cast<size_t>(file.tellg());
+        // uint64 storage keeps the sections 8 byte aligned
+        _fallback.resize((_size + 7) / 8);
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(_fallback.data()), static_cast<std::streamsize>(_size));
+        if (!file) fail("could not read " + filePath);
+        _data = reinterpret_cast<const char*>(_fallback.data());
+    }
+
+    void unmapFile() {
+        _fallback.clear();
+        _data = nullptr;
+    }
+
+    std::vector<uint64_t> _fallback;
+#else
+    void mapFile(const std::string &filePath) {
+        const int descriptor = ::open(filePath.c_str(), O_RDONLY);
+        if (descriptor < 0) fail("could not open " + filePath);
+        struct stat status;
+        if (::fstat(descriptor, &status) != 0) {
+            ::close(descriptor);
+            fail("could not stat " + filePath);
+        }
+        _size = static_cast<size_t>(status.st_size);
+        if (_size == 0) {
+            ::close(descriptor);
+            fail("file is too short to be a packed MSA");
+        }
+        void *mapping = ::mmap(nullptr, _size, PROT_READ, MAP_SHARED, descriptor, 0);
+        ::close(descriptor);
+        if (mapping == MAP_FAILED) fail("could not map " + filePath);
+        _data = static_cast<const char*>(mapping);
+    }
+
+    void unmapFile() {
+        if (_data != nullptr) ::munmap(const_cast<char*>(_data), _size);
+        _data = nullptr;
+    }
+#endif
+
+    const char *_data;
+    size_t _size;
+    PackedMsaHeader _header;
+};
+
+#endif
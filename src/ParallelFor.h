@@ -0,0 +1,77 @@
+#ifndef ___PARALLEL_FOR
+#define ___PARALLEL_FOR
+
+#include <vector>
+#include <thread>
+#include <exception>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+/**
+ * Minimal fork-join helpers shared by the parallel parts of the simulator.
+ *
+ * parallelFor splits [begin, end) into one contiguous block per thread and calls
+ * body(index) for every index; the first exception thrown by a worker is rethrown
+ * on the calling thread once all workers joined. With a single thread the loop runs
+ * inline, so serial callers pay nothing.
+ */
+
+/**
+ * Number of threads to use for a requested setting: 0 means one per hardware thread.
+ */
+inline size_t resolveThreadCount(size_t requested) {
+    if (requested > 0) return requested;
+    size_t hardware = std::thread::hardware_concurrency();
+    return hardware > 0 ? hardware : 1;
+}
+
+/**
+ * Seed of the index-th independent random stream derived from base (splitmix64 finalizer).
+ * Streams depend only on (base, index), so results do not depend on how work is
+ * scheduled over threads.
+ */
+inline uint64_t streamSeed(uint64_t base, uint64_t index) {
+    uint64_t z = base + (index + 1) * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+template<typename Body>
+void parallelFor(size_t begin, size_t end, size_t numThreads, Body &&body) {
+    if (end <= begin) return;
+    const size_t count = end - begin;
+    numThreads = std::min(resolveThreadCount(numThreads), count);
+
+    if (numThreads <= 1) {
+        for (size_t i = begin; i < end; ++i) body(i);
+        return;
+    }
+
+    std::vector<std::exception_ptr> errors(numThreads);
+    std::vector<std::thread> workers;
+    workers.reserve(numThreads - 1);
+
+    auto runBlock = [&](size_t worker) {
+        const size_t blockBegin = begin + (count * worker) / numThreads;
+        const size_t blockEnd = begin + (count * (worker + 1)) / numThreads;
+        try {
+            for (size_t i = blockBegin; i < blockEnd; ++i) body(i);
+        } catch (...) {
+            errors[worker] = std::current_exception();
+        }
+    };
+
+    for (size_t worker = 1; worker < numThreads; ++worker) {
+        workers.emplace_back(runBlock, worker);
+    }
+    runBlock(0);
+    for (auto &thread: workers) thread.join();
+
+    for (auto &error: errors) {
+        if (error) std::rethrow_exception(error);
+    }
+}
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef ___RATE_MATRIX_EIGEN
+#define ___RATE_MATRIX_EIGEN
+
+#include <array>
+#include <cmath>
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+#include "../libs/Phylolib/includes/stochasticProcess.h"
+
+/**
+ * Eigendecomposition of a time-reversible rate matrix, for computing whole transition
+ * matrices P(t) = exp(Qt) at once instead of one Pij_t call per entry.
+ *
+ * With pi the stationary frequencies and D = diag(pi), reversibility makes
+ * S = D^1/2 Q D^-1/2 symmetric, so S = U diag(lambda) U^T with U orthogonal and
+ * P(t) = (D^-1/2 U) diag(exp(lambda t)) (U^T D^1/2). The decomposition is done once per
+ * model (cyclic Jacobi rotations, exact to rounding for the small matrices used here);
+ * every P(t) then costs one scaled N x N matrix product.
+ */
+template<size_t AlphabetSize>
+class RateMatrixEigen {
+public:
+    static constexpr size_t N = AlphabetSize;
+    static constexpr size_t MATRIX_SIZE = N * N;
+
+    // relative asymmetry of pi_i Q_ij against pi_j Q_ji tolerated as rounding
+    static constexpr double REVERSIBILITY_TOLERANCE = 1e-8;
+
+    // largest difference to Pij_t at the probe times accepted by matches
+    static constexpr double PROBE_TOLERANCE = 1e-4;
+
+    RateMatrixEigen() : _valid(false) {}
+
+    /**
+     * Decompose the rate matrix of sp.
+     * @return false, leaving the decomposition unusable, if the process is not time
+     *         reversible or has a zero frequency
+     */
+    bool decompose(const stochasticProcess &sp) {
+        _valid = false;
+        std::array<double, N> sqrtPi;
+        for (size_t i = 0; i < N; ++i) {
+            const double pi = sp.freq(static_cast<int>(i));
+            if (!(pi > 0.0)) return false;
+            sqrtPi[i] = std::sqrt(pi);
+        }
+
+        std::vector<double> symmetric(MATRIX_SIZE);
+        for (size_t i = 0; i < N; ++i) {
+            for (size_t j = i; j < N; ++j) {
+                const double forward = sp.freq(static_cast<int>(i)) * sp.Qij(static_cast<int>(i), static_cast<int>(j));
+                const double backward = sp.freq(static_cast<int>(j)) * sp.Qij(static_cast<int>(j), static_cast<int>(i));
+                if (std::abs(forward - backward) > REVERSIBILITY_TOLERANCE * std::max(std::abs(forward), std::abs(backward))) {
+                    return false;
+                }
+                // pi_i Q_ij / sqrt(pi_i pi_j) = sqrt(pi_i / pi_j) Q_ij
+                const double value = 0.5 * (forward + backward) / (sqrtPi[i] * sqrtPi[j]);
+                symmetric[i * N + j] = value;
+                symmetric[j * N + i] = value;
+            }
+        }
+
+        std::vector<double> vectors(MATRIX_SIZE, 0.0);
+        for (size_t i = 0; i < N; ++i) vectors[i * N + i] = 1.0;
+        jacobi(symmetric, vectors);
+
+        _left.resize(MATRIX_SIZE);
+        _right.resize(MATRIX_SIZE);
+        for (size_t i = 0; i < N; ++i) {
+            _eigenvalues[i] = symmetric[i * N + i];
+            for (size_t k = 0; k < N; ++k) {
+                _left[i * N + k] = vectors[i * N + k] / sqrtPi[i];
+                _right[k * N + i] = vectors[i * N + k] * sqrtPi[i];
+            }
+        }
+        _valid = true;
+        return true;
+    }
+
+    bool isValid() const { return _valid; }
+
+    /**
+     * True if the decomposition describes the same process as the Pij_t of sp, which is
+     * not the case when Qij is given on another scale than Pij_t.
+     */
+    bool matches(const stochasticProcess &sp) const {
+        if (!_valid) return false;
+        const double probeTimes[2] = {0.1, 1.0};
+        std::vector<double> matrices(2 * MATRIX_SIZE);
+        transitionMatrices(probeTimes, 2, matrices.data());
+        for (size_t m = 0; m < 2; ++m) {
+            for (size_t i = 0; i < N; ++i) {
+                for (size_t j = 0; j < N; ++j) {
+                    const double expected = sp.Pij_t(static_cast<int>(i), static_cast<int>(j), probeTimes[m]);
+                    if (std::abs(matrices[(m * N + i) * N + j] - expected) > PROBE_TOLERANCE) return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    const std::array<double, N>& eigenvalues() const { return _eigenvalues; }
+
+    /**
+     * P(t) for every t of times, written row-major, MATRIX_SIZE values per time, to out.
+     * Entries below zero by rounding are clamped to zero.
+     */
+    void transitionMatrices(const double *times, size_t count, double *out) const {
+        std::array<double, MATRIX_SIZE> scaled;
+        for (size_t m = 0; m < count; ++m) {
+            std::array<double, N> decay;
+            for (size_t k = 0; k < N; ++k) decay[k] = std::exp(_eigenvalues[k] * times[m]);
+            for (size_t i = 0; i < MATRIX_SIZE; ++i) scaled[i] = _left[i] * decay[i % N];
+
+            double *matrix = out + m * MATRIX_SIZE;
+            std::fill(matrix, matrix + MATRIX_SIZE, 0.0);
+            for (size_t i = 0; i < N; ++i) {
+                double *row = matrix + i * N;
+                for (size_t k = 0; k < N; ++k) {
+                    const double weight = scaled[i * N + k];
+                    const double *rightRow = _right.data() + k * N;
+                    for (size_t j = 0; j < N; ++j) row[j] += weight * rightRow[j];
+                }
+                for (size_t j = 0; j < N; ++j) row[j] = std::max(row[j], 0.0);
+            }
+        }
+    }
+
+private:
+    // cyclic Jacobi: diagonalizes a (symmetric, in place) and accumulates the rotations
+    // into the columns of vectors
+    static void jacobi(std::vector<double> &a, std::vector<double> &vectors) {
+        const size_t MAX_SWEEPS = 100;
+        for (size_t sweep = 0; sweep < MAX_SWEEPS; ++sweep) {
+            double offDiagonal = 0.0;
+            double diagonal = 0.0;
+            for (size_t i = 0; i < N; ++i) {
+                diagonal += a[i * N + i] * a[i * N + i];
+                for (size_t j = i + 1; j < N; ++j) offDiagonal += a[i * N + j] * a[i * N + j];
+            }
+            if (offDiagonal <= 1e-30 * diagonal || offDiagonal == 0.0) return;
+
+            for (size_t p = 0; p < N; ++p) {
+                for (size_t q = p + 1; q < N; ++q) {
+                    const double apq = a[p * N + q];
+                    if (apq == 0.0) continue;
+                    const double theta = (a[q * N + q] - a[p * N + p]) / (2.0 * apq);
+                    const double t = (theta >= 0 ? 1.0 : -1.0) / (std::abs(theta) + std::sqrt(theta * theta + 1.0));
+                    const double c = 1.0 / std::sqrt(t * t + 1.0);
+                    const double s = t * c;
+                    for (size_t k = 0; k < N; ++k) {
+                        const double akp = a[k * N + p];
+                        const double akq = a[k * N + q];
+                        a[k * N + p] = c * akp - s * akq;
+                        a[k * N + q] = s * akp + c * akq;
+                    }
+                    for (size_t k = 0; k < N; ++k) {
+                        const double apk = a[p * N + k];
+                        const double aqk = a[q * N + k];
+                        a[p * N + k] = c * apk - s * aqk;
+                        a[q * N + k] = s * apk + c * aqk;
+                    }
+                    for (size_t k = 0; k < N; ++k) {
+                        const double vkp = vectors[k * N + p];
+                        const double vkq = vectors[k * N + q];
+                        vectors[k * N + p] = c * vkp - s * vkq;
+                        vectors[k * N + q] = s * vkp + c * vkq;
+                    }
+                }
+            }
+        }
+    }
+
+    bool _valid;
+    std::array<double, N> _eigenvalues;
+    std::vector<double> _left;  // D^-1/2 U
+    std::vector<double> _right; // U^T D^1/2
+};
+
+#endif
@@ -16,6 +16,10 @@ struct CompressedSequence {
     std::vector<std::pair<size_t, size_t>> runs; // (start_position, length)
     size_t nodeID;
     size_t uncompressedSize;
+
+    size_t memoryUsage() const {
+        return sizeof(CompressedSequence) + runs.capacity() * sizeof(runs[0]);
+    }
 };
 
 class Sequence
@@ -139,6 +143,10 @@ public:
         return _sequence.size();
     }
 
+    size_t memoryUsage() const {
+        return _sequence.capacity() * sizeof(iteratorType);
+    }
+
     iteratorType getPos(size_t pos) {
         return _sequence[pos];
     }
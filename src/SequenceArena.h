@@ -0,0 +1,141 @@
+#ifndef ___SEQUENCE_ARENA
+#define ___SEQUENCE_ARENA
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+
+#include "MemoryAccounting.h"
+
+/**
+ * Simulated sequences stored as one contiguous block of alphabet codes, rows x columns,
+ * one uint8 per site (codes outside 0..255, such as unknown characters, do not fit).
+ *
+ * Rows keep the order in which sequences were added, like the rows of a sequenceContainer,
+ * and are found by node id through rowOfId. Names are interned per node id: replicates on
+ * the same tree reuse the stored names, and reset() keeps every allocation, so refilling an
+ * arena does not touch the heap. The codes and ids can be exported as arrays without
+ * copying (see ArrayView.h).
+ */
+class SequenceArena {
+public:
+    static constexpr int64_t NO_ROW = -1;
+
+    SequenceArena() : _numColumns(0), _nameBytes(0), _charge(SUBSTITUTION_SEQUENCES_MEMORY) {}
+
+    /**
+     * Drop all rows and set the row length; allocated storage is kept for reuse.
+     */
+    void reset(size_t numColumns) {
+        _numColumns = numColumns;
+        _codes.clear();
+        _ids.clear();
+        std::fill(_idToRow.begin(), _idToRow.end(), NO_ROW);
+    }
+
+    void reserveRows(size_t numRows) {
+        _codes.reserve(numRows * _numColumns);
+        _ids.reserve(numRows);
+        _charge.update(memoryUsage());
+    }
+
+    /**
+     * Append a row for node id and return it for the caller to fill with numColumns codes.
+     */
+    uint8_t* addRow(size_t id, const std::string &name) {
+        if (id >= _idToRow.size()) {
+            _idToRow.resize(id + 1, NO_ROW);
+            _nameOfId.resize(id + 1);
+        }
+        if (_idToRow[id] != NO_ROW) throw std::invalid_argument("SequenceArena: node " + std::to_string(id) + " was already added");
+        _idToRow[id] = static_cast<int64_t>(_ids.size());
+        _ids.push_back(id);
+        if (_nameOfId[id] != name) {
+            _nameBytes -= heapBytes(_nameOfId[id]);
+            _nameOfId[id] = name;
+            _nameBytes += heapBytes(_nameOfId[id]);
+        }
+        _codes.resize(_codes.size() + _numColumns);
+        _charge.update(memoryUsage());
+        return _codes.data() + _codes.size() - _numColumns;
+    }
+
+    /**
+     * Append a copy of a Phylolib sequence (id, name and codes).
+     */
+    template<typename Sequence>
+    void addSequence(const Sequence &sequence) {
+        if (static_cast<size_t>(sequence.seqLen()) != _numColumns) {
+            throw std::invalid_argument("SequenceArena: sequence length does not match the arena");
+        }
+        uint8_t *row = addRow(sequence.id(), sequence.name());
+        for (size_t site = 0; site < _numColumns; ++site) row[site] = static_cast<uint8_t>(sequence[site]);
+    }
+
+    size_t numRows() const { return _ids.size(); }
+    size_t numColumns() const { return _numColumns; }
+
+    const uint8_t* codes() const { return _codes.data(); }
+    const uint8_t* row(size_t row) const { return _codes.data() + row * _numColumns; }
+    uint8_t* row(size_t row) { return _codes.data() + row * _numColumns; }
+
+    size_t id(size_t row) const { return _ids[row]; }
+    const std::vector<uint64_t>& ids() const { return _ids; }
+    const std::string& name(size_t row) const { return _nameOfId[_ids[row]]; }
+
+    std::vector<std::string> names() const {
+        std::vector<std::string> result;
+        result.reserve(_ids.size());
+        for (uint64_t id : _ids) result.push_back(_nameOfId[id]);
+        return result;
+    }
+
+    /**
+     * Row of node id, NO_ROW if it was not saved.
+     */
+    int64_t rowOfId(size_t id) const {
+        return id < _idToRow.size() ? _idToRow[id] : NO_ROW;
+    }
+
+    /**
+     * Output character of every code, e.g. "ACGT".
+     */
+    void setAlphabet(const std::string &alphabet) { _alphabet = alphabet; }
+    const std::string& alphabet() const { return _alphabet; }
+
+    /**
+     * Bytes allocated by the arena, charged to the memory ledger as rows are added.
+     */
+    size_t memoryUsage() const {
+        return _codes.capacity() + _ids.capacity() * sizeof(uint64_t) + _idToRow.capacity() * sizeof(int64_t)
+               + _nameOfId.capacity() * sizeof(std::string) + _nameBytes;
+    }
+
+    std::string rowString(size_t row) const {
+        std::string text(_numColumns, '?');
+        const uint8_t *codes = this->row(row);
+        for (size_t site = 0; site < _numColumns; ++site) {
+            if (codes[site] < _alphabet.size()) text[site] = _alphabet[codes[site]];
+        }
+        return text;
+    }
+
+private:
+    // characters stored outside the string object (beyond the small-string buffer)
+    static size_t heapBytes(const std::string &text) {
+        return text.capacity() > std::string().capacity() ? text.capacity() + 1 : 0;
+    }
+
+    size_t _numColumns;
+    std::vector<uint8_t> _codes;
+    std::vector<uint64_t> _ids;
+    std::vector<int64_t> _idToRow;
+    std::vector<std::string> _nameOfId;
+    std::string _alphabet;
+    size_t _nameBytes;
+    MemoryCharge _charge;
+};
+
+#endif
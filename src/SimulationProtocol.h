@@ -1,3 +1,6 @@
+#ifndef ___SIMULATION_PROTOCOL
+#define ___SIMULATION_PROTOCOL
+
 #include <sstream>
 
 #include "../libs/Phylolib/includes/tree.h"
@@ -142,3 +145,5 @@ public:
 
     ~SimulationProtocol() {}
 };
+
+#endif
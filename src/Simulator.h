@@ -1,3 +1,6 @@
+#ifndef ___SIMULATOR
+#define ___SIMULATOR
+
 
 #include <stack>
 #include <random>
@@ -9,6 +12,11 @@
 #include "MSA.h"
 #include "Sequence.h"
 #include "rateMatrixSim.h"
+#include "SequenceArena.h"
+#include "ArrayView.h"
+#include "GapRunSpill.h"
+#include "MemoryBudget.h"
+#include "MemoryAccounting.h"
 #include "modelFactory.h"
 
 template<typename RngType = std::mt19937_64, size_t AlphabetSize = 4>
@@ -25,10 +33,21 @@ private:
     BlockTree blocks;
 
     std::vector<size_t> _rootPositionsInMsa;
+    std::unique_ptr<GapRunSpill> _gapRunSpill;
+    substitutionEngine _substitutionEngine;
+    double _gillespieThreshold;
+    size_t _numThreads;
+    size_t _tableCapacity;
+    tableEviction _tableEviction;
+    double _lengthQuantization;
+    bool _asyncOutput;
+    bool _compressOutput;
 public:
     Simulator(SimulationProtocol* protocol): _protocol(protocol),
     _seed(protocol->getSeed()), _rng(protocol->getSeed()),
-    _biased_coin(0,1), blocks() {
+    _biased_coin(0,1), blocks(),
+    _substitutionEngine(substitutionEngine::AUTO_ENGINE), _gillespieThreshold(0.1), _numThreads(1),
+    _tableCapacity(0), _tableEviction(LRU_EVICTION), _lengthQuantization(0.0), _asyncOutput(true), _compressOutput(false) {
         // std::cout << "simulator ready!\n";
         // DiscreteDistribution::setSeed(_seed);
         _nodesToSave = std::make_shared<std::vector<bool>>(_protocol->getTree()->getNodesNum(), false);
@@ -60,12 +79,14 @@ public:
     BlockMap generateSimulation() {
         size_t sequenceSize = _protocol->getSequenceSize();
         tree::TreeNode *rootNode = _protocol->getTree()->getRoot();
+        MemoryPhaseScope phase(INDEL_PHASE);
 
+        // charged by the map itself as branches are added, and for as long as the caller holds it
         BlockMap nodeToBlockMap;
         BlockList rootBlockList;
         std::array<size_t, 3> rootBlock = {0,sequenceSize + 1, 0};
         rootBlockList.push_back(rootBlock);
-        nodeToBlockMap[rootNode->id()] = std::make_tuple(rootBlockList, sequenceSize + 1);
+        nodeToBlockMap.setBranch(rootNode->id(), std::make_tuple(rootBlockList, sequenceSize + 1));
         generateIndelsRecursively(nodeToBlockMap, *rootNode);
         return nodeToBlockMap;
     }
@@ -81,7 +102,7 @@ public:
         for (size_t i = 0; i < currentNode.getNumberOfSons(); i++) {
             tree::TreeNode* childNode =  currentNode.getSon(i);
             auto newBlockTuple = simulateAlongBranch(correctedSeqLength, childNode->dis2father(), childNode->id()-1);
-            blockmap[childNode->id()] = newBlockTuple;
+            blockmap.setBranch(childNode->id(), std::move(newBlockTuple));
             generateIndelsRecursively(blockmap, *(currentNode.getSon(i)));
         }
     }
@@ -176,15 +197,70 @@ public:
 
         }
 
+        MemoryCharge treeCharge(BLOCK_TREE_MEMORY, blocks.memoryUsage());
         auto blockData = std::make_tuple(blocks.getBlockList(), blocks.length());
         blocks.clear();
         return blockData;
     }
 
     void initSubstitionSim(modelFactory& mFac) {
-        _substitutionSim = std::make_unique<rateMatrixSim<RngType, AlphabetSize>>(mFac, _nodesToSave);
+        _substitutionSim = std::make_unique<rateMatrixSim<RngType, AlphabetSize>>(mFac, _nodesToSave, _numThreads);
         // _substitutionSim->setSeed(_seed);
         _substitutionSim->setRng(&_rng);
+        _substitutionSim->setGillespieThreshold(_gillespieThreshold);
+        _substitutionSim->setSubstitutionEngine(_substitutionEngine);
+        _substitutionSim->setTransitionTableCache(_tableCapacity, _tableEviction);
+        if (_lengthQuantization > 0.0) _substitutionSim->setBranchLengthQuantization(_lengthQuantization);
+        _substitutionSim->setAsyncOutput(_asyncOutput);
+        _substitutionSim->setCompressedOutput(_compressOutput);
+    }
+
+    void setSubstitutionEngine(substitutionEngine engine) {
+        _substitutionEngine = engine;
+        if (_substitutionSim) _substitutionSim->setSubstitutionEngine(engine);
+    }
+
+    void setGillespieThreshold(double eventsPerSite) {
+        _gillespieThreshold = eventsPerSite;
+        if (_substitutionSim) _substitutionSim->setGillespieThreshold(eventsPerSite);
+    }
+
+    void setNumThreads(size_t numThreads) {
+        _numThreads = numThreads;
+        if (_substitutionSim) _substitutionSim->setNumThreads(numThreads);
+    }
+
+    size_t getNumThreads() {
+        return _numThreads;
+    }
+
+    void setTransitionTableCache(size_t capacity, tableEviction eviction) {
+        _tableCapacity = capacity;
+        _tableEviction = eviction;
+        if (_substitutionSim) _substitutionSim->setTransitionTableCache(capacity, eviction);
+    }
+
+    void setBranchLengthQuantization(double maxTotalVariation) {
+        _lengthQuantization = maxTotalVariation;
+        if (_substitutionSim) _substitutionSim->setBranchLengthQuantization(maxTotalVariation);
+    }
+
+    TransitionTableStats getTransitionTableStats() const {
+        return _substitutionSim ? _substitutionSim->getTransitionTableStats() : TransitionTableStats();
+    }
+
+    void resetTransitionTableStats() {
+        if (_substitutionSim) _substitutionSim->resetTransitionTableStats();
+    }
+
+    void setAsyncOutput(bool asyncOutput) {
+        _asyncOutput = asyncOutput;
+        if (_substitutionSim) _substitutionSim->setAsyncOutput(asyncOutput);
+    }
+
+    void setCompressedOutput(bool compressOutput) {
+        _compressOutput = compressOutput;
+        if (_substitutionSim) _substitutionSim->setCompressedOutput(compressOutput);
     }
 
     std::vector<double> getSiteRates() {
@@ -193,6 +269,18 @@ public:
         return temp;
     }
 
+    /**
+     * Site rates (saved with save_site_rates) and rate categories of the last simulation,
+     * as views sharing the simulator's buffers instead of copies.
+     */
+    ArrayView getSiteRatesView() {
+        return ArrayView::of(_substitutionSim->getSiteRatesBuffer());
+    }
+
+    ArrayView getRateCategoriesView() {
+        return ArrayView::of(_substitutionSim->getRateCategoriesBuffer());
+    }
+
 
     void setNodesToSave(std::vector<size_t> nodeIDs) {
         std::fill(_nodesToSave->begin(), _nodesToSave->end(), false);
@@ -251,10 +339,17 @@ public:
 
         _substitutionSim->setWriteFolder(filePath);
         _substitutionSim->generate_substitution_log(sequenceLength, rootString, rootPositionsInMSA);
+        // the file is complete, and its write errors reported, only once closed
+        _substitutionSim->closeOutput();
     }
 
-    std::shared_ptr<sequenceContainer> simulateSubstitutions(size_t sequenceLength, const std::string& rootString = "", 
-                                                             const std::vector<size_t>& rootPositionsInMSA = {}) {
+    /**
+     * Simulate substitutions along the tree; the saved sequences are returned as one
+     * contiguous rows x columns block of uint8 codes, refilled in place across replicates
+     * once the previous result was released.
+     */
+    std::shared_ptr<SequenceArena> simulateSubstitutions(size_t sequenceLength, const std::string& rootString = "",
+                                                         const std::vector<size_t>& rootPositionsInMSA = {}) {
         // generate dummy root positions vector if not provided
         // should be numbers 0 to sequenceLength-1 in order.
         if (rootPositionsInMSA.empty() && !rootString.empty()) {
@@ -265,18 +360,74 @@ public:
             return simulateSubstitutions(sequenceLength, rootString, dummyRootPositionsInMSA);
         }
 
+        _substitutionSim->setWriteFolder(""); // keep the sequences, even after a low-memory run
         _substitutionSim->generate_substitution_log(sequenceLength, rootString, rootPositionsInMSA);
-        auto seqContainer = _substitutionSim->getSequenceContainer();
-
-        return seqContainer;
+        return _substitutionSim->getSequences();
     }
-    
 
     void setAlignedSequenceMap(const MSA& msa) {
         const auto& alignedSeq = msa.getAlignedSequence();
         _substitutionSim->setAlignedSequenceMap(alignedSeq);
     }
 
+    /**
+     * Plan the substitution and output phase of the low-memory path so that its estimated
+     * peak fits budgetBytes, once the indel MSA is built (msa is null for simulations without
+     * indels). Earlier phases are not covered.
+     */
+    MemoryPlan planSubstitutionMemory(size_t budgetBytes, size_t msaLength, const MSA* msa) {
+        return SubstitutionMemoryPlanner(budgetBytes).plan(substitutionFootprint(msaLength, msa), currentResidentBytes());
+    }
+
+    SubstitutionFootprint substitutionFootprint(size_t msaLength, const MSA* msa) {
+        SubstitutionFootprint footprint;
+        footprint.msaLength = msaLength;
+        footprint.numNodes = _protocol->getTree()->getNodesNum();
+        footprint.compress = _compressOutput;
+
+        // deepest root-to-leaf path and names of the saved rows, without recursing on deep trees
+        size_t treeDepth = 0;
+        std::vector<std::pair<tree::nodeP, size_t>> pending = {{_protocol->getTree()->getRoot(), 0}};
+        while (!pending.empty()) {
+            auto [node, depth] = pending.back();
+            pending.pop_back();
+            treeDepth = std::max(treeDepth, depth);
+            if ((*_nodesToSave)[node->id()]) {
+                footprint.numRows++;
+                footprint.nameBytes += node->name().size();
+            }
+            for (auto &son : node->getSons()) pending.emplace_back(son, depth + 1);
+        }
+        if (msa != nullptr) {
+            for (const auto &row : msa->getAlignedSequence()) footprint.totalGapRuns += row.second.size();
+        }
+        if (_substitutionSim) {
+            footprint.workingSetBytes = _substitutionSim->estimateWorkingSetBytes(msaLength, treeDepth);
+            footprint.outputBufferBytes = _substitutionSim->outputBufferBytes();
+        }
+        return footprint;
+    }
+
+    /**
+     * Move the gap runs of the low-memory output to a scratch file at filePath, so the MSA
+     * can be released before substitutions are streamed.
+     */
+    void spillGapRuns(const MSA& msa, const std::string& filePath) {
+        _gapRunSpill = std::make_unique<GapRunSpill>(filePath, msa.getAlignedSequence());
+        _substitutionSim->setGapRunSpill(_gapRunSpill.get());
+    }
+
+    /**
+     * Forget the gap runs of the last low-memory output, the MSA's or the spill file's
+     * (which is removed), so the next output does not read runs of a released MSA.
+     */
+    void clearGapRuns() {
+        if (_substitutionSim) _substitutionSim->setGapRunSpill(nullptr);
+        _gapRunSpill.reset();
+    }
+
 
     ~Simulator(){}
 };
+
+#endif
@@ -115,6 +115,12 @@ public:
         return _msaSeqLength;
     }
 
+    // list nodes (column plus two links) and the position index
+    size_t memoryUsage() const {
+        return _sequence.size() * (sizeof(columnContainer) + 2 * sizeof(void*))
+               + _positionToIterator.capacity() * sizeof(SequenceType::iterator);
+    }
+
 
     SequenceType::iterator getIteratorByPosition(size_t position) {
         return _positionToIterator[position];
@@ -0,0 +1,196 @@
+#ifndef ___TREE_GENERATORS
+#define ___TREE_GENERATORS
+
+#include <cmath>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+
+#include "FlatTree.h"
+
+/**
+ * Random and regular trees built in memory, for simulation (FlatTree::toTree() gives the
+ * tree of a SimulationProtocol) and for benchmarks of any size. Leaves are named T1..Tn;
+ * the random trees are ultrametric and depend only on their parameters and seed.
+ */
+
+namespace treeGenerators {
+
+inline void checkNumLeaves(size_t numLeaves) {
+    if (numLeaves < 2) throw std::invalid_argument("A tree needs at least 2 leaves");
+    if (numLeaves >= FlatTree::NO_PARENT / 2) throw std::invalid_argument("Too many leaves: " + std::to_string(numLeaves));
+}
+
+inline void checkBranchLength(double branchLength) {
+    if (!(branchLength >= 0.0)) throw std::invalid_argument("Branch length must be non-negative");
+}
+
+inline std::string leafName(size_t leaf) {
+    return "T" + std::to_string(leaf + 1);
+}
+
+// uniform on [0, 1) from the top 53 bits of a 64-bit generator, the same for every standard library
+template<typename RngType>
+double uniformUnit(RngType &rng) {
+    static_assert(RngType::max() == UINT64_MAX && RngType::min() == 0, "a 64-bit generator is required");
+    return static_cast<double>(static_cast<uint64_t>(rng()) >> 11) * 0x1.0p-53;
+}
+
+// a binary tree over nodes [0, numLeaves) as leaves and [numLeaves, 2 numLeaves - 1) as internal nodes
+struct BinaryTreeBuilder {
+    std::vector<uint32_t> parents;
+    std::vector<double> branchLengths;
+    std::vector<std::string> names;
+
+    explicit BinaryTreeBuilder(size_t numLeaves)
+        : parents(2 * numLeaves - 1, FlatTree::NO_PARENT), branchLengths(2 * numLeaves - 1, 0.0),
+          names(2 * numLeaves - 1) {
+        for (size_t leaf = 0; leaf < numLeaves; ++leaf) names[leaf] = leafName(leaf);
+    }
+
+    void join(uint32_t child, uint32_t parent, double branchLength) {
+        parents[child] = parent;
+        branchLengths[child] = branchLength;
+    }
+
+    FlatTree build() const { return FlatTree::fromParents(parents, branchLengths, names); }
+};
+
+} // namespace treeGenerators
+
+
+/**
+ * Balanced binary tree: every internal node splits its leaves in halves (the left half one
+ * larger for odd counts), so its depth is ceil(log2(numLeaves)).
+ */
+inline FlatTree balancedTree(size_t numLeaves, double branchLength = 0.1) {
+    treeGenerators::checkNumLeaves(numLeaves);
+    treeGenerators::checkBranchLength(branchLength);
+    // nodes numbered as created, in preorder (left subtrees first), so leaves are named left to right
+    std::vector<uint32_t> parents;
+    std::vector<double> branchLengths;
+    std::vector<std::string> names;
+    size_t nextLeaf = 0;
+    // (parent, number of leaves below the node)
+    std::vector<std::pair<uint32_t, size_t>> pending{{FlatTree::NO_PARENT, numLeaves}};
+    while (!pending.empty()) {
+        const auto [parent, leaves] = pending.back();
+        pending.pop_back();
+        const uint32_t node = static_cast<uint32_t>(parents.size());
+        parents.push_back(parent);
+        branchLengths.push_back(parent == FlatTree::NO_PARENT ? 0.0 : branchLength);
+        names.push_back(leaves == 1 ? treeGenerators::leafName(nextLeaf++) : std::string());
+        if (leaves > 1) {
+            pending.emplace_back(node, leaves / 2);
+            pending.emplace_back(node, leaves - leaves / 2);
+        }
+    }
+    return FlatTree::fromParents(parents, branchLengths, names);
+}
+
+/**
+ * Caterpillar (ladder) tree (Tn,(...,(T3,(T1,T2)))), the deepest binary tree: numLeaves - 1
+ * internal nodes on one path.
+ */
+inline FlatTree caterpillarTree(size_t numLeaves, double branchLength = 0.1) {
+    treeGenerators::checkNumLeaves(numLeaves);
+    treeGenerators::checkBranchLength(branchLength);
+    treeGenerators::BinaryTreeBuilder builder(numLeaves);
+    uint32_t clade = 0; // T1
+    for (uint32_t leaf = 1; leaf < numLeaves; ++leaf) {
+        const uint32_t internal = static_cast<uint32_t>(numLeaves) + leaf - 1;
+        builder.join(clade, internal, branchLength);
+        builder.join(leaf, internal, branchLength);
+        clade = internal;
+    }
+    return builder.build();
+}
+
+/**
+ * Kingman coalescent: with k lineages, the next two (a uniformly chosen pair) merge after an
+ * exponential time of rate k(k - 1) / (2 populationSize), so a pair of leaves coalesces
+ * populationSize time units back on average (branch lengths are in the same units).
+ */
+template<typename RngType = std::mt19937_64>
+FlatTree coalescentTree(size_t numLeaves, double populationSize, size_t seed) {
+    treeGenerators::checkNumLeaves(numLeaves);
+    if (!(populationSize > 0.0)) throw std::invalid_argument("Population size must be positive");
+    RngType rng(seed);
+    treeGenerators::BinaryTreeBuilder builder(numLeaves);
+    std::vector<double> heights(2 * numLeaves - 1, 0.0);
+    std::vector<uint32_t> lineages(numLeaves);
+    for (uint32_t leaf = 0; leaf < numLeaves; ++leaf) lineages[leaf] = leaf;
+
+    double height = 0.0;
+    uint32_t nextInternal = static_cast<uint32_t>(numLeaves);
+    while (lineages.size() > 1) {
+        const double k = static_cast<double>(lineages.size());
+        height += -std::log(1.0 - treeGenerators::uniformUnit(rng)) * 2.0 * populationSize / (k * (k - 1.0));
+        // a uniform pair: first from all lineages, second from the others
+        const size_t first = static_cast<size_t>(treeGenerators::uniformUnit(rng) * lineages.size());
+        size_t second = static_cast<size_t>(treeGenerators::uniformUnit(rng) * (lineages.size() - 1));
+        if (second >= first) ++second;
+        const uint32_t parent = nextInternal++;
+        heights[parent] = height;
+        for (size_t lineage : {first, second}) builder.join(lineages[lineage], parent, height - heights[lineages[lineage]]);
+        // the parent replaces one of the pair and the last lineage fills the other's place
+        lineages[std::min(first, second)] = parent;
+        lineages[std::max(first, second)] = lineages.back();
+        lineages.pop_back();
+    }
+    return builder.build();
+}
+
+/**
+ * Reconstructed tree of a constant-rate birth-death process conditioned on numLeaves extant
+ * species (uniform prior on the time of origin), sampled as a coalescent point process
+ * (Gernhard 2008): the numLeaves - 1 speciation times are independent with distribution
+ * F(s) = birthRate (1 - e^{-r s}) / (birthRate - deathRate e^{-r s}), r = birthRate - deathRate,
+ * and the split between neighbouring leaves i and i + 1 happens at the i-th of them. With a
+ * death rate of 0 this is the Yule process.
+ */
+template<typename RngType = std::mt19937_64>
+FlatTree birthDeathTree(size_t numLeaves, double birthRate, double deathRate, size_t seed) {
+    treeGenerators::checkNumLeaves(numLeaves);
+    if (!(birthRate > 0.0)) throw std::invalid_argument("Birth rate must be positive");
+    if (!(deathRate >= 0.0 && deathRate <= birthRate)) {
+        throw std::invalid_argument("Death rate must be non-negative and at most the birth rate");
+    }
+    RngType rng(seed);
+    const double netRate = birthRate - deathRate;
+    // inverse of F
+    auto speciationTime = [&](double u) {
+        if (netRate < 1e-12 * birthRate) return u / (birthRate * (1.0 - u)); // critical: F(s) = b s / (1 + b s)
+        return -std::log(birthRate * (1.0 - u) / (birthRate - u * deathRate)) / netRate;
+    };
+
+    treeGenerators::BinaryTreeBuilder builder(numLeaves);
+    std::vector<double> heights(2 * numLeaves - 1, 0.0);
+    std::vector<uint32_t> left(2 * numLeaves - 1), right(2 * numLeaves - 1);
+    // right spine of the tree built so far (heights decreasing towards the top), as in a Cartesian tree
+    std::vector<uint32_t> spine{0};
+    for (uint32_t leaf = 1; leaf < numLeaves; ++leaf) {
+        const uint32_t internal = static_cast<uint32_t>(numLeaves) + leaf - 1;
+        heights[internal] = speciationTime(treeGenerators::uniformUnit(rng));
+        uint32_t below = spine.back();
+        while (!spine.empty() && heights[spine.back()] <= heights[internal]) {
+            below = spine.back();
+            spine.pop_back();
+        }
+        left[internal] = below;
+        if (!spine.empty()) right[spine.back()] = internal;
+        spine.push_back(internal);
+        right[internal] = leaf;
+        spine.push_back(leaf);
+    }
+    for (uint32_t internal = static_cast<uint32_t>(numLeaves); internal < 2 * numLeaves - 1; ++internal) {
+        builder.join(left[internal], internal, heights[internal] - heights[left[internal]]);
+        builder.join(right[internal], internal, heights[internal] - heights[right[internal]]);
+    }
+    return builder.build();
+}
+
+#endif
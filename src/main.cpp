@@ -7,6 +7,10 @@
 #include "../libs/pcg/pcg_random.hpp"
 #include "../libs/Phylolib/includes/gammaDistribution.h"
 #include "./Simulator.h"
+#include "./BatchSimulator.h"
+#include "./FlatTree.h"
+#include "./TreeGenerators.h"
+#include "./AutoGammaCorrelation.h"
 
 namespace py = pybind11;
 
@@ -28,7 +32,9 @@ PYBIND11_MODULE(_Sailfish, m) {
             modelFactory
             Simulator
             Msa
+            PackedMsa
             Tree
+            FlatTree
     )pbdoc";
 
     using SelectedRNG = pcg64_fast;
@@ -41,6 +47,26 @@ PYBIND11_MODULE(_Sailfish, m) {
         .def("print_tree", &BlockTree::printTree)
         .def("block_list", &BlockTree::getBlockList);
 
+    // kept in C++ so its lists stay charged to the memory ledger until an Msa consumes them
+    py::class_<BlockMap>(m, "BlockMap")
+        .def(py::init<>())
+        .def("__len__", [](const BlockMap &blockmap) { return blockmap.size(); })
+        .def("__contains__", [](const BlockMap &blockmap, size_t nodeId) { return blockmap.count(nodeId) > 0; })
+        .def("__getitem__", [](const BlockMap &blockmap, size_t nodeId) {
+            auto branch = blockmap.find(nodeId);
+            if (branch == blockmap.end()) throw py::key_error(std::to_string(nodeId));
+            return branch->second;
+        })
+        .def("keys", [](const BlockMap &blockmap) {
+            std::vector<size_t> nodeIds;
+            for (const auto &branch : blockmap) nodeIds.push_back(branch.first);
+            return nodeIds;
+        })
+        .def("items", [](const BlockMap &blockmap) {
+            return std::vector<std::pair<size_t, std::tuple<BlockList, size_t>>>(blockmap.begin(), blockmap.end());
+        })
+        .def("memory_usage", &BlockMap::memoryUsage);
+
     py::enum_<event>(m, "event")
         .value("Insertion", event::INSERTION)
         .value("Deletion", event::DELETION)
@@ -54,6 +80,49 @@ PYBIND11_MODULE(_Sailfish, m) {
         .def_property_readonly("num_nodes", &tree::getNodesNum)
         .def_property_readonly("root", &tree::getRoot);
 
+    py::class_<FlatTree, std::shared_ptr<FlatTree>>(m, "FlatTree")
+        .def_static("from_newick", [](const std::string &newick) {
+            return std::make_shared<FlatTree>(FlatTree::fromNewick(newick));
+        }, py::arg("newick"), py::call_guard<py::gil_scoped_release>())
+        .def_static("from_file", [](const std::string &filePath) {
+            return std::make_shared<FlatTree>(FlatTree::fromFile(filePath));
+        }, py::arg("file_path"), py::call_guard<py::gil_scoped_release>())
+        .def_property_readonly("num_nodes", &FlatTree::numNodes)
+        .def_property_readonly("num_leaves", &FlatTree::numLeaves)
+        .def("parents", [](const std::shared_ptr<FlatTree> &flat) {
+            return ArrayView::of<uint32_t>(flat, flat->parents().data(), {flat->numNodes()});
+        })
+        .def("branch_lengths", [](const std::shared_ptr<FlatTree> &flat) {
+            return ArrayView::of<double>(flat, flat->branchLengths().data(), {flat->numNodes()});
+        })
+        .def("child_offsets", [](const std::shared_ptr<FlatTree> &flat) {
+            return ArrayView::of<uint32_t>(flat, flat->childOffsets().data(), {flat->childOffsets().size()});
+        })
+        .def("children", [](const std::shared_ptr<FlatTree> &flat) {
+            return ArrayView::of<uint32_t>(flat, flat->children().data(), {flat->children().size()});
+        })
+        .def("names", &FlatTree::names)
+        .def("to_newick", &FlatTree::toNewick)
+        .def_static("from_parents", [](const std::vector<uint32_t> &parents, const std::vector<double> &branchLengths,
+                                       const std::vector<std::string> &names) {
+            return std::make_shared<FlatTree>(FlatTree::fromParents(parents, branchLengths, names));
+        }, py::arg("parents"), py::arg("branch_lengths"), py::arg("names"))
+        .def("to_tree", &FlatTree::toTree);
+
+    m.def("balanced_tree", [](size_t numLeaves, double branchLength) {
+        return std::make_shared<FlatTree>(balancedTree(numLeaves, branchLength));
+    }, py::arg("num_leaves"), py::arg("branch_length") = 0.1, py::call_guard<py::gil_scoped_release>());
+    m.def("caterpillar_tree", [](size_t numLeaves, double branchLength) {
+        return std::make_shared<FlatTree>(caterpillarTree(numLeaves, branchLength));
+    }, py::arg("num_leaves"), py::arg("branch_length") = 0.1, py::call_guard<py::gil_scoped_release>());
+    m.def("coalescent_tree", [](size_t numLeaves, double populationSize, size_t seed) {
+        return std::make_shared<FlatTree>(coalescentTree(numLeaves, populationSize, seed));
+    }, py::arg("num_leaves"), py::arg("population_size"), py::arg("seed"), py::call_guard<py::gil_scoped_release>());
+    m.def("birth_death_tree", [](size_t numLeaves, double birthRate, double deathRate, size_t seed) {
+        return std::make_shared<FlatTree>(birthDeathTree(numLeaves, birthRate, deathRate, seed));
+    }, py::arg("num_leaves"), py::arg("birth_rate"), py::arg("death_rate"), py::arg("seed"),
+       py::call_guard<py::gil_scoped_release>());
+
     py::class_<tree::TreeNode>(m, "node")
         .def_property_readonly("sons", &tree::TreeNode::getSons)
         .def_property_readonly("num_leaves", &tree::TreeNode::getNumberLeaves)
@@ -119,6 +188,61 @@ PYBIND11_MODULE(_Sailfish, m) {
         .value("CUSTOM", modelCode::CUSTOM)
         .export_values();
 
+    py::enum_<substitutionEngine>(m, "substitutionEngine")
+        .value("AUTO", substitutionEngine::AUTO_ENGINE)
+        .value("MATRIX", substitutionEngine::MATRIX_ENGINE)
+        .value("GILLESPIE", substitutionEngine::GILLESPIE_ENGINE)
+        .export_values();
+
+    py::enum_<tableEviction>(m, "tableEviction")
+        .value("LRU", tableEviction::LRU_EVICTION)
+        .value("FIFO", tableEviction::FIFO_EVICTION)
+        .export_values();
+
+    py::class_<TransitionTableStats>(m, "TransitionTableStats")
+        .def_readonly("hits", &TransitionTableStats::hits)
+        .def_readonly("misses", &TransitionTableStats::misses)
+        .def_readonly("shared", &TransitionTableStats::shared)
+        .def_readonly("evictions", &TransitionTableStats::evictions)
+        .def_readonly("resident_tables", &TransitionTableStats::residentTables)
+        .def_readonly("capacity", &TransitionTableStats::capacity)
+        .def_readonly("unique_lengths", &TransitionTableStats::uniqueLengths)
+        .def_readonly("error_bound", &TransitionTableStats::errorBound);
+
+    py::class_<ModelCacheStats>(m, "ModelCacheStats")
+        .def_readonly("hits", &ModelCacheStats::hits)
+        .def_readonly("misses", &ModelCacheStats::misses)
+        .def_readonly("models", &ModelCacheStats::models)
+        .def_readonly("capacity", &ModelCacheStats::capacity);
+
+    m.def("model_cache_stats", []() { return modelCache().stats(); });
+    m.def("set_model_cache_capacity", [](size_t capacity) { modelCache().setCapacity(capacity); });
+    m.def("clear_model_cache", []() { modelCache().clear(); modelCache().resetStats(); modelRegistry().clear(); });
+
+    py::enum_<memoryStrategy>(m, "memoryStrategy")
+        .value("IN_MEMORY", memoryStrategy::IN_MEMORY_STRATEGY)
+        .value("STREAMED_ROWS", memoryStrategy::STREAMED_ROWS_STRATEGY)
+        .value("SPILLED_GAP_RUNS", memoryStrategy::SPILLED_GAP_RUNS_STRATEGY)
+        .export_values();
+
+    py::class_<MemoryPlan>(m, "MemoryPlan")
+        .def_readonly("strategy", &MemoryPlan::strategy)
+        .def_property_readonly("strategy_name", [](const MemoryPlan &plan) { return memoryStrategyName(plan.strategy); })
+        .def_readonly("feasible", &MemoryPlan::feasible)
+        .def_readonly("budget_bytes", &MemoryPlan::budgetBytes)
+        .def_readonly("baseline_bytes", &MemoryPlan::baselineBytes)
+        .def_readonly("estimated_peak_bytes", &MemoryPlan::estimatedPeakBytes)
+        .def_readwrite("peak_resident_bytes", &MemoryPlan::peakResidentBytes);
+
+    m.def("current_resident_bytes", &currentResidentBytes);
+    m.def("peak_resident_bytes", &peakResidentBytes);
+    m.def("reset_peak_resident_bytes", &resetPeakResidentBytes);
+    m.def("release_freed_memory", &releaseFreedMemory);
+
+    m.def("memory_report", []() { return memoryLedger().report(); },
+          "Current and peak bytes of every tracked subsystem and the total, overall and per phase");
+    m.def("reset_memory_peaks", []() { memoryLedger().resetPeaks(); });
+
     py::class_<gammaDistribution>(m, "GammaDistribution")
         .def(py::init<MDOUBLE, int>())
         .def("getAllRates", [](const gammaDistribution& g) {
@@ -136,6 +260,10 @@ PYBIND11_MODULE(_Sailfish, m) {
             return result;
         });
 
+    m.def("auto_gamma_transition_matrix", &autoGammaTransitionMatrix,
+          "Auto-discrete-gamma (Yang 1995) transition matrix of the rate categories, memoized by (categories, rho)",
+          py::arg("alpha"), py::arg("categories"), py::arg("rho"), py::arg("num_threads") = 1);
+
     py::class_<modelFactory>(m, "modelFactory")
         .def(py::init<tree*>())
         .def("set_alphabet", &modelFactory::setAlphabet)
@@ -158,10 +286,25 @@ PYBIND11_MODULE(_Sailfish, m) {
         .def("gen_substitutions", &Simulator<SelectedRNG, 20>::simulateSubstitutions)
         .def("gen_substitutions_to_file", &Simulator<SelectedRNG, 20>::simulateAndWriteSubstitutions)
         .def("set_aligned_sequence_map", &Simulator<SelectedRNG, 20>::setAlignedSequenceMap)
+        .def("plan_substitution_memory", &Simulator<SelectedRNG, 20>::planSubstitutionMemory)
+        .def("spill_gap_runs", &Simulator<SelectedRNG, 20>::spillGapRuns)
+        .def("clear_gap_runs", &Simulator<SelectedRNG, 20>::clearGapRuns)
         .def("save_site_rates", &Simulator<SelectedRNG, 20>::setSaveRates)
         .def("get_site_rates", &Simulator<SelectedRNG, 20>::getSiteRates)
+        .def("get_site_rates_view", &Simulator<SelectedRNG, 20>::getSiteRatesView)
+        .def("get_rate_categories_view", &Simulator<SelectedRNG, 20>::getRateCategoriesView)
         .def("save_all_nodes_sequences", &Simulator<SelectedRNG, 20>::setSaveAllNodes)
         .def("save_root_sequence", &Simulator<SelectedRNG, 20>::setSaveRoot)
+        .def("set_substitution_engine", &Simulator<SelectedRNG, 20>::setSubstitutionEngine)
+        .def("set_gillespie_threshold", &Simulator<SelectedRNG, 20>::setGillespieThreshold)
+        .def("set_num_threads", &Simulator<SelectedRNG, 20>::setNumThreads)
+        .def("get_num_threads", &Simulator<SelectedRNG, 20>::getNumThreads)
+        .def("set_transition_table_cache", &Simulator<SelectedRNG, 20>::setTransitionTableCache)
+        .def("set_branch_length_quantization", &Simulator<SelectedRNG, 20>::setBranchLengthQuantization)
+        .def("get_transition_table_stats", &Simulator<SelectedRNG, 20>::getTransitionTableStats)
+        .def("reset_transition_table_stats", &Simulator<SelectedRNG, 20>::resetTransitionTableStats)
+        .def("set_async_output", &Simulator<SelectedRNG, 20>::setAsyncOutput)
+        .def("set_compressed_output", &Simulator<SelectedRNG, 20>::setCompressedOutput)
         .def("get_saved_nodes_mask", &Simulator<SelectedRNG, 20>::getNodesSaveList);
 
     py::class_<Simulator<SelectedRNG, 4>>(m, "NucleotideSimulator")
@@ -173,12 +316,93 @@ PYBIND11_MODULE(_Sailfish, m) {
         .def("gen_substitutions", &Simulator<SelectedRNG, 4>::simulateSubstitutions)
         .def("gen_substitutions_to_file", &Simulator<SelectedRNG, 4>::simulateAndWriteSubstitutions)
         .def("set_aligned_sequence_map", &Simulator<SelectedRNG, 4>::setAlignedSequenceMap)
+        .def("plan_substitution_memory", &Simulator<SelectedRNG, 4>::planSubstitutionMemory)
+        .def("spill_gap_runs", &Simulator<SelectedRNG, 4>::spillGapRuns)
+        .def("clear_gap_runs", &Simulator<SelectedRNG, 4>::clearGapRuns)
         .def("save_site_rates", &Simulator<SelectedRNG, 4>::setSaveRates)
         .def("get_site_rates", &Simulator<SelectedRNG, 4>::getSiteRates)
+        .def("get_site_rates_view", &Simulator<SelectedRNG, 4>::getSiteRatesView)
+        .def("get_rate_categories_view", &Simulator<SelectedRNG, 4>::getRateCategoriesView)
         .def("save_all_nodes_sequences", &Simulator<SelectedRNG, 4>::setSaveAllNodes)
         .def("save_root_sequence", &Simulator<SelectedRNG, 4>::setSaveRoot)
+        .def("set_substitution_engine", &Simulator<SelectedRNG, 4>::setSubstitutionEngine)
+        .def("set_gillespie_threshold", &Simulator<SelectedRNG, 4>::setGillespieThreshold)
+        .def("set_num_threads", &Simulator<SelectedRNG, 4>::setNumThreads)
+        .def("get_num_threads", &Simulator<SelectedRNG, 4>::getNumThreads)
+        .def("set_transition_table_cache", &Simulator<SelectedRNG, 4>::setTransitionTableCache)
+        .def("set_branch_length_quantization", &Simulator<SelectedRNG, 4>::setBranchLengthQuantization)
+        .def("get_transition_table_stats", &Simulator<SelectedRNG, 4>::getTransitionTableStats)
+        .def("reset_transition_table_stats", &Simulator<SelectedRNG, 4>::resetTransitionTableStats)
+        .def("set_async_output", &Simulator<SelectedRNG, 4>::setAsyncOutput)
+        .def("set_compressed_output", &Simulator<SelectedRNG, 4>::setCompressedOutput)
         .def("get_saved_nodes_mask", &Simulator<SelectedRNG, 4>::getNodesSaveList);
 
+    py::class_<BatchSimulator<SelectedRNG, 20>>(m, "AminoBatchSimulator")
+        .def(py::init<>())
+        .def("set_model", &BatchSimulator<SelectedRNG, 20>::setModel)
+        .def("add_tree", &BatchSimulator<SelectedRNG, 20>::addTree)
+        .def("add_trees_from_file", &BatchSimulator<SelectedRNG, 20>::addTreesFromFile)
+        .def("num_trees", &BatchSimulator<SelectedRNG, 20>::numTrees)
+        .def("clear_trees", &BatchSimulator<SelectedRNG, 20>::clearTrees)
+        .def("set_sequence_size", &BatchSimulator<SelectedRNG, 20>::setSequenceSize)
+        .def("set_min_sequence_size", &BatchSimulator<SelectedRNG, 20>::setMinSequenceSize)
+        .def("set_insertion_rate", &BatchSimulator<SelectedRNG, 20>::setInsertionRate)
+        .def("set_deletion_rate", &BatchSimulator<SelectedRNG, 20>::setDeletionRate)
+        .def("set_insertion_length_distribution", &BatchSimulator<SelectedRNG, 20>::setInsertionLengthDistribution, py::keep_alive<1, 2>())
+        .def("set_deletion_length_distribution", &BatchSimulator<SelectedRNG, 20>::setDeletionLengthDistribution, py::keep_alive<1, 2>())
+        .def("set_seed", &BatchSimulator<SelectedRNG, 20>::setSeed)
+        .def("set_num_threads", &BatchSimulator<SelectedRNG, 20>::setNumThreads)
+        .def("save_all_nodes_sequences", &BatchSimulator<SelectedRNG, 20>::setSaveAllNodes)
+        .def("simulate_tree", [](const BatchSimulator<SelectedRNG, 20> &batch, size_t index) {
+            py::gil_scoped_release release;
+            return batch.simulateTree(index);
+        })
+        .def("simulate", [](const BatchSimulator<SelectedRNG, 20> &batch) {
+            std::vector<std::unique_ptr<MSA>> msas;
+            {
+                py::gil_scoped_release release;
+                msas = batch.simulate();
+            }
+            py::list result;
+            for (auto &msa : msas) result.append(py::cast(std::move(msa)));
+            return result;
+        })
+        .def("simulate_to_files", &BatchSimulator<SelectedRNG, 20>::simulateToFiles, py::arg("path_prefix"), py::arg("compress") = false,
+             py::call_guard<py::gil_scoped_release>());
+
+    py::class_<BatchSimulator<SelectedRNG, 4>>(m, "NucleotideBatchSimulator")
+        .def(py::init<>())
+        .def("set_model", &BatchSimulator<SelectedRNG, 4>::setModel)
+        .def("add_tree", &BatchSimulator<SelectedRNG, 4>::addTree)
+        .def("add_trees_from_file", &BatchSimulator<SelectedRNG, 4>::addTreesFromFile)
+        .def("num_trees", &BatchSimulator<SelectedRNG, 4>::numTrees)
+        .def("clear_trees", &BatchSimulator<SelectedRNG, 4>::clearTrees)
+        .def("set_sequence_size", &BatchSimulator<SelectedRNG, 4>::setSequenceSize)
+        .def("set_min_sequence_size", &BatchSimulator<SelectedRNG, 4>::setMinSequenceSize)
+        .def("set_insertion_rate", &BatchSimulator<SelectedRNG, 4>::setInsertionRate)
+        .def("set_deletion_rate", &BatchSimulator<SelectedRNG, 4>::setDeletionRate)
+        .def("set_insertion_length_distribution", &BatchSimulator<SelectedRNG, 4>::setInsertionLengthDistribution, py::keep_alive<1, 2>())
+        .def("set_deletion_length_distribution", &BatchSimulator<SelectedRNG, 4>::setDeletionLengthDistribution, py::keep_alive<1, 2>())
+        .def("set_seed", &BatchSimulator<SelectedRNG, 4>::setSeed)
+        .def("set_num_threads", &BatchSimulator<SelectedRNG, 4>::setNumThreads)
+        .def("save_all_nodes_sequences", &BatchSimulator<SelectedRNG, 4>::setSaveAllNodes)
+        .def("simulate_tree", [](const BatchSimulator<SelectedRNG, 4> &batch, size_t index) {
+            py::gil_scoped_release release;
+            return batch.simulateTree(index);
+        })
+        .def("simulate", [](const BatchSimulator<SelectedRNG, 4> &batch) {
+            std::vector<std::unique_ptr<MSA>> msas;
+            {
+                py::gil_scoped_release release;
+                msas = batch.simulate();
+            }
+            py::list result;
+            for (auto &msa : msas) result.append(py::cast(std::move(msa)));
+            return result;
+        })
+        .def("simulate_to_files", &BatchSimulator<SelectedRNG, 4>::simulateToFiles, py::arg("path_prefix"), py::arg("compress") = false,
+             py::call_guard<py::gil_scoped_release>());
+
 
     py::class_<MSA>(m, "Msa")
         .def(py::init<size_t, size_t, const std::vector<bool>& >())
@@ -189,10 +413,86 @@ PYBIND11_MODULE(_Sailfish, m) {
         .def("fill_substitutions", &MSA::fillSubstitutions)
         .def("print_msa", &MSA::printFullMsa)
         .def("print_indels", &MSA::printIndels)
-        .def("write_msa", &MSA::writeFullMsa)
+        .def("write_msa", &MSA::writeFullMsa, py::arg("file_path"), py::arg("compress") = false)
+        .def("write_packed_msa", &MSA::writePackedMsa, py::arg("file_path"))
         .def("write_msa_from_dir", &MSA::writeMsaFromDir)
         .def("get_msa_string", &MSA::generateMsaString)
         .def("get_msa", &MSA::getMSAVec)
-        .def("get_root_positions_in_msa", &MSA::getRootPositionsInMsa);
+        .def("get_root_positions_in_msa", &MSA::getRootPositionsInMsa)
+        .def("get_root_positions_view", [](const MSA &msa) {
+            const auto &positions = msa.getRootPositionsInMsa();
+            return ArrayView::of<size_t>(nullptr, positions.data(), {positions.size()});
+        }, py::keep_alive<0, 1>())
+        .def("rows", [](const MSA &msa) { return msa.makeRenderer(); }, py::keep_alive<0, 1>());
 
+    // rows are rendered straight into the bytes objects handed to Python
+    using MsaRows = decltype(std::declval<const MSA&>().makeRenderer());
+    py::class_<MsaRows>(m, "MsaRows")
+        .def("num_rows", &MsaRows::numRows)
+        .def("name", &MsaRows::rowName)
+        .def("row", [](const MsaRows &rows, size_t row) {
+            if (row >= rows.numRows()) throw py::index_error("row out of range");
+            py::bytes text(nullptr, rows.rowLength(row));
+            rows.renderSequence(row, PyBytes_AS_STRING(text.ptr()));
+            return text;
+        })
+        .def("chunk_end", &MsaRows::chunkEnd, py::arg("first_row"), py::arg("max_bytes"))
+        .def("chunk", [](const MsaRows &rows, size_t firstRow, size_t lastRow) {
+            if (firstRow > lastRow || lastRow > rows.numRows()) throw py::index_error("rows out of range");
+            py::bytes text(nullptr, rows.textSize(firstRow, lastRow));
+            char *out = PyBytes_AS_STRING(text.ptr());
+            {
+                py::gil_scoped_release release;
+                rows.render(out, firstRow, lastRow, 0);
+            }
+            return text;
+        }, py::arg("first_row"), py::arg("last_row"));
+
+
+    py::class_<ArrayView>(m, "ArrayView", py::buffer_protocol())
+        .def_buffer([](ArrayView &view) {
+            std::vector<py::ssize_t> shape(view.shape.begin(), view.shape.end());
+            std::vector<py::ssize_t> strides;
+            for (size_t stride : view.strides()) strides.push_back(static_cast<py::ssize_t>(stride));
+            return py::buffer_info(const_cast<void*>(view.data), static_cast<py::ssize_t>(view.itemSize),
+                                   view.format, static_cast<py::ssize_t>(shape.size()), shape, strides, true);
+        })
+        .def("__len__", [](const ArrayView &view) { return view.shape.empty() ? 0 : view.shape[0]; });
+
+    py::class_<SequenceArena, std::shared_ptr<SequenceArena>>(m, "SequenceArena")
+        .def("num_rows", &SequenceArena::numRows)
+        .def("num_columns", &SequenceArena::numColumns)
+        .def("codes", [](const std::shared_ptr<SequenceArena> &arena) {
+            return ArrayView::of<uint8_t>(arena, arena->codes(), {arena->numRows(), arena->numColumns()});
+        })
+        .def("ids", [](const std::shared_ptr<SequenceArena> &arena) {
+            return ArrayView::of<uint64_t>(arena, arena->ids().data(), {arena->numRows()});
+        })
+        .def("names", &SequenceArena::names)
+        .def("alphabet", &SequenceArena::alphabet)
+        .def("row_of_id", &SequenceArena::rowOfId)
+        .def("row_string", &SequenceArena::rowString);
+
+    py::class_<PackedMsaReader, std::shared_ptr<PackedMsaReader>>(m, "PackedMsa")
+        .def(py::init<const std::string&>(), py::arg("file_path"))
+        .def("num_sequences", &PackedMsaReader::getNumberOfSequences)
+        .def("length", &PackedMsaReader::getMSAlength)
+        .def("alphabet", &PackedMsaReader::getAlphabet)
+        .def("bits_per_residue", &PackedMsaReader::getBitsPerResidue)
+        .def("name", &PackedMsaReader::getName)
+        .def("names", &PackedMsaReader::getNames)
+        .def("row", [](const PackedMsaReader &reader, size_t row) { return py::bytes(reader.getRow(row)); })
+        .def("num_residues", &PackedMsaReader::getNumberOfResidues)
+        .def("residue_offset", &PackedMsaReader::getResidueOffset)
+        .def("gap_runs", [](const std::shared_ptr<PackedMsaReader> &reader, size_t row) {
+            return ArrayView::of<int32_t>(reader, reader->getGapRuns(row), {reader->getNumberOfGapRuns(row)});
+        })
+        .def("all_gap_runs", [](const std::shared_ptr<PackedMsaReader> &reader) {
+            return ArrayView::of<int32_t>(reader, reader->gapRunsData(), {reader->totalGapRuns()});
+        })
+        .def("packed_residues", [](const std::shared_ptr<PackedMsaReader> &reader) {
+            return ArrayView::of<uint64_t>(reader, reader->residueData(), {reader->residueDataWords()});
+        })
+        .def("verify", &PackedMsaReader::verify)
+        .def("to_fasta", &PackedMsaReader::toFasta);
 }
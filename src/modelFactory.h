@@ -2,6 +2,7 @@
 #define ___MODEL_FACTORY
 
 #include <vector>
+#include <algorithm>
 #include <memory>
 #include <sstream>
 #include <fstream>
@@ -19,6 +20,7 @@
 #include "../libs/Phylolib/includes/customDistribution.h"
 
 #include "allModels.h"
+#include "ModelRegistry.h"
 
 // wrapper for all the information about the substitution model:
 // alphabet = aa/nc
@@ -85,6 +87,13 @@ public:
         _state(factoryState::ALPHABET),
         _tree(tr) {}
 
+    // the model set up in other, on another tree
+    modelFactory(const modelFactory &other, tree* tr):
+        _state(other._state), _tree(tr), _alphabet(other._alphabet), _model(other._model),
+        _modelFilePath(other._modelFilePath), _parameters(other._parameters), _alpha(other._alpha),
+        _gammaCategories(other._gammaCategories), _customRates(other._customRates),
+        _transitionMatrix(other._transitionMatrix), _stationaryProbs(other._stationaryProbs) {}
+
     void setAlphabet(alphabetCode alphabet) {
         if (_state != factoryState::ALPHABET) {
             std::cout << "Please reset model if you wish to change alphabet.\n";
@@ -202,7 +211,33 @@ public:
 
     tree* getTree() { return _tree; }
 
-    bool isModelValid() {
+    /**
+     * Content of the model, for caching what is built from it: alphabet, replacement model,
+     * its parameters or model file contents, and the site-rate model, with every value
+     * written exactly.
+     */
+    std::string cacheKey() const {
+        std::ostringstream key;
+        key << std::hexfloat << "alphabet " << _alphabet << " model " << _model;
+        auto writeValues = [&key](const char *label, const std::vector<MDOUBLE> &values) {
+            key << ' ' << label << '[';
+            for (MDOUBLE value : values) key << value << ',';
+            key << ']';
+        };
+        if (_model == modelCode::GTR || _model == modelCode::HKY || _model == modelCode::TAMURA92) {
+            writeValues("parameters", _parameters);
+        }
+        if (_model == modelCode::CUSTOM) {
+            std::ifstream in(_modelFilePath, std::ios::binary);
+            key << " file[" << in.rdbuf() << ']';
+        }
+        writeValues("rates", _customRates);
+        writeValues("probabilities", _stationaryProbs);
+        for (const auto &row : _transitionMatrix) writeValues("transitions", row);
+        return key.str();
+    }
+
+    bool isModelValid() const {
         return (_state == factoryState::COMPLETE);
     }
 
@@ -224,11 +259,51 @@ public:
         return _alphPtr.get();
     }
 
+    /**
+     * The replacement model with its accelerator. Models without parameters come from the
+     * process-wide registry, so each is parsed and fitted once; the others are built anew.
+     */
+    std::shared_ptr<const RegisteredModel> getRegisteredModel() {
+        if (_model == modelCode::GTR || _model == modelCode::HKY || _model == modelCode::TAMURA92) {
+            return std::make_shared<const RegisteredModel>(makeAccelerator(""));
+        }
+        const std::string customContents = (_model == modelCode::CUSTOM) ? readCustomModelFile() : "";
+        std::ostringstream key;
+        key << "alphabet " << _alphabet << " model " << _model << " file[" << customContents << ']';
+        return modelRegistry().get(key.str(), [this, &customContents]() { return makeAccelerator(customContents); });
+    }
+
     std::shared_ptr<stochasticProcess> getStochasticProcess() {
+        return getStochasticProcess(*getRegisteredModel());
+    }
+
+    // a process of registered, which must be the model of this factory, and the site-rate model
+    std::shared_ptr<stochasticProcess> getStochasticProcess(const RegisteredModel &registered) {
         if (_state != factoryState::COMPLETE) {
             std::cout << "Please set all the required model parameters.\n";
         }
 
+        // Always use custom distribution
+        customDistribution dist(_customRates, _stationaryProbs);
+
+        return std::make_shared<stochasticProcess>(&dist, &registered.accelerator());
+    }
+
+    ~modelFactory() {}
+
+private:
+    // the model file without quotes and line breaks, as datMatrixString expects
+    std::string readCustomModelFile() const {
+        std::ifstream in(_modelFilePath, std::ios::binary);
+        if (!in.is_open()) throw std::runtime_error("Could not open file");
+        std::ostringstream contents;
+        contents << in.rdbuf();
+        std::string text = contents.str();
+        text.erase(std::remove_if(text.begin(), text.end(), [](char c) { return c == '\"' || c == '\n'; }), text.end());
+        return text;
+    }
+
+    std::unique_ptr<pijAccelerator> makeAccelerator(const std::string &customContents) const {
         std::unique_ptr<replacementModel> repModel;
 
         switch (_model) {
@@ -325,40 +400,16 @@ public:
                 repModel = std::make_unique<pupAll>(datMatrixHolder::EX_EHO_EXP_OTH);
                 break;
             case modelCode::CUSTOM: {
-                std::ifstream in(_modelFilePath);
-                if (!in.is_open()) throw std::runtime_error("Could not open file");
-                std::stringstream contents;
-                char buffer;
-                while (in.get(buffer)) {
-                    if (buffer == '\"' || buffer == '\n') continue;
-                    contents << buffer;
-                }
-                in.close();
-                const std::string &tmpstr = contents.str();
-                const char* cstr = tmpstr.c_str();
-                datMatrixString aminoFileString(cstr);
+                datMatrixString aminoFileString(customContents.c_str());
                 repModel = std::make_unique<pupAll>(aminoFileString);
                 break;
             }
         }
 
-        std::unique_ptr<pijAccelerator> pij;
-
-        if (_alphabet == alphabetCode::AMINOACID) {
-            pij = std::make_unique<chebyshevAccelerator>(repModel.get());
-        } else if (_alphabet == alphabetCode::NUCLEOTIDE) {
-            pij = std::make_unique<trivialAccelerator>(repModel.get());
-        }
-
-        // Always use custom distribution
-        customDistribution dist(_customRates, _stationaryProbs);
-
-        return std::make_shared<stochasticProcess>(&dist, pij.get());
+        if (_alphabet == alphabetCode::AMINOACID) return std::make_unique<chebyshevAccelerator>(repModel.get());
+        return std::make_unique<trivialAccelerator>(repModel.get());
     }
 
-    ~modelFactory() {}
-
-private:
     factoryState _state;
     tree* _tree;
     std::unique_ptr<alphabet> _alphPtr;
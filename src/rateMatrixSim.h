@@ -9,38 +9,62 @@
 #include "../libs/Phylolib/includes/sequenceContainer.h"
 
 #include "modelFactory.h"
-// #include "substitutionManager.h"
+#include "substitutionManager.h"
 #include "CategorySampler.h"
+#include "AliasTable.h"
+#include "ParallelFor.h"
+#include "FastaWriter.h"
+#include "ArrayView.h"
+#include "SequenceArena.h"
+#include "GapRunSpill.h"
 #include "CachedTransitionProbabilities.h"
 
+// Per-branch substitution engine:
+// MATRIX_ENGINE    - draw every site from the cached P(t) tables (cost ~ sequence length)
+// GILLESPIE_ENGINE - simulate the individual substitution events (cost ~ number of events)
+// AUTO_ENGINE      - pick per branch by the expected number of events per site
+enum substitutionEngine {
+	AUTO_ENGINE,
+	MATRIX_ENGINE,
+	GILLESPIE_ENGINE
+};
+
 
 template<typename RngType = std::mt19937_64,size_t AlphabetSize = 4>
 class rateMatrixSim {
 public:
-	explicit rateMatrixSim(modelFactory& mFac, std::shared_ptr<std::vector<bool>> nodesToSave) : 
-		_et(mFac.getTree()), _sp(mFac.getStochasticProcess()), _alph(mFac.getAlphabet()), 
+	/**
+	 * @param numThreads - threads for the parallel phases (0 = one per hardware thread)
+	 */
+	explicit rateMatrixSim(modelFactory& mFac, std::shared_ptr<std::vector<bool>> nodesToSave, size_t numThreads = 1) : 
+		_et(mFac.getTree()), _model(modelCache().model<AlphabetSize>(mFac)), _sp(_model->sharedProcess()),
+		_alph(mFac.getAlphabet()), 
 		// _invariantSitesProportion(mFac.getInvariantSitesProportion()),
 		// _siteRateCorrelation(mFac.getSiteRateCorrelation()),
-		_cachedPijt(*mFac.getTree(), *mFac.getStochasticProcess()),
+		_cachedPijt(*mFac.getTree(), _model),
+		_subManager(mFac.getTree()->getNodesNum()),
 		_nodesToSave(nodesToSave), _saveRates(false),
+		_engine(substitutionEngine::AUTO_ENGINE), _gillespieThreshold(0.1), _numThreads(numThreads),
 		_rateCategorySampler(mFac.getEffectiveTransitionMatrix(), mFac.getStationaryProbs()),
-		_finalMsaPath("") {
+		_finalMsaPath(""), _asyncOutput(true), _compressOutput(false) {
 		
 		
 		std::vector<MDOUBLE> frequencies;
 		for (int j = 0; j < AlphabetSize; ++j) {
 			frequencies.push_back(_sp->freq(j));
-			_charLookup[j] = _alph->fromInt(j);
+			_charLookup[j] = _alph->fromInt(j)[0];
 		}
 
-		_frequencySampler = std::make_unique<DiscreteDistribution>(frequencies);
-		_simulatedSequences = std::make_unique<sequenceContainer>();
+		_rootSampler = FixedAliasTable<AlphabetSize>(frequencies);
+		_fastaWriter.setCharLookup(_charLookup);
+
+		initGillespieSampler();
+		_expectedEventsPerUnitTime = computeExpectedEventsPerUnitTime();
+		assignBranchEngines();
 	}
 
 	virtual ~rateMatrixSim() {
-		if (_outputFile.is_open()) {
-			_outputFile.close();
-		}
+		_fastaWriter.close();
 	}
 
 	void setRng(RngType *rng) {
@@ -52,43 +76,144 @@ public:
 	}
 
 	void clearRatesVec() { 
-		_siteRates.clear();
+		if (_siteRates) exclusiveBuffer(_siteRates).clear();
+	}
+
+	void setSubstitutionEngine(substitutionEngine engine) {
+		_engine = engine;
+		assignBranchEngines();
+	}
+
+	/**
+	 * Crossover point of the AUTO engine: branches whose expected number of
+	 * substitutions per site is below this value are simulated event by event.
+	 */
+	void setGillespieThreshold(MDOUBLE eventsPerSite) {
+		if (eventsPerSite < 0.0) {
+			errorMsg::reportError("Gillespie threshold must be non-negative");
+		}
+		_gillespieThreshold = eventsPerSite;
+		assignBranchEngines();
+	}
+
+	/**
+	 * Threads used to generate the per-site rate categories, build the transition tables
+	 * and compress the output (0 = one per hardware thread).
+	 */
+	void setNumThreads(size_t numThreads) {
+		_numThreads = numThreads;
+	}
+
+	/**
+	 * Bound the resident transition tables, one per (branch length, rate category), to
+	 * capacity (0 = unbounded) and pick which table a full cache drops.
+	 */
+	void setTransitionTableCache(size_t capacity, tableEviction eviction) {
+		_cachedPijt.setEvictionPolicy(eviction);
+		_cachedPijt.setCapacity(capacity);
+	}
+
+	/**
+	 * Share transition tables between branches whose lengths are close enough that no row
+	 * of their transition matrices differs by more than maxTotalVariation (0 = exact lengths).
+	 */
+	void setBranchLengthQuantization(double maxTotalVariation) {
+		_cachedPijt.setLengthQuantization(maxTotalVariation);
+	}
+
+	TransitionTableStats getTransitionTableStats() const {
+		return _cachedPijt.stats();
+	}
+
+	void resetTransitionTableStats() {
+		_cachedPijt.resetStats();
+	}
+
+	/**
+	 * Write low-memory output from a separate thread (default) or from the simulation thread.
+	 * Takes effect the next time an output file is opened.
+	 */
+	void setAsyncOutput(bool asyncOutput) {
+		_asyncOutput = asyncOutput;
+	}
+
+	/**
+	 * Write low-memory output as BGZF (block gzip); blocks are compressed with the
+	 * configured number of threads. Takes effect the next time an output file is opened.
+	 */
+	void setCompressedOutput(bool compressOutput) {
+		_compressOutput = compressOutput;
+	}
+
+	bool isGillespieBranch(int nodeId) {
+		return _useGillespie[nodeId];
 	}
 
 	tree* gettree() {
 		return _et;
 	}
 
-	std::unique_ptr<sequenceContainer> getSequenceContainer() {
-		auto outputSequences = std::move(_simulatedSequences);
-		_simulatedSequences = std::make_unique<sequenceContainer>();
-		return outputSequences;
+	/**
+	 * Sequences saved by the last simulation. The arena is refilled in place by the next
+	 * simulation once the caller released it, and replaced by a new one while it is held.
+	 */
+	std::shared_ptr<SequenceArena> getSequences() {
+		if (!_sequences) _sequences = std::make_shared<SequenceArena>();
+		return _sequences;
 	}
 
 
 	std::vector<double> getSiteRates() { 
+		return _siteRates ? *_siteRates : std::vector<double>();
+	}
+
+	/**
+	 * Site rates and rate categories of the last simulation, shared rather than copied: the
+	 * next simulation writes into new buffers while these are still referenced.
+	 */
+	std::shared_ptr<std::vector<double>> getSiteRatesBuffer() {
+		if (!_siteRates) _siteRates = std::make_shared<std::vector<double>>();
 		return _siteRates;
 	}
 
+	std::shared_ptr<std::vector<uint8_t>> getRateCategoriesBuffer() {
+		if (!_rateCategories) _rateCategories = std::make_shared<std::vector<uint8_t>>();
+		return _rateCategories;
+	}
+
 
 
 	void generate_substitution_log(int seqLength,
 								   const std::string& rootString = "",
 								   const std::vector<size_t>& rootPositionsInMSA = {}) {
+		MemoryPhaseScope phase(SUBSTITUTION_PHASE);
 		std::vector<MDOUBLE> ratesVec(seqLength);
 		MDOUBLE sumOfRatesAcrossSites = 0.0;
-		_rateCategories.resize(seqLength);
+		std::vector<uint8_t> &rateCategories = exclusiveBuffer(_rateCategories);
+		_rateCategorySampler.drawSamples(seqLength, rateCategories, *_rng, _numThreads);
 		for (int h = 0; h < seqLength; h++)  {
-			int selectedRandomCategory = _rateCategorySampler.drawSample(*_rng);
-			_rateCategories[h] = selectedRandomCategory;
-			ratesVec[h] = _sp->rates(selectedRandomCategory);
+			ratesVec[h] = _sp->rates(rateCategories[h]);
 			sumOfRatesAcrossSites += ratesVec[h];
 		}
-		_siteRates.clear();
-		if (_saveRates) _siteRates.insert(_siteRates.end(), ratesVec.begin(), ratesVec.end());
-		
+		std::vector<double> &siteRates = exclusiveBuffer(_siteRates);
+		siteRates.clear();
+		if (_saveRates) siteRates.insert(siteRates.end(), ratesVec.begin(), ratesVec.end());
+
+		if (_finalMsaPath.empty()) {
+			SequenceArena &sequences = exclusiveBuffer(_sequences);
+			sequences.reset(seqLength);
+			sequences.reserveRows(std::count(_nodesToSave->begin(), _nodesToSave->end(), true));
+			sequences.setAlphabet(std::string(_charLookup.begin(), _charLookup.end()));
+		}
 
-		sequence rootSequence = generateRootSeq(seqLength, ratesVec);
+		// with threads to spare, build the tables up front in parallel rather than on demand
+		if (resolveThreadCount(_numThreads) > 1) _cachedPijt.prebuild(_matrixBranches, _numThreads);
+
+		sequence rootSequence = generateRootSeq(seqLength);
+		size_t workspaceBytes = ratesVec.capacity() * sizeof(MDOUBLE) + rateCategories.capacity()
+		                        + siteRates.capacity() * sizeof(double) + seqLength * sizeof(ALPHACHAR);
+		if (_anyGillespieBranch) workspaceBytes += seqLength * GILLESPIE_BYTES_PER_SITE;
+		MemoryCharge workspaceCharge(SUBSTITUTION_WORKSPACE_MEMORY, workspaceBytes);
 		// if the root sequence is provided overwrite the generated root only at the positions specified in rootPositionsInMSA)
 		if (!rootString.empty()) {
 			for (size_t position = 0; position < rootPositionsInMSA.size(); position++) {
@@ -101,9 +226,13 @@ public:
 			saveSequence(rootSequence);
 		}
 
+		if (_anyGillespieBranch) {
+			_subManager.handleRootSequence(rootSequence, *_rateCategories, _sp.get());
+		}
+
 		mutateSeqRecuresively(rootSequence, _et->getRoot());
 
-		// _subManager.clear();
+		_subManager.clear();
 	}
 
 	void mutateSeqRecuresively(const sequence& currentSequence, tree::nodeP currentNode) {
@@ -111,45 +240,87 @@ public:
 
 		for (auto &node: currentNode->getSons()) {
 			sequence childSeq(currentSequence);
+			MemoryCharge sequenceCharge(SUBSTITUTION_WORKSPACE_MEMORY, childSeq.seqLen() * sizeof(ALPHACHAR));
 			childSeq.setID(node->id());
 			childSeq.setName(node->name());
-			mutateSeqAlongBranch(childSeq, node->dis2father());
+			mutateSeqAlongBranch(childSeq, currentSequence, node->dis2father());
 			if ((*_nodesToSave)[node->id()]) saveSequence(childSeq);
 			mutateSeqRecuresively(childSeq, node);
-			// if (!(*_nodesToSave)[node->id()]) _subManager.freeSequence();
-			// if (!_subManager.isEmpty(node->id())) {
-			// 	_subManager.undoSubs(node->id(), *_currentSequence, _rateCategories, _sp.get());
-			// }
+			// restore the site sampler to the state of currentSequence before the next sibling
+			if (_anyGillespieBranch && !_subManager.isEmpty(node->id())) {
+				_subManager.undoSubs(node->id(), childSeq, *_rateCategories, _sp.get());
+			}
 		}
 	}
 
 	void setWriteFolder(const std::string &filePath) {
 		_finalMsaPath = filePath;
 		if (!filePath.empty()) {
-			_outputFile.open(filePath, std::ios::out);  // open once
-			if (!_outputFile.is_open()) {
+			if (!_fastaWriter.open(filePath, _asyncOutput, _compressOutput, _numThreads)) {  // open once
 				errorMsg::reportError("Could not open file " + filePath + " for writing MSA.");
 			}
 		}
 	}
 
+	/**
+	 * Finish the low-memory output file: flush it, write the BGZF end-of-file block when
+	 * compressed and close it, reporting any write failure.
+	 */
+	void closeOutput() {
+		_fastaWriter.close();
+	}
+
 	void setAlignedSequenceMap(const std::unordered_map<size_t, std::vector<int>>& alignedSeq) {
 		_alignedSequenceMap = &alignedSeq;
+		_gapRunSpill = nullptr;
+	}
+
+	/**
+	 * Read the gap runs of the low-memory output from a spill file instead of the MSA.
+	 */
+	void setGapRunSpill(GapRunSpill *spill) {
+		_gapRunSpill = spill;
+		_alignedSequenceMap = nullptr;
+	}
+
+	/**
+	 * Estimated bytes used while simulating seqLength sites, outputs excluded: one sequence
+	 * per level of the recursion (treeDepth edges below the root), the per-site rates and
+	 * categories, the Gillespie site sampler and the transition tables.
+	 */
+	size_t estimateWorkingSetBytes(size_t seqLength, size_t treeDepth) const {
+		size_t bytes = (treeDepth + 1) * seqLength * sizeof(ALPHACHAR);
+		bytes += seqLength * (2 * sizeof(uint8_t) + sizeof(MDOUBLE)); // categories, root buffer, rates
+		if (_saveRates) bytes += seqLength * sizeof(double);
+		if (_anyGillespieBranch) bytes += seqLength * GILLESPIE_BYTES_PER_SITE;
+		return bytes + _cachedPijt.projectedMemoryUsage(_matrixBranches);
+	}
+
+	/**
+	 * Bytes buffered by the low-memory writer: its own buffer, the writer thread's ring and
+	 * the BGZF block buffers.
+	 */
+	size_t outputBufferBytes() const {
+		const size_t buffer = _fastaWriter.bufferSize();
+		size_t bytes = buffer;
+		if (_asyncOutput) bytes += buffer * AsyncOutputSink::DEFAULT_RING_SIZE;
+		if (_compressOutput) bytes += 3 * buffer;
+		return bytes;
 	}
 
 private:
+	using Table = typename CachedTransitionProbabilities<AlphabetSize>::Table;
 
-	sequence generateRootSeq(int seqLength, std::vector<MDOUBLE>& ratesVec) {
+	sequence generateRootSeq(int seqLength) {
 		sequence rootSeq(_alph);
 
 		rootSeq.resize(seqLength);
 
-		size_t rootID = _et->getRoot()->id();
+		fillRootBuffer(static_cast<size_t>(seqLength));
+		const uint8_t *rootChars = _rootBuffer.data();
 		for (int i = 0; i < seqLength; i++) {
-			ALPHACHAR newChar = _frequencySampler->drawSample(*_rng) - 1;
-			rootSeq[i] = newChar;
+			rootSeq[i] = rootChars[i];
 		}
-		// _subManager.setRootSequence(seqLength, ratesVec, _sp.get(), *_currentSequence);
 		
 		// rootSeq.setAlphabet(_alph);
 		rootSeq.setName(_et->getRoot()->name());
@@ -158,125 +329,176 @@ private:
 
 	}
 
-	void mutateSeqAlongBranch(sequence& currentSequence, const MDOUBLE& distToFather) {
-		// const MDOUBLE distToFather = currentNode->dis2father();
+	/**
+	 * Draw seqLength root characters from the stationary frequencies into _rootBuffer.
+	 * Long roots are split into fixed chunks, each drawn from its own counter-based stream
+	 * (in order on one thread), so the result for a given seed does not depend on the number
+	 * of threads.
+	 */
+	void fillRootBuffer(size_t seqLength) {
+		_rootBuffer.resize(seqLength);
+		const size_t numChunks = (seqLength + ROOT_CHUNK_LENGTH - 1) / ROOT_CHUNK_LENGTH;
+		if (numChunks < 2) {
+			_rootSampler.drawSamples(_rootBuffer.data(), seqLength, *_rng);
+			return;
+		}
+
+		const uint64_t baseSeed = static_cast<uint64_t>((*_rng)());
+		parallelFor(0, numChunks, _numThreads, [&](size_t chunk) {
+			RngType chunkRng(streamSeed(baseSeed, chunk));
+			const size_t chunkBegin = chunk * ROOT_CHUNK_LENGTH;
+			const size_t chunkEnd = std::min(seqLength, chunkBegin + ROOT_CHUNK_LENGTH);
+			_rootSampler.drawSamples(_rootBuffer.data() + chunkBegin, chunkEnd - chunkBegin, chunkRng);
+		});
+	}
+
+	void mutateSeqAlongBranch(sequence& currentSequence, const sequence& parentSequence,
+							  const MDOUBLE& distToFather) {
+		if (_useGillespie[currentSequence.id()]) {
+			mutateSeqGillespie(currentSequence, distToFather);
+			return;
+		}
 		mutateEntireSeq(currentSequence);
+		// the site sampler has to follow the sequence for Gillespie branches further down
+		if (_anyGillespieBranch) {
+			_subManager.syncSequence(currentSequence.id(), parentSequence, currentSequence,
+									 *_rateCategories, _sp.get());
+		}
 	}
 
 	void mutateEntireSeq(sequence& currentSequence) {
 		const int nodeId = currentSequence.id();
+		const std::vector<uint8_t> &rateCategories = *_rateCategories;
+		// tables of the branch, acquired from the cache on the first site of each category;
+		// a site then reads one row, AlphabetSize floats, from its category's table
+		_branchTables.assign(_cachedPijt.numCategories(), nullptr);
+		const Table **tables = _branchTables.data();
+		auto rowOf = [&](uint8_t category, ALPHACHAR parentChar) {
+			const Table *table = tables[category];
+			if (table == nullptr) table = tables[category] = _cachedPijt.acquire(nodeId, category);
+			return table->row(parentChar);
+		};
 		
-		// Check if this is a leaf we're saving (low memory mode)
-		if (_alignedSequenceMap != nullptr && (*_nodesToSave)[nodeId]) {
-			const std::vector<int>& gapStructure = _alignedSequenceMap->at(nodeId);
-			
-			size_t site = 0;
-			for (int blockSize : gapStructure) {
-				if (blockSize < 0) {
-					// Gap block - skip these sites
-					site += (-blockSize);
-					continue;
-				}
-				// Non-gap block - mutate these sites
-				for (int i = 0; i < blockSize; ++i, ++site) {
-					ALPHACHAR parentChar = currentSequence[site];
-					auto &Pijt = _cachedPijt.getDistribution(nodeId, _rateCategories[site], parentChar);
-					ALPHACHAR nextChar = Pijt.drawSample(*_rng) - 1;
-					currentSequence[site] = nextChar;
-				}
-			}
-		} else {
-			// Normal mode - mutate all sites
-			for (size_t site = 0; site < currentSequence.seqLen(); ++site) {
-				ALPHACHAR parentChar = currentSequence[site];
-				auto &Pijt = _cachedPijt.getDistribution(nodeId, _rateCategories[site], parentChar);
-				ALPHACHAR nextChar = Pijt.drawSample(*_rng) - 1;
-				currentSequence[site] = nextChar;
-			}
+		// every site is mutated, gapped or not, so the random stream and therefore the output
+		// are the same whether rows are kept in memory or streamed with their gap runs
+		const size_t length = static_cast<size_t>(currentSequence.seqLen());
+		for (size_t site = 0; site < length; ++site) {
+			const float *row = rowOf(rateCategories[site], currentSequence[site]);
+			currentSequence[site] = Table::drawFromRow(row, *_rng);
+		}
+		for (size_t category = 0; category < _branchTables.size(); ++category) {
+			if (_branchTables[category] != nullptr) _cachedPijt.release(nodeId, static_cast<int>(category));
 		}
 	}
 
-	// void mutateSeqGillespie(tree::nodeP currentNode, int seqLength, MDOUBLE distToParent) {
-	// 	const int nodeId = currentNode->id();
-	// 	const int parentId = currentNode->father()->id();
-	// 	MDOUBLE branchLength = distToParent;
+	void mutateSeqGillespie(sequence& currentSequence, MDOUBLE branchLength) {
+		const int nodeId = currentSequence.id();
 
-	// 	double lambdaParam = _subManager.getReactantsSum();
-	// 	std::exponential_distribution<double> distribution(-lambdaParam);
-	// 	double waitingTime = distribution(*_rng);
-	// 	if (waitingTime < 0) {
-	// 		std::cout << branchLength << " " << lambdaParam << " " << waitingTime << "\n";
-	// 		errorMsg::reportError("waiting time is negative :(");
-	// 	}
-	// 	while (waitingTime < branchLength) {
-	// 		if (waitingTime < 0) {
-	// 			std::cout << branchLength << " " << lambdaParam << " " << waitingTime << "\n";
-	// 			errorMsg::reportError("waiting time is negative :(");
-	// 		}
-
-	// 		int mutatedSite = _subManager.sampleSite(*_rng);
-	// 		ALPHACHAR parentChar = (*_currentSequence)[mutatedSite];
-	// 		ALPHACHAR nextChar = _gillespieSampler[parentChar]->drawSample(*_rng) - 1;
-	// 		_subManager.handleEvent(nodeId, mutatedSite, nextChar, _rateCategories, _sp.get(), *_currentSequence);
-
-	// 		lambdaParam = _subManager.getReactantsSum();
-	// 		branchLength = branchLength - waitingTime;
-	// 		std::exponential_distribution<double> distribution(-lambdaParam);
-	// 		waitingTime = distribution(*_rng);
-	// 	}
-	// }
+		MDOUBLE lambdaParam = _subManager.getReactantsSum();
+		if (lambdaParam <= 0.0) return;
+		std::exponential_distribution<double> distribution(lambdaParam);
+		MDOUBLE waitingTime = distribution(*_rng);
+
+		while (waitingTime < branchLength) {
+			size_t mutatedSite = _subManager.sampleSite(*_rng);
+			ALPHACHAR parentChar = currentSequence[mutatedSite];
+			ALPHACHAR nextChar = _gillespieSampler[parentChar]->drawSample(*_rng) - 1;
+			_subManager.handleEvent(nodeId, mutatedSite, nextChar, *_rateCategories, _sp.get(), currentSequence);
+
+			branchLength = branchLength - waitingTime;
+			lambdaParam = _subManager.getReactantsSum();
+			if (lambdaParam <= 0.0) return;
+			distribution = std::exponential_distribution<double>(lambdaParam);
+			waitingTime = distribution(*_rng);
+		}
+	}
 
 	void saveSequence(const sequence &currentSequence) {
 		if (_finalMsaPath.size() > 0) {
 			saveSequenceToDisk(currentSequence);
 			return;
 		}
-		sequence temp(currentSequence);
-		_simulatedSequences->add(temp);
+		_sequences->addSequence(currentSequence);
 	}
 
 	void saveSequenceToDisk(const sequence &currentSequence) {
 		const int nodeId = currentSequence.id();
-		
-		
-		_outputFile << ">" << currentSequence.name() << "\n";
-		
+
 		// Get gap structure for this sequence
-		if (_alignedSequenceMap != nullptr) {
-			const std::vector<int>& gapStructure = _alignedSequenceMap->at(nodeId);
-			size_t site = 0;
-			for (int blockSize : gapStructure) {
-				if (blockSize < 0) {
-					// Gap block - write gaps
-					_outputFile << std::string(-blockSize, '-');
-				} else {
-					// Non-gap block - write sequence characters
-					for (int i = 0; i < blockSize; ++i) {
-						_outputFile << _charLookup[currentSequence[site++]];
-					}
-				}
-			}
+		if (hasGapRuns()) {
+			const std::vector<int>& gapStructure = gapRunsOf(nodeId);
+			_fastaWriter.writeAlignedRow(currentSequence.name(), currentSequence, gapStructure);
 		} else {
-			for (size_t site = 0; site < currentSequence.seqLen(); ++site) {
-				_outputFile << _charLookup[currentSequence[site]];
+			_fastaWriter.writeRow(currentSequence.name(), currentSequence, currentSequence.seqLen());
+		}
+	}
+
+	bool hasGapRuns() const {
+		return _alignedSequenceMap != nullptr || _gapRunSpill != nullptr;
+	}
+
+	const std::vector<int>& gapRunsOf(int nodeId) {
+		if (_gapRunSpill != nullptr) return _gapRunSpill->runsOf(nodeId);
+		return _alignedSequenceMap->at(nodeId);
+	}
+
+	// jump chain of the substitution process: P(i -> j | a substitution occurs) = Qij / -Qii
+	void initGillespieSampler() {
+		_gillespieSampler.resize(AlphabetSize);
+		for (size_t i = 0; i < AlphabetSize; ++i) {
+			std::vector<double> qRates(AlphabetSize, 0.0);
+			double sum = -_sp->Qij(i,i);
+			if (sum <= 0.0) continue; // absorbing state, never sampled
+			double normalizer = 1.0 / sum;
+			for (size_t j = 0; j < AlphabetSize; ++j) {
+				if (i==j) continue;
+				qRates[j] = _sp->Qij(i,j) * normalizer;
 			}
+			_gillespieSampler[i] = std::make_unique<DiscreteDistribution>(qRates);
 		}
-		_outputFile << "\n";
-	}
-
-	// void initGillespieSampler() {
-	// 	_gillespieSampler.resize(_alph->size());
-	// 	for (size_t i = 0; i < _alph->size(); ++i) {
-	// 		std::vector<double> qRates(_alph->size(), 0.0);
-	// 		double sum = -_sp->Qij(i,i);
-	// 		double normalizer = 1.0 / sum;
-	// 		for (size_t j = 0; j < _alph->size(); ++j) {
-	// 			if (i==j) continue;
-	// 			qRates[j] = _sp->Qij(i,j) * normalizer;
-	// 		}
-	// 		_gillespieSampler[i] = std::make_unique<DiscreteDistribution>(qRates);
-	// 	}
-	// }
+	}
+
+	// expected number of substitutions per site per unit of branch length
+	MDOUBLE computeExpectedEventsPerUnitTime() {
+		MDOUBLE meanRate = 0.0;
+		for (int cat = 0; cat < _sp->categories(); ++cat) {
+			meanRate += _sp->ratesProb(cat) * _sp->rates(cat);
+		}
+		MDOUBLE meanLeavingRate = 0.0;
+		for (size_t i = 0; i < AlphabetSize; ++i) {
+			meanLeavingRate += _sp->freq(i) * (-_sp->Qij(i,i));
+		}
+		return meanRate * meanLeavingRate;
+	}
+
+	void assignBranchEngines() {
+		const size_t numNodes = _et->getNodesNum();
+		_useGillespie.assign(numNodes, false);
+		_anyGillespieBranch = false;
+		_matrixBranches.clear();
+		if (_engine != substitutionEngine::MATRIX_ENGINE) {
+			assignGillespieBranches();
+		}
+		for (size_t nodeId = 0; nodeId < numNodes; ++nodeId) {
+			if (!_useGillespie[nodeId] && static_cast<int>(nodeId) != _et->getRoot()->id()) _matrixBranches.push_back(nodeId);
+		}
+	}
+
+	void assignGillespieBranches() {
+		std::vector<tree::nodeP> nodesToProcess = {_et->getRoot()};
+		while (!nodesToProcess.empty()) {
+			tree::nodeP currentNode = nodesToProcess.back();
+			nodesToProcess.pop_back();
+			for (auto &son: currentNode->getSons()) {
+				MDOUBLE expectedEvents = son->dis2father() * _expectedEventsPerUnitTime;
+				bool useGillespie = (_engine == substitutionEngine::GILLESPIE_ENGINE)
+									|| (expectedEvents < _gillespieThreshold);
+				_useGillespie[son->id()] = useGillespie;
+				_anyGillespieBranch = _anyGillespieBranch || useGillespie;
+				nodesToProcess.push_back(son);
+			}
+		}
+	}
 
 	void setSaveStateLeaves(const tree::nodeP &node) {
 		for(auto &node: node->getSons()) {
@@ -314,6 +536,7 @@ private:
 	// }
 
 	tree* _et;
+	std::shared_ptr<SharedSubstitutionModel<AlphabetSize>> _model; // from the process-wide ModelCache
 	std::shared_ptr<const stochasticProcess> _sp;
 	const alphabet* _alph;
 
@@ -321,27 +544,41 @@ private:
 	// MDOUBLE _siteRateCorrelation;
 
 	CachedTransitionProbabilities<AlphabetSize> _cachedPijt;
-	// computePijGam _cpijGam;
-	// sequence* _currentSequence;
-	// substitutionManager _subManager;
+	substitutionManager _subManager;
 	std::shared_ptr<std::vector<bool>> _nodesToSave;
 	bool _saveRates;
 	std::vector<std::unique_ptr<DiscreteDistribution>> _gillespieSampler;
 
-	std::vector<size_t> _rateCategories;
-	std::vector<double> _siteRates;
-	std::unique_ptr<sequenceContainer> _simulatedSequences;
-	std::unique_ptr<DiscreteDistribution> _frequencySampler;
+	substitutionEngine _engine;
+	MDOUBLE _gillespieThreshold;
+	MDOUBLE _expectedEventsPerUnitTime;
+	std::vector<bool> _useGillespie;
+	std::vector<size_t> _matrixBranches; // node ids of the branches drawn from the transition tables
+	std::vector<const Table*> _branchTables;
+	bool _anyGillespieBranch;
+	size_t _numThreads;
+
+	std::shared_ptr<std::vector<uint8_t>> _rateCategories;
+	std::shared_ptr<std::vector<double>> _siteRates;
+	std::shared_ptr<SequenceArena> _sequences;
+	FixedAliasTable<AlphabetSize> _rootSampler;
+	std::vector<uint8_t> _rootBuffer;
+	static constexpr size_t ROOT_CHUNK_LENGTH = size_t(1) << 18;
+	// initial site weight plus the rejection sampler's weight, bucket entry and position per site
+	static constexpr size_t GILLESPIE_BYTES_PER_SITE = 32;
 
 	CategorySampler _rateCategorySampler;
 	std::string _finalMsaPath;
 
-	std::array<std::string, AlphabetSize> _charLookup;
+	std::array<char, AlphabetSize> _charLookup;
 
 	const std::unordered_map<size_t, std::vector<int>>* _alignedSequenceMap = nullptr;
+	GapRunSpill *_gapRunSpill = nullptr;
 
 	RngType *_rng;
-	std::ofstream _outputFile;
+	FastaWriter _fastaWriter;
+	bool _asyncOutput;
+	bool _compressOutput;
 
 	std::vector<int> _userRootSequence;
 
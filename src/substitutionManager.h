@@ -1,112 +1,121 @@
+#ifndef ___SUBSTITUTION_MANAGER
+#define ___SUBSTITUTION_MANAGER
 
 #include <memory>
-#include <unordered_map>
-#include <map>
+#include <vector>
+#include <limits>
+#include <cstdint>
 #include <iostream>
-#include <fstream>
 
+#include "../libs/Phylolib/includes/definitions.h"
+#include "../libs/Phylolib/includes/errorMsg.h"
 #include "../libs/Phylolib/includes/sequence.h"
+#include "../libs/Phylolib/includes/stochasticProcess.h"
 #include "FastRejectionSampler.h"
 
-const unsigned char INVALID_CHAR = 255;
-
-
+/**
+ * substitutionManager holds the state used by the event-driven (Gillespie) substitution engine.
+ *
+ * Every site s carries a leaving rate w_s = r(c_s) * -Q(x_s, x_s), where c_s is the rate category
+ * and x_s the current character. The rates live in a dynamic weighted sampler so that the next
+ * mutated site can be drawn in (amortized) constant time, and their sum is the total event rate
+ * of the sequence. Every change applied along a branch is logged under the child node id so the
+ * sampler can be rolled back to the parent state once the subtree below that branch is done.
+ */
 class substitutionManager
 {
 private:
-    // using changeMap = std::vector<ALPHACHAR>;
-    std::vector<std::unique_ptr<sequence>> _nodeIdToSequencess;
+    struct change {
+        size_t position;
+        ALPHACHAR previousChar;
+    };
+
+    std::vector<std::vector<change>> _changeLog;
     std::unique_ptr<FastRejectionSampler> _siteSampler;
+    std::vector<MDOUBLE> _leavingRates;
     MDOUBLE _sumOfReactantsXRates;
-    // size_t _changeCounter;
-public:
-    substitutionManager(int numberOfTreeNodes) {
-        _nodeIdToSequencess.resize(numberOfTreeNodes);
-        _sumOfReactantsXRates = 0.0;
-        // _changeCounter = 0;
-    }
+    size_t _sequenceLength;
+    size_t _updatesSinceRecompute;
 
-    void updateReactantsSum(MDOUBLE Qii, MDOUBLE siteRate) {
-        _sumOfReactantsXRates += Qii*siteRate;
+    void updateSite(size_t position, ALPHACHAR newChar, MDOUBLE siteRate) {
+        if (siteRate <= 0.0) return; // invariant sites are never sampled
+        const MDOUBLE newWeight = -_leavingRates[newChar] * siteRate;
+        _siteSampler->updateWeight(position, newWeight);
+        ++_updatesSinceRecompute;
     }
 
-    MDOUBLE getReactantsSum() {
-        return _sumOfReactantsXRates;
+    // The sampler keeps its sums up to date incrementally, so rounding errors build up over
+    // many updates. Recomputing them once per sequence length's worth of updates keeps the
+    // total rate exact at an amortized O(1) cost per update.
+    void refreshSum() {
+        if (_updatesSinceRecompute >= _sequenceLength) {
+            _siteSampler->recomputeSums();
+            _updatesSinceRecompute = 0;
+        }
+        _sumOfReactantsXRates = _siteSampler->getSumOfWeights();
     }
 
-
-    // ALPHACHAR getCharacter(const int nodeId, const size_t position, const sequence &rootSeq) {
-    //     if (_substitutionVec[nodeId] == nullptr) return rootSeq[position];
-        
-    //     changeMap* currentChanges = (_substitutionVec[nodeId].get());
-    //     size_t isInvalid = ((*currentChanges)[position] == INVALID_CHAR);
-    //     if (isInvalid) return rootSeq[position];
-    //     return (*currentChanges)[position];
-    // }
-    void initializeRoot(std::unique_ptr<sequence> rootSeq) {
-        _nodeIdToSequences[0] = std::move(rootSeq);
-        _currentSequence = _nodeIdToSequences[0].get(); // Now just a raw pointer
+public:
+    substitutionManager(int numberOfTreeNodes)
+        : _sumOfReactantsXRates(0.0), _sequenceLength(0), _updatesSinceRecompute(0) {
+        _changeLog.resize(numberOfTreeNodes);
     }
 
-    void handleRootSequence(size_t sequenceLength,
-                            std::vector<MDOUBLE> &gammaSiteRates, 
-                            const stochasticProcess *sp,
-                            sequence &rootSeq) {
-        _substitutionVec[0] = std::make_unique<changeMap>(sequenceLength, INVALID_CHAR);
-        for (size_t site = 0; site < sequenceLength; site++) {
-            ALPHACHAR currentChar = rootSeq[site];
-		    MDOUBLE qii = sp->Qij(currentChar, currentChar);
-            if(qii > 0) errorMsg::reportError("Qii is positive!");
-		    if(gammaSiteRates[site] < 0) errorMsg::reportError("rate category is negative!");
-
-            (*_substitutionVec[0])[site] = currentChar;
-            updateReactantsSum(qii, gammaSiteRates[site]);
-            gammaSiteRates[site] = gammaSiteRates[site]*(-qii);
-        }
+    /**
+     * Build the site sampler for a new replicate from the root sequence.
+     * @param rootSeq - the root sequence
+     * @param rateCategories - rate category of every site
+     * @param sp - stochastic process providing Q and the category rates
+     */
+    template<typename CategoryVec>
+    void handleRootSequence(const sequence &rootSeq, const CategoryVec &rateCategories,
+                            const stochasticProcess *sp) {
+        const size_t sequenceLength = rootSeq.seqLen();
+        const int alphabetSize = sp->alphabetSize();
+
+        _leavingRates.resize(alphabetSize);
         MDOUBLE minQii = std::numeric_limits<MDOUBLE>::max();
         MDOUBLE maxQii = 0.0;
-        for (size_t i = 0; i < sp->alphabetSize(); i++) {
-            // std::cout << "Q" << i << i << "=" << -sp->Qij(i,i) << "\n";
-
-            minQii = std::min<MDOUBLE>(-sp->Qij(i,i), minQii);
-            maxQii = std::max<MDOUBLE>(-sp->Qij(i,i), maxQii);
+        for (int i = 0; i < alphabetSize; i++) {
+            _leavingRates[i] = sp->Qij(i, i);
+            if (_leavingRates[i] > 0) errorMsg::reportError("Qii is positive!");
+            minQii = std::min<MDOUBLE>(-_leavingRates[i], minQii);
+            maxQii = std::max<MDOUBLE>(-_leavingRates[i], maxQii);
         }
+
         MDOUBLE minRate = std::numeric_limits<MDOUBLE>::max();
         MDOUBLE maxRate = 0.0;
-
-        for (size_t i = 0; i < sp->categories(); i++) {
-            // std::cout << "rate=" << sp->rates(i) << "\n";
+        for (int i = 0; i < sp->categories(); i++) {
+            if (sp->rates(i) < 0) errorMsg::reportError("rate category is negative!");
+            if (sp->rates(i) == 0.0) continue;
             minRate = std::min<MDOUBLE>(sp->rates(i), minRate);
             maxRate = std::max<MDOUBLE>(sp->rates(i), maxRate);
         }
+        if (maxRate == 0.0 || maxQii == 0.0) {
+            errorMsg::reportError("substitutionManager: all sites have a zero substitution rate");
+        }
 
-        minRate = (minRate * minQii) / 2.0;
-        maxRate = (maxRate * maxQii) * 2.0;
-        _siteSampler = std::make_unique<FastRejectionSampler>(gammaSiteRates, minRate, maxRate);
-    }
-
-    void handleEvent(const int nodeId, const size_t position, const ALPHACHAR change,
-                     const vector<size_t> &rateCategories, const stochasticProcess *sp,
-                    sequence &rootSeq) {
-        // std::cout << "Change in node=" << nodeId << " in position=" << position << "\n";
-
-        // if (_substitutionVec[nodeId] == nullptr) {
-        //     _substitutionVec[nodeId] = std::make_unique<changeMap>(rootSeq.seqLen(), INVALID_CHAR);
-        // }
-
-        ALPHACHAR previousChar = rootSeq[position];
-
-        MDOUBLE previousQii = sp->Qij(previousChar, previousChar);
-		MDOUBLE newQii = sp->Qij(change, change);
-		updateReactantsSum(-previousQii, sp->rates(rateCategories[position]));
-        updateReactantsSum(newQii, sp->rates(rateCategories[position]));
-
-        MDOUBLE newWeight = (-newQii)*sp->rates(rateCategories[position]);
-        _siteSampler->updateWeight(position, newWeight);
+        std::vector<double> siteWeights(sequenceLength);
+        _sumOfReactantsXRates = 0.0;
+        for (size_t site = 0; site < sequenceLength; site++) {
+            const MDOUBLE siteRate = sp->rates(rateCategories[site]);
+            siteWeights[site] = -_leavingRates[rootSeq[site]] * siteRate;
+        }
 
+        for (auto &log: _changeLog) log.clear();
+        _siteSampler = std::make_unique<FastRejectionSampler>(siteWeights,
+                                                              (minRate * minQii) / 2.0,
+                                                              (maxRate * maxQii) * 2.0);
+        _sequenceLength = sequenceLength;
+        _updatesSinceRecompute = 0;
+        _sumOfReactantsXRates = _siteSampler->getSumOfWeights();
+    }
 
-        // (*_substitutionVec[nodeId])[position] = previousChar;
-        // rootSeq[position] = change;
+    /**
+     * Total event rate of the current sequence (sum of all site leaving rates).
+     */
+    MDOUBLE getReactantsSum() {
+        return _sumOfReactantsXRates;
     }
 
     template <typename Generator>
@@ -114,88 +123,71 @@ public:
         return _siteSampler->sample(gen);
     }
 
-    void dumpSubstitutionLog(const int nodeId) {
-        if (nodeId == 0) return;
-        if (_substitutionVec[nodeId] == nullptr) return;
-        std::stringstream ss;
-        std::stringstream changeString;
-
-        ss << "/home/elyawy/temp/" << nodeId << ".sfasta";
-        std::ofstream o(ss.str());
+    /**
+     * Apply a single substitution at position, logging the previous character under nodeId.
+     */
+    template<typename CategoryVec>
+    void handleEvent(const int nodeId, const size_t position, const ALPHACHAR change,
+                     const CategoryVec &rateCategories, const stochasticProcess *sp,
+                     sequence &currentSeq) {
+        _changeLog[nodeId].push_back({position, currentSeq[position]});
+        currentSeq[position] = change;
+        updateSite(position, change, sp->rates(rateCategories[position]));
+        refreshSum();
+    }
 
-        for (auto &changes: *_substitutionVec[nodeId]) {
-            // changeString << changes.first << "-" << changes.second << "\n";
-            changeString << changes << "\n";
+    /**
+     * Bring the sampler in line with a sequence that was mutated by another engine.
+     * Every site that differs between parentSeq and childSeq is logged under nodeId.
+     */
+    template<typename CategoryVec>
+    void syncSequence(const int nodeId, const sequence &parentSeq, const sequence &childSeq,
+                      const CategoryVec &rateCategories, const stochasticProcess *sp) {
+        const size_t sequenceLength = childSeq.seqLen();
+        for (size_t site = 0; site < sequenceLength; ++site) {
+            const ALPHACHAR previousChar = parentSeq[site];
+            const ALPHACHAR newChar = childSeq[site];
+            if (previousChar == newChar) continue;
+            _changeLog[nodeId].push_back({site, previousChar});
+            if (_leavingRates[previousChar] == _leavingRates[newChar]) continue;
+            updateSite(site, newChar, sp->rates(rateCategories[site]));
         }
-        o << changeString.str();
-
+        refreshSum();
     }
 
-
-    void undoSubs(int fromNode, sequence &rootSeq, 
-                  const vector<size_t> &rateCategories, const stochasticProcess *sp) {
-        if ((_substitutionVec[fromNode] == nullptr)) {
-            errorMsg::reportError("Trying to reach removed pointer!");
+    /**
+     * Roll back every change logged under fromNode, restoring both currentSeq and the sampler.
+     */
+    template<typename CategoryVec>
+    void undoSubs(int fromNode, sequence &currentSeq,
+                  const CategoryVec &rateCategories, const stochasticProcess *sp) {
+        auto &nodeChanges = _changeLog[fromNode];
+        for (auto it = nodeChanges.rbegin(); it != nodeChanges.rend(); ++it) {
+            const ALPHACHAR currentChar = currentSeq[it->position];
+            currentSeq[it->position] = it->previousChar;
+            if (_leavingRates[currentChar] == _leavingRates[it->previousChar]) continue;
+            updateSite(it->position, it->previousChar, sp->rates(rateCategories[it->position]));
         }
-        auto nodeChangeMap = getChangeMap(fromNode);
-        // std::cout << "Recovering sequence from node=" << fromNode << "\n";
-        for (size_t currentSite=0; currentSite < rootSeq.seqLen(); ++currentSite) {
-
-            if ((*nodeChangeMap)[currentSite] == INVALID_CHAR) continue;
-            if ((*nodeChangeMap)[currentSite] == rootSeq[currentSite]) continue;
-
-            ALPHACHAR currentChar = rootSeq[currentSite];
-            ALPHACHAR restoredChar = (*nodeChangeMap)[currentSite];
-
-            MDOUBLE oldFreq = sp->Qij(currentChar, currentChar);
-            MDOUBLE newFreq = sp->Qij(restoredChar, restoredChar);
-
-            rootSeq[currentSite] = restoredChar;
-
-            updateReactantsSum(-oldFreq, sp->rates(rateCategories[currentSite]));
-            updateReactantsSum(newFreq, sp->rates(rateCategories[currentSite]));
-
-            MDOUBLE newWeight = (-newFreq)*sp->rates(rateCategories[currentSite]);
-            _siteSampler->updateWeight(currentSite, newWeight);
-	    }
+        nodeChanges.clear();
+        refreshSum();
     }
 
-
     bool isEmpty(const int nodeId) {
-
-        bool checkEmpty = _substitutionVec[nodeId] == nullptr;
-        return checkEmpty;
+        return _changeLog[nodeId].empty();
     }
 
-
-    std::unique_ptr<changeMap> getChangeMap(const int nodeId) {
-        if ((_substitutionVec[nodeId] == nullptr)) {
-            std::cout << nodeId << " <- this node is null\n";
-            errorMsg::reportError("Trying to reach removed pointer!");
-        }
-
-        return std::move(_substitutionVec[nodeId]);
-    }
-
-    void printSubManager() {
-        std::cout << "printing subs...\n";
-        for(auto &node: _substitutionVec) {
-            for(auto &changes: *node){
-                std::cout << changes << ", ";
-            }
-
-            std::cout << "\n";
-        }
+    bool isInitialized() {
+        return _siteSampler != nullptr;
     }
 
     void clear() {
-        size_t containerSize = _substitutionVec.size();
-        _substitutionVec.clear();
-        _substitutionVec.resize(containerSize);
+        for (auto &log: _changeLog) log.clear();
+        _siteSampler.reset();
         _sumOfReactantsXRates = 0.0;
+        _updatesSinceRecompute = 0;
     }
 
-
-
     ~substitutionManager() {};
 };
+
+#endif
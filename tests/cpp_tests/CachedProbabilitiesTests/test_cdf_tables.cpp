@@ -0,0 +1,136 @@
+#include <chrono>
+#include <random>
+#include <iostream>
+#include "../../../libs/pcg/pcg_random.hpp"
+#include "../../../src/CachedTransitionProbabilities.h"
+#include "../../../libs/Phylolib/includes/tree.h"
+#include "../../../libs/Phylolib/includes/stochasticProcess.h"
+#include "../../../libs/Phylolib/includes/gammaDistribution.h"
+#include "../../../libs/Phylolib/includes/readDatMatrix.h"
+#include "../../../libs/Phylolib/includes/trivialAccelerator.h"
+#include "../TestCheck.h"
+
+// Draws from the float32 cumulative rows follow the transition probabilities and never
+// produce a zero-probability character; the per-site lookup through one flat table per
+// branch and category is timed on a 20-state model against a nested layout (node to unique
+// branch, then per-category and per-parent vectors of double thresholds).
+
+// nested per-branch, per-category, per-parent distributions, as a reference layout
+struct NestedTables {
+    std::vector<size_t> uniqueOfNode;
+    std::vector<std::vector<std::vector<std::vector<double>>>> cdfs; // [unique][category][parent][child]
+
+    template<typename RngType>
+    uint8_t draw(size_t node, size_t category, size_t parent, RngType &rng) const {
+        const std::vector<double> &cdf = cdfs[uniqueOfNode[node]][category][parent];
+        const double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        size_t character = 0;
+        while (character + 1 < cdf.size() && u >= cdf[character]) ++character;
+        return static_cast<uint8_t>(character);
+    }
+};
+
+int main() {
+    bool passed = true;
+    gammaDistribution gamma(0.5, 4);
+    pupAll wag(datMatrixHolder::wag);
+    trivialAccelerator wagPij(&wag);
+    stochasticProcess process(&gamma, &wagPij);
+
+    // frequencies against P(t)
+    tree tree_("((A:0.05,B:0.4):0.1,C:1.2);", false);
+    CachedTransitionProbabilities<20> cache(tree_, process);
+    pcg64_fast rng(3);
+    const size_t numDraws = 2000000;
+    double worst = 0.0;
+    for (int node = 1; node < tree_.getNodesNum(); ++node) {
+        const float *row = cache.getCdf(node, 3, 7);
+        std::vector<size_t> counts(20, 0);
+        for (size_t k = 0; k < numDraws; ++k) ++counts[CdfTable<20>::drawFromRow(row, rng)];
+        std::vector<tree::nodeP> nodes = {tree_.getRoot()};
+        MDOUBLE length = 0.0;
+        while (!nodes.empty()) {
+            tree::nodeP current = nodes.back();
+            nodes.pop_back();
+            if (current->id() == node) length = current->dis2father();
+            for (int s = 0; s < current->getNumberOfSons(); ++s) nodes.push_back(current->getSon(s));
+        }
+        for (int j = 0; j < 20; ++j) {
+            const double expected = process.Pij_t(7, j, length * gamma.rates(3));
+            worst = std::max(worst, std::abs(counts[j] / double(numDraws) - expected));
+        }
+    }
+    passed &= check("frequencies match P(t)", worst < 2e-3);
+    std::cout << "largest frequency difference: " << worst << "\n";
+
+    CdfTable<4> sparse;
+    const double probabilities[] = {0.0, 0.7, 0.0, 0.3};
+    sparse.setRow(0, probabilities);
+    std::vector<size_t> counts(4, 0);
+    for (size_t k = 0; k < numDraws; ++k) ++counts[CdfTable<4>::drawFromRow(sparse.row(0), rng)];
+    passed &= check("zero probabilities never drawn", counts[0] == 0 && counts[2] == 0 && counts[1] > 0 && counts[3] > 0);
+
+    // per-site lookup on a 20-state model, 200 branches of distinct lengths
+    std::string newick = "(L0:0.01,L1:0.02)";
+    for (int leaf = 2; leaf < 101; ++leaf) {
+        newick = "(" + newick + ":" + std::to_string(0.01 + 0.003 * leaf) + ",L" + std::to_string(leaf) + ":"
+                 + std::to_string(0.5 + 0.003 * leaf) + ")";
+    }
+    tree bench(newick + ";", false);
+    const size_t numNodes = bench.getNodesNum();
+    std::vector<size_t> branches;
+    for (size_t node = 1; node < numNodes; ++node) branches.push_back(node);
+    CachedTransitionProbabilities<20> flat(bench, process);
+    flat.prebuild(branches, 1);
+
+    NestedTables nested;
+    nested.uniqueOfNode.resize(numNodes);
+    nested.cdfs.resize(numNodes);
+    for (size_t node = 1; node < numNodes; ++node) {
+        nested.uniqueOfNode[node] = node;
+        nested.cdfs[node].resize(4, std::vector<std::vector<double>>(20, std::vector<double>(20)));
+        for (size_t cat = 0; cat < 4; ++cat) {
+            for (size_t parent = 0; parent < 20; ++parent) {
+                const float *row = flat.getCdf(static_cast<int>(node), static_cast<int>(cat), static_cast<int>(parent));
+                for (size_t j = 0; j < 20; ++j) nested.cdfs[node][cat][parent][j] = row[j];
+            }
+        }
+    }
+
+    const size_t numSites = 20000;
+    std::vector<uint8_t> categories(numSites);
+    std::vector<uint8_t> sequence(numSites);
+    for (size_t site = 0; site < numSites; ++site) {
+        categories[site] = static_cast<uint8_t>(rng() % 4);
+        sequence[site] = static_cast<uint8_t>(rng() % 20);
+    }
+
+    std::vector<uint8_t> nestedSequence = sequence;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t node = 1; node < numNodes; ++node) {
+        for (size_t site = 0; site < numSites; ++site) {
+            nestedSequence[site] = nested.draw(node, categories[site], nestedSequence[site], rng);
+        }
+    }
+    const double nestedMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    std::vector<uint8_t> flatSequence = sequence;
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t node = 1; node < numNodes; ++node) {
+        const CdfTable<20> *tables[4];
+        for (int cat = 0; cat < 4; ++cat) tables[cat] = flat.acquire(static_cast<int>(node), cat);
+        for (size_t site = 0; site < numSites; ++site) {
+            flatSequence[site] = CdfTable<20>::drawFromRow(tables[categories[site]]->row(flatSequence[site]), rng);
+        }
+        for (int cat = 0; cat < 4; ++cat) flat.release(static_cast<int>(node), cat);
+    }
+    const double flatMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    size_t checksum = 0;
+    for (size_t site = 0; site < numSites; ++site) checksum += nestedSequence[site] + flatSequence[site];
+    std::cout << (numNodes - 1) << " branches x " << numSites << " 20-state sites: " << nestedMs << " ms nested, "
+              << flatMs << " ms flat float32 (checksum " << checksum << ")\n";
+    passed &= check("table layout", sizeof(CdfTable<20>) % 64 == 0 && alignof(CdfTable<20>) == 64);
+
+    return passed ? 0 : 1;
+}
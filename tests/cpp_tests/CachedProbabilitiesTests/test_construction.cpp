@@ -33,7 +33,7 @@ int main() {
     
     // 4. Test retrieval - get distribution for node 1, category 0, character 0
     if (testTree.getNodesNum() > 1) {
-        const DiscreteDistribution& dist = cachedPij.getDistribution(3, 2, 5);
+        const float* cdf = cachedPij.getCdf(3, 2, 5);
         std::cout << "Successfully retrieved distribution for node 3 category 2 and character 5\n";
     }
     
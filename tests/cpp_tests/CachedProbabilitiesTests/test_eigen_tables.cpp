@@ -0,0 +1,117 @@
+#include <chrono>
+#include <cmath>
+#include <sstream>
+#include <iostream>
+#include <memory>
+#include "../../../src/CachedTransitionProbabilities.h"
+#include "../../../libs/Phylolib/includes/tree.h"
+#include "../../../libs/Phylolib/includes/stochasticProcess.h"
+#include "../../../libs/Phylolib/includes/gammaDistribution.h"
+#include "../../../libs/Phylolib/includes/gtrModel.h"
+#include "../../../libs/Phylolib/includes/readDatMatrix.h"
+#include "../../../libs/Phylolib/includes/trivialAccelerator.h"
+#include "../TestCheck.h"
+
+// The eigendecomposition must reproduce Pij_t for reversible nucleotide and protein models,
+// the tables must not depend on the number of threads, and building them for a tree of
+// unique branch lengths is timed against one Pij_t call per entry.
+
+template<size_t N>
+double maxDifferenceToPijt(const stochasticProcess &sp, const RateMatrixEigen<N> &eigen) {
+    const double times[] = {0.0, 0.001, 0.05, 0.3, 1.0, 4.0};
+    std::vector<double> matrices(6 * N * N);
+    eigen.transitionMatrices(times, 6, matrices.data());
+    double worst = 0.0;
+    for (size_t m = 0; m < 6; ++m) {
+        for (size_t i = 0; i < N; ++i) {
+            for (size_t j = 0; j < N; ++j) {
+                worst = std::max(worst, std::abs(matrices[(m * N + i) * N + j] - sp.Pij_t(i, j, times[m])));
+            }
+        }
+    }
+    return worst;
+}
+
+// caterpillar tree whose branch lengths are all distinct
+std::string caterpillar(size_t numLeaves) {
+    size_t branch = 0;
+    auto length = [&branch]() { return 0.001 + 1e-4 * branch++; };
+    std::ostringstream newick;
+    newick.precision(9);
+    newick << "(L0:" << length() << ",L1:" << length() << ")";
+    for (size_t leaf = 2; leaf < numLeaves; ++leaf) {
+        const std::string inner = newick.str();
+        newick.str("");
+        newick << "(" << inner << ":" << length() << ",L" << leaf << ":" << length() << ")";
+    }
+    newick << ";";
+    return newick.str();
+}
+
+template<size_t N>
+std::vector<int> drawAll(CachedTransitionProbabilities<N> &cache, size_t numNodes, size_t numCategories) {
+    std::mt19937_64 rng(1);
+    std::vector<int> draws;
+    for (size_t node = 1; node < numNodes; ++node) {
+        for (size_t cat = 0; cat < numCategories; ++cat) {
+            for (size_t i = 0; i < N; ++i) draws.push_back(CdfTable<N>::drawFromRow(cache.getCdf(node, cat, i), rng));
+        }
+    }
+    return draws;
+}
+
+int main() {
+    bool passed = true;
+    gammaDistribution gamma(0.5, 4);
+
+    gtrModel gtr({0.1, 0.2, 0.3, 0.4}, 1.0, 2.0, 0.5, 0.8, 3.0, 1.0);
+    trivialAccelerator gtrPij(&gtr);
+    stochasticProcess gtrProcess(&gamma, &gtrPij);
+    RateMatrixEigen<4> gtrEigen;
+    passed &= check("gtr decomposed", gtrEigen.decompose(gtrProcess));
+    passed &= check("gtr matches Pij_t", maxDifferenceToPijt(gtrProcess, gtrEigen) < 1e-9);
+
+    pupAll wag(datMatrixHolder::wag);
+    trivialAccelerator wagPij(&wag);
+    stochasticProcess wagProcess(&gamma, &wagPij);
+    RateMatrixEigen<20> wagEigen;
+    passed &= check("protein decomposed", wagEigen.decompose(wagProcess));
+    const double wagDifference = maxDifferenceToPijt(wagProcess, wagEigen);
+    passed &= check("protein matches Pij_t", wagDifference < 1e-9);
+    std::cout << "largest difference to Pij_t: " << wagDifference << "\n";
+
+    tree tree_(caterpillar(2000), false);
+    const size_t numNodes = static_cast<size_t>(tree_.getNodesNum());
+    std::vector<size_t> branches;
+    for (size_t node = 1; node < numNodes; ++node) branches.push_back(node);
+    auto start = std::chrono::high_resolution_clock::now();
+    CachedTransitionProbabilities<20> serial(tree_, wagProcess);
+    serial.prebuild(branches, 1);
+    const double eigenMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    CachedTransitionProbabilities<20> threaded(tree_, wagProcess);
+    threaded.prebuild(branches, 4);
+    passed &= check("eigen tables used", serial.usesEigenDecomposition() && threaded.usesEigenDecomposition());
+    passed &= check("unique branches", serial.getNumUniqueBranches() == numNodes - 1
+                                       && serial.residentTables() == 4 * serial.getNumUniqueBranches());
+    passed &= check("same tables for any thread count",
+                    drawAll(serial, numNodes, 4) == drawAll(threaded, numNodes, 4));
+
+    // reference: one Pij_t call per entry, as the tables were built before, on a few branches
+    const size_t referenceBranches = 10;
+    start = std::chrono::high_resolution_clock::now();
+    double checksum = 0.0;
+    for (size_t branch = 0; branch < referenceBranches; ++branch) {
+        for (int cat = 0; cat < gamma.categories(); ++cat) {
+            for (int i = 0; i < 20; ++i) {
+                for (int j = 0; j < 20; ++j) checksum += wagProcess.Pij_t(i, j, 0.01 * (branch + 1) * gamma.rates(cat));
+            }
+        }
+    }
+    const double entryMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    const size_t numBranches = numNodes - 1;
+    std::cout << numBranches << " unique 20-state branches x 4 categories: " << eigenMs
+              << " ms from the decomposition, " << entryMs / referenceBranches * numBranches
+              << " ms estimated entry by entry (checksum " << checksum << ")\n";
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,97 @@
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <iostream>
+#include "../../../src/CachedTransitionProbabilities.h"
+#include "../../../libs/Phylolib/includes/tree.h"
+#include "../../../libs/Phylolib/includes/stochasticProcess.h"
+#include "../../../libs/Phylolib/includes/gammaDistribution.h"
+#include "../../../libs/Phylolib/includes/readDatMatrix.h"
+#include "../../../libs/Phylolib/includes/trivialAccelerator.h"
+#include "../TestCheck.h"
+
+// With a total-variation bound, continuous branch lengths share the tables of a log-spaced
+// grid: far fewer unique lengths, a realized error within the bound, and rows of the shared
+// tables within that error of the exact transition probabilities of sampled branches.
+
+// caterpillar tree with exponentially distributed branch lengths
+std::string randomCaterpillar(size_t numLeaves, std::mt19937_64 &rng) {
+    std::exponential_distribution<double> lengthDist(10.0);
+    std::ostringstream newick;
+    newick.precision(12);
+    newick << "(L0:" << lengthDist(rng) << ",L1:" << lengthDist(rng) << ")";
+    for (size_t leaf = 2; leaf < numLeaves; ++leaf) {
+        const std::string inner = newick.str();
+        newick.str("");
+        newick << "(" << inner << ":" << lengthDist(rng) << ",L" << leaf << ":" << lengthDist(rng) << ")";
+    }
+    newick << ";";
+    return newick.str();
+}
+
+int main() {
+    bool passed = true;
+    std::mt19937_64 rng(5);
+    tree tree_(randomCaterpillar(20000, rng), false);
+    std::vector<tree::nodeP> nodes;
+    std::vector<tree::nodeP> pending = {tree_.getRoot()};
+    while (!pending.empty()) {
+        tree::nodeP node = pending.back();
+        pending.pop_back();
+        if (node != tree_.getRoot()) nodes.push_back(node);
+        for (int k = 0; k < node->getNumberOfSons(); ++k) pending.push_back(node->getSon(k));
+    }
+
+    gammaDistribution gamma(0.5, 4);
+    pupAll wag(datMatrixHolder::wag);
+    trivialAccelerator wagPij(&wag);
+    stochasticProcess process(&gamma, &wagPij);
+
+    CachedTransitionProbabilities<20> cache(tree_, process);
+    const size_t exactLengths = cache.getNumUniqueBranches();
+    passed &= check("exact lengths by default", exactLengths > nodes.size() / 2 && cache.quantizationErrorBound() == 0.0);
+
+    const double bound = 1e-3;
+    auto start = std::chrono::high_resolution_clock::now();
+    cache.setLengthQuantization(bound);
+    const double quantizeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    const size_t gridLengths = cache.getNumUniqueBranches();
+    passed &= check("fewer unique lengths", gridLengths * 20 < exactLengths);
+    passed &= check("realized error within bound", cache.quantizationErrorBound() > 0.0 && cache.quantizationErrorBound() <= bound);
+    std::cout << nodes.size() << " branches: " << exactLengths << " exact lengths, " << gridLengths
+              << " on the grid, realized error " << cache.quantizationErrorBound() << " (" << quantizeMs << " ms)\n";
+
+    // rows of the shared tables against P(t) of the branch itself
+    RateMatrixEigen<20> eigen;
+    eigen.decompose(process);
+    double worst = 0.0;
+    std::vector<double> exact(400);
+    for (size_t sample = 0; sample < 300; ++sample) {
+        tree::nodeP node = nodes[(sample * 7919) % nodes.size()];
+        for (int cat = 0; cat < gamma.categories(); ++cat) {
+            const MDOUBLE time = node->dis2father() * gamma.rates(cat);
+            eigen.transitionMatrices(&time, 1, exact.data());
+            for (int parent = 0; parent < 20; ++parent) {
+                const float *row = cache.getCdf(node->id(), cat, parent);
+                double distance = 0.0, previous = 0.0;
+                for (int j = 0; j < 20; ++j) {
+                    distance += std::abs((row[j] - previous) - exact[parent * 20 + j]);
+                    previous = row[j];
+                }
+                worst = std::max(worst, 0.5 * distance);
+            }
+        }
+    }
+    // plus the float32 rounding of the thresholds
+    passed &= check("sampled branches within bound", worst <= bound + 20 * 1e-7);
+    std::cout << "largest sampled row error: " << worst << "\n";
+
+    cache.setLengthQuantization(0.0);
+    passed &= check("exact lengths restored", cache.getNumUniqueBranches() == exactLengths && cache.quantizationErrorBound() == 0.0
+                                              && cache.residentTables() == 0);
+
+    cache.setLengthQuantization(1e-12);
+    passed &= check("tight bound", cache.quantizationErrorBound() <= 1e-12);
+
+    return passed ? 0 : 1;
+}
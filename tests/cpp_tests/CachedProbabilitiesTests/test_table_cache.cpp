@@ -0,0 +1,162 @@
+#include <map>
+#include <iostream>
+#include "../../../libs/pcg/pcg_random.hpp"
+#include "../../../src/Simulator.h"
+#include "../../../src/CachedTransitionProbabilities.h"
+#include "../../../libs/Phylolib/includes/tree.h"
+#include "../../../libs/Phylolib/includes/stochasticProcess.h"
+#include "../../../libs/Phylolib/includes/gammaDistribution.h"
+#include "../../../libs/Phylolib/includes/gtrModel.h"
+#include "../../../libs/Phylolib/includes/trivialAccelerator.h"
+#include "../TestCheck.h"
+
+// Tables are built on first use and shared by equal branch lengths; a bounded cache evicts
+// by the chosen policy but never a pinned table, rebuilds evicted tables identically, and
+// leaves the simulated sequences unchanged.
+
+std::map<std::string, int> nodeIds(const tree &tree_) {
+    std::map<std::string, int> ids;
+    std::vector<tree::nodeP> nodes = {tree_.getRoot()};
+    while (!nodes.empty()) {
+        tree::nodeP node = nodes.back();
+        nodes.pop_back();
+        ids[node->name()] = node->id();
+        for (int k = 0; k < node->getNumberOfSons(); ++k) nodes.push_back(node->getSon(k));
+    }
+    return ids;
+}
+
+// acquire and release at once, as a branch does when it is done
+void touch(CachedTransitionProbabilities<4> &cache, int nodeID, int category) {
+    cache.acquire(nodeID, category);
+    cache.release(nodeID, category);
+}
+
+std::vector<int> draws(CachedTransitionProbabilities<4> &cache, int nodeID, int category) {
+    std::mt19937_64 rng(7);
+    std::vector<int> result;
+    auto *table = cache.acquire(nodeID, category);
+    for (size_t i = 0; i < 4; ++i) {
+        for (int k = 0; k < 100; ++k) result.push_back(CdfTable<4>::drawFromRow(table->row(i), rng));
+    }
+    cache.release(nodeID, category);
+    return result;
+}
+
+std::vector<std::string> simulateRows(Simulator<pcg64_fast, 4> &sim, size_t length) {
+    sim.initSimulator();
+    auto arena = sim.simulateSubstitutions(length);
+    std::vector<std::string> rows;
+    for (size_t row = 0; row < arena->numRows(); ++row) rows.push_back(arena->rowString(row));
+    return rows;
+}
+
+int main() {
+    bool passed = true;
+    // A and D share a branch length, the others are distinct
+    tree tree_("((A:0.1,B:0.2):0.05,(C:0.3,D:0.1):0.2,(E:0.4,(F:0.15,G:0.25):0.35):0.45);", false);
+    auto id = nodeIds(tree_);
+
+    gammaDistribution gamma(0.5, 2);
+    gtrModel gtr({0.1, 0.2, 0.3, 0.4}, 1.0, 2.0, 0.5, 0.8, 3.0, 1.0);
+    trivialAccelerator pij(&gtr);
+    stochasticProcess process(&gamma, &pij);
+
+    // lazy construction, shared lengths
+    CachedTransitionProbabilities<4> lazy(tree_, process);
+    passed &= check("nothing built up front", lazy.residentTables() == 0 && lazy.stats().misses == 0);
+    touch(lazy, id["A"], 0);
+    touch(lazy, id["D"], 0);
+    touch(lazy, id["A"], 1);
+    TransitionTableStats stats = lazy.stats();
+    passed &= check("built on first use", stats.misses == 2 && stats.hits == 1 && stats.residentTables == 2);
+    const std::vector<int> reference = draws(lazy, id["B"], 0);
+
+    // LRU: A was used after B, so C replaces B
+    CachedTransitionProbabilities<4> lru(tree_, process, 2, LRU_EVICTION);
+    touch(lru, id["A"], 0);
+    touch(lru, id["B"], 0);
+    touch(lru, id["A"], 0);
+    touch(lru, id["C"], 0);
+    touch(lru, id["A"], 0);
+    stats = lru.stats();
+    passed &= check("lru keeps the recently used table", stats.hits == 2 && stats.misses == 3 && stats.evictions == 1
+                                                          && stats.residentTables == 2 && stats.capacity == 2);
+
+    // FIFO: A was built first, so C replaces it regardless of use
+    CachedTransitionProbabilities<4> fifo(tree_, process, 2, FIFO_EVICTION);
+    touch(fifo, id["A"], 0);
+    touch(fifo, id["B"], 0);
+    touch(fifo, id["A"], 0);
+    touch(fifo, id["C"], 0);
+    touch(fifo, id["A"], 0);
+    stats = fifo.stats();
+    passed &= check("fifo drops the oldest table", stats.hits == 1 && stats.misses == 4 && stats.evictions == 2);
+
+    // rebuilt tables are identical to the first ones
+    passed &= check("evicted table rebuilt identically", draws(fifo, id["B"], 0) == reference
+                                                         && draws(fifo, id["E"], 0) == draws(lazy, id["E"], 0));
+
+    // pinned tables survive a full cache, which shrinks back once they are released
+    CachedTransitionProbabilities<4> pinned(tree_, process, 2);
+    auto *tableA = pinned.acquire(id["A"], 0);
+    auto *tableB = pinned.acquire(id["B"], 1);
+    pinned.acquire(id["C"], 0);
+    passed &= check("pinned tables kept", pinned.residentTables() == 3 && pinned.stats().evictions == 0);
+    std::mt19937_64 rngA(7), rngRef(7);
+    passed &= check("pinned table intact", CdfTable<4>::drawFromRow(tableA->row(2), rngA)
+                                           == CdfTable<4>::drawFromRow(lazy.acquire(id["A"], 0)->row(2), rngRef)
+                                           && tableB != nullptr);
+    lazy.release(id["A"], 0);
+    pinned.release(id["A"], 0);
+    pinned.release(id["B"], 1);
+    pinned.release(id["C"], 0);
+    touch(pinned, id["E"], 0);
+    passed &= check("released tables evicted", pinned.residentTables() == 2 && pinned.stats().evictions == 2);
+
+    CachedTransitionProbabilities<4> capped(tree_, process, 1);
+    passed &= check("capacity at least the categories", capped.stats().capacity == 2);
+
+    // simulated sequences do not depend on the cache
+    std::vector<DiscreteDistribution*> lengthDists(tree_.getNodesNum() - 1);
+    DiscreteDistribution d1({0.5, 0.3, 0.2});
+    std::fill(lengthDists.begin(), lengthDists.end(), &d1);
+    SimulationProtocol protocol(&tree_);
+    protocol.setInsertionLengthDistributions(lengthDists);
+    protocol.setDeletionLengthDistributions(lengthDists);
+    protocol.setInsertionRates(std::vector<double>(tree_.getNodesNum() - 1, 0.0));
+    protocol.setDeletionRates(std::vector<double>(tree_.getNodesNum() - 1, 0.0));
+    protocol.setSequenceSize(3000);
+    protocol.setSeed(11);
+
+    modelFactory factory(&tree_);
+    factory.setAlphabet(alphabetCode::NUCLEOTIDE);
+    factory.setReplacementModel(modelCode::NUCJC);
+    factory.setSiteRateModel({0.2, 0.7, 1.3, 1.8}, {0.25, 0.25, 0.25, 0.25});
+
+    Simulator<pcg64_fast, 4> sim(&protocol);
+    sim.setSubstitutionEngine(substitutionEngine::MATRIX_ENGINE);
+    sim.initSubstitionSim(factory);
+    const std::vector<std::string> unbounded = simulateRows(sim, 3000);
+    stats = sim.getTransitionTableStats();
+    passed &= check("unbounded cache", stats.evictions == 0 && stats.misses == stats.residentTables && stats.hits > 0);
+
+    sim.setTransitionTableCache(4, LRU_EVICTION);
+    sim.resetTransitionTableStats();
+    passed &= check("lru output unchanged", simulateRows(sim, 3000) == unbounded);
+    stats = sim.getTransitionTableStats();
+    passed &= check("lru bounded", stats.residentTables <= 4 && stats.evictions > 0);
+
+    sim.setTransitionTableCache(4, FIFO_EVICTION);
+    passed &= check("fifo output unchanged", simulateRows(sim, 3000) == unbounded);
+
+    // prebuilt in parallel (unbounded) against built on demand (bounded) with the same threads
+    sim.setNumThreads(4);
+    sim.setTransitionTableCache(0, LRU_EVICTION);
+    sim.initSubstitionSim(factory);
+    const std::vector<std::string> prebuilt = simulateRows(sim, 3000);
+    sim.setTransitionTableCache(4, LRU_EVICTION);
+    passed &= check("prebuilt matches on demand", simulateRows(sim, 3000) == prebuilt);
+
+    return passed ? 0 : 1;
+}
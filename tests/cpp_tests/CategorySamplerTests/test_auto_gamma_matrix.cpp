@@ -0,0 +1,110 @@
+#include <chrono>
+#include <random>
+#include <iostream>
+#include "../../../src/AutoGammaCorrelation.h"
+#include "../TestCheck.h"
+
+// The bivariate normal CDF matches closed forms and a numerical integral over the whole
+// range of correlations, and the auto-gamma matrices built from it are symmetric stochastic
+// matrices with uniform stationary distribution, independent of the thread count and
+// memoized by (categories, rho).
+
+// P(X < x, Y < y) = integral over t < x of phi(t) Phi((y - rho t) / sqrt(1 - rho^2)), Simpson's rule
+double integratedCdf(double x, double y, double rho) {
+    const double lower = -12.0;
+    const size_t steps = 200000;
+    const double width = (x - lower) / steps;
+    const double scale = std::sqrt(1.0 - rho * rho);
+    double sum = 0.0;
+    for (size_t s = 0; s <= steps; ++s) {
+        const double t = lower + s * width;
+        const double value = std::exp(-0.5 * t * t) / std::sqrt(2.0 * M_PI) * normalCdf((y - rho * t) / scale);
+        sum += value * ((s == 0 || s == steps) ? 1.0 : (s % 2 ? 4.0 : 2.0));
+    }
+    return sum * width / 3.0;
+}
+
+int main() {
+    bool passed = true;
+
+    double worstQuantile = 0.0;
+    for (double p : {1e-12, 1e-6, 0.01, 0.02425, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99, 1.0 - 1e-6}) {
+        worstQuantile = std::max(worstQuantile, std::abs(normalCdf(normalQuantile(p)) - p) / p);
+    }
+    passed &= check("quantiles invert the CDF", worstQuantile < 1e-13);
+
+    // orthant: 1/4 + asin(rho) / (2 pi)
+    double worstOrthant = 0.0;
+    for (double rho = -0.99; rho < 0.995; rho += 0.01) {
+        worstOrthant = std::max(worstOrthant, std::abs(bivariateNormalCdf(0.0, 0.0, rho) - (0.25 + std::asin(rho) / (2.0 * M_PI))));
+    }
+    passed &= check("orthant probabilities", worstOrthant < 1e-14);
+
+    std::mt19937_64 rng(17);
+    std::uniform_real_distribution<double> point(-3.0, 3.0);
+    double worstIntegral = 0.0;
+    for (double rho : {-0.97, -0.8, -0.5, -0.2, 0.1, 0.4, 0.7, 0.9, 0.93, 0.99}) {
+        for (int sample = 0; sample < 6; ++sample) {
+            const double x = point(rng), y = point(rng);
+            worstIntegral = std::max(worstIntegral, std::abs(bivariateNormalCdf(x, y, rho) - integratedCdf(x, y, rho)));
+        }
+    }
+    passed &= check("matches the integral", worstIntegral < 1e-10);
+    std::cout << "largest differences: " << worstOrthant << " orthant, " << worstIntegral << " integral\n";
+
+    for (size_t K : {2, 4, 8, 16}) {
+        for (double rho : {0.0, 0.3, 0.8, 0.95}) {
+            const auto M = buildAutoGammaTransitionMatrix(0.5, K, rho);
+            double rowError = 0.0, asymmetry = 0.0, stationaryError = 0.0;
+            for (size_t i = 0; i < K; ++i) {
+                double rowSum = 0.0, columnSum = 0.0;
+                for (size_t j = 0; j < K; ++j) {
+                    rowSum += M[i][j];
+                    columnSum += M[j][i] / K;
+                    asymmetry = std::max(asymmetry, std::abs(M[i][j] - M[j][i]));
+                }
+                rowError = std::max(rowError, std::abs(rowSum - 1.0));
+                stationaryError = std::max(stationaryError, std::abs(columnSum - 1.0 / K));
+            }
+            passed &= check("K=" + std::to_string(K) + " rho=" + std::to_string(rho) + " stochastic, symmetric, uniform",
+                            rowError < 1e-12 && asymmetry < 1e-12 && stationaryError < 1e-12);
+        }
+    }
+
+    const auto independent = buildAutoGammaTransitionMatrix(1.0, 4, 0.0);
+    bool uniform = true;
+    for (const auto &row : independent) {
+        for (double value : row) uniform &= std::abs(value - 0.25) < 1e-15;
+    }
+    passed &= check("rho 0 is independent", uniform);
+    passed &= check("stickier with rho", buildAutoGammaTransitionMatrix(1.0, 4, 0.3)[1][1] < buildAutoGammaTransitionMatrix(1.0, 4, 0.6)[1][1]
+                                         && buildAutoGammaTransitionMatrix(1.0, 4, 0.6)[1][1] < buildAutoGammaTransitionMatrix(1.0, 4, 0.9)[1][1]);
+    passed &= check("rho 1 is the identity", buildAutoGammaTransitionMatrix(1.0, 3, 1.0)[2][2] == 1.0
+                                             && buildAutoGammaTransitionMatrix(1.0, 3, -1.0)[0][2] == 1.0);
+    passed &= check("threads do not change the matrix", buildAutoGammaTransitionMatrix(1.0, 16, 0.7, 4)
+                                                        == buildAutoGammaTransitionMatrix(1.0, 16, 0.7, 1));
+
+    bool rejected = false;
+    try { buildAutoGammaTransitionMatrix(1.0, 1, 0.5); } catch (const std::invalid_argument &) { rejected = true; }
+    try { buildAutoGammaTransitionMatrix(0.0, 4, 0.5); rejected = false; } catch (const std::invalid_argument &) {}
+    try { buildAutoGammaTransitionMatrix(1.0, 4, 1.5); rejected = false; } catch (const std::invalid_argument &) {}
+    passed &= check("invalid parameters rejected", rejected);
+
+    // memoized by (categories, rho)
+    autoGammaMatrixCache().clear();
+    auto start = std::chrono::high_resolution_clock::now();
+    const auto first = autoGammaTransitionMatrix(0.5, 16, 0.7);
+    const double buildUs = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+    start = std::chrono::high_resolution_clock::now();
+    const auto again = autoGammaTransitionMatrix(2.0, 16, 0.7);
+    const double cachedUs = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << "K=16 matrix: " << buildUs << " us built, " << cachedUs << " us memoized\n";
+    passed &= check("memoized", first == again && autoGammaMatrixCache().size() == 1);
+    autoGammaTransitionMatrix(0.5, 16, 0.71);
+    autoGammaTransitionMatrix(0.5, 8, 0.7);
+    passed &= check("keyed by categories and rho", autoGammaMatrixCache().size() == 3);
+    for (size_t n = 0; n < AutoGammaMatrixCache::MAX_MATRICES + 10; ++n) autoGammaTransitionMatrix(0.5, 2, n * 1e-4);
+    passed &= check("bounded", autoGammaMatrixCache().size() == AutoGammaMatrixCache::MAX_MATRICES);
+
+    return passed ? 0 : 1;
+}
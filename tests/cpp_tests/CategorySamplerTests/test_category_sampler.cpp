@@ -2,7 +2,9 @@
 #include <vector>
 #include <map>
 #include <cmath>
+#include <chrono>
 #include "../../../src/CategorySampler.h"
+#include "../../../libs/Phylolib/includes/DiscreteDistribution.h"
 
 // Helper function to build transition matrix for autocorrelation model
 // P[i][j] = ρ * δ(i,j) + (1-ρ) * π[j]
@@ -318,6 +320,129 @@ void testNonUniformModerateCorrelation() {
 }
 
 
+void testBulkSampling() {
+    std::cout << "=== Test 8: Bulk Sampling (drawSamples) ===" << std::endl;
+
+    std::vector<MDOUBLE> probs = {0.5, 0.3, 0.15, 0.05};
+    const size_t numSamples = 10000000;
+    std::mt19937_64 rng(42);
+
+    for (MDOUBLE correlation: {0.0, 0.7}) {
+        auto transitionMatrix = buildTransitionMatrix(probs, correlation);
+        CategorySampler sampler(transitionMatrix, probs);
+        std::vector<uint8_t> categories;
+
+        auto start = std::chrono::high_resolution_clock::now();
+        sampler.drawSamples(numSamples, categories, rng);
+        auto end = std::chrono::high_resolution_clock::now();
+
+        std::vector<size_t> counts(probs.size(), 0);
+        size_t stays = 0;
+        for (size_t i = 0; i < numSamples; ++i) {
+            counts[categories[i]]++;
+            if (i > 0 && categories[i] == categories[i - 1]) stays++;
+        }
+
+        std::cout << "  correlation=" << correlation
+                  << " independent=" << (sampler.isIndependent() ? "yes" : "no")
+                  << " time=" << std::chrono::duration<double, std::milli>(end - start).count() << "ms" << std::endl;
+        for (size_t i = 0; i < probs.size(); ++i) {
+            double observed = static_cast<double>(counts[i]) / numSamples;
+            bool match = std::abs(observed - probs[i]) < 0.005;
+            std::cout << "   Category " << i << ": expected=" << probs[i]
+                      << ", observed=" << observed << (match ? " ✓" : " ✗") << std::endl;
+            if (!match) throw std::runtime_error("bulk sampling frequencies do not match");
+        }
+
+        double sumPiSquared = 0.0;
+        for (MDOUBLE p: probs) sumPiSquared += p * p;
+        double expectedStay = correlation + (1.0 - correlation) * sumPiSquared;
+        double observedStay = static_cast<double>(stays) / (numSamples - 1);
+        bool match = std::abs(observedStay - expectedStay) < 0.005;
+        std::cout << "   P(stay): expected=" << expectedStay << ", observed=" << observedStay
+                  << (match ? " ✓" : " ✗") << std::endl;
+        if (!match) throw std::runtime_error("bulk sampling autocorrelation does not match");
+    }
+    std::cout << std::endl;
+}
+
+void testParallelBridgeSampling() {
+    std::cout << "=== Test 9: Parallel Chunked Bridge Sampling ===" << std::endl;
+
+    // Sites around chunk boundaries are drawn by the bridge, so the pair statistics
+    // there must match the chain exactly like everywhere else.
+    std::vector<MDOUBLE> probs = {0.5, 0.3, 0.15, 0.05};
+    const MDOUBLE correlation = 0.9;
+    const size_t numSamples = 8000000;
+    auto transitionMatrix = buildTransitionMatrix(probs, correlation);
+    CategorySampler sampler(transitionMatrix, probs);
+    std::mt19937_64 rng(42);
+    std::vector<uint8_t> categories;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    sampler.drawSamples(numSamples, categories, rng, 4);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "  time=" << std::chrono::duration<double, std::milli>(end - start).count() << "ms" << std::endl;
+
+    std::vector<size_t> counts(probs.size(), 0);
+    size_t stays = 0;
+    for (size_t i = 0; i < numSamples; ++i) {
+        counts[categories[i]]++;
+        if (i > 0 && categories[i] == categories[i - 1]) stays++;
+    }
+    for (size_t i = 0; i < probs.size(); ++i) {
+        double observed = static_cast<double>(counts[i]) / numSamples;
+        bool match = std::abs(observed - probs[i]) < 0.01;
+        std::cout << "   Category " << i << ": expected=" << probs[i]
+                  << ", observed=" << observed << (match ? " ✓" : " ✗") << std::endl;
+        if (!match) throw std::runtime_error("parallel sampling frequencies do not match");
+    }
+
+    double sumPiSquared = 0.0;
+    for (MDOUBLE p: probs) sumPiSquared += p * p;
+    double expectedStay = correlation + (1.0 - correlation) * sumPiSquared;
+    double observedStay = static_cast<double>(stays) / (numSamples - 1);
+    bool match = std::abs(observedStay - expectedStay) < 0.005;
+    std::cout << "   P(stay): expected=" << expectedStay << ", observed=" << observedStay
+              << (match ? " ✓" : " ✗") << std::endl;
+    if (!match) throw std::runtime_error("parallel sampling autocorrelation does not match");
+
+    // lag-1 transitions over the bridged sites just before every chunk start (and across it)
+    // follow P row by row
+    const size_t chunkLength = size_t(1) << 15; // CategorySampler::BRIDGE_CHUNK_LENGTH
+    const size_t window = 256;
+    std::vector<std::vector<size_t>> transitions(probs.size(), std::vector<size_t>(probs.size(), 0));
+    for (size_t chunkStart = chunkLength; chunkStart < numSamples; chunkStart += chunkLength) {
+        for (size_t site = chunkStart - window; site <= chunkStart; ++site) {
+            transitions[categories[site - 1]][categories[site]]++;
+        }
+    }
+    for (size_t from = 0; from < probs.size(); ++from) {
+        size_t total = 0;
+        for (size_t count: transitions[from]) total += count;
+        for (size_t to = 0; to < probs.size(); ++to) {
+            const double expected = transitionMatrix[from][to];
+            const double observed = static_cast<double>(transitions[from][to]) / total;
+            if (std::abs(observed - expected) > 4.0 * std::sqrt(expected * (1.0 - expected) / total)) {
+                std::cout << "   P(" << from << " -> " << to << ") at chunk ends: expected=" << expected
+                          << ", observed=" << observed << " ✗" << std::endl;
+                throw std::runtime_error("bridged transitions do not match the chain");
+            }
+        }
+    }
+    std::cout << "   Transitions at chunk ends match P ✓" << std::endl;
+
+    // same seed, different thread counts: identical output
+    for (size_t numThreads: {1, 2}) {
+        std::vector<uint8_t> other;
+        CategorySampler sampler2(transitionMatrix, probs);
+        std::mt19937_64 rng2(42);
+        sampler2.drawSamples(numSamples, other, rng2, numThreads);
+        if (other != categories) throw std::runtime_error("parallel output depends on the thread count");
+    }
+    std::cout << "   Same output with 1, 2 and 4 threads ✓" << std::endl << std::endl;
+}
+
 void testAliasMethodAccuracy() {
     std::cout << "=== Alias Method Accuracy Test ===" << std::endl;
     
@@ -355,6 +480,8 @@ int main() {
         testReset();
         testWithInvariantSites();
         testNonUniformModerateCorrelation();
+        testBulkSampling();
+        testParallelBridgeSampling();
         testAliasMethodAccuracy();
 
 
@@ -0,0 +1,80 @@
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "../../../src/FastRejectionSampler.h"
+#include "../../../libs/pcg/pcg_random.hpp"
+
+// Microbenchmark of the dynamic sampler in the Gillespie access pattern (draw a site, then
+// change its weight), plus a correctness check: after a long run of updates the empirical
+// draw frequencies must still match the current weights, and the internal bookkeeping
+// must be consistent.
+
+int main() {
+    const size_t numWeights = 1000000;
+    const size_t numEvents = 10000000;
+    const double minWeight = 0.01;
+    const double maxWeight = 100.0;
+
+    pcg64_fast rng(42);
+    std::uniform_real_distribution<double> weightDist(std::log(minWeight), std::log(maxWeight));
+
+    std::vector<double> weights(numWeights);
+    for (auto &w: weights) w = std::exp(weightDist(rng));
+    // a few zero weights, as produced by invariant sites
+    for (size_t i = 0; i < numWeights; i += 1000) weights[i] = 0.0;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    FastRejectionSampler sampler(weights, minWeight, maxWeight);
+    auto built = std::chrono::high_resolution_clock::now();
+
+    size_t checksum = 0;
+    for (size_t event = 0; event < numEvents; ++event) {
+        size_t site = sampler.sample(rng);
+        checksum += site;
+        double newWeight = (site % 997 == 0) ? 0.0 : std::exp(weightDist(rng));
+        sampler.updateWeight(site, newWeight);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    double buildMs = std::chrono::duration<double, std::milli>(built - start).count();
+    double runMs = std::chrono::duration<double, std::milli>(end - built).count();
+    std::cout << "build: " << buildMs << "ms, " << numEvents << " sample+update: " << runMs
+              << "ms (" << (runMs * 1e6 / numEvents) << "ns/event), checksum " << checksum << "\n";
+
+    bool passed = sampler.checkValidity();
+    if (!passed) std::cout << "checkValidity FAILED\n";
+
+    // frequency check on a small sampler after many updates
+    std::vector<double> smallWeights = {1.0, 2.0, 0.0, 3.5, 0.25, 7.9};
+    FastRejectionSampler small(smallWeights, 0.1, 10.0);
+    for (int i = 0; i < 1000; ++i) {
+        size_t idx = i % smallWeights.size();
+        small.updateWeight(idx, (i % 3 == 0) ? 0.0 : 0.1 + (i % 7));
+    }
+    small.updateWeight(0, 1.0);
+    small.updateWeight(1, 2.0);
+    small.updateWeight(2, 0.0);
+    small.updateWeight(3, 3.5);
+    small.updateWeight(4, 0.25);
+    small.updateWeight(5, 7.9);
+
+    const size_t numDraws = 2000000;
+    std::vector<size_t> counts(smallWeights.size(), 0);
+    for (size_t i = 0; i < numDraws; ++i) counts[small.sample(rng)]++;
+
+    double total = 0.0;
+    for (double w: smallWeights) total += w;
+    for (size_t i = 0; i < smallWeights.size(); ++i) {
+        double p = smallWeights[i] / total;
+        double observed = static_cast<double>(counts[i]) / numDraws;
+        double tolerance = 5.0 * std::sqrt(p * (1.0 - p) / numDraws) + 1e-12;
+        bool ok = std::abs(observed - p) <= tolerance;
+        passed = passed && ok;
+        std::cout << "index " << i << " expected=" << p << " observed=" << observed
+                  << (ok ? " OK" : " FAILED") << "\n";
+    }
+
+    return passed ? 0 : 1;
+}
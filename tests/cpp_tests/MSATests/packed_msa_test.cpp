@@ -0,0 +1,135 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <functional>
+
+#include "../../../libs/pcg/pcg_random.hpp"
+#include "../../../src/Simulator.h"
+#include "../../../src/MSA.h"
+#include "../../../src/MsaFixed.h"
+#include "../../../src/PackedMsa.h"
+
+// Simulates indels and substitutions (nucleotides and amino acids), writes the alignment in
+// the packed binary format from both MSA implementations and checks that the mapped reader
+// renders exactly the FASTA text of generateMsaString. An indel-only alignment is checked
+// against generateMsaStringWithoutSubs. Files with crafted counts and offsets that would
+// wrap the reader's bounds checks are rejected.
+
+template<typename Msa>
+bool checkRoundTrip(Msa &msa, const std::string &label) {
+    const std::string path = "packed_msa_test.sfmsa";
+    msa.writePackedMsa(path.c_str());
+
+    auto start = std::chrono::high_resolution_clock::now();
+    PackedMsaReader reader(path);
+    auto end = std::chrono::high_resolution_clock::now();
+    reader.verify();
+
+    bool ok;
+    if (reader.getAlphabetSize() == 0) {
+        std::string rows;
+        for (size_t row = 0; row < reader.getNumberOfSequences(); ++row) rows += reader.getRow(row) + "\n";
+        ok = rows == msa.generateMsaStringWithoutSubs();
+    } else {
+        ok = reader.toFasta() == msa.generateMsaString();
+    }
+    std::cout << label << ": " << reader.getNumberOfSequences() << "x" << reader.getMSAlength()
+              << ", " << reader.size() << " bytes, opened in "
+              << std::chrono::duration<double, std::micro>(end - start).count() << " us: "
+              << (ok ? "OK" : "FAILED") << "\n";
+    std::remove(path.c_str());
+    return ok;
+}
+
+// a copy of the file at path with its header or bytes changed is rejected
+bool rejectsCorrupted(const std::string &path, const std::function<void(std::vector<char>&, PackedMsaHeader&)> &corrupt) {
+    std::ifstream in(path, std::ios::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    PackedMsaHeader header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    corrupt(bytes, header);
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    const std::string corruptedPath = "packed_msa_test_corrupted.sfmsa";
+    std::ofstream(corruptedPath, std::ios::binary).write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    bool rejected = false;
+    try {
+        PackedMsaReader reader(corruptedPath);
+    } catch (const std::runtime_error &) {
+        rejected = true;
+    }
+    std::remove(corruptedPath.c_str());
+    return rejected;
+}
+
+template<typename Msa>
+bool checkMalformed(Msa &msa, const std::string &label) {
+    const std::string path = "packed_msa_test.sfmsa";
+    msa.writePackedMsa(path.c_str());
+    auto setIndexEnd = [](std::vector<char> &bytes, uint64_t offset, uint64_t numSequences, uint64_t value) {
+        std::memcpy(bytes.data() + offset + numSequences * sizeof(uint64_t), &value, sizeof(value));
+    };
+    const bool ok =
+        rejectsCorrupted(path, [](std::vector<char>&, PackedMsaHeader &header) { header.numSequences = (uint64_t(1) << 61) - 1; })
+        && rejectsCorrupted(path, [](std::vector<char>&, PackedMsaHeader &header) { header.nameDataOffset = UINT64_MAX - 7; })
+        && rejectsCorrupted(path, [](std::vector<char>&, PackedMsaHeader &header) { header.nameDataOffset = header.gapIndexOffset + 8; })
+        && rejectsCorrupted(path, [](std::vector<char>&, PackedMsaHeader &header) { header.gapRunsOffset = header.gapIndexOffset - 8; })
+        && rejectsCorrupted(path, [&](std::vector<char> &bytes, PackedMsaHeader &header) {
+               setIndexEnd(bytes, header.nameIndexOffset, header.numSequences, UINT64_MAX - 2);
+           })
+        && rejectsCorrupted(path, [&](std::vector<char> &bytes, PackedMsaHeader &header) {
+               setIndexEnd(bytes, header.gapIndexOffset, header.numSequences, uint64_t(1) << 62);
+           })
+        && rejectsCorrupted(path, [&](std::vector<char> &bytes, PackedMsaHeader &header) {
+               setIndexEnd(bytes, header.residueIndexOffset, header.numSequences, uint64_t(1) << 62);
+           });
+    std::remove(path.c_str());
+    std::cout << label << ": " << (ok ? "OK" : "FAILED") << "\n";
+    return ok;
+}
+
+template<size_t AlphabetSize>
+bool runCase(alphabetCode alphabet, modelCode model, const std::string &label) {
+    tree tree_("((A:0.1,B:0.2):0.05,(C:0.3,D:0.1):0.2,E:0.4);", false);
+
+    std::vector<DiscreteDistribution*> lengthDists(tree_.getNodesNum() - 1);
+    DiscreteDistribution d1({0.5, 0.3, 0.2});
+    std::fill(lengthDists.begin(), lengthDists.end(), &d1);
+
+    SimulationProtocol protocol(&tree_);
+    protocol.setInsertionLengthDistributions(lengthDists);
+    protocol.setDeletionLengthDistributions(lengthDists);
+    protocol.setInsertionRates(std::vector<double>(tree_.getNodesNum() - 1, 0.05));
+    protocol.setDeletionRates(std::vector<double>(tree_.getNodesNum() - 1, 0.05));
+    protocol.setSequenceSize(3000);
+    protocol.setSeed(42);
+
+    Simulator<pcg64_fast, AlphabetSize> sim(&protocol);
+    auto blockmap = sim.generateSimulation();
+    // MSA consumes the blockmap, so the FixedList version is built first
+    MsaFixed msaFixed(blockmap, tree_.getRoot(), sim.getNodesSaveList());
+    MSA msa(blockmap, tree_.getRoot(), sim.getNodesSaveList());
+
+    bool passed = checkRoundTrip(msa, label + " indels only");
+
+    modelFactory factory(&tree_);
+    factory.setAlphabet(alphabet);
+    factory.setReplacementModel(model);
+    factory.setSiteRateModel({0.5, 1.5}, {0.5, 0.5});
+    sim.initSubstitionSim(factory);
+    auto sequences = sim.simulateSubstitutions(msa.getMSAlength());
+    msa.fillSubstitutions(sequences);
+    msaFixed.fillSubstitutions(sequences);
+
+    passed = checkRoundTrip(msa, label + " MSA") && passed;
+    passed = checkRoundTrip(msaFixed, label + " MsaFixed") && passed;
+    passed = checkMalformed(msa, label + " malformed files rejected") && passed;
+    return passed;
+}
+
+int main() {
+    bool passed = runCase<4>(alphabetCode::NUCLEOTIDE, modelCode::NUCJC, "nucleotides");
+    passed = runCase<20>(alphabetCode::AMINOACID, modelCode::LG, "amino acids") && passed;
+    return passed ? 0 : 1;
+}
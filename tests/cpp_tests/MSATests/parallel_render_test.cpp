@@ -0,0 +1,146 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "../../../libs/pcg/pcg_random.hpp"
+#include "../../../src/Simulator.h"
+#include "../../../src/MSA.h"
+
+#ifdef SAILFISH_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+// Renders a few MB of alignment with 1 and 4 threads, to a string, to a memory mapped file
+// and (with zlib) to BGZF, row by row and in chunks as the Python iterators do, and compares
+// every output with the rows built naively from toString() and the gap runs, the way
+// generateMsaString used to.
+
+std::string naiveMsaString(MSA &msa, const SequenceArena &sequences) {
+    std::string text;
+    const auto &alignedSequence = msa.getAlignedSequence();
+    for (size_t row = 0; row < static_cast<size_t>(msa.getNumberOfSequences()); row++) {
+        size_t id = sequences.id(row);
+        std::string currentSeq = sequences.rowString(row);
+        text += ">" + sequences.name(row) + "\n";
+        size_t passed = 0;
+        for (int blockSize : alignedSequence.at(id)) {
+            if (blockSize < 0) text.append(-blockSize, '-');
+            else text.append(currentSeq.substr(passed, blockSize));
+            passed += std::abs(blockSize);
+        }
+        text += "\n";
+    }
+    return text;
+}
+
+std::string readFile(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+int main() {
+    tree tree_("((A:0.1,B:0.2):0.05,(C:0.3,D:0.1):0.2,(E:0.4,(F:0.1,G:0.2):0.1):0.1);", false);
+
+    std::vector<DiscreteDistribution*> lengthDists(tree_.getNodesNum() - 1);
+    DiscreteDistribution d1({0.5, 0.3, 0.2});
+    std::fill(lengthDists.begin(), lengthDists.end(), &d1);
+
+    SimulationProtocol protocol(&tree_);
+    protocol.setInsertionLengthDistributions(lengthDists);
+    protocol.setDeletionLengthDistributions(lengthDists);
+    protocol.setInsertionRates(std::vector<double>(tree_.getNodesNum() - 1, 0.02));
+    protocol.setDeletionRates(std::vector<double>(tree_.getNodesNum() - 1, 0.02));
+    protocol.setSequenceSize(500000);
+    protocol.setSeed(7);
+
+    Simulator<pcg64_fast, 4> sim(&protocol);
+    auto blockmap = sim.generateSimulation();
+    MSA msa(blockmap, tree_.getRoot(), sim.getNodesSaveList());
+
+    modelFactory factory(&tree_);
+    factory.setAlphabet(alphabetCode::NUCLEOTIDE);
+    factory.setReplacementModel(modelCode::NUCJC);
+    factory.setSiteRateModel({0.5, 1.5}, {0.5, 0.5});
+    sim.initSubstitionSim(factory);
+    auto sequences = sim.simulateSubstitutions(msa.getMSAlength());
+    msa.fillSubstitutions(sequences);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    const std::string expected = naiveMsaString(msa, *sequences);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "naive rendering: " << expected.size() << " bytes in "
+              << std::chrono::duration<double, std::milli>(end - start).count() << " ms\n";
+
+    bool passed = true;
+    auto report = [&](const std::string &label, bool ok, double milliseconds) {
+        std::cout << label << ": " << milliseconds << " ms " << (ok ? "OK" : "FAILED") << "\n";
+        passed = passed && ok;
+    };
+
+    auto renderer = msa.makeRenderer();
+    for (size_t numThreads : {1, 4}) {
+        start = std::chrono::high_resolution_clock::now();
+        std::string text = renderer.toString(numThreads);
+        end = std::chrono::high_resolution_clock::now();
+        report("string, " + std::to_string(numThreads) + " threads", text == expected,
+               std::chrono::duration<double, std::milli>(end - start).count());
+
+        const std::string path = "parallel_render_test.fa";
+        start = std::chrono::high_resolution_clock::now();
+        renderer.writeFile(path, false, numThreads);
+        end = std::chrono::high_resolution_clock::now();
+        report("mapped file, " + std::to_string(numThreads) + " threads", readFile(path) == expected,
+               std::chrono::duration<double, std::milli>(end - start).count());
+        std::remove(path.c_str());
+    }
+
+#ifdef SAILFISH_HAVE_ZLIB
+    {
+        const std::string path = "parallel_render_test.fa.gz";
+        start = std::chrono::high_resolution_clock::now();
+        msa.writeFullMsa(path.c_str(), true);
+        end = std::chrono::high_resolution_clock::now();
+        std::string content;
+        gzFile file = gzopen(path.c_str(), "rb");
+        char chunk[1 << 16];
+        int read;
+        while (file != nullptr && (read = gzread(file, chunk, sizeof(chunk))) > 0) content.append(chunk, read);
+        if (file != nullptr) gzclose(file);
+        report("bgzf file", content == expected, std::chrono::duration<double, std::milli>(end - start).count());
+        std::remove(path.c_str());
+    }
+#endif
+
+    // streaming: rows one at a time, and chunks of whole rows of at most 64 KB
+    {
+        start = std::chrono::high_resolution_clock::now();
+        std::string streamed;
+        std::string row;
+        for (size_t r = 0; r < renderer.numRows(); ++r) {
+            row.resize(renderer.rowLength(r));
+            renderer.renderSequence(r, &row[0]);
+            streamed += ">" + renderer.rowName(r) + "\n" + row + "\n";
+        }
+        end = std::chrono::high_resolution_clock::now();
+        report("row by row", streamed == expected, std::chrono::duration<double, std::milli>(end - start).count());
+
+        streamed.clear();
+        std::vector<char> chunk;
+        bool bounded = true;
+        for (size_t first = 0; first < renderer.numRows();) {
+            size_t last = renderer.chunkEnd(first, 1 << 16);
+            chunk.resize(renderer.textSize(first, last));
+            bounded = bounded && (chunk.size() <= (1 << 16) || last == first + 1);
+            renderer.render(chunk.data(), first, last, 4);
+            streamed.append(chunk.data(), chunk.size());
+            first = last;
+        }
+        report("chunks", streamed == expected && bounded, 0);
+    }
+
+    report("generateMsaString", msa.generateMsaString() == expected, 0);
+    return passed ? 0 : 1;
+}
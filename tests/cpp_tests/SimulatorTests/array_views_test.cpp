@@ -0,0 +1,90 @@
+#include <iostream>
+
+#include "../../../libs/pcg/pcg_random.hpp"
+#include "../../../src/Simulator.h"
+#include "../../../src/MSA.h"
+#include "../TestCheck.h"
+
+// Checks the zero-copy outputs behind the NumPy views: the arena holds one row per saved
+// node, arenas and rate buffers held by the caller are left alone by the next simulation
+// (which gets fresh ones) and reused once released, and view shapes and strides describe
+// C-contiguous arrays.
+
+int main() {
+    tree tree_("((A:0.1,B:0.2):0.05,(C:0.3,D:0.1):0.2,(E:0.4,(F:0.1,G:0.2):0.1):0.1);", false);
+
+    std::vector<DiscreteDistribution*> lengthDists(tree_.getNodesNum() - 1);
+    DiscreteDistribution d1({0.5, 0.3, 0.2});
+    std::fill(lengthDists.begin(), lengthDists.end(), &d1);
+
+    SimulationProtocol protocol(&tree_);
+    protocol.setInsertionLengthDistributions(lengthDists);
+    protocol.setDeletionLengthDistributions(lengthDists);
+    protocol.setInsertionRates(std::vector<double>(tree_.getNodesNum() - 1, 0.05));
+    protocol.setDeletionRates(std::vector<double>(tree_.getNodesNum() - 1, 0.05));
+    protocol.setSequenceSize(2000);
+    protocol.setSeed(11);
+
+    Simulator<pcg64_fast, 4> sim(&protocol);
+    auto blockmap = sim.generateSimulation();
+    MSA msa(blockmap, tree_.getRoot(), sim.getNodesSaveList());
+
+    modelFactory factory(&tree_);
+    factory.setAlphabet(alphabetCode::NUCLEOTIDE);
+    factory.setReplacementModel(modelCode::NUCJC);
+    factory.setSiteRateModel({0.5, 1.5}, {0.5, 0.5});
+    sim.initSubstitionSim(factory);
+    sim.setSaveRates(true);
+
+    bool passed = true;
+
+    // one arena row per saved node, findable by node id
+    const std::vector<bool> saveList = sim.getNodesSaveList();
+    sim.initSimulator();
+    auto arena = sim.simulateSubstitutions(msa.getMSAlength());
+    bool sameRows = arena->numRows() == static_cast<size_t>(std::count(saveList.begin(), saveList.end(), true))
+                    && arena->numColumns() == static_cast<size_t>(msa.getMSAlength());
+    for (size_t row = 0; sameRows && row < arena->numRows(); ++row) {
+        sameRows = saveList[arena->id(row)] && arena->rowOfId(arena->id(row)) == static_cast<int64_t>(row)
+                   && arena->rowString(row).find('?') == std::string::npos;
+    }
+    passed &= check("arena rows", sameRows);
+    passed &= check("alphabet", arena->alphabet() == "ACGT");
+
+    // a held arena is left alone, a released one is refilled in place
+    sim.initSimulator();
+    auto replicate = sim.simulateSubstitutions(msa.getMSAlength());
+    const uint8_t *replicateCodes = replicate->codes();
+    passed &= check("held arena kept", replicate != arena && std::equal(arena->codes(),
+                    arena->codes() + arena->numRows() * arena->numColumns(), replicateCodes)
+                    && arena->names() == replicate->names());
+    replicate.reset();
+    passed &= check("free arena reused", sim.simulateSubstitutions(msa.getMSAlength())->codes() == replicateCodes);
+
+    ArrayView codes = ArrayView::of<uint8_t>(arena, arena->codes(), {arena->numRows(), arena->numColumns()});
+    passed &= check("codes layout", codes.size() == arena->numRows() * arena->numColumns()
+                                    && codes.strides() == std::vector<size_t>({arena->numColumns(), 1})
+                                    && std::string(codes.format) == "B" && codes.itemSize == 1);
+
+    // a held view keeps its buffer; the next simulation writes elsewhere
+    ArrayView rates = sim.getSiteRatesView();
+    ArrayView categories = sim.getRateCategoriesView();
+    const std::vector<double> heldRates(static_cast<const double*>(rates.data),
+                                        static_cast<const double*>(rates.data) + rates.size());
+    const size_t msaLength = static_cast<size_t>(msa.getMSAlength());
+    passed &= check("rates view", rates.size() == msaLength && std::string(rates.format) == "d"
+                                  && categories.size() == msaLength && std::string(categories.format) == "B");
+    sim.simulateSubstitutions(msa.getMSAlength());
+    ArrayView nextRates = sim.getSiteRatesView();
+    passed &= check("held buffer kept", nextRates.data != rates.data
+                    && std::equal(heldRates.begin(), heldRates.end(), static_cast<const double*>(rates.data)));
+
+    // once no view holds it, the buffer is reused instead of reallocated
+    const void *current = nextRates.data;
+    rates = ArrayView();
+    nextRates = ArrayView();
+    sim.simulateSubstitutions(msa.getMSAlength());
+    passed &= check("free buffer reused", sim.getSiteRatesView().data == current);
+
+    return passed ? 0 : 1;
+}
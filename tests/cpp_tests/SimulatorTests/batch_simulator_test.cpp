@@ -0,0 +1,163 @@
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+#include "../../../libs/pcg/pcg_random.hpp"
+#include "../../../src/BatchSimulator.h"
+#include "../TestCheck.h"
+
+// A batch of gene trees read from one multi-Newick file gives the same alignments for any
+// thread count, tree by tree, in memory and written to files; the model is built once for
+// the whole batch. Trees with continuous branch lengths, whose tables are all built
+// concurrently, also match across thread counts, and the batch leaves the ledger's memory
+// phase alone. The batch is timed against a Simulator and model set up per tree without
+// the model cache.
+
+// lengths of 0.01 steps, shared between trees, or continuous ones
+std::string randomTree(size_t numLeaves, std::mt19937_64 &rng, bool continuous = false) {
+    std::uniform_int_distribution<int> steps(1, 40);
+    std::uniform_real_distribution<double> continuousLength(0.01, 0.4);
+    auto length = [&](std::mt19937_64 &rng) { return continuous ? continuousLength(rng) : steps(rng) * 0.01; };
+    std::vector<std::string> clades;
+    for (size_t leaf = 0; leaf < numLeaves; ++leaf) clades.push_back("L" + std::to_string(leaf));
+    while (clades.size() > 1) {
+        std::uniform_int_distribution<size_t> pick(0, clades.size() - 1);
+        const size_t first = pick(rng);
+        std::string a = clades[first] + ":" + std::to_string(length(rng));
+        clades.erase(clades.begin() + first);
+        const size_t second = std::uniform_int_distribution<size_t>(0, clades.size() - 1)(rng);
+        std::string b = clades[second] + ":" + std::to_string(length(rng));
+        clades[second] = "(" + a + "," + b + ")";
+    }
+    return clades[0] + ";";
+}
+
+std::string readFile(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+std::vector<std::string> msaStrings(const std::vector<std::unique_ptr<MSA>> &msas) {
+    std::vector<std::string> texts;
+    for (const auto &msa : msas) texts.push_back(msa->generateMsaString());
+    return texts;
+}
+
+int main() {
+    bool passed = true;
+    const size_t numTrees = 30;
+    std::mt19937_64 rng(21);
+    std::vector<std::string> newicks;
+    {
+        std::ofstream file("batch_trees.nwk");
+        for (size_t t = 0; t < numTrees; ++t) {
+            newicks.push_back(randomTree(12 + t % 9, rng));
+            file << newicks.back() << "\n";
+        }
+    }
+
+    DiscreteDistribution lengths({0.5, 0.25, 0.15, 0.1});
+    modelFactory model(nullptr);
+    model.setAlphabet(alphabetCode::AMINOACID);
+    model.setReplacementModel(modelCode::LG);
+    model.setSiteRateModel({0.3, 0.8, 1.4, 2.5}, {0.25, 0.25, 0.25, 0.25});
+
+    BatchSimulator<pcg64_fast, 20> batch;
+    passed &= check("trees read", batch.addTreesFromFile("batch_trees.nwk") == numTrees && batch.numTrees() == numTrees);
+    std::remove("batch_trees.nwk");
+    batch.setModel(model);
+    batch.setSequenceSize(500);
+    batch.setInsertionRate(0.03);
+    batch.setDeletionRate(0.03);
+    batch.setInsertionLengthDistribution(&lengths);
+    batch.setDeletionLengthDistribution(&lengths);
+    batch.setSeed(5);
+
+    modelCache().clear();
+    modelCache().resetStats();
+    auto start = std::chrono::high_resolution_clock::now();
+    const std::vector<std::string> serial = msaStrings(batch.simulate());
+    const double batchMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    passed &= check("model built once", modelCache().stats().misses == 1 && modelCache().stats().hits == numTrees - 1);
+
+    batch.setNumThreads(4);
+    start = std::chrono::high_resolution_clock::now();
+    const std::vector<std::string> parallel = msaStrings(batch.simulate());
+    const double parallelMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    passed &= check("same alignments on 4 threads", parallel == serial);
+    passed &= check("tree by tree", batch.simulateTree(17)->generateMsaString() == serial[17]);
+    passed &= check("trees differ", serial[3] != serial[4] && serial[3].find(">L0") != std::string::npos);
+
+    batch.setSeed(6);
+    passed &= check("seeded", batch.simulateTree(3)->generateMsaString() != serial[3]);
+    batch.setSeed(5);
+
+    const std::vector<std::string> paths = batch.simulateToFiles("batch_msa_");
+    bool filesMatch = paths.size() == numTrees;
+    for (size_t t = 0; t < paths.size(); ++t) {
+        filesMatch &= readFile(paths[t]) == serial[t];
+        std::remove(paths[t].c_str());
+    }
+    passed &= check("written to files", filesMatch);
+
+    BatchSimulator<pcg64_fast, 20> continuous;
+    for (size_t t = 0; t < numTrees; ++t) continuous.addTree(randomTree(30, rng, true));
+    continuous.setModel(model);
+    continuous.setSequenceSize(500);
+    continuous.setSeed(8);
+    const std::vector<std::string> continuousSerial = msaStrings(continuous.simulate());
+    continuous.setNumThreads(4);
+    passed &= check("continuous lengths on 4 threads", msaStrings(continuous.simulate()) == continuousSerial);
+    passed &= check("memory phase untouched", memoryLedger().phase() == NO_PHASE);
+
+    // one Simulator and model per tree, built from scratch
+    modelCache().setCapacity(0);
+    modelRegistry().clear();
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t t = 0; t < numTrees; ++t) {
+        tree phylotree(newicks[t], false);
+        const size_t numBranches = phylotree.getNodesNum() - 1;
+        SimulationProtocol protocol(&phylotree);
+        protocol.setSequenceSize(500);
+        protocol.setInsertionRates(std::vector<double>(numBranches, 0.03));
+        protocol.setDeletionRates(std::vector<double>(numBranches, 0.03));
+        protocol.setInsertionLengthDistributions(std::vector<DiscreteDistribution*>(numBranches, &lengths));
+        protocol.setDeletionLengthDistributions(std::vector<DiscreteDistribution*>(numBranches, &lengths));
+        protocol.setSeed(streamSeed(5, t));
+        modelRegistry().clear();
+        modelFactory perTree(&phylotree);
+        perTree.setAlphabet(alphabetCode::AMINOACID);
+        perTree.setReplacementModel(modelCode::LG);
+        perTree.setSiteRateModel({0.3, 0.8, 1.4, 2.5}, {0.25, 0.25, 0.25, 0.25});
+        Simulator<pcg64_fast, 20> simulator(&protocol);
+        BlockMap blocks = simulator.generateSimulation();
+        MSA msa(blocks, phylotree.getRoot(), simulator.getNodesSaveList());
+        simulator.initSubstitionSim(perTree);
+        msa.fillSubstitutions(simulator.simulateSubstitutions(msa.getMSAlength(), "", msa.getRootPositionsInMsa()));
+        if (t == 9) passed &= check("same as a lone simulator", msa.generateMsaString() == serial[9]);
+    }
+    const double perTreeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    modelCache().setCapacity(ModelCache::DEFAULT_CAPACITY);
+    std::cout << numTrees << " trees: " << perTreeMs << " ms set up per tree, " << batchMs << " ms batch, "
+              << parallelMs << " ms batch on 4 threads\n";
+
+    BatchSimulator<pcg64_fast, 4> indelsOnly;
+    indelsOnly.addTree(newicks[0]);
+    indelsOnly.setInsertionRate(0.05);
+    indelsOnly.setInsertionLengthDistribution(&lengths);
+    indelsOnly.setDeletionLengthDistribution(&lengths);
+    indelsOnly.setSaveAllNodes(true);
+    auto indels = indelsOnly.simulateTree(0);
+    passed &= check("indels only, all nodes", indels->getNumberOfSequences() == 23);
+
+    bool rejected = false;
+    try { indelsOnly.simulateTree(1); } catch (const std::out_of_range &) { rejected = true; }
+    passed &= check("index checked", rejected);
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,121 @@
+#include <chrono>
+#include <cmath>
+
+#include "../../../src/Simulator.h"
+#include "../../../libs/pcg/pcg_random.hpp"
+
+// Compares the event-driven (Gillespie) engine against the per-site transition-matrix
+// engine: the proportion of differing sites between two sister leaves must match
+// the JC expectation p = 3/4 * (1 - exp(-4/3 * d)) for both engines. The total event rate
+// kept by the substitution manager must still equal the sum of the site rates after many
+// millions of updates and roll-backs.
+
+double differingSites(const SequenceArena &sequences, int firstId, int secondId) {
+    const uint8_t *first = sequences.row(sequences.rowOfId(firstId));
+    const uint8_t *second = sequences.row(sequences.rowOfId(secondId));
+    size_t differences = 0;
+    for (size_t site = 0; site < sequences.numColumns(); ++site) {
+        differences += (first[site] != second[site]);
+    }
+    return static_cast<double>(differences) / sequences.numColumns();
+}
+
+double runEngine(tree &tree_, SimulationProtocol &protocol, substitutionEngine engine,
+                 size_t sequenceLength, std::shared_ptr<SequenceArena> &output) {
+    Simulator<pcg64_fast, 4> sim(&protocol);
+    modelFactory mFac(&tree_);
+    mFac.setAlphabet(alphabetCode::NUCLEOTIDE);
+    mFac.setReplacementModel(modelCode::NUCJC);
+    mFac.setSiteRateModel({1.0}, {1.0});
+
+    sim.setSubstitutionEngine(engine);
+    sim.initSubstitionSim(mFac);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    output = sim.simulateSubstitutions(sequenceLength);
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// largest relative gap between the maintained total rate and a fresh sum of the site rates
+double reactantsSumDrift(tree &tree_) {
+    modelFactory mFac(&tree_);
+    mFac.setAlphabet(alphabetCode::NUCLEOTIDE);
+    mFac.setReplacementModel(modelCode::GTR);
+    mFac.setModelParameters({0.1, 0.2, 0.3, 0.4, 1.0, 2.0, 0.5, 0.8, 3.0, 1.0});
+    mFac.setSiteRateModel({0.1, 0.7, 3.3}, {0.3, 0.4, 0.3});
+    std::shared_ptr<stochasticProcess> sp = mFac.getStochasticProcess();
+
+    const size_t sequenceLength = 10000;
+    pcg64_fast rng(7);
+    std::vector<size_t> categories(sequenceLength);
+    sequence currentSeq;
+    currentSeq.resize(sequenceLength);
+    for (size_t site = 0; site < sequenceLength; ++site) {
+        categories[site] = rng() % 3;
+        currentSeq[site] = rng() % 4;
+    }
+
+    auto exactSum = [&]() {
+        double sum = 0.0;
+        for (size_t site = 0; site < sequenceLength; ++site) {
+            sum += -sp->Qij(currentSeq[site], currentSeq[site]) * sp->rates(categories[site]);
+        }
+        return sum;
+    };
+
+    substitutionManager manager(tree_.getNodesNum());
+    manager.handleRootSequence(currentSeq, categories, sp.get());
+    const int nodeId = tree_.getRoot()->getSon(0)->id();
+    double drift = 0.0;
+    for (size_t round = 0; round < 200; ++round) {
+        for (size_t event = 0; event < 25000; ++event) {
+            manager.handleEvent(nodeId, rng() % sequenceLength, rng() % 4, categories, sp.get(), currentSeq);
+        }
+        drift = std::max(drift, std::abs(manager.getReactantsSum() - exactSum()) / exactSum());
+        if (round % 2 == 1) manager.undoSubs(nodeId, currentSeq, categories, sp.get());
+    }
+    return drift;
+}
+
+int main() {
+    const double branchLength = 0.01;
+    const size_t sequenceLength = 1000000;
+    tree tree_("(A:0.01,B:0.01);", false);
+
+    std::vector<DiscreteDistribution*> lengthDists(tree_.getNodesNum() - 1);
+    DiscreteDistribution d1({1.0});
+    std::fill(lengthDists.begin(), lengthDists.end(), &d1);
+
+    SimulationProtocol protocol(&tree_);
+    protocol.setInsertionLengthDistributions(lengthDists);
+    protocol.setDeletionLengthDistributions(lengthDists);
+    protocol.setInsertionRates(std::vector<double>(tree_.getNodesNum() - 1, 0.0));
+    protocol.setDeletionRates(std::vector<double>(tree_.getNodesNum() - 1, 0.0));
+    protocol.setSequenceSize(sequenceLength);
+    protocol.setSeed(42);
+
+    const double expected = 0.75 * (1.0 - std::exp(-4.0 / 3.0 * 2 * branchLength));
+    const double tolerance = 4.0 * std::sqrt(expected * (1.0 - expected) / sequenceLength);
+    const int idA = tree_.getRoot()->getSon(0)->id();
+    const int idB = tree_.getRoot()->getSon(1)->id();
+
+    bool passed = true;
+    for (auto engine: {substitutionEngine::MATRIX_ENGINE, substitutionEngine::GILLESPIE_ENGINE}) {
+        std::shared_ptr<SequenceArena> output;
+        double elapsed = runEngine(tree_, protocol, engine, sequenceLength, output);
+        double observed = differingSites(*output, idA, idB);
+        bool ok = std::abs(observed - expected) < tolerance;
+        passed = passed && ok;
+        std::cout << (engine == substitutionEngine::MATRIX_ENGINE ? "matrix   " : "gillespie")
+                  << " observed=" << observed << " expected=" << expected
+                  << " time=" << elapsed << "ms " << (ok ? "OK" : "FAILED") << "\n";
+    }
+
+    const double drift = reactantsSumDrift(tree_);
+    const bool exact = drift < 1e-12;
+    passed = passed && exact;
+    std::cout << "total rate drift=" << drift << " " << (exact ? "OK" : "FAILED") << "\n";
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+#include <cstdio>
+#include <iostream>
+
+#include "../../../libs/pcg/pcg_random.hpp"
+#include "../../../src/Simulator.h"
+#include "../../../src/MSA.h"
+#include "../TestCheck.h"
+
+// The memory ledger follows the structures of a replicate through its phases: temporary
+// structures (block trees, the super sequence, sequences along the tree) leave peaks but no
+// current bytes, owned ones (block maps, gap runs, the arena, transition tables) are held
+// exactly while their owner lives, and everything is released with the simulator.
+
+int64_t current(memorySubsystem subsystem) { return memoryLedger().current(subsystem); }
+int64_t peak(memorySubsystem subsystem) { return memoryLedger().peak(subsystem); }
+
+int main() {
+    tree tree_("((A:0.1,B:0.2):0.05,(C:0.3,D:0.1):0.2,(E:0.4,(F:0.1,G:0.2):0.1):0.1);", false);
+
+    std::vector<DiscreteDistribution*> lengthDists(tree_.getNodesNum() - 1);
+    DiscreteDistribution d1({0.5, 0.3, 0.2});
+    std::fill(lengthDists.begin(), lengthDists.end(), &d1);
+
+    SimulationProtocol protocol(&tree_);
+    protocol.setInsertionLengthDistributions(lengthDists);
+    protocol.setDeletionLengthDistributions(lengthDists);
+    protocol.setInsertionRates(std::vector<double>(tree_.getNodesNum() - 1, 0.05));
+    protocol.setDeletionRates(std::vector<double>(tree_.getNodesNum() - 1, 0.05));
+    protocol.setSequenceSize(5000);
+    protocol.setSeed(3);
+
+    bool passed = true;
+    {
+        Simulator<pcg64_fast, 4> sim(&protocol);
+        memoryLedger().resetPeaks();
+
+        auto blockmap = sim.generateSimulation();
+        const int64_t blockMapBytes = static_cast<int64_t>(blockmap.memoryUsage());
+        passed &= check("block map held", blockMapBytes > 0 && current(BLOCK_MAP_MEMORY) == blockMapBytes
+                                          && memoryLedger().phasePeak(INDEL_PHASE, BLOCK_MAP_MEMORY) >= blockMapBytes);
+        passed &= check("block trees released", current(BLOCK_TREE_MEMORY) == 0 && peak(BLOCK_TREE_MEMORY) > 0);
+        {
+            BlockMap copy(blockmap);
+            passed &= check("block map copy charged", copy.memoryUsage() > 0
+                                                   && current(BLOCK_MAP_MEMORY) == blockMapBytes + static_cast<int64_t>(copy.memoryUsage()));
+        }
+        passed &= check("block map copy released", current(BLOCK_MAP_MEMORY) == blockMapBytes);
+
+        auto msa = std::make_unique<MSA>(blockmap, tree_.getRoot(), sim.getNodesSaveList());
+        passed &= check("block map consumed", current(BLOCK_MAP_MEMORY) == 0 && blockmap.empty());
+        const int64_t gapRuns = current(GAP_RUNS_MEMORY);
+        passed &= check("msa structures released", current(SUPER_SEQUENCE_MEMORY) == 0 && current(MSA_SEQUENCES_MEMORY) == 0
+                                                   && peak(SUPER_SEQUENCE_MEMORY) > 0 && peak(MSA_SEQUENCES_MEMORY) > 0);
+        passed &= check("gap runs held", gapRuns > 0 && memoryLedger().phasePeak(MSA_PHASE, GAP_RUNS_MEMORY) == gapRuns);
+        {
+            MSA copy(*msa);
+            passed &= check("copy charged", current(GAP_RUNS_MEMORY) > gapRuns);
+        }
+        passed &= check("copy released", current(GAP_RUNS_MEMORY) == gapRuns);
+
+        modelFactory factory(&tree_);
+        factory.setAlphabet(alphabetCode::NUCLEOTIDE);
+        factory.setReplacementModel(modelCode::NUCJC);
+        factory.setSiteRateModel({0.5, 1.5}, {0.5, 0.5});
+        sim.initSubstitionSim(factory);
+        passed &= check("transition tables held", current(TRANSITION_TABLES_MEMORY) > 0);
+
+        sim.initSimulator();
+        auto arena = sim.simulateSubstitutions(msa->getMSAlength());
+        passed &= check("arena held", current(SUBSTITUTION_SEQUENCES_MEMORY) == static_cast<int64_t>(arena->memoryUsage()));
+        passed &= check("workspace released", current(SUBSTITUTION_WORKSPACE_MEMORY) == 0
+                                               && memoryLedger().phasePeak(SUBSTITUTION_PHASE, SUBSTITUTION_WORKSPACE_MEMORY)
+                                                  >= static_cast<int64_t>(2 * msa->getMSAlength() * sizeof(ALPHACHAR)));
+
+        msa->fillSubstitutions(arena);
+        const int64_t beforeOutput = current(OUTPUT_BUFFERS_MEMORY);
+        msa->writeFullMsa("memory_accounting.fa");
+        passed &= check("output buffers", current(OUTPUT_BUFFERS_MEMORY) == beforeOutput
+                                          && memoryLedger().phasePeak(OUTPUT_PHASE, OUTPUT_BUFFERS_MEMORY) > beforeOutput);
+
+        const auto report = memoryLedger().report();
+        int64_t sum = 0;
+        for (const auto &entry : report) {
+            if (entry.first != "total") sum += entry.second.at("current");
+        }
+        passed &= check("report total", report.size() == NUM_MEMORY_SUBSYSTEMS + 1 && report.at("total").at("current") == sum
+                                        && report.at("total").at("peak") >= report.at("total").at("peak_substitutions"));
+        std::cout << "peak total " << report.at("total").at("peak") << " bytes, peak gap runs "
+                  << report.at("gap_runs").at("peak") << "\n";
+
+        memoryLedger().resetPeaks();
+        passed &= check("peaks reset", memoryLedger().peak(MemoryLedger::TOTAL) == memoryLedger().current(MemoryLedger::TOTAL)
+                                       && memoryLedger().phasePeak(MSA_PHASE, MemoryLedger::TOTAL) == 0);
+        std::remove("memory_accounting.fa");
+    }
+    modelCache().clear(); // holds the model's shared transition tables
+    passed &= check("all released", memoryLedger().current(MemoryLedger::TOTAL) == 0);
+    return passed ? 0 : 1;
+}
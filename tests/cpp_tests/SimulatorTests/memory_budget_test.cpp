@@ -0,0 +1,133 @@
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include "../../../libs/pcg/pcg_random.hpp"
+#include "../../../src/Simulator.h"
+#include "../../../src/MSA.h"
+#include "../TestCheck.h"
+
+// For one seed, the output of all three strategies must be byte-identical: the MSA filled
+// in memory and written, the rows streamed with the gap runs in memory, and the rows
+// streamed with the runs spilled to a scratch file. The planner must step from the
+// in-memory strategy down to the spilled one as the budget shrinks, refusing budgets
+// nothing fits.
+
+std::string readFile(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+int main() {
+    tree tree_("((A:0.1,B:0.2):0.05,(C:0.3,D:0.1):0.2,(E:0.4,(F:0.1,G:0.2):0.1):0.1);", false);
+
+    std::vector<DiscreteDistribution*> lengthDists(tree_.getNodesNum() - 1);
+    DiscreteDistribution d1({0.5, 0.3, 0.2});
+    std::fill(lengthDists.begin(), lengthDists.end(), &d1);
+
+    SimulationProtocol protocol(&tree_);
+    protocol.setInsertionLengthDistributions(lengthDists);
+    protocol.setDeletionLengthDistributions(lengthDists);
+    protocol.setInsertionRates(std::vector<double>(tree_.getNodesNum() - 1, 0.05));
+    protocol.setDeletionRates(std::vector<double>(tree_.getNodesNum() - 1, 0.05));
+    protocol.setSequenceSize(20000);
+    protocol.setSeed(5);
+
+    Simulator<pcg64_fast, 4> sim(&protocol);
+    auto blockmap = sim.generateSimulation();
+    auto msa = std::make_unique<MSA>(blockmap, tree_.getRoot(), sim.getNodesSaveList());
+    const size_t msaLength = msa->getMSAlength();
+
+    modelFactory factory(&tree_);
+    factory.setAlphabet(alphabetCode::NUCLEOTIDE);
+    factory.setReplacementModel(modelCode::NUCJC);
+    factory.setSiteRateModel({0.5, 1.5}, {0.5, 0.5});
+    sim.initSubstitionSim(factory);
+
+    bool passed = true;
+
+    // planner, for a large run over a fixed baseline: everything fits, then only streaming,
+    // then only spilling, then nothing
+    SubstitutionFootprint large;
+    large.msaLength = 10000;
+    large.numRows = 1000000;
+    large.numNodes = 2 * large.numRows - 1;
+    large.totalGapRuns = 50 * large.numRows;
+    large.nameBytes = 8 * large.numRows;
+    large.workingSetBytes = 64 * large.msaLength * sizeof(ALPHACHAR);
+    large.outputBufferBytes = size_t(20) << 20;
+    const size_t resident = size_t(1) << 30;
+    const MemoryPlan roomy = SubstitutionMemoryPlanner(size_t(1) << 40).plan(large, resident);
+    passed &= check("large budget keeps everything in memory", roomy.feasible && roomy.strategy == IN_MEMORY_STRATEGY);
+    const MemoryPlan streamed = SubstitutionMemoryPlanner(roomy.estimatedPeakBytes - 1).plan(large, resident);
+    passed &= check("smaller budget streams rows", streamed.feasible && streamed.strategy == STREAMED_ROWS_STRATEGY);
+    const MemoryPlan spilled = SubstitutionMemoryPlanner(streamed.estimatedPeakBytes - 1).plan(large, resident);
+    passed &= check("smaller budget spills gap runs", spilled.feasible && spilled.strategy == SPILLED_GAP_RUNS_STRATEGY);
+    const MemoryPlan refused = SubstitutionMemoryPlanner(spilled.estimatedPeakBytes - 1).plan(large, resident);
+    passed &= check("too small budget refused", !refused.feasible);
+    passed &= check("baseline excludes gap runs", roomy.baselineBytes == resident - SubstitutionMemoryPlanner::gapRunBytes(large));
+    std::cout << "estimated peaks of 1M x 10k rows: " << roomy.estimatedPeakBytes << " / "
+              << streamed.estimatedPeakBytes << " / " << spilled.estimatedPeakBytes << " bytes\n";
+
+    // this run, from the resident memory of the process
+    const SubstitutionFootprint footprint = sim.substitutionFootprint(msaLength, msa.get());
+    passed &= check("footprint", footprint.numRows == 7 && footprint.msaLength == msaLength
+                                 && footprint.totalGapRuns > 0 && footprint.workingSetBytes > 0);
+    const MemoryPlan measured = sim.planSubstitutionMemory(size_t(1) << 40, msaLength, msa.get());
+    passed &= check("plan from resident memory", measured.feasible && measured.baselineBytes > 0);
+
+    // filled in memory, streamed with the runs of the MSA, then spilled with the MSA released
+    const std::string inMemoryPath = "memory_budget_in_memory.fa";
+    const std::string streamedPath = "memory_budget_streamed.fa";
+    const std::string spilledPath = "memory_budget_spilled.fa";
+    sim.initSimulator();
+    msa->fillSubstitutions(sim.simulateSubstitutions(msaLength));
+    msa->writeFullMsa(inMemoryPath.c_str());
+
+    sim.initSimulator();
+    sim.setAlignedSequenceMap(*msa);
+    sim.simulateAndWriteSubstitutions(msaLength, streamedPath);
+    const std::string streamedText = readFile(streamedPath); // complete once the call returns
+#ifdef SAILFISH_HAVE_ZLIB
+    const std::string compressedPath = "memory_budget_streamed.fa.gz";
+    sim.initSimulator();
+    sim.setCompressedOutput(true);
+    sim.simulateAndWriteSubstitutions(msaLength, compressedPath);
+    sim.setCompressedOutput(false);
+    const std::string compressed = readFile(compressedPath);
+    const std::string bgzfEof("\x1f\x8b\x08\x04\0\0\0\0\0\xff\x06\0\x42\x43\x02\0\x1b\0\x03\0\0\0\0\0\0\0\0\0", 28);
+    passed &= check("compressed output ends with the BGZF EOF block",
+                    compressed.size() > bgzfEof.size() && compressed.compare(compressed.size() - bgzfEof.size(), bgzfEof.size(), bgzfEof) == 0);
+    std::remove(compressedPath.c_str());
+#endif
+#ifdef __linux__
+    bool reported = false;
+    sim.initSimulator();
+    try {
+        sim.simulateAndWriteSubstitutions(msaLength, "/dev/full");
+    } catch (const std::exception &) {
+        reported = true;
+    }
+    passed &= check("write failure reported by the call", reported);
+#endif
+    sim.clearGapRuns();
+
+    sim.initSimulator();
+    sim.spillGapRuns(*msa, spilledPath + ".gapruns");
+    msa.reset();
+    releaseFreedMemory();
+    sim.simulateAndWriteSubstitutions(msaLength, spilledPath);
+    sim.clearGapRuns();
+
+    passed &= check("streamed output matches in memory", !streamedText.empty() && readFile(inMemoryPath) == streamedText);
+    passed &= check("spilled output matches streamed", readFile(spilledPath) == streamedText);
+    passed &= check("spill file removed", !std::ifstream(spilledPath + ".gapruns").good());
+    std::cout << "peak resident: " << peakResidentBytes() << " bytes\n";
+
+    std::remove(inMemoryPath.c_str());
+    std::remove(streamedPath.c_str());
+    std::remove(spilledPath.c_str());
+    return passed ? 0 : 1;
+}
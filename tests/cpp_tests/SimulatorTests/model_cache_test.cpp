@@ -0,0 +1,139 @@
+#include <chrono>
+#include <random>
+#include <iostream>
+
+#include "../../../libs/pcg/pcg_random.hpp"
+#include "../../../src/Simulator.h"
+#include "../TestCheck.h"
+
+// Simulators set up with the same model share it through the process-wide cache: the second
+// one builds no process and no tables, yet simulates exactly what a fresh setup would. Models
+// that differ in any parameter or site rate get their own entry, and a cache of capacity 0
+// keeps nothing. Tables shared through a cached model are freed with the last simulator
+// using them, so simulating many trees with distinct branch lengths does not grow memory.
+
+std::vector<std::string> simulateRows(Simulator<pcg64_fast, 20> &sim, size_t length) {
+    sim.initSimulator();
+    auto arena = sim.simulateSubstitutions(length);
+    std::vector<std::string> rows;
+    for (size_t row = 0; row < arena->numRows(); ++row) rows.push_back(arena->rowString(row));
+    return rows;
+}
+
+void setModel(modelFactory &factory, MDOUBLE secondRate) {
+    factory.resetFactory();
+    factory.setAlphabet(alphabetCode::AMINOACID);
+    factory.setReplacementModel(modelCode::WAG);
+    factory.setSiteRateModel({0.3, secondRate}, {0.5, 0.5});
+}
+
+int main() {
+    tree tree_("((A:0.1,B:0.2):0.05,(C:0.3,D:0.1):0.2,(E:0.4,(F:0.1,G:0.2):0.1):0.1);", false);
+
+    std::vector<DiscreteDistribution*> lengthDists(tree_.getNodesNum() - 1);
+    DiscreteDistribution d1({0.5, 0.3, 0.2});
+    std::fill(lengthDists.begin(), lengthDists.end(), &d1);
+    SimulationProtocol protocol(&tree_);
+    protocol.setInsertionLengthDistributions(lengthDists);
+    protocol.setDeletionLengthDistributions(lengthDists);
+    protocol.setInsertionRates(std::vector<double>(tree_.getNodesNum() - 1, 0.05));
+    protocol.setDeletionRates(std::vector<double>(tree_.getNodesNum() - 1, 0.05));
+    protocol.setSequenceSize(2000);
+    protocol.setSeed(9);
+
+    modelFactory factory(&tree_);
+    setModel(factory, 1.7);
+
+    bool passed = true;
+    modelCache().clear();
+    modelCache().resetStats();
+
+    auto start = std::chrono::high_resolution_clock::now();
+    Simulator<pcg64_fast, 20> first(&protocol);
+    first.setSubstitutionEngine(substitutionEngine::MATRIX_ENGINE);
+    first.initSubstitionSim(factory);
+    const std::vector<std::string> expected = simulateRows(first, 2000);
+    const double firstMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    passed &= check("first setup builds the model", modelCache().stats().misses == 1 && modelCache().stats().models == 1);
+
+    // a sweep over indel rates: a new simulator and factory with the same substitution model
+    protocol.setInsertionRates(std::vector<double>(tree_.getNodesNum() - 1, 0.1));
+    modelFactory sameModel(&tree_);
+    setModel(sameModel, 1.7);
+    start = std::chrono::high_resolution_clock::now();
+    Simulator<pcg64_fast, 20> second(&protocol);
+    second.setSubstitutionEngine(substitutionEngine::MATRIX_ENGINE);
+    second.initSubstitionSim(sameModel);
+    const std::vector<std::string> reused = simulateRows(second, 2000);
+    const double secondMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    const TransitionTableStats stats = second.getTransitionTableStats();
+    passed &= check("same model reused", modelCache().stats().hits == 1 && modelCache().stats().models == 1);
+    passed &= check("tables shared", stats.misses > 0 && stats.shared == stats.misses);
+    passed &= check("same output", reused == expected);
+    std::cout << "setup and simulation: " << firstMs << " ms first, " << secondMs << " ms from the cache\n";
+
+    // another site-rate model is another entry, with tables of its own
+    modelFactory otherRates(&tree_);
+    setModel(otherRates, 1.6);
+    passed &= check("keys differ by site rates", otherRates.cacheKey() != sameModel.cacheKey()
+                                                 && factory.cacheKey() == sameModel.cacheKey());
+    Simulator<pcg64_fast, 20> third(&protocol);
+    third.setSubstitutionEngine(substitutionEngine::MATRIX_ENGINE);
+    third.initSubstitionSim(otherRates);
+    simulateRows(third, 2000);
+    passed &= check("other model built", modelCache().stats().misses == 2 && modelCache().stats().models == 2);
+    passed &= check("its tables built", third.getTransitionTableStats().shared < third.getTransitionTableStats().misses);
+
+    // bounded caches keep what they build to themselves
+    second.setTransitionTableCache(2, LRU_EVICTION);
+    modelCache().clear();
+    second.initSubstitionSim(sameModel);
+    simulateRows(second, 2000);
+    Simulator<pcg64_fast, 20> fourth(&protocol);
+    fourth.setSubstitutionEngine(substitutionEngine::MATRIX_ENGINE);
+    fourth.initSubstitionSim(sameModel);
+    passed &= check("model still shared", modelCache().stats().models == 1);
+    simulateRows(fourth, 2000);
+    passed &= check("nothing shared by the bounded cache", fourth.getTransitionTableStats().shared == 0);
+
+    // one simulator after another, each on a tree of new continuous branch lengths
+    modelCache().clear();
+    std::mt19937_64 rng(3);
+    std::uniform_real_distribution<double> length(0.01, 0.5);
+    auto randomLength = [&]() { return std::to_string(length(rng)); };
+    int64_t firstTreeBytes = 0, largestBytes = 0;
+    size_t liveAfterTrees = 0;
+    for (size_t replicate = 0; replicate < 50; ++replicate) {
+        tree lengths("((A:" + randomLength() + ",B:" + randomLength() + "):" + randomLength() + ",(C:" + randomLength()
+                     + ",D:" + randomLength() + "):" + randomLength() + ",(E:" + randomLength() + ",(F:" + randomLength()
+                     + ",G:" + randomLength() + "):" + randomLength() + "):" + randomLength() + ");", false);
+        SimulationProtocol lengthsProtocol(&lengths);
+        lengthsProtocol.setSequenceSize(500);
+        lengthsProtocol.setSeed(replicate);
+        modelFactory lengthsModel(&lengths);
+        setModel(lengthsModel, 1.7);
+        {
+            Simulator<pcg64_fast, 20> sim(&lengthsProtocol);
+            sim.setSubstitutionEngine(substitutionEngine::MATRIX_ENGINE);
+            sim.initSubstitionSim(lengthsModel);
+            simulateRows(sim, 500);
+            const int64_t bytes = memoryLedger().current(TRANSITION_TABLES_MEMORY);
+            if (replicate == 0) firstTreeBytes = bytes;
+            largestBytes = std::max(largestBytes, bytes);
+        }
+        liveAfterTrees = std::max(liveAfterTrees, modelCache().model<20>(lengthsModel)->sharedTables());
+    }
+    std::cout << "transition table bytes: " << firstTreeBytes << " for one tree, at most " << largestBytes << " over 50\n";
+    passed &= check("released tables freed", liveAfterTrees == 0);
+    passed &= check("table memory bounded", largestBytes <= firstTreeBytes + 4096);
+
+    modelCache().setCapacity(0);
+    passed &= check("disabled cache keeps nothing", modelCache().stats().models == 0);
+    const size_t misses = modelCache().stats().misses;
+    Simulator<pcg64_fast, 20> fifth(&protocol);
+    fifth.initSubstitionSim(sameModel);
+    passed &= check("disabled cache builds", modelCache().stats().misses == misses + 1 && modelCache().stats().models == 0);
+    modelCache().setCapacity(ModelCache::DEFAULT_CAPACITY);
+
+    return passed ? 0 : 1;
+}
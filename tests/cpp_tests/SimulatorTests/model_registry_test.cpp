@@ -0,0 +1,93 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#include "../../../src/modelFactory.h"
+#include "../TestCheck.h"
+
+// Models without parameters are built once per process: later factories of the same model,
+// with any site-rate model, get the registered model and its eigensystem, and their processes
+// match one built from scratch. Parameterized models and changed model files are built anew.
+
+void setProtein(modelFactory &factory, modelCode model, MDOUBLE secondRate) {
+    factory.resetFactory();
+    factory.setAlphabet(alphabetCode::AMINOACID);
+    factory.setReplacementModel(model);
+    factory.setSiteRateModel({0.4, secondRate}, {0.5, 0.5});
+}
+
+int main() {
+    bool passed = true;
+    tree tree_("((A:0.1,B:0.2):0.05,C:0.3);", false);
+    modelRegistry().clear();
+
+    auto start = std::chrono::high_resolution_clock::now();
+    modelFactory first(&tree_);
+    setProtein(first, modelCode::WAG, 1.6);
+    auto firstProcess = first.getStochasticProcess();
+    const double firstUs = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+
+    start = std::chrono::high_resolution_clock::now();
+    modelFactory second(&tree_);
+    setProtein(second, modelCode::WAG, 1.3);
+    auto secondProcess = second.getStochasticProcess();
+    const double secondUs = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << "WAG process: " << firstUs << " us first, " << secondUs << " us registered\n";
+
+    passed &= check("registered once", modelRegistry().size() == 1
+                                       && first.getRegisteredModel() == second.getRegisteredModel());
+    passed &= check("own site rates", firstProcess->rates(1) == 1.6 && secondProcess->rates(1) == 1.3);
+
+    // the registered accelerator is the one a fresh build fits
+    pupAll wag(datMatrixHolder::wag);
+    chebyshevAccelerator wagPij(&wag);
+    customDistribution rates({0.4, 1.3}, {0.5, 0.5});
+    stochasticProcess fresh(&rates, &wagPij);
+    double worst = 0.0;
+    for (int i = 0; i < 20; ++i) {
+        for (int j = 0; j < 20; ++j) {
+            worst = std::max(worst, std::abs(secondProcess->Pij_t(i, j, 0.3) - fresh.Pij_t(i, j, 0.3)));
+        }
+    }
+    passed &= check("same transition probabilities", worst == 0.0 && secondProcess->freq(3) == fresh.freq(3));
+
+    auto registered = second.getRegisteredModel();
+    auto eigen = registered->eigensystem<20>();
+    passed &= check("eigensystem once", eigen != nullptr && eigen == registered->eigensystem<20>());
+    passed &= check("eigensystem matches", eigen->matches(fresh));
+    passed &= check("no eigensystem of another size", registered->eigensystem<4>() == nullptr);
+
+    modelFactory lg(&tree_);
+    setProtein(lg, modelCode::LG, 1.6);
+    passed &= check("another model registered", lg.getRegisteredModel() != registered && modelRegistry().size() == 2);
+
+    // parameterized models are not registered
+    modelFactory gtr(&tree_);
+    gtr.setAlphabet(alphabetCode::NUCLEOTIDE);
+    gtr.setReplacementModel(modelCode::GTR);
+    gtr.setModelParameters({0.1, 0.2, 0.3, 0.4, 1.0, 2.0, 0.5, 0.8, 3.0, 1.0});
+    gtr.setSiteRateModel({1.0}, {1.0});
+    passed &= check("gtr built anew", gtr.getRegisteredModel() != gtr.getRegisteredModel() && modelRegistry().size() == 2
+                                      && gtr.getRegisteredModel()->eigensystem<4>() != nullptr);
+
+    // model files are registered by their contents
+    const std::string path = "model_registry_test.dat";
+    std::ofstream("model_registry_test.dat") << "\"custom model one\"\n";
+    modelFactory custom(&tree_);
+    custom.setAlphabet(alphabetCode::AMINOACID);
+    custom.setReplacementModel(modelCode::CUSTOM);
+    custom.setCustomAAModelFile(path);
+    custom.setSiteRateModel({1.0}, {1.0});
+    auto customModel = custom.getRegisteredModel();
+    passed &= check("custom file registered", custom.getRegisteredModel() == customModel && modelRegistry().size() == 3);
+    std::ofstream("model_registry_test.dat") << "\"custom model two\"\n";
+    passed &= check("changed file rebuilt", custom.getRegisteredModel() != customModel && modelRegistry().size() == 4);
+    std::remove(path.c_str());
+
+    modelRegistry().clear();
+    passed &= check("cleared", modelRegistry().size() == 0 && second.getRegisteredModel() != registered
+                               && registered->eigensystem<20>() == eigen);
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,13 @@
+#ifndef ___TEST_CHECK
+#define ___TEST_CHECK
+
+#include <string>
+#include <iostream>
+
+// prints "label: OK" or "label: FAILED" and returns ok, so a test can collect passed &= check(...)
+inline bool check(const std::string &label, bool ok) {
+    std::cout << label << ": " << (ok ? "OK" : "FAILED") << "\n";
+    return ok;
+}
+
+#endif
@@ -0,0 +1,152 @@
+#include <chrono>
+#include <random>
+#include <iostream>
+
+#include "../../../libs/pcg/pcg_random.hpp"
+#include "../../../src/FlatTree.h"
+#include "../../../src/Simulator.h"
+#include "../TestCheck.h"
+
+// The flat tree parsed from Newick has Phylolib's preorder ids, parents, names and branch
+// lengths, survives a Newick round trip with every length read back exactly, rejects
+// malformed input with its position, handles trees too deep for recursion, and its Phylolib
+// tree simulates exactly like one read by Phylolib. A million-leaf tree is parsed in well
+// under a second.
+// Run from tests/cpp_tests/TreeTests.
+
+bool rejects(const std::string &newick) {
+    try {
+        FlatTree::fromNewick(newick);
+    } catch (const std::invalid_argument &error) {
+        return true;
+    }
+    return false;
+}
+
+// random binary tree by splitting leaves, written with random lengths
+std::string randomNewick(size_t numLeaves, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::vector<std::vector<size_t>> children(1);
+    std::vector<size_t> leaves{0};
+    while (leaves.size() < numLeaves) {
+        const size_t pick = std::uniform_int_distribution<size_t>(0, leaves.size() - 1)(rng);
+        const size_t node = leaves[pick];
+        children[node] = {children.size(), children.size() + 1};
+        leaves[pick] = children.size();
+        leaves.push_back(children.size() + 1);
+        children.resize(children.size() + 2);
+    }
+    std::uniform_real_distribution<double> length(0.001, 0.5);
+    std::string out;
+    std::vector<std::pair<size_t, size_t>> stack{{0, 0}};
+    while (!stack.empty()) {
+        auto &[node, next] = stack.back();
+        if (children[node].empty()) {
+            out += "taxon" + std::to_string(node);
+        } else if (next < 2) {
+            out += next == 0 ? "(" : ",";
+            stack.emplace_back(children[node][next++], 0);
+            continue;
+        } else {
+            out += ")";
+        }
+        if (stack.size() > 1) out += ":" + std::to_string(length(rng));
+        stack.pop_back();
+    }
+    return out + ";";
+}
+
+std::string simulateIndels(tree &phylotree) {
+    const size_t numBranches = phylotree.getNodesNum() - 1;
+    DiscreteDistribution lengths({0.6, 0.3, 0.1});
+    SimulationProtocol protocol(&phylotree);
+    protocol.setSequenceSize(200);
+    protocol.setInsertionRates(std::vector<double>(numBranches, 0.05));
+    protocol.setDeletionRates(std::vector<double>(numBranches, 0.05));
+    protocol.setInsertionLengthDistributions(std::vector<DiscreteDistribution*>(numBranches, &lengths));
+    protocol.setDeletionLengthDistributions(std::vector<DiscreteDistribution*>(numBranches, &lengths));
+    protocol.setSeed(3);
+    Simulator<pcg64_fast, 4> simulator(&protocol);
+    simulator.setSaveAllNodes();
+    BlockMap blocks = simulator.generateSimulation();
+    MSA msa(blocks, phylotree.getRoot(), simulator.getNodesSaveList());
+    return msa.generateMsaString();
+}
+
+int main() {
+    bool passed = true;
+
+    const FlatTree small = FlatTree::fromNewick(" ((A:0.1, 'B c':2e-1)x[support 90]:0.3,\n'D''s':1,E)root;");
+    passed &= check("preorder ids", small.numNodes() == 6 && small.numLeaves() == 4
+                                    && small.parents() == std::vector<uint32_t>({FlatTree::NO_PARENT, 0, 1, 1, 0, 0})
+                                    && small.children() == std::vector<uint32_t>({1, 4, 5, 2, 3})
+                                    && small.numChildren(0) == 3 && small.child(1, 1) == 3 && small.isLeaf(4));
+    passed &= check("names", small.names() == std::vector<std::string>({"root", "x", "A", "B c", "D's", "E"}));
+    passed &= check("branch lengths", small.branchLengths() == std::vector<double>({0.0, 0.3, 0.1, 0.2, 1.0, 0.0}));
+    passed &= check("round trip", small.toNewick() == "((A:0.1,'B c':0.2)x:0.3,'D''s':1,E:0)root;"
+                                  && FlatTree::fromNewick(small.toNewick()).toNewick() == small.toNewick());
+    const FlatTree awkward = FlatTree::fromNewick("(A:0.30000000000000004,B:0.3333333333333333,C:1e-300,D:123456789.125);");
+    passed &= check("lengths read back exactly", FlatTree::fromNewick(awkward.toNewick()).branchLengths() == awkward.branchLengths()
+                                                 && awkward.branchLengths()[1] == 0.1 + 0.2 && awkward.branchLengths()[2] == 1.0 / 3);
+    passed &= check("single node", FlatTree::fromNewick("A;").numNodes() == 1 && FlatTree::fromNewick("A;").numLeaves() == 1);
+
+    bool allRejected = true;
+    for (const std::string bad : {"", "(A,B)", "(A,B));", "((A,B);", "A,B;", "(A:x,B);", "(A:-1,B);",
+                                  "('A,B);", "(A,B)[x;", "(A,B); (C,D);"}) {
+        allRejected &= rejects(bad);
+    }
+    passed &= check("malformed input rejected", allRejected);
+    std::string message;
+    try { FlatTree::fromNewick("(A,B:1.0)):2;"); } catch (const std::invalid_argument &error) { message = error.what(); }
+    passed &= check("error position", message.find("position 9") != std::string::npos);
+
+    // against Phylolib's reader
+    tree phylotree("../../trees/normalbranches_nLeaves1000.treefile");
+    const FlatTree fromFile = FlatTree::fromFile("../../trees/normalbranches_nLeaves1000.treefile");
+    std::unique_ptr<tree> converted = fromFile.toTree();
+    bool sameTree = fromFile.numNodes() == static_cast<size_t>(phylotree.getNodesNum())
+                    && converted->getNodesNum() == phylotree.getNodesNum() && fromFile.numLeaves() == 1000;
+    std::vector<tree::nodeP> pending{phylotree.getRoot()}, pendingConverted{converted->getRoot()};
+    while (sameTree && !pending.empty()) {
+        tree::nodeP node = pending.back(), other = pendingConverted.back();
+        pending.pop_back();
+        pendingConverted.pop_back();
+        const uint32_t id = node->id();
+        sameTree &= other->id() == node->id() && other->dis2father() == node->dis2father()
+                    && fromFile.branchLength(id) == node->dis2father()
+                    && (node->isRoot() ? fromFile.parent(id) == FlatTree::NO_PARENT : fromFile.parent(id) == static_cast<uint32_t>(node->father()->id()))
+                    && (!node->isLeaf() || (fromFile.name(id) == node->name() && other->name() == node->name()))
+                    && other->getNumberOfSons() == node->getNumberOfSons();
+        for (int son = 0; son < node->getNumberOfSons() && sameTree; ++son) {
+            pending.push_back(node->getSon(son));
+            pendingConverted.push_back(other->getSon(son));
+        }
+    }
+    passed &= check("same as Phylolib's reader", sameTree);
+    passed &= check("same simulation", simulateIndels(*converted) == simulateIndels(phylotree));
+
+    // a caterpillar deeper than any recursion
+    const size_t depth = 300000;
+    std::string caterpillar(depth, '(');
+    caterpillar += "t0";
+    for (size_t leaf = 1; leaf <= depth; ++leaf) caterpillar += ",t" + std::to_string(leaf) + "):0.01";
+    caterpillar += ";";
+    const FlatTree deep = FlatTree::fromNewick(caterpillar);
+    passed &= check("deep tree", deep.numLeaves() == depth + 1 && deep.numNodes() == 2 * depth + 1
+                                 && FlatTree::fromNewick(deep.toNewick()).parents() == deep.parents());
+
+    // a million leaves
+    const std::string large = randomNewick(1000000, 7);
+    auto start = std::chrono::high_resolution_clock::now();
+    const FlatTree flat = FlatTree::fromNewick(large);
+    const double parseMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    start = std::chrono::high_resolution_clock::now();
+    std::unique_ptr<tree> largeTree = flat.toTree();
+    const double convertMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << "1000000 leaves (" << large.size() / 1000000 << " MB): " << parseMs << " ms parsed, " << convertMs
+              << " ms to a Phylolib tree\n";
+    passed &= check("million leaves", flat.numLeaves() == 1000000 && largeTree->getNodesNum() == 1999999);
+    passed &= check("parsed in well under a second", parseMs < 500.0);
+
+    return passed ? 0 : 1;
+}
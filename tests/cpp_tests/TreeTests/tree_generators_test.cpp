@@ -0,0 +1,151 @@
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include "../../../libs/pcg/pcg_random.hpp"
+#include "../../../src/TreeGenerators.h"
+#include "../../../src/Simulator.h"
+#include "../TestCheck.h"
+
+// Balanced and caterpillar trees have the expected shape; coalescent and birth-death trees
+// are reproducible from their seed, ultrametric, and match the expected heights and the
+// 1/3 chance of a balanced four-leaf topology; FlatTree::fromParents rejects broken parent
+// links; a generated tree goes straight into a SimulationProtocol. Million-leaf trees of
+// every kind are timed.
+
+std::vector<double> nodeHeights(const FlatTree &flat) {
+    // depth from the root, in preorder, then height below the deepest leaf
+    std::vector<double> depths(flat.numNodes(), 0.0);
+    for (uint32_t node = 1; node < flat.numNodes(); ++node) depths[node] = depths[flat.parent(node)] + flat.branchLength(node);
+    double deepest = 0.0;
+    for (double depth : depths) deepest = std::max(deepest, depth);
+    for (double &depth : depths) depth = deepest - depth;
+    return depths;
+}
+
+bool isUltrametric(const FlatTree &flat) {
+    const std::vector<double> heights = nodeHeights(flat);
+    for (uint32_t node = 0; node < flat.numNodes(); ++node) {
+        if (flat.isLeaf(node) && std::abs(heights[node]) > 1e-9 * (1.0 + heights[0])) return false;
+    }
+    return true;
+}
+
+size_t maxDepth(const FlatTree &flat) {
+    std::vector<size_t> depths(flat.numNodes(), 0);
+    size_t deepest = 0;
+    for (uint32_t node = 1; node < flat.numNodes(); ++node) {
+        depths[node] = depths[flat.parent(node)] + 1;
+        deepest = std::max(deepest, depths[node]);
+    }
+    return deepest;
+}
+
+// four leaves as ((a,b),(c,d)) rather than (((a,b),c),d)
+bool isBalancedQuartet(const FlatTree &flat) {
+    return flat.numChildren(0) == 2 && !flat.isLeaf(flat.child(0, 0)) && !flat.isLeaf(flat.child(0, 1));
+}
+
+// E[max of n - 1 independent speciation times] = integral of 1 - F(s)^(n - 1)
+double expectedRootHeight(size_t numLeaves, double birthRate, double deathRate) {
+    const double r = birthRate - deathRate;
+    double sum = 0.0;
+    const double step = 1e-3;
+    for (double s = step / 2; s < 60.0; s += step) {
+        const double F = birthRate * (1.0 - std::exp(-r * s)) / (birthRate - deathRate * std::exp(-r * s));
+        sum += (1.0 - std::pow(F, static_cast<double>(numLeaves - 1))) * step;
+    }
+    return sum;
+}
+
+bool rejects(const std::vector<uint32_t> &parents) {
+    try {
+        FlatTree::fromParents(parents, std::vector<double>(parents.size(), 0.1), std::vector<std::string>(parents.size()));
+    } catch (const std::invalid_argument &) {
+        return true;
+    }
+    return false;
+}
+
+int main() {
+    bool passed = true;
+    const uint32_t NONE = FlatTree::NO_PARENT;
+
+    const FlatTree renumbered = FlatTree::fromParents({4, 4, 3, NONE, 3}, {0.1, 0.2, 0.3, 0.0, 0.5}, {"a", "b", "c", "", ""});
+    passed &= check("renumbered in preorder", renumbered.toNewick() == "(c:0.3,(a:0.1,b:0.2):0.5);"
+                                              && renumbered.parents() == std::vector<uint32_t>({NONE, 0, 0, 2, 2}));
+    passed &= check("broken parent links rejected", rejects({NONE, NONE}) && rejects({1, 0, NONE}) && rejects({5, NONE}) && rejects({}));
+
+    const FlatTree balanced = balancedTree(1000, 0.05);
+    bool leavesInOrder = true;
+    size_t leaf = 0;
+    for (uint32_t node = 0; node < balanced.numNodes(); ++node) {
+        if (balanced.isLeaf(node)) leavesInOrder &= balanced.name(node) == "T" + std::to_string(++leaf);
+    }
+    passed &= check("balanced", balanced.numLeaves() == 1000 && balanced.numNodes() == 1999 && maxDepth(balanced) == 10
+                                && leavesInOrder && balanced.branchLength(500) == 0.05);
+    passed &= check("caterpillar", caterpillarTree(5).toNewick() == "(T5:0.1,(T4:0.1,(T3:0.1,(T1:0.1,T2:0.1):0.1):0.1):0.1);"
+                                   && maxDepth(caterpillarTree(1000)) == 999);
+
+    passed &= check("seeded", coalescentTree(50, 1.0, 3).toNewick() == coalescentTree(50, 1.0, 3).toNewick()
+                              && coalescentTree(50, 1.0, 3).toNewick() != coalescentTree(50, 1.0, 4).toNewick()
+                              && birthDeathTree(50, 1.0, 0.3, 3).toNewick() == birthDeathTree(50, 1.0, 0.3, 3).toNewick()
+                              && birthDeathTree(50, 1.0, 0.3, 3).toNewick() != birthDeathTree(50, 1.0, 0.3, 4).toNewick());
+    passed &= check("ultrametric", isUltrametric(coalescentTree(2000, 0.5, 1)) && isUltrametric(birthDeathTree(2000, 2.0, 1.0, 1))
+                                   && isUltrametric(birthDeathTree(2000, 1.0, 0.0, 1)) && isUltrametric(birthDeathTree(2000, 1.0, 1.0, 1)));
+
+    // E[T_MRCA] = 2 N (1 - 1/n) under the coalescent
+    const size_t replicates = 4000;
+    double coalescentHeight = 0.0, yuleHeight = 0.0, birthDeathHeight = 0.0;
+    size_t coalescentBalanced = 0, yuleBalanced = 0;
+    for (size_t replicate = 0; replicate < replicates; ++replicate) {
+        coalescentHeight += nodeHeights(coalescentTree(20, 0.5, replicate))[0] / replicates;
+        yuleHeight += nodeHeights(birthDeathTree(20, 1.0, 0.0, replicate))[0] / replicates;
+        birthDeathHeight += nodeHeights(birthDeathTree(20, 1.0, 0.5, replicate))[0] / replicates;
+        coalescentBalanced += isBalancedQuartet(coalescentTree(4, 1.0, replicate));
+        yuleBalanced += isBalancedQuartet(birthDeathTree(4, 1.0, 0.0, replicate));
+    }
+    std::cout << "root heights: coalescent " << coalescentHeight << " (expected 0.95), Yule " << yuleHeight << " (expected "
+              << expectedRootHeight(20, 1.0, 0.0) << "), birth-death " << birthDeathHeight << " (expected "
+              << expectedRootHeight(20, 1.0, 0.5) << ")\n";
+    passed &= check("coalescent height", std::abs(coalescentHeight - 0.95) < 0.03);
+    passed &= check("Yule height", std::abs(yuleHeight - expectedRootHeight(20, 1.0, 0.0)) < 0.05);
+    passed &= check("birth-death height", std::abs(birthDeathHeight - expectedRootHeight(20, 1.0, 0.5)) < 0.1);
+    passed &= check("balanced quartets 1/3", std::abs(coalescentBalanced / double(replicates) - 1.0 / 3) < 0.03
+                                             && std::abs(yuleBalanced / double(replicates) - 1.0 / 3) < 0.03);
+
+    bool rejected = false;
+    try { balancedTree(1); } catch (const std::invalid_argument &) { rejected = true; }
+    try { coalescentTree(10, 0.0, 1); rejected = false; } catch (const std::invalid_argument &) {}
+    try { birthDeathTree(10, 1.0, 2.0, 1); rejected = false; } catch (const std::invalid_argument &) {}
+    passed &= check("invalid parameters rejected", rejected);
+
+    // straight into a simulation
+    std::unique_ptr<tree> phylotree = birthDeathTree(200, 1.0, 0.2, 9).toTree();
+    const size_t numBranches = phylotree->getNodesNum() - 1;
+    DiscreteDistribution lengths({0.6, 0.3, 0.1});
+    SimulationProtocol protocol(phylotree.get());
+    protocol.setSequenceSize(300);
+    protocol.setInsertionRates(std::vector<double>(numBranches, 0.02));
+    protocol.setDeletionRates(std::vector<double>(numBranches, 0.02));
+    protocol.setInsertionLengthDistributions(std::vector<DiscreteDistribution*>(numBranches, &lengths));
+    protocol.setDeletionLengthDistributions(std::vector<DiscreteDistribution*>(numBranches, &lengths));
+    protocol.setSeed(1);
+    Simulator<pcg64_fast, 4> simulator(&protocol);
+    BlockMap blocks = simulator.generateSimulation();
+    MSA msa(blocks, phylotree->getRoot(), simulator.getNodesSaveList());
+    passed &= check("simulated", msa.getNumberOfSequences() == 200 && msa.getMSAlength() > 0);
+
+    for (const std::string kind : {"balanced", "caterpillar", "coalescent", "birth-death"}) {
+        const auto start = std::chrono::high_resolution_clock::now();
+        const FlatTree large = kind == "balanced" ? balancedTree(1000000)
+                             : kind == "caterpillar" ? caterpillarTree(1000000)
+                             : kind == "coalescent" ? coalescentTree(1000000, 1.0, 1)
+                             : birthDeathTree(1000000, 1.0, 0.5, 1);
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        std::cout << kind << ", 1000000 leaves: " << ms << " ms\n";
+        passed &= check(kind + " million leaves", large.numLeaves() == 1000000 && large.numNodes() == 1999999);
+    }
+
+    return passed ? 0 : 1;
+}